@@ -0,0 +1,181 @@
+#ifndef BOUNDING_BOX_H_INCLUDED
+#define BOUNDING_BOX_H_INCLUDED
+
+#include "vector3d.h"
+#include "ray.h"
+#include "transform.h"
+#include <algorithm>
+
+namespace PathTrace
+{
+
+/** axis aligned bounding box<br/>
+ * coordinates are clamped to <code>[-max_value, max_value]</code> so unbounded objects
+ * can be represented by <code>BoundingBox::infinite()</code>
+ */
+class BoundingBox
+{
+public:
+    Vector3D minCorner, maxCorner;
+
+    BoundingBox()
+        : minCorner(max_value), maxCorner(-max_value)
+    {
+    }
+
+    BoundingBox(Vector3D minCorner, Vector3D maxCorner)
+        : minCorner(minCorner), maxCorner(maxCorner)
+    {
+    }
+
+    static BoundingBox empty()
+    {
+        return BoundingBox();
+    }
+
+    static BoundingBox infinite()
+    {
+        return BoundingBox(Vector3D(-max_value), Vector3D(max_value));
+    }
+
+    bool isEmpty() const
+    {
+        return minCorner.x > maxCorner.x || minCorner.y > maxCorner.y || minCorner.z > maxCorner.z;
+    }
+
+    bool isFinite() const
+    {
+        if(isEmpty())
+            return true;
+        return minCorner.x > -max_value && minCorner.y > -max_value && minCorner.z > -max_value
+               && maxCorner.x < max_value && maxCorner.y < max_value && maxCorner.z < max_value;
+    }
+
+    Vector3D center() const
+    {
+        return 0.5f * (minCorner + maxCorner);
+    }
+
+    Vector3D extent() const
+    {
+        if(isEmpty())
+            return Vector3D(0);
+        return maxCorner - minCorner;
+    }
+
+    float surfaceArea() const
+    {
+        Vector3D e = extent();
+        return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    bool contains(Vector3D p) const
+    {
+        return p.x >= minCorner.x && p.x <= maxCorner.x
+               && p.y >= minCorner.y && p.y <= maxCorner.y
+               && p.z >= minCorner.z && p.z <= maxCorner.z;
+    }
+
+    friend BoundingBox combine(const BoundingBox & a, const BoundingBox & b)
+    {
+        return BoundingBox(Vector3D(std::min(a.minCorner.x, b.minCorner.x), std::min(a.minCorner.y, b.minCorner.y), std::min(a.minCorner.z, b.minCorner.z)),
+                           Vector3D(std::max(a.maxCorner.x, b.maxCorner.x), std::max(a.maxCorner.y, b.maxCorner.y), std::max(a.maxCorner.z, b.maxCorner.z)));
+    }
+
+    friend BoundingBox combine(const BoundingBox & a, Vector3D p)
+    {
+        return combine(a, BoundingBox(p, p));
+    }
+
+    friend BoundingBox intersect(const BoundingBox & a, const BoundingBox & b)
+    {
+        BoundingBox retval(Vector3D(std::max(a.minCorner.x, b.minCorner.x), std::max(a.minCorner.y, b.minCorner.y), std::max(a.minCorner.z, b.minCorner.z)),
+                           Vector3D(std::min(a.maxCorner.x, b.maxCorner.x), std::min(a.maxCorner.y, b.maxCorner.y), std::min(a.maxCorner.z, b.maxCorner.z)));
+        if(retval.isEmpty())
+            return BoundingBox();
+        return retval;
+    }
+
+    friend bool overlaps(const BoundingBox & a, const BoundingBox & b)
+    {
+        return !intersect(a, b).isEmpty();
+    }
+
+    /** intersects the infinite line through <code>ray</code> with this box
+     *
+     * @param ray
+     *            the ray to intersect
+     * @param tNear
+     *            set to the ray parameter where the line enters this box
+     * @param tFar
+     *            set to the ray parameter where the line leaves this box
+     * @return if the line intersects this box */
+    bool intersects(const Ray & ray, float & tNear, float & tFar) const
+    {
+        tNear = -max_value;
+        tFar = max_value;
+        if(isEmpty())
+            return false;
+        return intersectSlab(ray.origin.x, ray.dir.x, minCorner.x, maxCorner.x, tNear, tFar)
+               && intersectSlab(ray.origin.y, ray.dir.y, minCorner.y, maxCorner.y, tNear, tFar)
+               && intersectSlab(ray.origin.z, ray.dir.z, minCorner.z, maxCorner.z, tNear, tFar);
+    }
+
+    /** @return the reciprocal of <code>dir</code> for passing to
+     * <code>intersects(origin, invDir, tNear, tFar)</code>.<br/>
+     * zero components are replaced by a tiny value so no NaNs are generated */
+    static Vector3D inverseDirection(Vector3D dir)
+    {
+        const float tiny = 1e-30f;
+        return Vector3D(1 / (dir.x == 0 ? tiny : dir.x), 1 / (dir.y == 0 ? tiny : dir.y), 1 / (dir.z == 0 ? tiny : dir.z));
+    }
+
+    /** the same as <code>intersects(ray, tNear, tFar)</code> but with the
+     * reciprocal of the ray direction precomputed for traversing many boxes
+     * @see #inverseDirection(Vector3D dir) */
+    bool intersects(const Vector3D & origin, const Vector3D & invDir, float & tNear, float & tFar) const
+    {
+        float tx0 = (minCorner.x - origin.x) * invDir.x, tx1 = (maxCorner.x - origin.x) * invDir.x;
+        float ty0 = (minCorner.y - origin.y) * invDir.y, ty1 = (maxCorner.y - origin.y) * invDir.y;
+        float tz0 = (minCorner.z - origin.z) * invDir.z, tz1 = (maxCorner.z - origin.z) * invDir.z;
+        tNear = std::max(-max_value, std::max(std::min(tx0, tx1), std::max(std::min(ty0, ty1), std::min(tz0, tz1))));
+        tFar = std::min(max_value, std::min(std::max(tx0, tx1), std::min(std::max(ty0, ty1), std::max(tz0, tz1))));
+        return tNear <= tFar;
+    }
+private:
+    static bool intersectSlab(float origin, float dir, float minV, float maxV, float & tNear, float & tFar)
+    {
+        if(dir == 0)
+            return origin >= minV && origin <= maxV;
+        float invDir = 1 / dir;
+        float t0 = (minV - origin) * invDir;
+        float t1 = (maxV - origin) * invDir;
+        if(t0 > t1)
+            std::swap(t0, t1);
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+        return tNear <= tFar;
+    }
+};
+
+/** @return the bounding box of <code>box</code> after transforming it by <code>m</code> */
+inline BoundingBox transform(const Matrix & m, const BoundingBox & box)
+{
+    if(box.isEmpty())
+        return box;
+    if(!box.isFinite())
+        return BoundingBox::infinite();
+    BoundingBox retval;
+    for(int i = 0; i < 8; i++)
+    {
+        Vector3D corner((i & 1) ? box.maxCorner.x : box.minCorner.x,
+                        (i & 2) ? box.maxCorner.y : box.minCorner.y,
+                        (i & 4) ? box.maxCorner.z : box.minCorner.z);
+        retval = combine(retval, m.apply(corner));
+    }
+    return retval;
+}
+
+}
+
+#endif // BOUNDING_BOX_H_INCLUDED
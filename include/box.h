@@ -0,0 +1,37 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "object.h"
+
+namespace PathTrace
+{
+
+/** an axis aligned box, use a <code>TransformedObject</code> to rotate it.<br/>
+ * the rays are intersected with the three slabs at once instead of with six planes */
+class Box : public Object
+{
+public:
+    Box(Vector3D minCorner, Vector3D maxCorner, const Material * material);
+    virtual ~Box();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual Object *duplicate() const
+    {
+        return new Box(minCorner, maxCorner, material);
+    }
+    /** @return the transformed box or NULL if <code>m</code> rotates */
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox(minCorner, maxCorner);
+    }
+private:
+    Vector3D minCorner, maxCorner;
+    const Material * material;
+};
+
+}
+
+#endif // BOX_H
@@ -0,0 +1,210 @@
+#ifndef BVH_UNION_H
+#define BVH_UNION_H
+
+#include "object.h"
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+/** a node of a bounding volume hierarchy.<br/>
+ * the nodes are stored in depth first order so the first child of an interior node is the next node */
+struct BVHNode
+{
+    BoundingBox bounds;
+    size_t start; /// index of the first item for leaves or the second child for interior nodes
+    size_t count; /// number of items in a leaf or 0 for interior nodes
+};
+
+/** builds a bounding volume hierarchy with the surface area heuristic
+ *
+ * @param bounds
+ *            the bounds of each item, they must be finite and not empty
+ * @param nodes
+ *            set to the nodes of the hierarchy, the root is first. left empty if there aren't any items
+ * @param order
+ *            set to the indexes of the items in the order referenced by the leaves
+ * @param maxLeafSize
+ *            the most items in a leaf */
+void buildBVH(const std::vector<BoundingBox> & bounds, std::vector<BVHNode> & nodes, std::vector<size_t> & order, size_t maxLeafSize = 4);
+
+/** finds the first boundary after <code>t</code> of a union of items that may overlap, using the bounding volume
+ * hierarchy of the items.<br/>
+ * <code>Leaves</code> has a type <code>Boundary</code> with a <code>float t</code> and a <code>bool entering</code>, and a method
+ * <code>void addLeaf(UnionFirstHitSearch<Leaves> & search, size_t start, size_t count) const</code> that calls
+ * <code>addBoundary</code> with the first boundary at or after <code>search.t</code> of each item in a leaf, and
+ * <code>void addUnbounded(UnionFirstHitSearch<Leaves> & search) const</code> that does the same for the items that
+ * aren't in the hierarchy.
+ * @see findUnionFirstHit */
+template <typename Leaves>
+class UnionFirstHitSearch
+{
+public:
+    typedef typename Leaves::Boundary Boundary;
+    UnionFirstHitSearch(const std::vector<BVHNode> & nodes, const Leaves & leaves, const Ray & ray, float t, float tmax)
+        : nodes(nodes), leaves(leaves), ray(ray), invDir(BoundingBox::inverseDirection(ray.dir)), t(t), limit(tmax), found(false), hasEntering(false), hasExiting(false), hasMaxExit(false)
+    {
+    }
+    void addBoundary(const Boundary & boundary)
+    {
+        if(!boundary.entering && (!hasMaxExit || boundary.t > maxExit.t))
+        {
+            hasMaxExit = true;
+            maxExit = boundary;
+        }
+        if(boundary.t > limit)
+        {
+            return;
+        }
+        if(!found || boundary.t < limit)
+        {
+            found = true;
+            limit = boundary.t;
+            hasEntering = false;
+            hasExiting = false;
+        }
+        if(boundary.entering)
+        {
+            hasEntering = true;
+            entering = boundary;
+        }
+        else
+        {
+            hasExiting = true;
+            exiting = boundary;
+        }
+    }
+    void addNode(size_t index)
+    {
+        const BVHNode & node = nodes[index];
+        if(node.count > 0)
+        {
+            leaves.addLeaf(*this, node.start, node.count);
+            return;
+        }
+        size_t first = index + 1, second = node.start;
+        float firstNear, firstFar, secondNear, secondFar;
+        bool hitFirst = nodes[first].bounds.intersects(ray.origin, invDir, firstNear, firstFar) && firstFar >= t;
+        bool hitSecond = nodes[second].bounds.intersects(ray.origin, invDir, secondNear, secondFar) && secondFar >= t;
+        if(hitFirst && hitSecond && secondNear < firstNear)
+        {
+            std::swap(first, second);
+            std::swap(firstNear, secondNear);
+            std::swap(hitFirst, hitSecond);
+        }
+        if(hitFirst && firstNear <= limit)
+        {
+            addNode(first);
+        }
+        if(hitSecond && secondNear <= limit)
+        {
+            addNode(second);
+        }
+    }
+    void addRoot()
+    {
+        float rootNear, rootFar;
+        if(!nodes.empty() && nodes[0].bounds.intersects(ray.origin, invDir, rootNear, rootFar) && rootFar >= t && rootNear <= limit)
+        {
+            addNode(0);
+        }
+    }
+    const std::vector<BVHNode> & nodes;
+    const Leaves & leaves;
+    const Ray & ray;
+    const Vector3D invDir;
+    const float t;
+    float limit;
+    bool found, hasEntering, hasExiting, hasMaxExit;
+    Boundary entering, exiting;
+    Boundary maxExit; /// the last place the ray leaves an item it is in at <code>t</code>
+};
+
+/** finds the first boundary of a union of items that may overlap with <code>tmin <= t <= tmax</code>.<br/>
+ * a boundary of an item is only a boundary of the union if the ray isn't inside another item there, so when the
+ * closest boundary is inside another item the search is repeated from where the ray leaves that item. that boundary
+ * is kept for the next search instead of being found again : the bounds of the nodes aren't exact enough to find a
+ * boundary that is exactly at the start of the search, and a CSG item may not count a boundary there.
+ * @see UnionFirstHitSearch
+ * @return if a boundary was found */
+template <typename Leaves>
+bool findUnionFirstHit(const std::vector<BVHNode> & nodes, const Leaves & leaves, const Ray & ray, float tmin, float tmax, typename Leaves::Boundary & boundary)
+{
+    typename Leaves::Boundary pendingExit = typename Leaves::Boundary();
+    bool hasPendingExit = false;
+    float t = tmin;
+    while(t <= tmax)
+    {
+        UnionFirstHitSearch<Leaves> search(nodes, leaves, ray, t, tmax);
+        if(hasPendingExit)
+        {
+            search.addBoundary(pendingExit);
+        }
+        leaves.addUnbounded(search);
+        search.addRoot();
+        if(!search.found)
+        {
+            return false;
+        }
+        float bestT = search.limit;
+        if(search.hasMaxExit && search.maxExit.t > bestT)
+        {
+            // inside an item until it is left so there can't be any boundaries before then
+            pendingExit = search.maxExit;
+            hasPendingExit = true;
+            t = pendingExit.t;
+            continue;
+        }
+        if(search.hasMaxExit && search.maxExit.t == bestT)
+        {
+            if(search.hasEntering)
+            {
+                hasPendingExit = false;
+                t = nextFloatUp(bestT); // one item starts where another ends
+                continue;
+            }
+            boundary = search.exiting;
+            return true;
+        }
+        boundary = search.entering;
+        return true;
+    }
+    return false;
+}
+
+/** union of many objects using a bounding volume hierarchy built with the
+ * surface area heuristic so rays only evaluate the objects whose bounds they enter.<br/>
+ * objects with infinite bounds are evaluated for every ray.
+ */
+class BVHUnion : public Object
+{
+public:
+    typedef BVHNode Node;
+    BVHUnion(Object * const objects[], size_t count);
+    explicit BVHUnion(const std::vector<Object *> & objects);
+    virtual ~BVHUnion();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual Object *duplicate() const;
+    virtual Object *transform(const Matrix &m) const;
+    virtual void getLights(std::vector<Light *> & lights) const;
+    virtual BoundingBox getBounds() const
+    {
+        return bounds;
+    }
+private:
+    friend class CSGOptimizer;
+    void build(Object * const objects[], size_t count);
+    std::vector<Object *> objects; /// bounded objects in the order referenced by the leaves
+    std::vector<Object *> unboundedObjects;
+    std::vector<Node> nodes;
+    BoundingBox bounds;
+};
+
+}
+
+#endif // BVH_UNION_H
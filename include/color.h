@@ -6,6 +6,12 @@
 namespace PathTrace
 {
 typedef Vector3D Color;
+
+/** @return the luminance of a linear RGB color with Rec. 709 primaries */
+inline float luminance(Color c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
 }
 
 #endif // COLOR_H_INCLUDED
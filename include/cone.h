@@ -0,0 +1,65 @@
+#ifndef CONE_H
+#define CONE_H
+
+#include "object.h"
+
+namespace PathTrace
+{
+
+/** a truncated cone with flat caps, the radius changes linearly from <code>baseRadius</code> at
+ * <code>base</code> to <code>topRadius</code> at <code>top</code>.<br/>
+ * a solid cone is convex so each line goes through at most one span : the side is intersected
+ * as a quadric and clipped to the slab between the caps.
+ * @see Cylinder */
+class Cone : public Object
+{
+public:
+    /** @param base
+     *            the center of the base cap
+     * @param baseRadius
+     *            the radius of the base cap, at least 0
+     * @param top
+     *            the center of the top cap
+     * @param topRadius
+     *            the radius of the top cap, at least 0 */
+    Cone(Vector3D base, float baseRadius, Vector3D top, float topRadius, const Material * material);
+    virtual ~Cone();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual Object *duplicate() const
+    {
+        return new Cone(base, baseRadius, top, topRadius, material);
+    }
+    /** @return the transformed cone or NULL if <code>m</code> isn't a similarity transform */
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const;
+    /** the boundaries of a cone */
+    enum Face
+    {
+        Side,
+        BaseCap,
+        TopCap
+    };
+    /** intersects the line through <code>ray</code> with this cone
+     *
+     * @param startFace
+     *            set to the <code>Face</code> where the line enters
+     * @param endFace
+     *            set to the <code>Face</code> where the line leaves
+     * @return if the line goes through this cone */
+    bool intersect(const Ray & ray, float & start, float & end, unsigned & startFace, unsigned & endFace) const;
+    /** @return the outward facing normal of <code>face</code> at <code>position</code>, not normalized */
+    Vector3D getNormal(unsigned face, Vector3D position) const;
+protected:
+    Vector3D base, top;
+    float baseRadius, topRadius;
+    const Material * material;
+private:
+    Vector3D axis; /// the unit vector from <code>base</code> to <code>top</code>
+    float length;
+    float slope; /// how much the radius changes per unit along <code>axis</code>
+};
+
+}
+
+#endif // CONE_H
@@ -0,0 +1,121 @@
+#ifndef CSG_H_INCLUDED
+#define CSG_H_INCLUDED
+
+#include "object.h"
+#include <algorithm>
+
+namespace PathTrace
+{
+
+enum CSGOperation
+{
+    CSGUnion,
+    CSGIntersection,
+    CSGDifference
+};
+
+inline bool csgContains(CSGOperation operation, bool inA, bool inB)
+{
+    switch(operation)
+    {
+    case CSGUnion:
+        return inA || inB;
+    case CSGIntersection:
+        return inA && inB;
+    default:
+        return inA && !inB;
+    }
+}
+
+/** finds the first boundary of <code>a</code> combined with <code>b</code> using <code>operation</code>,
+ * walking the boundaries of <code>a</code> and <code>b</code> only until the result changes
+ * @see Object#firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) */
+bool csgFirstHit(CSGOperation operation, const Object * a, const Object * b, const Ray & ray, float tmin, float tmax, Hit & hit);
+
+/** the same as <code>csgFirstHit</code> for operands of any type with a <code>firstHit</code> member like
+ * <code>Object::firstHit</code>, so the calls can be inlined when the types of the operands are known */
+template <typename A, typename B>
+inline bool inlineCSGFirstHit(CSGOperation operation, const A & a, const B & b, const Ray & ray, float tmin, float tmax, Hit & hit)
+{
+    float t = tmin;
+    while(t <= tmax)
+    {
+        // children are searched to max_value so we know if t is inside them
+        Hit hitA, hitB;
+        bool hasA = a.firstHit(ray, t, max_value, hitA);
+        if(!hasA && operation != CSGUnion)
+        {
+            return false; // never inside a again
+        }
+        bool hasB = b.firstHit(ray, t, max_value, hitB);
+        if(!hasB)
+        {
+            if(!hasA || operation == CSGIntersection || hitA.t > tmax)
+            {
+                return false;
+            }
+            hit = hitA; // outside b for the rest of the ray
+            return true;
+        }
+        if(!hasA)
+        {
+            if(hitB.t > tmax)
+            {
+                return false;
+            }
+            hit = hitB;
+            return true;
+        }
+        float eventT = std::min(hitA.t, hitB.t);
+        if(eventT > tmax)
+        {
+            return false;
+        }
+        bool inA = !hitA.entering, inB = !hitB.entering;
+        bool afterA = (hitA.t == eventT) ? !inA : inA;
+        bool afterB = (hitB.t == eventT) ? !inB : inB;
+        bool before = csgContains(operation, inA, inB);
+        bool after = csgContains(operation, afterA, afterB);
+        if(before != after)
+        {
+            if(afterA != inA && csgContains(operation, afterA, inB) != before)
+            {
+                hit = hitA;
+            }
+            else
+            {
+                hit = hitB;
+                if(operation == CSGDifference)
+                {
+                    hit.normal = -hit.normal;
+                }
+            }
+            hit.entering = after;
+            return true;
+        }
+        t = nextFloatUp(eventT);
+    }
+    return false;
+}
+
+inline MaskPacket csgContains(CSGOperation operation, MaskPacket inA, MaskPacket inB)
+{
+    switch(operation)
+    {
+    case CSGUnion:
+        return inA | inB;
+    case CSGIntersection:
+        return inA & inB;
+    default:
+        return inA & ~inB;
+    }
+}
+
+/** the same as <code>csgFirstHit</code> for a packet of rays, querying <code>a</code> and <code>b</code> with
+ * packets and only continuing with the rays that haven't found a boundary yet
+ * @see Object#firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) */
+MaskPacket csgFirstHitPacket(CSGOperation operation, const Object * a, const Object * b, const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits);
+
+}
+
+#endif // CSG_H_INCLUDED
@@ -0,0 +1,65 @@
+#ifndef CSG_OPTIMIZER_H_INCLUDED
+#define CSG_OPTIMIZER_H_INCLUDED
+
+#include "object.h"
+#include <vector>
+#include <string>
+
+namespace PathTrace
+{
+
+/** rewrites a tree of <code>Union</code>s, <code>Intersection</code>s and <code>Difference</code>s to an
+ * equivalent tree that is faster to trace, using the bounds of the objects :
+ * <ul>
+ * <li>each object is only needed where its parents can use it, the bounds of the other operand of an
+ * intersection or the minuend of a difference, so the objects that are entirely outside of that are removed</li>
+ * <li>intersections whose operands don't overlap and differences whose subtrahend doesn't touch the
+ * minuend are removed</li>
+ * <li>the operand of an intersection with the smaller bounds is put first, <code>csgFirstHit</code> doesn't
+ * test the second operand if a ray misses the first</li>
+ * <li>nested unions are merged into one <code>BVHUnion</code> so their objects are sorted spatially</li>
+ * </ul>
+ * objects that aren't CSG operations, including <code>CompiledCSG</code>, are kept as they are, so this
+ * should be run before <code>compileCSG</code>.
+ * @see optimizeCSG(Object * o, std::vector<std::string> * changes) */
+class CSGOptimizer
+{
+public:
+    /** @param changes
+     *            the description of each change is added to this if it isn't NULL */
+    explicit CSGOptimizer(std::vector<std::string> * changes);
+    /** @param o
+     *            the object to optimize, owned by the returned object or deleted
+     * @param clip
+     *            the region where the result has to be the same as <code>o</code>
+     * @return the optimized object */
+    Object * optimize(Object * o, const BoundingBox & clip);
+private:
+    Object * optimizeUnion(Object * o, const BoundingBox & clip);
+    Object * optimizeIntersection(Object * o, const BoundingBox & clip);
+    Object * optimizeDifference(Object * o, const BoundingBox & clip);
+    /** adds the optimized objects of the union <code>o</code> and the unions in it to <code>objects</code>
+     * @return the number of unions merged */
+    size_t collectUnion(Object * o, const BoundingBox & clip, std::vector<Object *> & objects);
+    /** moves the objects out of <code>o</code> if it is a union and deletes it
+     * @return if <code>o</code> is a union */
+    static bool splitUnion(Object * o, std::vector<Object *> & objects);
+    /** @return an object with no spans */
+    static Object * makeEmpty();
+    void report(const std::string & change);
+    std::vector<std::string> * changes;
+};
+
+/** optimizes the CSG operations in <code>o</code>
+ *
+ * @param o
+ *            the object to optimize, owned by the returned object or deleted
+ * @param changes
+ *            the description of each change is added to this if it isn't NULL
+ * @return the optimized object
+ * @see CSGOptimizer */
+Object * optimizeCSG(Object * o, std::vector<std::string> * changes = NULL);
+
+}
+
+#endif // CSG_OPTIMIZER_H_INCLUDED
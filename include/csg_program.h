@@ -0,0 +1,136 @@
+#ifndef CSG_PROGRAM_H_INCLUDED
+#define CSG_PROGRAM_H_INCLUDED
+
+#include "object.h"
+#include "csg.h"
+#include <vector>
+
+namespace PathTrace
+{
+
+/** a tree of spheres, planes, transforms and CSG operations compiled to a flat list of instructions.<br/>
+ * the instructions are in postfix order : each primitive pushes its span onto a stack and each
+ * operation replaces the top two span lists with the combined list. the transforms are
+ * folded into the primitives when compiling so each primitive only transforms the ray once.<br/>
+ * <code>evaluate</code> runs the whole program in one loop with the spans in fixed size arrays
+ * on the stack. the spans only hold the ray parameters and which primitive each boundary
+ * belongs to, the normals are only calculated for the boundaries that are used.
+ * @see compileCSG(Object * o)
+ */
+class CSGProgram
+{
+public:
+    /** the most primitives in a program, every operation makes at most as many spans as
+     * its operands so the program never has more spans than this */
+    static const size_t MaxPrimitiveCount = 64;
+    /// a boundary of a primitive, the high bit is set if the normal is reversed
+    typedef unsigned BoundaryReference;
+    static const BoundaryReference ReversedNormal = SpanBoundary::ReversedNormal;
+    /** a span made by a program */
+    struct ProgramSpan
+    {
+        float start, end;
+        BoundaryReference startBoundary, endBoundary; /// the index of the primitive, with <code>ReversedNormal</code> set if the normal is reversed
+    };
+    /** the spans made by <code>evaluate</code> */
+    struct Result
+    {
+        ProgramSpan spans[MaxPrimitiveCount];
+        size_t count;
+    };
+    CSGProgram();
+    /** @return if the sphere was added, false if there are too many primitives */
+    bool addSphere(Vector3D center, float r, const Material * material, const Object * object);
+    /** @return if the plane was added, false if there are too many primitives */
+    bool addPlane(Vector3D normal, float d, const Material * material, const Object * object);
+    /** combines the last two objects added with <code>operation</code> */
+    bool addOperation(CSGOperation operation);
+    /** makes the primitives added before the matching <code>popTransform</code> use the rays transformed by <code>m</code> */
+    void pushTransform(const Matrix & m);
+    void popTransform();
+    /** @return if the program makes exactly one list of spans */
+    bool isComplete() const
+    {
+        return stackSize == 1 && transforms.empty();
+    }
+    /** calculates all the spans along the line through <code>ray</code> */
+    void evaluate(const Ray & ray, Result & result) const;
+    /** fills in the normal, material and object of a boundary of a span made by <code>evaluate</code> */
+    void getBoundary(const Ray & ray, float t, BoundaryReference boundary, Vector3D & normal, const Material *& material, const Object *& object) const;
+    const Material * getMaterial(BoundaryReference boundary) const
+    {
+        return primitives[boundary & ~ReversedNormal].material;
+    }
+private:
+    enum Opcode
+    {
+        OpSphere,
+        OpPlane,
+        OpCombine
+    };
+    struct Instruction
+    {
+        Opcode opcode;
+        CSGOperation operation; /// the operation for <code>OpCombine</code>
+        unsigned primitive; /// the primitive for <code>OpSphere</code> and <code>OpPlane</code>
+    };
+    struct Primitive
+    {
+        Opcode type; /// <code>OpSphere</code> or <code>OpPlane</code>
+        Vector3D position; /// the center of spheres or the normal of planes
+        float value; /// the radius squared of spheres or d for planes
+        const Material * material;
+        const Object * object;
+        bool transformed;
+        Matrix m, normalMatrix;
+    };
+    bool addPrimitive(Opcode opcode, Vector3D position, float value, const Material * material, const Object * object);
+    std::vector<Instruction> instructions;
+    std::vector<Primitive> primitives;
+    std::vector<Matrix> transforms; /// the combined transforms pushed while compiling
+    size_t stackSize;
+};
+
+/** an object evaluated by a <code>CSGProgram</code>.<br/>
+ * the original object is kept for the bounds, lights and transforming */
+class CompiledCSG : public Object
+{
+public:
+    /** @param o
+     *            the object, owned by the new object
+     * @param program
+     *            <code>o</code> compiled */
+    CompiledCSG(Object * o, const CSGProgram & program);
+    virtual ~CompiledCSG();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual Object * duplicate() const;
+    virtual Object * transform(const Matrix & m) const;
+    virtual void getLights(std::vector<Light *> & lights) const
+    {
+        o->getLights(lights);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return o->getBounds();
+    }
+    virtual bool compile(CSGProgram & program) const
+    {
+        return o->compile(program);
+    }
+private:
+    Object * const o;
+    const CSGProgram program;
+};
+
+/** compiles the <code>Union</code>s, <code>Intersection</code>s, <code>Difference</code>s,
+ * <code>TransformedObject</code>s, <code>Sphere</code>s and <code>Plane</code>s in <code>o</code>
+ *
+ * @param o
+ *            the object to compile, owned by the returned object
+ * @return a <code>CompiledCSG</code> or <code>o</code> if it has other objects or too many primitives */
+Object * compileCSG(Object * o);
+
+}
+
+#endif // CSG_PROGRAM_H_INCLUDED
@@ -0,0 +1,42 @@
+#ifndef CYLINDER_H
+#define CYLINDER_H
+
+#include "cone.h"
+
+namespace PathTrace
+{
+
+/** a cylinder with flat caps, a cone with the same radius at both ends */
+class Cylinder : public Cone
+{
+public:
+    /** @param base
+     *            the center of one cap
+     * @param top
+     *            the center of the other cap
+     * @param r
+     *            the radius */
+    Cylinder(Vector3D base, Vector3D top, float r, const Material * material)
+        : Cone(base, r, top, r, material)
+    {
+    }
+    virtual Object *duplicate() const
+    {
+        return new Cylinder(base, top, baseRadius, material);
+    }
+    /** @return the transformed cylinder or NULL if <code>m</code> isn't a similarity transform */
+    virtual Object *transform(const Matrix &m) const
+    {
+        float scale;
+        if(!m.isSimilarity(scale))
+        {
+            return NULL;
+        }
+        Matrix inv = invert(m);
+        return new Cylinder(inv.apply(base), inv.apply(top), baseRadius / scale, material);
+    }
+};
+
+}
+
+#endif // CYLINDER_H
@@ -2,6 +2,7 @@
 #define DIFFERENCE_H
 
 #include "object.h"
+#include "csg.h"
 
 namespace PathTrace
 {
@@ -12,18 +13,49 @@ public:
     Difference(Object * a, Object * b);
     virtual ~Difference();
     virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return csgFirstHit(CSGDifference, a, b, ray, tmin, tmax, hit);
+    }
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+    {
+        return csgFirstHitPacket(CSGDifference, a, b, rays, tmin, tmax, hits);
+    }
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const
+    {
+        if(!a->occluded(ray, tmin, tmax))
+        {
+            return false;
+        }
+        if(!b->occluded(ray, tmin, tmax))
+        {
+            return true; // nothing is removed from a on the segment
+        }
+        return Object::occluded(ray, tmin, tmax);
+    }
     virtual Object *duplicate() const
     {
         return new Difference(a->duplicate(), b->duplicate());
     }
     virtual Object *transform(const Matrix &m) const
     {
-        return new Difference(PathTrace::transform(m, a), PathTrace::transform(m, a));
+        return new Difference(PathTrace::transform(m, a), PathTrace::transform(m, b));
+    }
+    virtual void getLights(std::vector<Light *> & lights) const
+    {
+        a->getLights(lights);
+        b->getLights(lights);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return a->getBounds();
     }
+    virtual bool compile(CSGProgram & program) const;
 protected:
 private:
-    Object * const a;
-    Object * const b;
+    friend class CSGOptimizer;
+    Object * a;
+    Object * b;
 };
 
 }
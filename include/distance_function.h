@@ -0,0 +1,297 @@
+#ifndef DISTANCE_FUNCTION_H
+#define DISTANCE_FUNCTION_H
+
+#include "vector3d.h"
+#include "transform.h"
+#include "ray_packet.h"
+#include <cassert>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+/** a signed distance function for <code>SDFObject</code> : negative inside the shape and positive outside.<br/>
+ * the value doesn't have to be the exact distance to the surface but it can't change faster than the
+ * Lipschitz bound given to the <code>SDFObject</code>, the built in functions are exact or are bounded by 1. */
+class DistanceFunction
+{
+public:
+    virtual float evaluate(Vector3D p) const = 0;
+    /** the same as <code>evaluate</code> for each lane of <code>p</code>.<br/>
+     * the default implementation calls <code>evaluate</code> for each lane */
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        float values[PacketSize];
+        for(int i = 0; i < PacketSize; i++)
+        {
+            values[i] = evaluate(p.get(i));
+        }
+        return FloatPacket::load(values);
+    }
+    virtual DistanceFunction * duplicate() const = 0;
+    virtual ~DistanceFunction()
+    {
+    }
+};
+
+class SphereDistance : public DistanceFunction
+{
+private:
+    Vector3D center;
+    float r;
+public:
+    SphereDistance(Vector3D center, float r)
+        : center(center), r(r)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return abs(p - center) - r;
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        VectorPacket relative = p - VectorPacket(center);
+        return sqrt(dot(relative, relative)) - FloatPacket(r);
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new SphereDistance(center, r);
+    }
+};
+
+class BoxDistance : public DistanceFunction
+{
+private:
+    Vector3D center, halfSize;
+public:
+    BoxDistance(Vector3D minCorner, Vector3D maxCorner)
+        : center((minCorner + maxCorner) * 0.5f), halfSize((maxCorner - minCorner) * 0.5f)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        Vector3D q = p - center;
+        q = Vector3D(std::fabs(q.x), std::fabs(q.y), std::fabs(q.z)) - halfSize;
+        Vector3D outside(std::max(q.x, 0.0f), std::max(q.y, 0.0f), std::max(q.z, 0.0f));
+        return abs(outside) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        VectorPacket q = p - VectorPacket(center);
+        q = VectorPacket(abs(q.x) - FloatPacket(halfSize.x), abs(q.y) - FloatPacket(halfSize.y), abs(q.z) - FloatPacket(halfSize.z));
+        VectorPacket outside(max(q.x, FloatPacket(0.0f)), max(q.y, FloatPacket(0.0f)), max(q.z, FloatPacket(0.0f)));
+        return sqrt(dot(outside, outside)) + min(max(q.x, max(q.y, q.z)), FloatPacket(0.0f));
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new BoxDistance(center - halfSize, center + halfSize);
+    }
+};
+
+class TorusDistance : public DistanceFunction
+{
+private:
+    Vector3D center, axis;
+    float majorRadius, minorRadius;
+public:
+    TorusDistance(Vector3D center, Vector3D axis, float majorRadius, float minorRadius)
+        : center(center), axis(normalize(axis)), majorRadius(majorRadius), minorRadius(minorRadius)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        Vector3D q = p - center;
+        float h = dot(q, axis);
+        float fromCircle = abs(q - axis * h) - majorRadius;
+        return std::sqrt(fromCircle * fromCircle + h * h) - minorRadius;
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        VectorPacket q = p - VectorPacket(center);
+        FloatPacket h = dot(q, VectorPacket(axis));
+        VectorPacket fromAxis = q - h * VectorPacket(axis);
+        FloatPacket fromCircle = sqrt(dot(fromAxis, fromAxis)) - FloatPacket(majorRadius);
+        return sqrt(fromCircle * fromCircle + h * h) - FloatPacket(minorRadius);
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new TorusDistance(center, axis, majorRadius, minorRadius);
+    }
+};
+
+/** a distance function combining two others, it owns them */
+class CombinedDistance : public DistanceFunction
+{
+protected:
+    DistanceFunction * const a, * const b;
+public:
+    CombinedDistance(DistanceFunction * a, DistanceFunction * b)
+        : a(a), b(b)
+    {
+    }
+    virtual ~CombinedDistance()
+    {
+        delete a;
+        delete b;
+    }
+};
+
+class UnionDistance : public CombinedDistance
+{
+public:
+    UnionDistance(DistanceFunction * a, DistanceFunction * b)
+        : CombinedDistance(a, b)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return std::min(a->evaluate(p), b->evaluate(p));
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        return min(a->evaluatePacket(p), b->evaluatePacket(p));
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new UnionDistance(a->duplicate(), b->duplicate());
+    }
+};
+
+class IntersectionDistance : public CombinedDistance
+{
+public:
+    IntersectionDistance(DistanceFunction * a, DistanceFunction * b)
+        : CombinedDistance(a, b)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return std::max(a->evaluate(p), b->evaluate(p));
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        return max(a->evaluatePacket(p), b->evaluatePacket(p));
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new IntersectionDistance(a->duplicate(), b->duplicate());
+    }
+};
+
+/** the points in <code>a</code> but not in <code>b</code> */
+class DifferenceDistance : public CombinedDistance
+{
+public:
+    DifferenceDistance(DistanceFunction * a, DistanceFunction * b)
+        : CombinedDistance(a, b)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return std::max(a->evaluate(p), -b->evaluate(p));
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        return max(a->evaluatePacket(p), -b->evaluatePacket(p));
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new DifferenceDistance(a->duplicate(), b->duplicate());
+    }
+};
+
+/** a union that blends the surfaces together where they are closer than <code>blendRadius</code> */
+class SmoothUnionDistance : public CombinedDistance
+{
+private:
+    float blendRadius;
+public:
+    SmoothUnionDistance(DistanceFunction * a, DistanceFunction * b, float blendRadius)
+        : CombinedDistance(a, b), blendRadius(blendRadius)
+    {
+        assert(blendRadius > 0);
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        float da = a->evaluate(p), db = b->evaluate(p);
+        float h = std::min(std::max(0.5f + 0.5f * (db - da) / blendRadius, 0.0f), 1.0f);
+        return db + (da - db) * h - blendRadius * h * (1 - h);
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        FloatPacket da = a->evaluatePacket(p), db = b->evaluatePacket(p);
+        FloatPacket h = min(max(FloatPacket(0.5f) + FloatPacket(0.5f / blendRadius) * (db - da), FloatPacket(0.0f)), FloatPacket(1.0f));
+        return db + (da - db) * h - FloatPacket(blendRadius) * h * (FloatPacket(1.0f) - h);
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new SmoothUnionDistance(a->duplicate(), b->duplicate(), blendRadius);
+    }
+};
+
+/** a distance function with the points transformed by <code>m</code> before they are passed to <code>f</code>,
+ * <code>m</code> must be a similarity transform so the distances only need to be scaled */
+class TransformedDistance : public DistanceFunction
+{
+private:
+    Matrix m;
+    DistanceFunction * f;
+    float invScale;
+public:
+    TransformedDistance(const Matrix & m, DistanceFunction * f)
+        : m(m), f(f)
+    {
+        float scale = 1;
+        bool isSimilarity = m.isSimilarity(scale);
+        assert(isSimilarity);
+        (void)isSimilarity;
+        invScale = 1 / scale;
+    }
+    virtual ~TransformedDistance()
+    {
+        delete f;
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return f->evaluate(m.apply(p)) * invScale;
+    }
+    virtual FloatPacket evaluatePacket(const VectorPacket & p) const
+    {
+        return f->evaluatePacket(apply(m, p)) * FloatPacket(invScale);
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new TransformedDistance(m, f->duplicate());
+    }
+};
+
+/** a distance function calculated by a user supplied function */
+class CallbackDistance : public DistanceFunction
+{
+public:
+    typedef float (*Callback)(Vector3D p, void * arg);
+private:
+    Callback fn;
+    void * arg;
+public:
+    /** @param fn
+     *            the distance function
+     * @param arg
+     *            passed to <code>fn</code>, it must stay valid while this is used */
+    CallbackDistance(Callback fn, void * arg)
+        : fn(fn), arg(arg)
+    {
+    }
+    virtual float evaluate(Vector3D p) const
+    {
+        return fn(p, arg);
+    }
+    virtual DistanceFunction * duplicate() const
+    {
+        return new CallbackDistance(fn, arg);
+    }
+};
+
+}
+
+#endif // DISTANCE_FUNCTION_H
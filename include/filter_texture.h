@@ -16,7 +16,7 @@ public:
     }
     virtual ~FilterTexture()
     {
-        delete t;
+        t->release();
     }
 protected:
     virtual Color filter(Color v) const = 0;
@@ -25,6 +25,10 @@ public:
     {
         return filter(t->getColor(pos));
     }
+    virtual bool getImageSize(unsigned & width, unsigned & height) const
+    {
+        return t->getImageSize(width, height);
+    }
 };
 
 class MultiplyTexture : public FilterTexture
@@ -36,15 +40,21 @@ public:
         : FilterTexture(t), factor(factor)
     {
     }
-    virtual Texture * duplicate() const
-    {
-        return new MultiplyTexture(factor, t->duplicate());
-    }
 protected:
     virtual Color filter(Color v) const
     {
         return v * factor;
     }
+public:
+    virtual size_t hash() const
+    {
+        return hashCombine(hashCombine(hashCombine(t->hash(), hashFloat(factor.x)), hashFloat(factor.y)), hashFloat(factor.z));
+    }
+    virtual bool equals(const Texture & rt) const
+    {
+        const MultiplyTexture * other = dynamic_cast<const MultiplyTexture *>(&rt);
+        return other && other->factor == factor && t->equals(*other->t);
+    }
 };
 
 class LogTexture : public FilterTexture
@@ -54,10 +64,6 @@ public:
         : FilterTexture(t)
     {
     }
-    virtual Texture * duplicate() const
-    {
-        return new LogTexture(t->duplicate());
-    }
 private:
     static float myLog(float v)
     {
@@ -70,6 +76,16 @@ protected:
     {
         return Color(myLog(v.x), myLog(v.y), myLog(v.z));
     }
+public:
+    virtual size_t hash() const
+    {
+        return t->hash();
+    }
+    virtual bool equals(const Texture & rt) const
+    {
+        const LogTexture * other = dynamic_cast<const LogTexture *>(&rt);
+        return other && t->equals(*other->t);
+    }
 };
 }
 
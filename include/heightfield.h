@@ -0,0 +1,44 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include "object.h"
+#include "image.h"
+
+namespace PathTrace
+{
+
+struct HeightfieldData;
+
+/** terrain : the ground below a surface with the elevations from an image, cut off by the box around it.<br/>
+ * the samples are at the corners of a grid over x and z and each cell is split into two triangles.
+ * rays walk a quadtree of the lowest and highest heights front to back, skipping the blocks they pass
+ * entirely above or below, so only the cells where they are near the surface are intersected.<br/>
+ * the heights are shared by the copies made by <code>duplicate</code>. */
+class Heightfield : public Object
+{
+public:
+    /** @param image
+     *            the elevations, at least 2 by 2 pixels. the average of the color channels goes from 0
+     *            at <code>minCorner.y</code> to 1 at <code>maxCorner.y</code>, the columns are along x
+     *            and the rows are along z
+     * @param minCorner
+     *            the corner of the terrain with the lowest coordinates
+     * @param maxCorner
+     *            the corner of the terrain with the highest coordinates */
+    Heightfield(const Image & image, Vector3D minCorner, Vector3D maxCorner, const Material * material);
+    virtual ~Heightfield();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual Object *duplicate() const;
+    virtual BoundingBox getBounds() const;
+    /** @return the outward facing normal of boundary <code>index</code> found by the span iterator, not normalized */
+    Vector3D getNormal(unsigned index) const;
+private:
+    Heightfield(HeightfieldData * data, const Material * material);
+    HeightfieldData * data;
+    const Material * material;
+};
+
+}
+
+#endif // HEIGHTFIELD_H
@@ -24,6 +24,7 @@
 #include "mutex.h"
 #include "atomic.h"
 #include "color.h"
+#include "misc.h"
 
 using namespace std;
 
@@ -72,6 +73,13 @@ public:
     {
         return data == NULL;
     }
+    /** @return a hash of the size and pixels, images with the same pixels have the same hash */
+    size_t hash() const
+    {
+        return data ? data->hash : 0;
+    }
+    /** @return if this image has the same size and pixels as <code>rt</code>, even if they were loaded separately */
+    bool hasSamePixels(const Image & rt) const;
     friend bool operator ==(Image l, Image r)
     {
         return l.data == r.data;
@@ -85,9 +93,10 @@ private:
     {
         float * const data;
         const unsigned w, h;
+        const size_t hash; /// computed once since the pixels don't change
         atomic_uint refCount;
         data_t(float * data, unsigned w, unsigned h)
-            : data(data), w(w), h(h), refCount(0)
+            : data(data), w(w), h(h), hash(hashPixels(data, w, h)), refCount(0)
         {
         }
         ~data_t()
@@ -97,6 +106,7 @@ private:
     };
     data_t * data;
     enum {FloatsPerPixel = 4};
+    static size_t hashPixels(const float * data, unsigned w, unsigned h);
     friend class MutableImage;
 };
 
@@ -6,6 +6,12 @@
 
 namespace PathTrace
 {
+/** @return a hash of the faces of a skybox */
+inline size_t hashImages(const Image & top, const Image & bottom, const Image & left, const Image & right, const Image & front, const Image & back)
+{
+    return hashCombine(hashCombine(hashCombine(hashCombine(hashCombine(top.hash(), bottom.hash()), left.hash()), right.hash()), front.hash()), back.hash());
+}
+
 class ImageTexture : public Texture
 {
 private:
@@ -26,9 +32,20 @@ public:
         int xi = (int)std::floor(x), yi = (int)std::floor(y);
         return image.getPixel(xi, yi);
     }
-    virtual Texture *duplicate() const
+    virtual bool getImageSize(unsigned &width, unsigned &height) const
+    {
+        width = image.width();
+        height = image.height();
+        return true;
+    }
+    virtual size_t hash() const
+    {
+        return image.hash();
+    }
+    virtual bool equals(const Texture &rt) const
     {
-        return new ImageTexture(image);
+        const ImageTexture * other = dynamic_cast<const ImageTexture *>(&rt);
+        return other && image.hasSamePixels(other->image);
     }
 };
 
@@ -63,9 +80,14 @@ public:
         int xi = (int)std::floor(x), yi = (int)std::floor(y);
         return image.getPixelAlpha(xi, yi);
     }
-    virtual Texture *duplicate() const
+    virtual size_t hash() const
     {
-        return new ImageAlphaTexture(image);
+        return hashCombine(image.hash(), 1);
+    }
+    virtual bool equals(const Texture &rt) const
+    {
+        const ImageAlphaTexture * other = dynamic_cast<const ImageAlphaTexture *>(&rt);
+        return other && image.hasSamePixels(other->image);
     }
 };
 
@@ -108,9 +130,21 @@ public:
             return getColor(v.x / a.z, v.y / a.z, back);
         return getColor(-v.x / a.z, v.y / a.z, front);
     }
-    virtual Texture *duplicate() const
+    virtual bool getImageSize(unsigned &width, unsigned &height) const
+    {
+        // the same detail as a spherical coordinates map around the sides of the box
+        width = 4 * front.width();
+        height = 2 * front.height();
+        return true;
+    }
+    virtual size_t hash() const
     {
-        return new ImageSkyboxTexture(top, bottom, left, right, front, back);
+        return hashImages(top, bottom, left, right, front, back);
+    }
+    virtual bool equals(const Texture &rt) const
+    {
+        const ImageSkyboxTexture * other = dynamic_cast<const ImageSkyboxTexture *>(&rt);
+        return other && top.hasSamePixels(other->top) && bottom.hasSamePixels(other->bottom) && left.hasSamePixels(other->left) && right.hasSamePixels(other->right) && front.hasSamePixels(other->front) && back.hasSamePixels(other->back);
     }
 };
 
@@ -174,9 +208,14 @@ public:
             return Color(get(v.x / a.z, v.y / a.z, back));
         return Color(get(-v.x / a.z, v.y / a.z, front));
     }
-    virtual Texture *duplicate() const
+    virtual size_t hash() const
+    {
+        return hashCombine(hashImages(top, bottom, left, right, front, back), 1);
+    }
+    virtual bool equals(const Texture &rt) const
     {
-        return new ImageSkyboxAlphaTexture(top, bottom, left, right, front, back);
+        const ImageSkyboxAlphaTexture * other = dynamic_cast<const ImageSkyboxAlphaTexture *>(&rt);
+        return other && top.hasSamePixels(other->top) && bottom.hasSamePixels(other->bottom) && left.hasSamePixels(other->left) && right.hasSamePixels(other->right) && front.hasSamePixels(other->front) && back.hasSamePixels(other->back);
     }
 };
 }
@@ -0,0 +1,84 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "object.h"
+#include "reference_counted.h"
+#include <vector>
+
+namespace PathTrace
+{
+
+/** an object shared by many <code>Instance</code>s.<br/>
+ * each instance adds a reference, the code that makes the prototype calls <code>removeReference</code>
+ * when it has made the instances and the prototype is deleted with the last reference. */
+class Prototype : public ReferenceCounted
+{
+public:
+    /** @param o
+     *            the shared object, the prototype owns it and it must not be changed */
+    explicit Prototype(Object * o)
+        : o(o), bounds(o->getBounds())
+    {
+    }
+    const Object & get() const
+    {
+        return *o;
+    }
+    /** @return the bounds of the shared object, calculated once when the prototype is made */
+    const BoundingBox & getBounds() const
+    {
+        return bounds;
+    }
+private:
+    ~Prototype()
+    {
+        delete o;
+    }
+    Object * const o;
+    const BoundingBox bounds;
+};
+
+/** a copy of a <code>Prototype</code> placed with the rays transformed by <code>m</code>.<br/>
+ * unlike <code>TransformedObject</code> the prototype is referenced instead of owned so
+ * <code>duplicate</code> and <code>transform</code> don't copy it and any number of instances
+ * only cost one copy of the prototype. a <code>BVHUnion</code> of instances is the top level
+ * hierarchy, the prototypes keep their own hierarchies in their local space.<br/>
+ * the primitives of the prototype aren't added to the lights.
+ * @see makeInstances */
+class Instance : public Object
+{
+public:
+    Instance(const Matrix & m, const Prototype * prototype);
+    virtual ~Instance();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual Object * duplicate() const
+    {
+        return new Instance(m, prototype);
+    }
+    /** @return a new instance of the same prototype, the prototype isn't transformed */
+    virtual Object * transform(const Matrix & m) const
+    {
+        return new Instance(m.concat(this->m), prototype);
+    }
+    virtual BoundingBox getBounds() const;
+private:
+    Matrix m;
+    Matrix normalMatrix; /// transforms the normals of the prototype to the normals of this instance
+    const Prototype * prototype;
+};
+
+/** makes a top level bounding volume hierarchy over instances of <code>prototype</code>
+ *
+ * @param prototype
+ *            the object to place
+ * @param transforms
+ *            the matrix that transforms the rays of each instance
+ * @return the new <code>BVHUnion</code> of the instances */
+Object * makeInstances(const Prototype * prototype, const std::vector<Matrix> & transforms);
+
+}
+
+#endif // INSTANCE_H
@@ -2,6 +2,7 @@
 #define INTERSECTION_H
 
 #include "object.h"
+#include "csg.h"
 
 namespace PathTrace
 {
@@ -12,18 +13,45 @@ public:
     Intersection(Object * a, Object * b);
     virtual ~Intersection();
     virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return csgFirstHit(CSGIntersection, a, b, ray, tmin, tmax, hit);
+    }
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+    {
+        return csgFirstHitPacket(CSGIntersection, a, b, rays, tmin, tmax, hits);
+    }
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const
+    {
+        if(!a->occluded(ray, tmin, tmax) || !b->occluded(ray, tmin, tmax))
+        {
+            return false;
+        }
+        return Object::occluded(ray, tmin, tmax); // both are on the segment but they might not overlap there
+    }
     virtual Object *duplicate() const
     {
         return new Intersection(a->duplicate(), b->duplicate());
     }
     virtual Object *transform(const Matrix &m) const
     {
-        return new Intersection(PathTrace::transform(m, a), PathTrace::transform(m, a));
+        return new Intersection(PathTrace::transform(m, a), PathTrace::transform(m, b));
+    }
+    virtual void getLights(std::vector<Light *> & lights) const
+    {
+        a->getLights(lights);
+        b->getLights(lights);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return intersect(a->getBounds(), b->getBounds());
     }
+    virtual bool compile(CSGProgram & program) const;
 protected:
 private:
-    Object * const a;
-    Object * const b;
+    friend class CSGOptimizer;
+    Object * a;
+    Object * b;
 };
 
 }
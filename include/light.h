@@ -0,0 +1,239 @@
+#ifndef LIGHT_H_INCLUDED
+#define LIGHT_H_INCLUDED
+
+#include "object.h"
+#include "material.h"
+#include <vector>
+#include <map>
+#include <cstddef>
+
+namespace PathTrace
+{
+
+/** an emissive surface that can be sampled directly */
+class Light
+{
+public:
+    virtual ~Light()
+    {
+    }
+    /** @return the object the hits on this light belong to or <code>NULL</code> for lights made of several objects */
+    virtual const Object * getObject() const = 0;
+    /** @return the bounds of the emitting surface */
+    virtual BoundingBox getBounds() const = 0;
+    /** @return an estimate of the total light emitted */
+    virtual float getPower() const = 0;
+    /** picks a direction from <code>x</code> towards this light
+     *
+     * @param u1
+     *            a random number in <code>[0, 1)</code>
+     * @param u2
+     *            a random number in <code>[0, 1)</code>
+     * @param dir
+     *            set to the normalized direction
+     * @param pdf
+     *            set to the probability density of <code>dir</code> per solid angle
+     * @return if a direction was found */
+    virtual bool sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const = 0;
+    /** @return the probability density per solid angle of <code>sample</code>
+     * picking the normalized direction <code>dir</code> from <code>x</code> */
+    virtual float pdf(Vector3D x, Vector3D dir) const = 0;
+    /** @return the material of a light that is part of a sky surrounding the scene or <code>NULL</code>.<br/>
+     * the lights sharing a sky material are replaced by one <code>EnvironmentLight</code> */
+    virtual const Material * getEnvironmentMaterial() const
+    {
+        return NULL;
+    }
+};
+
+class SphereLight : public Light
+{
+public:
+    SphereLight(Vector3D center, float r, const Material * material, const Object * object);
+    virtual const Object * getObject() const
+    {
+        return object;
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox(center - Vector3D(r), center + Vector3D(r));
+    }
+    virtual float getPower() const
+    {
+        return power;
+    }
+    virtual bool sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const;
+    virtual float pdf(Vector3D x, Vector3D dir) const;
+private:
+    const Vector3D center;
+    const float r;
+    const Object * const object;
+    float power;
+};
+
+/** an emissive plane, the directions from a point to the plane are sampled uniformly */
+class PlaneLight : public Light
+{
+public:
+    PlaneLight(Vector3D normal, float d, const Material * material, const Object * object);
+    virtual const Object * getObject() const
+    {
+        return object;
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox::infinite();
+    }
+    virtual float getPower() const
+    {
+        return power;
+    }
+    virtual bool sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const;
+    virtual float pdf(Vector3D x, Vector3D dir) const;
+    /** @return the material if it is looked up in an image, like the sky textures */
+    virtual const Material * getEnvironmentMaterial() const;
+    Vector3D getNormal() const
+    {
+        return normal;
+    }
+    float getD() const
+    {
+        return d;
+    }
+private:
+    Vector3D normal;
+    float d;
+    const Material * const material;
+    const Object * const object;
+    float power;
+};
+
+/** the sky made of the planes sharing an emissive material.<br/>
+ * the points on the sky are picked in proportion to their luminance using a
+ * precomputed table over the spherical coordinates of their direction from the origin,
+ * the same way the sky textures look up their image
+ */
+class EnvironmentLight : public Light
+{
+public:
+    /** @param normals
+     *            the normals of the planes making up the sky
+     * @param ds
+     *            the distances of the planes making up the sky, like <code>Plane</code> */
+    EnvironmentLight(const Material * material, const std::vector<Vector3D> & normals, const std::vector<float> & ds);
+    virtual const Object * getObject() const
+    {
+        return NULL;
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox::infinite();
+    }
+    virtual float getPower() const
+    {
+        return power;
+    }
+    virtual bool sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const;
+    virtual float pdf(Vector3D x, Vector3D dir) const;
+private:
+    /** finds the closest of the planes in direction <code>dir</code> from <code>origin</code>
+     *
+     * @param point
+     *            set to the point hit
+     * @param normal
+     *            set to the normal of the plane hit
+     * @return if a plane was hit */
+    bool findSkyPoint(Vector3D origin, Vector3D dir, Vector3D & point, Vector3D & normal) const;
+    /** @return the probability density per solid angle as seen from the origin of picking the direction <code>dir</code> */
+    float tablePdf(Vector3D dir) const;
+    /** @return the factor converting a probability density per solid angle as seen from the
+     * origin to one as seen from <code>x</code> for the sky point <code>point</code> */
+    static float solidAngleFactor(Vector3D x, Vector3D point, Vector3D normal);
+    static const unsigned MaxWidth = 2048, MinWidth = 64;
+    std::vector<Vector3D> normals;
+    std::vector<float> ds;
+    int width, height;
+    std::vector<float> values; /// the luminance of each cell times the sine of its polar angle
+    std::vector<float> columnCdf; /// <code>width + 1</code> entries per row
+    std::vector<float> rowCdf;
+    float average; /// the average of <code>values</code>
+    float power;
+};
+
+/** the lights of a scene for sampling direct lighting.<br/>
+ * bounded lights are picked by walking a bounding volume hierarchy, choosing
+ * children in proportion to their power divided by their squared distance.
+ * unbounded lights are picked uniformly.<br/>
+ * the planes sharing a sky material are collected into one <code>EnvironmentLight</code>.
+ */
+class LightList
+{
+public:
+    /** collects the lights in <code>world</code> using <code>Object::getLights</code> */
+    explicit LightList(const Object & world);
+    ~LightList();
+    bool empty() const
+    {
+        return lights.empty();
+    }
+    const Object & getWorld() const
+    {
+        return world;
+    }
+    /** picks a light and a direction from <code>x</code> towards it
+     *
+     * @param u0
+     *            a random number in <code>[0, 1)</code> for picking the light
+     * @param u1
+     *            a random number in <code>[0, 1)</code>
+     * @param u2
+     *            a random number in <code>[0, 1)</code>
+     * @param dir
+     *            set to the normalized direction
+     * @param pdf
+     *            set to the probability density of picking <code>dir</code> per solid angle
+     * @param light
+     *            set to the light picked, the object hit in direction <code>dir</code> has to belong to it
+     * @return if a direction was found */
+    bool sample(Vector3D x, float u0, float u1, float u2, Vector3D & dir, float & pdf, const Light *& light) const;
+    /** @return the light <code>object</code> belongs to or <code>NULL</code> */
+    const Light * getLight(const Object * object) const;
+    /** @return the probability density per solid angle of <code>sample</code> picking
+     * the normalized direction <code>dir</code> from <code>x</code> and hitting <code>object</code>.<br/>
+     * 0 for objects that aren't lights */
+    float pdf(Vector3D x, const Object * object, Vector3D dir) const;
+private:
+    struct Node
+    {
+        BoundingBox bounds;
+        float power;
+        size_t parent;
+        size_t second; /// the second child of interior nodes, the first is the next node
+        size_t light; /// the index in <code>lights</code> of a leaf or <code>NoLight</code> for interior nodes
+    };
+    static const size_t NoLight = (size_t)-1;
+    /** the sky planes sharing a material */
+    struct EnvironmentPlanes
+    {
+        std::vector<Vector3D> normals;
+        std::vector<float> ds;
+        std::vector<const Object *> objects;
+    };
+    size_t build(size_t * lightIndexes, size_t count, size_t parent);
+    float importance(const Node & node, Vector3D x) const;
+    /** @return the probability of picking the first child of <code>node</code> */
+    float firstChildProbability(const Node & node, size_t index, Vector3D x) const;
+    float boundedProbability() const;
+    LightList(const LightList &); // not implemented
+    const LightList & operator =(const LightList &); // not implemented
+    const Object & world;
+    std::vector<Light *> lights;
+    std::vector<size_t> boundedLights, unboundedLights;
+    std::vector<Node> nodes;
+    std::vector<size_t> leafNode; /// the leaf of each light or <code>NoLight</code> for unbounded lights
+    std::map<const Object *, size_t> lightIndex; /// the index in <code>lights</code> of each light's object
+};
+
+}
+
+#endif // LIGHT_H_INCLUDED
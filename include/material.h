@@ -3,11 +3,18 @@
 
 #include "color.h"
 #include "texture.h"
+#include "reference_counted.h"
 
 namespace PathTrace
 {
 
-struct Material
+/** a material references its textures, they are released when it is deleted.<br/>
+ * materials are immutable and shared by reference counting like textures : <code>duplicate</code> adds a reference
+ * and <code>release</code> removes one. objects add a reference to their materials, so the code that made a material
+ * releases its reference once it has made the objects that use it.<br/>
+ * transformed materials share the textures so they only cost the new <code>Material</code>
+ * and a <code>TransformedTexture</code> view for each texture that depends on position. */
+struct Material : public ReferenceCounted
 {
     Texture * reflect;
     Texture * scatter_coefficient; /// amount of scattering : (0, 1) to (specular, diffuse)
@@ -15,31 +22,38 @@ struct Material
     Texture * transmit;
     float ior;
     Texture * transmit_reflect_coefficient; /// (0, 1) to (reflect, transmit)
-    Material(Texture * reflect = new ColorTexture(1), Texture * scatter_coefficient = new ColorTexture(1), Texture * emissive = new ColorTexture(0), Texture * transmit = new ColorTexture(0), float ior = 1, Texture * transmit_reflect_coefficient = new ColorTexture(0))
+    /** makes a material that isn't shared with <code>makeMaterial</code>, it takes the references to the textures */
+    Material(Texture * reflect = makeColorTexture(1), Texture * scatter_coefficient = makeColorTexture(1), Texture * emissive = makeColorTexture(0), Texture * transmit = makeColorTexture(0), float ior = 1, Texture * transmit_reflect_coefficient = makeColorTexture(0))
         : reflect(reflect), scatter_coefficient(scatter_coefficient), emissive(emissive), transmit(transmit), ior(ior), transmit_reflect_coefficient(transmit_reflect_coefficient)
     {
     }
-    ~Material()
+    /** @return another reference to this material */
+    const Material * duplicate() const
     {
-        delete reflect;
-        delete scatter_coefficient;
-        delete emissive;
-        delete transmit;
-        delete transmit_reflect_coefficient;
+        addReference();
+        return this;
     }
-    Material * duplicate() const
-    {
-        return new Material(reflect->duplicate(), scatter_coefficient->duplicate(), emissive->duplicate(), transmit->duplicate(), ior, transmit_reflect_coefficient->duplicate());
-    }
-private:
-    Material(const Material & rt); // not implemented
-    const Material & operator =(const Material & rt); // not implemented
+    /** removes a reference to this material, deleting it if it was the last one.
+     * materials must be released with this instead of <code>removeReference</code> so a deleted material
+     * is removed from the shared materials before another thread can find it */
+    void release() const;
+protected:
+    virtual ~Material();
 };
 
-inline Material * transform(const Matrix & m, const Material * mat)
-{
-    return new Material(transform(m, mat->reflect), transform(m, mat->scatter_coefficient), transform(m, mat->emissive), transform(m, mat->transmit), mat->ior, transform(m, mat->transmit_reflect_coefficient));
-}
+/** gets the shared material with these textures, made by the first call with textures that look the same.<br/>
+ * takes the references to the textures and returns a reference to the material that the caller releases.
+ * the textures are compared with <code>Texture::equals</code>, so identical materials are only stored once
+ * even if their textures were made or loaded separately. a shared material stops being shared when
+ * its last reference is released. it is thread safe.
+ *
+ * @return a new reference to the shared material */
+const Material * makeMaterial(Texture * reflect = makeColorTexture(1), Texture * scatter_coefficient = makeColorTexture(1), Texture * emissive = makeColorTexture(0), Texture * transmit = makeColorTexture(0), float ior = 1, Texture * transmit_reflect_coefficient = makeColorTexture(0));
+
+/** @return a new reference to the shared material with the textures of <code>mat</code> transformed by <code>m</code>,
+ * the same material is returned each time <code>mat</code> is transformed by the same matrix
+ * @see makeMaterial */
+const Material * transform(const Matrix & m, const Material * mat);
 
 }
 
@@ -1,12 +1,38 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
 namespace PathTrace
 {
 
 const float eps = 1e-3;
 const float max_value = 1e20;
 
+/** @return the smallest float greater than <code>v</code> */
+inline float nextFloatUp(float v)
+{
+    return ::nextafterf(v, 2 * max_value);
+}
+
+/** @return <code>seed</code> combined with the hash <code>value</code>, used to hash several values in order */
+inline size_t hashCombine(size_t seed, size_t value)
+{
+    return seed ^ (value + 0x9E3779B9 + (seed << 6) + (seed >> 2));
+}
+
+/** @return a hash of <code>v</code>, the same for <code>0</code> and <code>-0</code> since they compare equal */
+inline size_t hashFloat(float v)
+{
+    v += 0.0f; // -0 + 0 is 0
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
 template <typename T>
 class AutoDestruct
 {
@@ -3,94 +3,245 @@
 
 #include "span.h"
 #include "ray.h"
+#include "bounding_box.h"
+#include "ray_packet.h"
+#include <vector>
 
 namespace PathTrace
 {
 
+class Object;
+class Light;
+class CSGProgram;
+
+/** a boundary of an object found by <code>Object::firstHit</code> */
+struct Hit
+{
+    float t;
+    Vector3D normal; /// the outward facing surface normal
+    const Material * material;
+    bool entering; /// if the ray is going into the object
+    const Object * object; /// the primitive the boundary belongs to
+};
+
+/** the boundaries found by <code>Object::firstHitPacket</code> for each ray in a <code>RayPacket</code> */
+struct HitPacket
+{
+    FloatPacket t;
+    VectorPacket normal; /// the outward facing surface normals
+    const Material * material[PacketSize];
+    MaskPacket entering; /// if the rays are going into the object
+    const Object * object[PacketSize];
+    Hit get(int i) const
+    {
+        Hit retval;
+        retval.t = lane(t, i);
+        retval.normal = normal.get(i);
+        retval.material = material[i];
+        retval.entering = lane(entering, i);
+        retval.object = object[i];
+        return retval;
+    }
+    /** copies the lanes of <code>other</code> that are set in <code>mask</code> */
+    void merge(MaskPacket mask, const HitPacket & other)
+    {
+        int bits = mask.bits();
+        if(bits == 0)
+        {
+            return;
+        }
+        t = select(mask, other.t, t);
+        normal = select(mask, other.normal, normal);
+        entering = (mask & other.entering) | (~mask & entering);
+        for(int i = 0; i < PacketSize; i++)
+        {
+            if((bits >> i) & 1)
+            {
+                material[i] = other.material[i];
+                object[i] = other.object[i];
+            }
+        }
+    }
+};
+
 class Object
 {
 public:
     Object();
     virtual SpanIterator * makeSpanIterator() const = 0;
+    /** finds the first boundary of this object along <code>ray</code> with <code>tmin <= t <= tmax</code>.<br/>
+     * the default implementation walks the spans from <code>makeSpanIterator()</code>
+     *
+     * @param ray
+     *            the ray to intersect
+     * @param tmin
+     *            the minimum ray parameter
+     * @param tmax
+     *            the maximum ray parameter
+     * @param hit
+     *            set to the boundary found
+     * @return if a boundary was found */
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    /** the same as <code>firstHit</code> for all the active rays in <code>rays</code> at once.<br/>
+     * the default implementation calls <code>firstHit</code> for each active ray
+     *
+     * @param rays
+     *            the rays to intersect
+     * @param tmin
+     *            the minimum ray parameters
+     * @param tmax
+     *            the maximum ray parameters
+     * @param hits
+     *            set to the boundaries found, lanes without a boundary are left undefined
+     * @return the active rays that found a boundary */
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    /** checks if any part of this object is on <code>ray</code> with <code>tmin <= t <= tmax</code>, for shadow
+     * and visibility tests that don't need to know where the object is.<br/>
+     * the segment is occluded if it crosses a boundary of this object or is inside of it.
+     * the default implementation uses <code>firstHit</code> on the segment and <code>isInside</code> if that misses
+     *
+     * @param ray
+     *            the ray to test
+     * @param tmin
+     *            the minimum ray parameter
+     * @param tmax
+     *            the maximum ray parameter
+     * @return if the segment is occluded */
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
     virtual Object * transform(const Matrix &m) const
     {
         return NULL;
     }
     virtual ~Object() {}
     virtual Object * duplicate() const = 0;
+    /** adds the lights for the emissive primitives in this object to <code>lights</code>.<br/>
+     * the caller owns the added lights. primitives inside a <code>TransformedObject</code> or an <code>Instance</code>
+     * aren't added, they are still found by the rays scattered from surfaces */
+    virtual void getLights(std::vector<Light *> & lights) const
+    {
+    }
+    /** @return the world space bounds of this object */
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox::infinite();
+    }
+    /** adds the instructions that evaluate this object to <code>program</code>
+     *
+     * @return if this object can be compiled, the default implementation returns false
+     * @see compileCSG(Object * o) */
+    virtual bool compile(CSGProgram & program) const
+    {
+        return false;
+    }
+protected:
+    /** checks if the point at <code>t</code> on <code>ray</code> is inside this object by finding the next
+     * boundary, only searching until the ray leaves the bounds of this object
+     *
+     * @return if the next boundary after <code>t</code> leaves this object */
+    bool isInside(const Ray & ray, float t) const;
 private:
     Object(const Object & rt); // not implemented
     const Object & operator =(const Object & rt); // not implemented
 };
 
+/** the spans of an object with the rays transformed by <code>m</code>, the normals are transformed by
+ * <code>normalMatrix</code> when they are calculated */
+class TransformedSpanIterator : public SpanIterator
+{
+private:
+    const Matrix & m;
+    const Matrix & normalMatrix;
+    SpanIterator * iter;
+protected:
+    virtual Vector3D transformNormal(Vector3D normal) const
+    {
+        return normalMatrix.applyNoTranslate(normal);
+    }
+public:
+    TransformedSpanIterator(const Matrix & m, const Matrix & normalMatrix, SpanIterator * iter)
+        : m(m), normalMatrix(normalMatrix), iter(iter)
+    {
+        adopt(iter);
+    }
+    virtual const Span & operator *() const
+    {
+        return **iter; // the normals are transformed when they are calculated
+    }
+    virtual const Span * operator ->() const
+    {
+        return &**iter;
+    }
+    virtual bool isAtEnd() const
+    {
+        return iter->isAtEnd();
+    }
+    virtual void next()
+    {
+        iter->next();
+    }
+    virtual void init(const Ray & ray)
+    {
+        iter->init(PathTrace::transform(m, ray));
+    }
+
+    virtual ~TransformedSpanIterator()
+    {
+        delete iter;
+    }
+};
+
+/** an object with the rays transformed by <code>m</code> before they are passed to <code>o</code>.<br/>
+ * <code>transform(m, o)</code> only makes these for the objects that can't be transformed directly,
+ * the inverse and the normal matrix are calculated when it is made.
+ * @see flattenTransforms(Object * o) */
 class TransformedObject : public Object
 {
 private:
+    friend class CSGOptimizer;
     Matrix m;
     Object * o;
-    class TransformedSpanIterator : public SpanIterator
-    {
-    private:
-        Matrix m, inv;
-        SpanIterator * iter;
-        Span span;
-        void calcSpan()
-        {
-            if(!isAtEnd())
-            {
-                span = PathTrace::transform(inv, **iter);
-            }
-        }
-    public:
-        TransformedSpanIterator(Matrix m, SpanIterator * iter)
-            : m(m), inv(invert(m)), iter(iter)
-        {
-        }
-        virtual const Span & operator *() const
-        {
-            return span;
-        }
-        virtual const Span * operator ->() const
-        {
-            return &span;
-        }
-        virtual bool isAtEnd() const
-        {
-            return iter->isAtEnd();
-        }
-        virtual void next()
-        {
-            iter->next();
-            calcSpan();
-        }
-        virtual void init(const Ray & ray)
-        {
-            iter->init(PathTrace::transform(m, ray));
-            calcSpan();
-        }
-
-        virtual ~TransformedSpanIterator()
-        {
-            delete iter;
-        }
-    };
+    Matrix inv;
+    Matrix normalMatrix; /// transforms the normals of <code>o</code> to the normals of this object
 public:
     TransformedObject(const Matrix &m, Object * o)
-        : m(m), o(o)
+        : m(m), o(o), inv(invert(m)), normalMatrix(m.transposeNoTranslate())
     {
     }
     virtual SpanIterator * makeSpanIterator() const
     {
-        return new TransformedSpanIterator(m, o->makeSpanIterator());
-    }
-    virtual Object * transform(const Matrix &m) const
-    {
-        return new TransformedObject(this->m.concat(m), o->duplicate());
+        return new TransformedSpanIterator(m, normalMatrix, o->makeSpanIterator());
     }
+    /** pushes <code>m</code> and the transform of this object down to <code>o</code> */
+    virtual Object * transform(const Matrix &m) const;
     virtual Object * duplicate() const
     {
         return new TransformedObject(m, o->duplicate());
     }
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        if(!o->firstHit(PathTrace::transform(m, ray), tmin, tmax, hit))
+            return false;
+        hit.normal = normalize(normalMatrix.applyNoTranslate(hit.normal));
+        return true;
+    }
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+    {
+        MaskPacket retval = o->firstHitPacket(PathTrace::transform(m, rays), tmin, tmax, hits);
+        if(any(retval))
+        {
+            hits.normal = normalize(applyNoTranslate(normalMatrix, hits.normal));
+        }
+        return retval;
+    }
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const
+    {
+        return o->occluded(PathTrace::transform(m, ray), tmin, tmax);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return PathTrace::transform(inv, o->getBounds());
+    }
+    virtual bool compile(CSGProgram & program) const;
     virtual ~TransformedObject()
     {
         delete o;
@@ -101,10 +252,28 @@ inline Object *transform(const Matrix &m, Object *o)
 {
     Object *retval = o->transform(m);
     if(!retval)
-        retval = new TransformedObject(m, o->duplicate());
+    {
+        if(m == Matrix::identity())
+            retval = o->duplicate();
+        else
+            retval = new TransformedObject(m, o->duplicate());
+    }
     return retval;
 }
 
+/** makes a copy of <code>o</code> with the transforms pushed down into the primitives.<br/>
+ * spheres under similarity transforms and planes are transformed directly, triangle meshes are
+ * kept in a <code>TransformedObject</code> that shares their triangles,
+ * nested <code>TransformedObject</code>s are combined so each ray is transformed at most once.
+ *
+ * @param o
+ *            the object to flatten, the caller still owns it
+ * @return the new object */
+inline Object *flattenTransforms(Object *o)
+{
+    return transform(Matrix::identity(), o);
+}
+
 }
 
 #endif // OBJECT_H
@@ -12,51 +12,145 @@
 #include "plane.h"
 #include "intersection.h"
 #include "difference.h"
+#include "bvh_union.h"
+#include "light.h"
+#include "sampler.h"
+#include "philox.h"
 //#include <random>
 #include <stdint.h>
 
 namespace PathTrace
 {
 
-class DefaultRandomEngine
+/** the random number engine used when no <code>Sampler</code> is given */
+typedef PhiloxRandomEngine DefaultRandomEngine;
+
+const int DefaultRayDepth = 16;
+
+/** the number of dimensions of each pixel sample used for the position in the pixel */
+const unsigned PixelSampleDimensions = 2;
+
+/** picks the direction of a ray reflected off a surface.<br/>
+ * <code>randomEngine</code> is either a random number engine with the sample
+ * functions of <code>DefaultRandomEngine</code> or a <code>Sampler</code>
+ *
+ * @param reflectedRayDir
+ *            the direction of the mirror reflection
+ * @param normal
+ *            the surface normal facing the side the reflected ray leaves from
+ * @param scatter_coefficient
+ *            0 for a mirror up to 1 for a fully diffuse surface
+ * @param resultingRayDir
+ *            set to the chosen direction
+ * @return if a direction leaving the surface was found */
+template <typename T>
+inline bool sampleScatterDirection(Vector3D reflectedRayDir, Vector3D normal, float scatter_coefficient, T &randomEngine, Vector3D &resultingRayDir)
 {
-public:
-    DefaultRandomEngine()
+    resultingRayDir = reflectedRayDir;
+    if(scatter_coefficient <= eps)
     {
-        seed(0);
+        return true;
     }
-    static unsigned min()
+    float u1, u2;
+    if(scatter_coefficient >= 1 - eps)
+    {
+        // fully diffuse : the directions are uniform over the hemisphere so they can be picked without rejection
+        randomEngine.get2D(u1, u2);
+        float cosTheta = eps + (1 - eps) * u1;
+        float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+        float phi = 2 * M_PI * u2;
+        Vector3D a = std::abs(normal.x) > 0.9f ? Vector3D(0, 1, 0) : Vector3D(1, 0, 0);
+        Vector3D u = normalize(cross(a, normal));
+        Vector3D v = cross(normal, u);
+        resultingRayDir = normalize(cosTheta * normal + sinTheta * std::cos(phi) * u + sinTheta * std::sin(phi) * v);
+        return true;
+    }
+    int count = 0;
+    do
+    {
+        count++;
+        assert(count <= 1000);
+        if(count > 1000)
+        {
+            return false;
+        }
+        // a uniformly distributed point in the unit ball
+        float r = std::pow(randomEngine.get1D(), 1.0f / 3);
+        randomEngine.get2D(u1, u2);
+        float z = 1 - 2 * u1;
+        float s = std::sqrt(std::max(0.0f, 1 - z * z));
+        resultingRayDir = r * Vector3D(s * std::cos(2 * M_PI * u2), s * std::sin(2 * M_PI * u2), z);
+        resultingRayDir += (1 / scatter_coefficient - 1) * reflectedRayDir;
+    }
+    while(dot(normal, resultingRayDir) <= eps);
+    resultingRayDir = normalize(resultingRayDir);
+    return true;
+}
+
+/** calculates the light leaving the surface hit by <code>ray</code> at <code>t</code>,
+ * tracing the transmitted and reflected rays through <code>scene</code>
+ *
+ * @param normal
+ *            the surface normal facing the side <code>ray</code> comes from
+ * @param ior
+ *            the ratio of the index of refraction on the incoming side to the other side */
+template <typename T, typename SceneT>
+inline Color shadeHit(const Ray &ray, float t, Vector3D normal, const Material *material, float ior, SceneT &scene, int depth, T &randomEngine, float strength)
+{
+    Vector3D hitPos = ray.getPoint(t);
+    //ior = 1 / ior;
+    Color retval = material->emissive->getColor(hitPos);
+    float addFactor = 1;
+    if(depth <= 0 || strength < eps)
     {
-        return 0;
+        return retval;
     }
-    static unsigned max()
+    //uniform_real_distribution<float> zeroToOne(0, 1);
+    float refractFactor = std::max(0.0f, std::min(1.0f, material->transmit_reflect_coefficient->getFloat(hitPos))) * ray.dir.refractStrength(ior, normal);
+    if(refractFactor > eps) // transmit
     {
-        return 0xFFFFFFFF;
+        Vector3D refractedRayDir = ray.dir.refract(ior, normal);
+        if(refractedRayDir != Vector3D(0, 0, 0))
+        {
+            Ray newRay = Ray(hitPos, refractedRayDir);
+            Color transmit = material->transmit->getColor(hitPos);
+            retval += addFactor * refractFactor * transmit * traceRay(newRay, scene, depth - 1, randomEngine, strength * refractFactor * addFactor * abs(transmit));
+            addFactor *= 1 - refractFactor;
+        }
     }
-    void seed(unsigned newValue)
+    if(addFactor < eps)
     {
-        v = newValue ^ 0x12476242;
+        return retval;
     }
-    unsigned operator()()
+
+    // diffuse/specular reflect
+    float scatter_coefficient = material->scatter_coefficient->getFloat(hitPos);
+    scatter_coefficient = std::max(0.0f, std::min(1.0f, scatter_coefficient));
+    int scatter_ray_count = (int)(10000 * strength * addFactor * scatter_coefficient);
+    if(scatter_coefficient <= eps)
     {
-        v = (214013 * v + 2531011);
-        return (unsigned)(v >> 32);
+        scatter_ray_count = 1;
     }
-    void discard(unsigned long long count)
+    if(scatter_ray_count == 0)
+        scatter_ray_count = 1;
+    Color reflect = material->reflect->getColor(hitPos);
+    for(int i = 0; i < scatter_ray_count; i++)
     {
-        for(unsigned long long i = 0; i < count; i++)
+        Vector3D resultingRayDir;
+        if(!sampleScatterDirection(ray.dir.reflect(normal), normal, scatter_coefficient, randomEngine, resultingRayDir))
         {
-            operator()();
+            return retval;
         }
+
+        float factor = 1 - (1 - dot(resultingRayDir, normal)) * scatter_coefficient;
+        Ray newRay = Ray(ray.getPoint(t), resultingRayDir);
+        retval += addFactor / scatter_ray_count * factor * reflect * traceRay(newRay, scene, depth - 1, randomEngine, strength / scatter_ray_count * addFactor * factor * abs(reflect));
     }
-private:
-    uint64_t v;
-};
+    return retval;
+}
 
-extern DefaultRandomEngine defaultRandomEngine;
-const int DefaultRayDepth = 16;
 template <typename T>
-inline Color traceRay(const Ray &ray, SpanIterator &spanIterator, int depth = DefaultRayDepth, T &randomEngine = defaultRandomEngine, float strength = 1.0)
+inline Color traceRay(const Ray &ray, SpanIterator &spanIterator, int depth, T &randomEngine, float strength = 1.0)
 {
     spanIterator.init(ray);
     float t = -1;
@@ -72,8 +166,8 @@ inline Color traceRay(const Ray &ray, SpanIterator &spanIterator, int depth = De
         if(spanIterator->start >= eps)
         {
             t = spanIterator->start;
-            normal = spanIterator->startNormal;
-            material = spanIterator->startMaterial;
+            normal = spanIterator->getStartNormal();
+            material = spanIterator->getStartMaterial();
             assert(material != NULL);
             assert(material->ior > eps);
             ior = 1.0 / material->ior;
@@ -86,8 +180,8 @@ inline Color traceRay(const Ray &ray, SpanIterator &spanIterator, int depth = De
         if(spanIterator->end >= eps)
         {
             t = spanIterator->end;
-            normal = -spanIterator->endNormal;
-            material = spanIterator->endMaterial;
+            normal = -spanIterator->getEndNormal();
+            material = spanIterator->getEndMaterial();
             assert(material != NULL);
             assert(material->ior > eps);
             ior = material->ior;
@@ -98,79 +192,247 @@ inline Color traceRay(const Ray &ray, SpanIterator &spanIterator, int depth = De
     {
         return Color(0, 0, 0);
     }
-    Vector3D hitPos = ray.getPoint(t);
-    //ior = 1 / ior;
-    Color retval = material->emissive->getColor(hitPos);
-    float addFactor = 1;
-    if(depth <= 0 || strength < eps)
+    return shadeHit(ray, t, normal, material, ior, spanIterator, depth, randomEngine, strength);
+}
+
+/** calculates the light leaving the boundary <code>hit</code> found along <code>ray</code>
+ * @see shadeHit(const Ray &ray, float t, Vector3D normal, const Material *material, float ior, SceneT &scene, int depth, T &randomEngine, float strength) */
+template <typename T>
+inline Color shadeHit(const Ray &ray, const Hit &hit, const Object &world, int depth, T &randomEngine, float strength)
+{
+    assert(hit.material != NULL);
+    assert(hit.material->ior > eps);
+    if(hit.entering)
     {
-        return retval;
+        return shadeHit(ray, hit.t, hit.normal, hit.material, 1.0f / hit.material->ior, world, depth, randomEngine, strength);
     }
-    //uniform_real_distribution<float> zeroToOne(0, 1);
+    return shadeHit(ray, hit.t, -hit.normal, hit.material, hit.material->ior, world, depth, randomEngine, strength);
+}
+
+/** the same as <code>traceRay(ray, spanIterator, ...)</code> except that it only
+ * asks <code>world</code> for the closest hit instead of enumerating all the spans */
+template <typename T>
+inline Color traceRay(const Ray &ray, const Object &world, int depth, T &randomEngine, float strength = 1.0)
+{
+    Hit hit;
+    if(!world.firstHit(ray, eps, max_value, hit) || hit.t >= max_value)
+    {
+        return Color(0, 0, 0);
+    }
+    return shadeHit(ray, hit, world, depth, randomEngine, strength);
+}
+
+const int DefaultRussianRouletteDepth = 3;
+
+/** the probability density per solid angle of the direction picked by
+ * <code>sampleScatterDirection</code> for a fully diffuse surface */
+const float DiffuseScatterPdf = 1 / (2 * M_PI);
+
+/** @return the weight of a sample picked with probability density <code>pdf</code>
+ * when it could also have been picked with probability density <code>otherPdf</code> using the power heuristic */
+inline float misWeight(float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+/** picks a point on one of <code>lights</code> and calculates the light
+ * reflected from it by a fully diffuse surface at <code>hitPos</code>,
+ * weighted against finding the light with <code>sampleScatterDirection</code>
+ *
+ * @param normal
+ *            the surface normal facing the side the light is reflected to
+ * @param reflect
+ *            the color of the surface */
+template <typename T>
+inline Color sampleDirectLight(Vector3D hitPos, Vector3D normal, Color reflect, const LightList &lights, T &randomEngine)
+{
+    float u0 = randomEngine.get1D();
+    float u1, u2;
+    randomEngine.get2D(u1, u2);
+    Vector3D dir;
+    float lightPdf;
+    const Light *light;
+    if(!lights.sample(hitPos, u0, u1, u2, dir, lightPdf, light))
+    {
+        return Color(0, 0, 0);
+    }
+    float cosine = dot(dir, normal);
+    if(cosine <= eps)
+    {
+        return Color(0, 0, 0);
+    }
+    Ray shadowRay = Ray(hitPos, dir);
+    Hit hit;
+    if(!lights.getWorld().firstHit(shadowRay, eps, max_value, hit) || hit.t >= max_value || lights.getLight(hit.object) != light)
+    {
+        return Color(0, 0, 0);
+    }
+    Color emitted = hit.material->emissive->getColor(shadowRay.getPoint(hit.t));
+    // a fully diffuse surface scatters reflect / (2 * pi) per solid angle
+    return (cosine * DiffuseScatterPdf * misWeight(lightPdf, DiffuseScatterPdf) / lightPdf) * reflect * emitted;
+}
+
+/** the state carried along a path by <code>scatterPath</code> */
+struct PathState
+{
+    Color throughput; /// the weight of the light coming back along the current ray
+    Vector3D lastPosition; /// where the current ray starts
+    float lastScatterPdf; /// the probability density of the current ray's direction if direct lighting was sampled where it starts, otherwise 0
+    PathState()
+        : throughput(1, 1, 1), lastPosition(0, 0, 0), lastScatterPdf(0)
+    {
+    }
+};
+
+/** one bounce of <code>tracePath</code> : adds the light emitted at <code>hit</code> to <code>radiance</code>
+ * and replaces <code>ray</code> with the next ray of the path.<br/>
+ * if <code>lights</code> isn't <code>NULL</code> the direct lighting is sampled
+ * at fully diffuse surfaces and combined with the light found by the scattered
+ * rays using multiple importance sampling.
+ *
+ * @param depth
+ *            the number of bounces before <code>hit</code>
+ * @param state
+ *            the state of the path, updated for the next ray
+ * @return if the path continues */
+template <typename T>
+inline bool scatterPath(Ray &ray, const Hit &hit, int depth, PathState &state, Color &radiance, int maxDepth, T &randomEngine, int russianRouletteDepth, const LightList *lights)
+{
+    const Material *material = hit.material;
+    assert(material != NULL);
+    assert(material->ior > eps);
+    Vector3D normal = hit.normal;
+    float ior = material->ior;
+    if(hit.entering)
+    {
+        ior = 1.0f / ior;
+    }
+    else
+    {
+        normal = -normal;
+    }
+    Vector3D hitPos = ray.getPoint(hit.t);
+    Color emitted = material->emissive->getColor(hitPos);
+    if(state.lastScatterPdf > 0 && emitted != Color(0, 0, 0))
+    {
+        emitted *= misWeight(state.lastScatterPdf, lights->pdf(state.lastPosition, hit.object, normalize(ray.dir)));
+    }
+    radiance += state.throughput * emitted;
+    state.lastScatterPdf = 0;
+    if(depth >= maxDepth)
+    {
+        return false;
+    }
+
     float refractFactor = std::max(0.0f, std::min(1.0f, material->transmit_reflect_coefficient->getFloat(hitPos))) * ray.dir.refractStrength(ior, normal);
-    if(refractFactor > eps) // transmit
+    Vector3D refractedRayDir = Vector3D(0, 0, 0);
+    if(refractFactor > eps)
     {
-        Vector3D refractedRayDir = ray.dir.refract(ior, normal);
-        if(refractedRayDir != Vector3D(0, 0, 0))
+        refractedRayDir = ray.dir.refract(ior, normal);
+    }
+    // picking the transmitted ray with probability refractFactor cancels out its weight
+    if(refractedRayDir != Vector3D(0, 0, 0) && randomEngine.get1D() < refractFactor)
+    {
+        state.throughput *= material->transmit->getColor(hitPos);
+        ray = Ray(hitPos, refractedRayDir);
+    }
+    else
+    {
+        float scatter_coefficient = material->scatter_coefficient->getFloat(hitPos);
+        scatter_coefficient = std::max(0.0f, std::min(1.0f, scatter_coefficient));
+        Color reflect = material->reflect->getColor(hitPos);
+        if(lights != NULL && !lights->empty() && scatter_coefficient >= 1 - eps)
         {
-            Ray newRay = Ray(hitPos, refractedRayDir);
-            Color transmit = material->transmit->getColor(hitPos);
-            retval += addFactor * refractFactor * transmit * traceRay(newRay, spanIterator, depth - 1, randomEngine, strength * refractFactor * addFactor * abs(transmit));
-            addFactor *= 1 - refractFactor;
+            radiance += state.throughput * sampleDirectLight(hitPos, normal, reflect, *lights, randomEngine);
+            state.lastScatterPdf = DiffuseScatterPdf;
+            state.lastPosition = hitPos;
+        }
+        Vector3D resultingRayDir;
+        if(!sampleScatterDirection(ray.dir.reflect(normal), normal, scatter_coefficient, randomEngine, resultingRayDir))
+        {
+            return false;
         }
+        float factor = 1 - (1 - dot(resultingRayDir, normal)) * scatter_coefficient;
+        state.throughput *= factor * reflect;
+        ray = Ray(hitPos, resultingRayDir);
     }
-    if(addFactor < eps)
+
+    if(depth + 1 >= russianRouletteDepth)
     {
-        return retval;
+        float survivalProbability = std::min(1.0f, std::max(state.throughput.x, std::max(state.throughput.y, state.throughput.z)));
+        if(randomEngine.get1D() >= survivalProbability)
+        {
+            return false;
+        }
+        state.throughput /= survivalProbability;
     }
+    return true;
+}
 
-    // diffuse/specular reflect
-    float scatter_coefficient = material->scatter_coefficient->getFloat(hitPos);
-    scatter_coefficient = std::max(0.0f, std::min(1.0f, scatter_coefficient));
-    int scatter_ray_count = (int)(10000 * strength * addFactor * scatter_coefficient);
-    if(scatter_coefficient <= eps)
+template <typename T>
+inline Color continuePath(Ray ray, Hit hit, const Object &world, int maxDepth, T &randomEngine, int russianRouletteDepth, const LightList *lights);
+
+/** traces a single path through <code>world</code> starting with <code>ray</code>.<br/>
+ * instead of branching into every transmitted and reflected ray like
+ * <code>traceRay</code>, one of them is picked at each hit and the light is
+ * weighted by the throughput accumulated along the path, so the cost of a
+ * sample is bounded by <code>maxDepth</code>.<br/>
+ * after <code>russianRouletteDepth</code> bounces the path is randomly
+ * terminated with a probability based on its throughput, the surviving paths
+ * are scaled up so the expected value doesn't change.
+ *
+ * @param maxDepth
+ *            the maximum number of bounces
+ * @param russianRouletteDepth
+ *            the number of bounces before paths can be terminated
+ * @param lights
+ *            the lights to sample directly or <code>NULL</code>
+ * @return an estimate of the light coming back along <code>ray</code> */
+template <typename T>
+inline Color tracePath(const Ray &ray, const Object &world, int maxDepth, T &randomEngine, int russianRouletteDepth = DefaultRussianRouletteDepth, const LightList *lights = NULL)
+{
+    Hit hit;
+    if(!world.firstHit(ray, eps, max_value, hit) || hit.t >= max_value)
     {
-        scatter_ray_count = 1;
+        return Color(0, 0, 0);
     }
-    if(scatter_ray_count == 0)
-        scatter_ray_count = 1;
-    Color reflect = material->reflect->getColor(hitPos);
-    for(int i = 0; i < scatter_ray_count; i++)
+    return continuePath(ray, hit, world, maxDepth, randomEngine, russianRouletteDepth, lights);
+}
+
+/** the same as <code>tracePath</code> starting from the already found boundary <code>hit</code> */
+template <typename T>
+inline Color continuePath(Ray ray, Hit hit, const Object &world, int maxDepth, T &randomEngine, int russianRouletteDepth, const LightList *lights)
+{
+    Color retval = Color(0, 0, 0);
+    PathState state;
+    for(int depth = 0; ; depth++)
     {
-        Vector3D reflectedRayDir = ray.dir.reflect(normal);
-        Vector3D resultingRayDir = reflectedRayDir;
-        if(scatter_coefficient > eps)
+        if(!scatterPath(ray, hit, depth, state, retval, maxDepth, randomEngine, russianRouletteDepth, lights))
         {
-            int count = 0;
-            do
-            {
-                count++;
-                assert(count <= 1000);
-                if(count > 1000)
-                {
-                    return retval;
-                }
-                resultingRayDir = Vector3D::rand(randomEngine, 1, 0);
-                resultingRayDir += (1 / scatter_coefficient - 1) * reflectedRayDir;
-            }
-            while(dot(normal, resultingRayDir) <= eps);
-            resultingRayDir = normalize(resultingRayDir);
+            break;
+        }
+        if(!world.firstHit(ray, eps, max_value, hit) || hit.t >= max_value)
+        {
+            break;
         }
-
-        float factor = 1 - (1 - dot(resultingRayDir, normal)) * scatter_coefficient;
-        Ray newRay = Ray(ray.getPoint(t), resultingRayDir);
-        retval += addFactor / scatter_ray_count * factor * reflect * traceRay(newRay, spanIterator, depth - 1, randomEngine, strength / scatter_ray_count * addFactor * factor * abs(reflect));
     }
     return retval;
 }
 
+/** selects how <code>tracePixel</code> estimates the light along each camera ray */
+enum Integrator
+{
+    RecursiveIntegrator, /// <code>traceRay</code> : branches into many rays at every hit
+    PathIntegrator /// <code>tracePath</code> : follows a single path per sample
+};
+
 const int DefaultSampleCount = 200;
 const float DefaultScreenWidth = 4.0 / 3.0;
 const float DefaultScreenHeight = 1.0;
 const float DefaultScreenDistance = 2.0;
 
 template <typename T>
-inline Color tracePixel(SpanIterator &spanIterator, float px, float py, float screenXResolution, float screenYResolution, int sampleCount = DefaultSampleCount, int rayDepth = DefaultRayDepth, float screenWidth = DefaultScreenWidth, float screenHeight = DefaultScreenHeight, float screenDistance = DefaultScreenDistance, T &randomEngine = defaultRandomEngine)
+inline Color tracePixel(SpanIterator &spanIterator, float px, float py, float screenXResolution, float screenYResolution, int sampleCount, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine)
 {
     float x = 2 * px / screenXResolution - 1;
     float y = 1 - 2 * py / screenYResolution;
@@ -187,12 +449,14 @@ inline Color tracePixel(SpanIterator &spanIterator, float px, float py, float sc
 template <typename T>
 inline Color tracePixel(SpanIterator &spanIterator, int px, int py, int screenXResolution, int screenYResolution, int sampleCount, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine)
 {
-    uniform_real_distribution<float> zeroToOne(0, 1);
     Color retval = Color(0, 0, 0);
     for(int i = 0; i < sampleCount; i++)
     {
-        float x = 2 * (px + zeroToOne(randomEngine)) / screenXResolution - 1;
-        float y = 1 - 2 * (py + zeroToOne(randomEngine)) / screenYResolution;
+        float jitterX, jitterY;
+        randomEngine.startPixelSample(px, py, i);
+        randomEngine.get2D(jitterX, jitterY);
+        float x = 2 * (px + jitterX) / screenXResolution - 1;
+        float y = 1 - 2 * (py + jitterY) / screenYResolution;
         Ray ray = Ray(Vector3D(0, 0, 0), Vector3D(x * screenWidth, y * screenHeight, -screenDistance));
         retval += traceRay(ray, spanIterator, rayDepth, randomEngine);
     }
@@ -202,7 +466,153 @@ inline Color tracePixel(SpanIterator &spanIterator, int px, int py, int screenXR
 
 inline Color tracePixel(SpanIterator &spanIterator, int px, int py, int screenXResolution, int screenYResolution, int sampleCount = DefaultSampleCount, int rayDepth = DefaultRayDepth, float screenWidth = DefaultScreenWidth, float screenHeight = DefaultScreenHeight, float screenDistance = DefaultScreenDistance)
 {
-    return tracePixel(spanIterator, px, py, screenXResolution, screenYResolution, sampleCount, rayDepth, screenWidth, screenHeight, screenDistance, defaultRandomEngine);
+    DefaultRandomEngine randomEngine;
+    return tracePixel(spanIterator, px, py, screenXResolution, screenYResolution, sampleCount, rayDepth, screenWidth, screenHeight, screenDistance, randomEngine);
+}
+
+/** the running mean and variance of the samples of a pixel, using Welford's algorithm */
+struct PixelStatistics
+{
+    int count;
+    Color mean;
+    Color sumSquaredDifferences; /// the sum of the squared differences from the mean of each channel
+    float luminanceMean, luminanceSumSquaredDifferences;
+    PixelStatistics()
+        : count(0), mean(0), sumSquaredDifferences(0), luminanceMean(0), luminanceSumSquaredDifferences(0)
+    {
+    }
+    void add(Color sample)
+    {
+        count++;
+        Color delta = sample - mean;
+        mean += delta / count;
+        sumSquaredDifferences += delta * (sample - mean);
+        float sampleLuminance = luminance(sample);
+        float luminanceDelta = sampleLuminance - luminanceMean;
+        luminanceMean += luminanceDelta / count;
+        luminanceSumSquaredDifferences += luminanceDelta * (sampleLuminance - luminanceMean);
+    }
+    /** @return the variance of the samples of each channel */
+    Color getVariance() const
+    {
+        if(count < 2)
+        {
+            return Color(0);
+        }
+        return sumSquaredDifferences / (count - 1);
+    }
+    /** @return the variance of <code>mean</code> as an estimate of the pixel's color */
+    Color getMeanVariance() const
+    {
+        if(count < 1)
+        {
+            return Color(0);
+        }
+        return getVariance() / count;
+    }
+    /** @return the estimated standard error of the mean luminance divided by the mean luminance
+     *
+     * @param minimumLuminance
+     *            the luminance to divide by for darker pixels, so they don't need a lot of samples */
+    float getRelativeError(float minimumLuminance) const
+    {
+        if(count < 2)
+        {
+            return max_value;
+        }
+        float meanVariance = luminanceSumSquaredDifferences / (count - 1) / count;
+        return std::sqrt(std::max(0.0f, meanVariance)) / std::max(minimumLuminance, std::abs(luminanceMean));
+    }
+};
+
+/** traces the samples <code>firstSample</code> to <code>firstSample + sampleCount - 1</code> of
+ * a pixel and adds their colors to <code>statistics</code>
+ * @see tracePixel(const Object &world, int px, int py, int screenXResolution, int screenYResolution, int sampleCount, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine, Integrator integrator, const LightList *lights) */
+template <typename T>
+inline void tracePixelSamples(const Object &world, int px, int py, int screenXResolution, int screenYResolution, int firstSample, int sampleCount, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine, Integrator integrator, const LightList *lights, PixelStatistics &statistics)
+{
+    // the primary rays are traced in packets, the rest of each path is traced one ray at a time
+    for(int packetStart = firstSample; packetStart < firstSample + sampleCount; packetStart += PacketSize)
+    {
+        int count = std::min(PacketSize, firstSample + sampleCount - packetStart);
+        Vector3D dirs[PacketSize];
+        for(int i = 0; i < count; i++)
+        {
+            float jitterX, jitterY;
+            randomEngine.startPixelSample(px, py, packetStart + i);
+            randomEngine.get2D(jitterX, jitterY);
+            float x = 2 * (px + jitterX) / screenXResolution - 1;
+            float y = 1 - 2 * (py + jitterY) / screenYResolution;
+            dirs[i] = Vector3D(x * screenWidth, y * screenHeight, -screenDistance);
+        }
+        HitPacket hits;
+        int hitBits = world.firstHitPacket(RayPacket(Vector3D(0, 0, 0), dirs, count), FloatPacket(eps), FloatPacket(max_value), hits).bits();
+        for(int i = 0; i < count; i++)
+        {
+            Hit hit;
+            if(((hitBits >> i) & 1) == 0 || (hit = hits.get(i)).t >= max_value)
+            {
+                statistics.add(Color(0, 0, 0));
+                continue;
+            }
+            Ray ray = Ray(Vector3D(0, 0, 0), dirs[i]);
+            randomEngine.startPixelSample(px, py, packetStart + i, PixelSampleDimensions);
+            if(integrator == PathIntegrator)
+            {
+                statistics.add(continuePath(ray, hit, world, rayDepth, randomEngine, DefaultRussianRouletteDepth, lights));
+            }
+            else
+            {
+                statistics.add(shadeHit(ray, hit, world, rayDepth, randomEngine, 1.0f));
+            }
+        }
+    }
+}
+
+template <typename T>
+inline Color tracePixel(const Object &world, int px, int py, int screenXResolution, int screenYResolution, int sampleCount, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine, Integrator integrator = RecursiveIntegrator, const LightList *lights = NULL)
+{
+    PixelStatistics statistics;
+    tracePixelSamples(world, px, py, screenXResolution, screenYResolution, 0, sampleCount, rayDepth, screenWidth, screenHeight, screenDistance, randomEngine, integrator, lights, statistics);
+    return statistics.mean;
+}
+
+/** pixels darker than this are sampled until the standard error is <code>relativeError</code> times this */
+const float AdaptiveMinimumLuminance = 0.01f;
+
+/** the same as <code>tracePixel</code> except that it keeps tracing samples until the relative
+ * standard error of the pixel's luminance is at most <code>relativeError</code>
+ *
+ * @param minSampleCount
+ *            the number of samples traced before checking the error
+ * @param maxSampleCount
+ *            the maximum number of samples
+ * @param statistics
+ *            if not <code>NULL</code> set to the statistics of the samples traced, for writing the variance and sample count of each pixel */
+template <typename T>
+inline Color tracePixelAdaptive(const Object &world, int px, int py, int screenXResolution, int screenYResolution, int minSampleCount, int maxSampleCount, float relativeError, int rayDepth, float screenWidth, float screenHeight, float screenDistance, T &randomEngine, Integrator integrator = RecursiveIntegrator, const LightList *lights = NULL, PixelStatistics *statistics = NULL)
+{
+    PixelStatistics localStatistics;
+    if(statistics == NULL)
+    {
+        statistics = &localStatistics;
+    }
+    *statistics = PixelStatistics();
+    int sampleCount = std::min(std::max(minSampleCount, 1), maxSampleCount);
+    tracePixelSamples(world, px, py, screenXResolution, screenYResolution, 0, sampleCount, rayDepth, screenWidth, screenHeight, screenDistance, randomEngine, integrator, lights, *statistics);
+    while(sampleCount < maxSampleCount && statistics->getRelativeError(AdaptiveMinimumLuminance) > relativeError)
+    {
+        int count = std::min(PacketSize, maxSampleCount - sampleCount);
+        tracePixelSamples(world, px, py, screenXResolution, screenYResolution, sampleCount, count, rayDepth, screenWidth, screenHeight, screenDistance, randomEngine, integrator, lights, *statistics);
+        sampleCount += count;
+    }
+    return statistics->mean;
+}
+
+inline Color tracePixel(const Object &world, int px, int py, int screenXResolution, int screenYResolution, int sampleCount = DefaultSampleCount, int rayDepth = DefaultRayDepth, float screenWidth = DefaultScreenWidth, float screenHeight = DefaultScreenHeight, float screenDistance = DefaultScreenDistance, Integrator integrator = RecursiveIntegrator, const LightList *lights = NULL)
+{
+    DefaultRandomEngine randomEngine;
+    return tracePixel(world, px, py, screenXResolution, screenYResolution, sampleCount, rayDepth, screenWidth, screenHeight, screenDistance, randomEngine, integrator, lights);
 }
 }
 
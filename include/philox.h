@@ -0,0 +1,136 @@
+#ifndef PHILOX_H_INCLUDED
+#define PHILOX_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace PathTrace
+{
+
+/** counter-based random number engine (Philox4x32-10).<br/>
+ * number <code>i</code> of a stream is a hash of the seed, the stream and
+ * <code>i</code>, so it doesn't depend on the numbers used before it :
+ * the streams can be started anywhere and <code>discard</code> doesn't need
+ * to generate the skipped numbers.<br/>
+ * each sample of each pixel has its own stream, picked with <code>startPixelSample</code>,
+ * so the result of a render doesn't depend on which thread or computer renders which pixel.<br/>
+ * it isn't thread safe, each thread should use its own engine.
+ */
+class PhiloxRandomEngine
+{
+public:
+    explicit PhiloxRandomEngine(unsigned seed = 0)
+    {
+        this->seed(seed);
+    }
+    static unsigned min()
+    {
+        return 0;
+    }
+    static unsigned max()
+    {
+        return 0xFFFFFFFF;
+    }
+    /** sets the seed, usually the frame number, and starts stream 0 */
+    void seed(unsigned newValue)
+    {
+        key = newValue;
+        startStream(0, 0, 0, 0);
+    }
+    /** starts the stream for the sample <code>sampleIndex</code> of pixel <code>(px, py)</code>
+     *
+     * @param dimension
+     *            the index of the first number to use in the stream */
+    void startPixelSample(int px, int py, unsigned sampleIndex, unsigned dimension = 0)
+    {
+        startStream((unsigned)px, (unsigned)py, sampleIndex, dimension);
+    }
+    /** @return the index in the current stream of the next number */
+    unsigned getDimension() const
+    {
+        return position;
+    }
+    unsigned operator()()
+    {
+        unsigned block = position >> 2;
+        if(block != bufferBlock)
+        {
+            generate(block, buffer);
+            bufferBlock = block;
+        }
+        return buffer[position++ & 3];
+    }
+    void discard(unsigned long long count)
+    {
+        position += (unsigned)count;
+    }
+    /// @return a random number in <code>[0, 1)</code>
+    float get1D()
+    {
+        return toFloat(operator()());
+    }
+    /// picks two random numbers in <code>[0, 1)</code>
+    void get2D(float &u1, float &u2)
+    {
+        u1 = get1D();
+        u2 = get1D();
+    }
+    /** sets <code>values[0]</code> to <code>values[count - 1]</code> to the next
+     * <code>count</code> numbers converted like <code>get1D</code>, generating
+     * several blocks at once with SIMD instructions when they're available */
+    void fill(float *values, size_t count);
+    static float toFloat(unsigned v)
+    {
+        return (v >> 8) * (1.0f / 16777216.0f);
+    }
+private:
+    void startStream(unsigned stream0, unsigned stream1, unsigned stream2, unsigned dimension)
+    {
+        stream[0] = stream0;
+        stream[1] = stream1;
+        stream[2] = stream2;
+        position = dimension;
+        bufferBlock = 0xFFFFFFFF;
+    }
+    static void mulhilo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo)
+    {
+        uint64_t product = (uint64_t)a * b;
+        hi = (uint32_t)(product >> 32);
+        lo = (uint32_t)product;
+    }
+    /** generates the 4 numbers of block <code>block</code> of the current stream */
+    void generate(unsigned block, uint32_t result[4]) const
+    {
+        uint32_t c0 = block, c1 = stream[0], c2 = stream[1], c3 = stream[2];
+        uint32_t k0 = key, k1 = Key1;
+        for(int round = 0; round < RoundCount; round++)
+        {
+            uint32_t hi0, lo0, hi1, lo1;
+            mulhilo(Multiplier0, c0, hi0, lo0);
+            mulhilo(Multiplier1, c2, hi1, lo1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += KeyIncrement0;
+            k1 += KeyIncrement1;
+        }
+        result[0] = c0;
+        result[1] = c1;
+        result[2] = c2;
+        result[3] = c3;
+    }
+    static const uint32_t Multiplier0 = 0xD2511F53, Multiplier1 = 0xCD9E8D57;
+    static const uint32_t KeyIncrement0 = 0x9E3779B9, KeyIncrement1 = 0xBB67AE85;
+    static const uint32_t Key1 = 0xA511E9B3; /// the second word of the key, the first is the seed
+    static const int RoundCount = 10;
+    uint32_t key;
+    uint32_t stream[3];
+    unsigned position; /// the index of the next number in the stream
+    unsigned bufferBlock; /// the block in <code>buffer</code>
+    uint32_t buffer[4];
+};
+
+}
+
+#endif // PHILOX_H_INCLUDED
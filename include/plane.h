@@ -6,17 +6,54 @@
 namespace PathTrace
 {
 
+/** intersects the line through <code>ray</code> with the half space behind a plane
+ * @return if the line is in the half space anywhere, <code>start</code> and <code>end</code> are set to where it is */
+inline bool intersectPlane(const Ray & ray, const Vector3D & normal, float d, float & start, float & end)
+{
+    float divisor = dot(ray.dir, normal);
+    float numerator = -d - dot(ray.origin, normal);
+    float t;
+    if(std::abs(divisor) < eps * eps || std::abs(t = numerator / divisor) >= max_value)
+    {
+        if(std::abs(numerator) < eps * eps)
+        {
+            start = -max_value;
+            end = max_value;
+            return true;
+        }
+        return false;
+    }
+    if(divisor < 0)
+    {
+        start = t;
+        end = max_value;
+    }
+    else
+    {
+        start = -max_value;
+        end = t;
+    }
+    return true;
+}
+
 class Plane : public Object
 {
 public:
     Plane(Vector3D normal, float d, const Material * material);
     Plane(Vector3D normal, Vector3D pos, const Material * material);
     virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual void getLights(std::vector<Light *> & lights) const;
     virtual ~Plane();
     virtual Object *duplicate() const
     {
         return new Plane(normal, d, material);
     }
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const;
+    virtual bool compile(CSGProgram & program) const;
 protected:
 private:
     const Vector3D normal;
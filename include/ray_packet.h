@@ -0,0 +1,141 @@
+#ifndef RAY_PACKET_H_INCLUDED
+#define RAY_PACKET_H_INCLUDED
+
+#include "simd.h"
+#include "vector3d.h"
+#include "ray.h"
+#include "transform.h"
+
+namespace PathTrace
+{
+
+/** <code>PacketSize</code> vectors stored as one <code>FloatPacket</code> per component */
+struct VectorPacket
+{
+    FloatPacket x, y, z;
+    VectorPacket()
+    {
+    }
+    VectorPacket(FloatPacket x, FloatPacket y, FloatPacket z)
+        : x(x), y(y), z(z)
+    {
+    }
+    /** makes a packet with <code>v</code> in every lane */
+    explicit VectorPacket(Vector3D v)
+        : x(v.x), y(v.y), z(v.z)
+    {
+    }
+    friend VectorPacket operator +(const VectorPacket & l, const VectorPacket & r)
+    {
+        return VectorPacket(l.x + r.x, l.y + r.y, l.z + r.z);
+    }
+    friend VectorPacket operator -(const VectorPacket & l, const VectorPacket & r)
+    {
+        return VectorPacket(l.x - r.x, l.y - r.y, l.z - r.z);
+    }
+    friend VectorPacket operator *(FloatPacket l, const VectorPacket & r)
+    {
+        return VectorPacket(l * r.x, l * r.y, l * r.z);
+    }
+    VectorPacket operator -() const
+    {
+        return VectorPacket(-x, -y, -z);
+    }
+    friend FloatPacket dot(const VectorPacket & l, const VectorPacket & r)
+    {
+        return l.x * r.x + l.y * r.y + l.z * r.z;
+    }
+    friend VectorPacket normalize(const VectorPacket & v)
+    {
+        FloatPacket magnitude = sqrt(dot(v, v));
+        magnitude = select(magnitude == FloatPacket(0.0f), FloatPacket(1.0f), magnitude);
+        return (FloatPacket(1.0f) / magnitude) * v;
+    }
+    friend VectorPacket select(MaskPacket mask, const VectorPacket & ifTrue, const VectorPacket & ifFalse)
+    {
+        return VectorPacket(select(mask, ifTrue.x, ifFalse.x), select(mask, ifTrue.y, ifFalse.y), select(mask, ifTrue.z, ifFalse.z));
+    }
+    Vector3D get(int i) const
+    {
+        return Vector3D(lane(x, i), lane(y, i), lane(z, i));
+    }
+};
+
+/** <code>PacketSize</code> rays traced together<br/>
+ * rays in lanes that aren't set in <code>active</code> are ignored */
+struct RayPacket
+{
+    VectorPacket origin;
+    VectorPacket dir;
+    MaskPacket active;
+    RayPacket()
+    {
+    }
+    /** makes a packet of <code>count</code> rays starting at <code>origin</code>, <code>1 <= count <= PacketSize</code>.<br/>
+     * the remaining lanes are filled with copies of the last ray and marked inactive */
+    RayPacket(Vector3D origin, const Vector3D dirs[], int count)
+        : origin(origin)
+    {
+        float values[3][PacketSize];
+        for(int i = 0; i < PacketSize; i++)
+        {
+            const Vector3D & dir = dirs[std::min(i, count - 1)];
+            values[0][i] = dir.x;
+            values[1][i] = dir.y;
+            values[2][i] = dir.z;
+        }
+        dir = VectorPacket(FloatPacket::load(values[0]), FloatPacket::load(values[1]), FloatPacket::load(values[2]));
+        active = MaskPacket::fromBits((1 << count) - 1);
+    }
+    /** makes a packet of the <code>count</code> rays stored as one array per component, <code>1 <= count <= PacketSize</code>.<br/>
+     * the remaining lanes are filled with copies of the last ray and marked inactive */
+    RayPacket(const float * originX, const float * originY, const float * originZ, const float * dirX, const float * dirY, const float * dirZ, int count)
+    {
+        const float * arrays[6] = {originX, originY, originZ, dirX, dirY, dirZ};
+        float values[6][PacketSize];
+        for(int j = 0; j < 6; j++)
+        {
+            for(int i = 0; i < PacketSize; i++)
+            {
+                values[j][i] = arrays[j][std::min(i, count - 1)];
+            }
+        }
+        origin = VectorPacket(FloatPacket::load(values[0]), FloatPacket::load(values[1]), FloatPacket::load(values[2]));
+        dir = VectorPacket(FloatPacket::load(values[3]), FloatPacket::load(values[4]), FloatPacket::load(values[5]));
+        active = MaskPacket::fromBits((1 << count) - 1);
+    }
+    Ray get(int i) const
+    {
+        return Ray(origin.get(i), dir.get(i));
+    }
+    VectorPacket getPoint(FloatPacket t) const
+    {
+        return origin + t * dir;
+    }
+};
+
+inline VectorPacket apply(const Matrix & m, const VectorPacket & v)
+{
+    return VectorPacket(v.x * FloatPacket(m.x00) + v.y * FloatPacket(m.x10) + v.z * FloatPacket(m.x20) + FloatPacket(m.x30),
+                        v.x * FloatPacket(m.x01) + v.y * FloatPacket(m.x11) + v.z * FloatPacket(m.x21) + FloatPacket(m.x31),
+                        v.x * FloatPacket(m.x02) + v.y * FloatPacket(m.x12) + v.z * FloatPacket(m.x22) + FloatPacket(m.x32));
+}
+
+inline VectorPacket applyNoTranslate(const Matrix & m, const VectorPacket & v)
+{
+    return VectorPacket(v.x * FloatPacket(m.x00) + v.y * FloatPacket(m.x10) + v.z * FloatPacket(m.x20),
+                        v.x * FloatPacket(m.x01) + v.y * FloatPacket(m.x11) + v.z * FloatPacket(m.x21),
+                        v.x * FloatPacket(m.x02) + v.y * FloatPacket(m.x12) + v.z * FloatPacket(m.x22));
+}
+
+inline RayPacket transform(const Matrix & m, const RayPacket & rays)
+{
+    RayPacket retval = rays;
+    retval.origin = apply(m, rays.origin);
+    retval.dir = applyNoTranslate(m, rays.dir);
+    return retval;
+}
+
+}
+
+#endif // RAY_PACKET_H_INCLUDED
@@ -0,0 +1,49 @@
+#ifndef REFERENCE_COUNTED_H_INCLUDED
+#define REFERENCE_COUNTED_H_INCLUDED
+
+#include "atomic.h"
+
+namespace PathTrace
+{
+
+/** base class for immutable data shared by reference counting.<br/>
+ * the count includes every reference : the code that makes the object holds the first one,
+ * <code>addReference</code> adds another one and <code>removeReference</code> removes one,
+ * deleting the object with the last one. so it must not be deleted directly. */
+class ReferenceCounted
+{
+public:
+    ReferenceCounted()
+        : referenceCount(1)
+    {
+    }
+    void addReference() const
+    {
+        referenceCount++;
+    }
+    /** removes a reference, deleting this object if it was the last one */
+    void removeReference() const
+    {
+        if(--referenceCount == 0)
+        {
+            delete this;
+        }
+    }
+    /** @return if there are other references to this object, so it can't be changed */
+    bool isShared() const
+    {
+        return referenceCount != 1;
+    }
+protected:
+    virtual ~ReferenceCounted()
+    {
+    }
+private:
+    mutable atomic_uint referenceCount;
+    ReferenceCounted(const ReferenceCounted & rt); // not implemented
+    const ReferenceCounted & operator =(const ReferenceCounted & rt); // not implemented
+};
+
+}
+
+#endif // REFERENCE_COUNTED_H_INCLUDED
@@ -0,0 +1,118 @@
+#ifndef SAMPLER_H_INCLUDED
+#define SAMPLER_H_INCLUDED
+
+#include <cstddef>
+
+namespace PathTrace
+{
+
+/** makes the random numbers for the samples of each pixel.<br/>
+ * every sample of a pixel is a point in a space with one dimension for every
+ * random number used along its path : the first two are the position in the
+ * pixel, the rest are used for picking scatter directions, lights, ...<br/>
+ * the values only depend on the seed, the pixel, the sample index and the
+ * dimension so the samples of a pixel cover the space more evenly than
+ * independent random numbers.<br/>
+ * it can also be used like a random number engine, then each number is the next dimension.
+ */
+class Sampler
+{
+public:
+    virtual ~Sampler()
+    {
+    }
+    /** starts the sample <code>sampleIndex</code> of pixel <code>(px, py)</code>
+     *
+     * @param dimension
+     *            the first dimension to use */
+    void startPixelSample(int px, int py, unsigned sampleIndex, unsigned dimension = 0);
+    /** @return the next dimension, in <code>[0, 1)</code> */
+    float get1D()
+    {
+        float retval = sample1D(dimension);
+        dimension++;
+        return retval;
+    }
+    /** gets the next two dimensions, each in <code>[0, 1)</code>.<br/>
+     * the pairs are spread evenly together, use this for points on a surface or directions */
+    void get2D(float &u1, float &u2)
+    {
+        sample2D(dimension, u1, u2);
+        dimension += 2;
+    }
+    static unsigned min()
+    {
+        return 0;
+    }
+    static unsigned max()
+    {
+        return 0xFFFFFFFF;
+    }
+    unsigned operator()()
+    {
+        return (unsigned)(get1D() * 4294967296.0);
+    }
+protected:
+    explicit Sampler(unsigned seed)
+        : seed(seed), pixelSeed(seed), sampleIndex(0), dimension(0)
+    {
+    }
+    virtual float sample1D(unsigned dimension) const = 0;
+    virtual void sample2D(unsigned dimension, float &u1, float &u2) const = 0;
+    /** @return a hash of the seed, the current pixel and <code>dimension</code> */
+    unsigned getDimensionSeed(unsigned dimension) const;
+    unsigned getSampleIndex() const
+    {
+        return sampleIndex;
+    }
+    /** @return a random number in <code>[0, 1)</code> depending on the current pixel, sample and <code>dimension</code> */
+    float getRandom(unsigned dimension) const;
+private:
+    const unsigned seed;
+    unsigned pixelSeed;
+    unsigned sampleIndex, dimension;
+};
+
+/** jittered sampling : each dimension is split into <code>sampleCount</code> strata
+ * and each pair of dimensions into a grid of about <code>sampleCount</code> cells,
+ * the samples of a pixel are assigned to the strata in a random order */
+class StratifiedSampler : public Sampler
+{
+public:
+    StratifiedSampler(unsigned sampleCount, unsigned seed = 0);
+protected:
+    virtual float sample1D(unsigned dimension) const;
+    virtual void sample2D(unsigned dimension, float &u1, float &u2) const;
+private:
+    const unsigned sampleCount;
+    unsigned gridWidth, gridHeight;
+};
+
+/** the Halton sequence with the digits shuffled differently for each pixel and dimension.<br/>
+ * dimensions after the first <code>HaltonSampler::DimensionCount</code> are random */
+class HaltonSampler : public Sampler
+{
+public:
+    explicit HaltonSampler(unsigned seed = 0);
+    static const unsigned DimensionCount = 64;
+protected:
+    virtual float sample1D(unsigned dimension) const;
+    virtual void sample2D(unsigned dimension, float &u1, float &u2) const;
+};
+
+/** Owen scrambled Sobol points.<br/>
+ * each 1D or 2D request uses the first one or two dimensions of the Sobol sequence
+ * with the order of the samples shuffled differently for each pixel and dimension,
+ * so the pairs keep the stratification of the 2D Sobol points */
+class SobolSampler : public Sampler
+{
+public:
+    explicit SobolSampler(unsigned seed = 0);
+protected:
+    virtual float sample1D(unsigned dimension) const;
+    virtual void sample2D(unsigned dimension, float &u1, float &u2) const;
+};
+
+}
+
+#endif // SAMPLER_H_INCLUDED
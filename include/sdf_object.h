@@ -0,0 +1,54 @@
+#ifndef SDF_OBJECT_H
+#define SDF_OBJECT_H
+
+#include "object.h"
+#include "distance_function.h"
+
+namespace PathTrace
+{
+
+/** a shape given by a signed distance function, found by sphere tracing : rays step forward by the
+ * distance divided by the Lipschitz bound so they can't step over the surface, then each crossing is
+ * refined by bisection.<br/>
+ * rays are clipped to <code>bounds</code> before they are traced and the shape is cut off by it too,
+ * with the normals of the box where it is cut.
+ * features thinner than <code>tolerance</code> can be missed. */
+class SDFObject : public Object
+{
+public:
+    /** @param f
+     *            the distance function, the object owns it
+     * @param bounds
+     *            a finite box around the shape
+     * @param lipschitz
+     *            the most <code>f</code> can change per unit distance, 1 for exact distances
+     * @param tolerance
+     *            the shortest step taken along a ray */
+    SDFObject(DistanceFunction * f, const BoundingBox & bounds, const Material * material, float lipschitz = 1, float tolerance = 1e-4f);
+    virtual ~SDFObject();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual Object *duplicate() const
+    {
+        return new SDFObject(f->duplicate(), bounds, material, lipschitz, tolerance);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return bounds;
+    }
+    /** @return the outward facing normal at <code>position</code> from the gradient of the distance function, not normalized */
+    Vector3D getNormal(Vector3D position) const;
+    static const int MaxSteps = 1024; /// the most steps taken to find each boundary
+    static const int RefineSteps = 24; /// the number of bisection steps for each boundary
+private:
+    VectorPacket getNormal(const VectorPacket & position) const;
+    DistanceFunction * f;
+    BoundingBox bounds;
+    const Material * material;
+    float lipschitz, tolerance;
+};
+
+}
+
+#endif // SDF_OBJECT_H
@@ -0,0 +1,474 @@
+#ifndef SIMD_H_INCLUDED
+#define SIMD_H_INCLUDED
+
+#include "misc.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PATH_TRACE_SIMD_AVX
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define PATH_TRACE_SIMD_SSE
+#endif
+
+namespace PathTrace
+{
+
+/** number of lanes in <code>FloatPacket</code> and <code>MaskPacket</code> */
+#ifdef PATH_TRACE_SIMD_AVX
+const int PacketSize = 8;
+#else
+const int PacketSize = 4;
+#endif
+
+#if defined(PATH_TRACE_SIMD_AVX)
+
+/** per lane boolean produced by comparing <code>FloatPacket</code>s */
+class MaskPacket
+{
+public:
+    __m256 v;
+    MaskPacket()
+    {
+    }
+    MaskPacket(__m256 v)
+        : v(v)
+    {
+    }
+    explicit MaskPacket(bool value)
+        : v(_mm256_castsi256_ps(_mm256_set1_epi32(value ? -1 : 0)))
+    {
+    }
+    /** @return the mask with lane <code>i</code> set if bit <code>i</code> of <code>bits</code> is set */
+    static MaskPacket fromBits(int bits)
+    {
+        return MaskPacket(_mm256_castsi256_ps(_mm256_set_epi32(-((bits >> 7) & 1), -((bits >> 6) & 1), -((bits >> 5) & 1), -((bits >> 4) & 1),
+                                                               -((bits >> 3) & 1), -((bits >> 2) & 1), -((bits >> 1) & 1), -(bits & 1))));
+    }
+    int bits() const
+    {
+        return _mm256_movemask_ps(v);
+    }
+    friend MaskPacket operator &(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm256_and_ps(l.v, r.v));
+    }
+    friend MaskPacket operator |(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm256_or_ps(l.v, r.v));
+    }
+    friend MaskPacket operator ^(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm256_xor_ps(l.v, r.v));
+    }
+    MaskPacket operator ~() const
+    {
+        return *this ^ MaskPacket(true);
+    }
+};
+
+/** <code>PacketSize</code> floats operated on at once */
+class FloatPacket
+{
+public:
+    __m256 v;
+    FloatPacket()
+    {
+    }
+    FloatPacket(__m256 v)
+        : v(v)
+    {
+    }
+    FloatPacket(float value)
+        : v(_mm256_set1_ps(value))
+    {
+    }
+    static FloatPacket load(const float * values)
+    {
+        return FloatPacket(_mm256_loadu_ps(values));
+    }
+    void store(float * values) const
+    {
+        _mm256_storeu_ps(values, v);
+    }
+    friend FloatPacket operator +(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_add_ps(l.v, r.v));
+    }
+    friend FloatPacket operator -(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_sub_ps(l.v, r.v));
+    }
+    friend FloatPacket operator *(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_mul_ps(l.v, r.v));
+    }
+    friend FloatPacket operator /(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_div_ps(l.v, r.v));
+    }
+    FloatPacket operator -() const
+    {
+        return FloatPacket(_mm256_xor_ps(v, _mm256_set1_ps(-0.0f)));
+    }
+    friend FloatPacket sqrt(FloatPacket v)
+    {
+        return FloatPacket(_mm256_sqrt_ps(v.v));
+    }
+    friend FloatPacket abs(FloatPacket v)
+    {
+        return FloatPacket(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), v.v));
+    }
+    friend FloatPacket min(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_min_ps(l.v, r.v));
+    }
+    friend FloatPacket max(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm256_max_ps(l.v, r.v));
+    }
+    friend MaskPacket operator <(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_LT_OQ));
+    }
+    friend MaskPacket operator <=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_LE_OQ));
+    }
+    friend MaskPacket operator >(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_GT_OQ));
+    }
+    friend MaskPacket operator >=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_GE_OQ));
+    }
+    friend MaskPacket operator ==(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_EQ_OQ));
+    }
+    friend MaskPacket operator !=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm256_cmp_ps(l.v, r.v, _CMP_NEQ_UQ));
+    }
+    /** @return <code>ifTrue</code> in the lanes set in <code>mask</code> and <code>ifFalse</code> in the other lanes */
+    friend FloatPacket select(MaskPacket mask, FloatPacket ifTrue, FloatPacket ifFalse)
+    {
+        return FloatPacket(_mm256_blendv_ps(ifFalse.v, ifTrue.v, mask.v));
+    }
+};
+
+#elif defined(PATH_TRACE_SIMD_SSE)
+
+/** per lane boolean produced by comparing <code>FloatPacket</code>s */
+class MaskPacket
+{
+public:
+    __m128 v;
+    MaskPacket()
+    {
+    }
+    MaskPacket(__m128 v)
+        : v(v)
+    {
+    }
+    explicit MaskPacket(bool value)
+        : v(value ? _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps()) : _mm_setzero_ps())
+    {
+    }
+    /** @return the mask with lane <code>i</code> set if bit <code>i</code> of <code>bits</code> is set */
+    static MaskPacket fromBits(int bits)
+    {
+        return MaskPacket(_mm_cmpneq_ps(_mm_set_ps((float)((bits >> 3) & 1), (float)((bits >> 2) & 1), (float)((bits >> 1) & 1), (float)(bits & 1)), _mm_setzero_ps()));
+    }
+    int bits() const
+    {
+        return _mm_movemask_ps(v);
+    }
+    friend MaskPacket operator &(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm_and_ps(l.v, r.v));
+    }
+    friend MaskPacket operator |(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm_or_ps(l.v, r.v));
+    }
+    friend MaskPacket operator ^(MaskPacket l, MaskPacket r)
+    {
+        return MaskPacket(_mm_xor_ps(l.v, r.v));
+    }
+    MaskPacket operator ~() const
+    {
+        return *this ^ MaskPacket(true);
+    }
+};
+
+/** <code>PacketSize</code> floats operated on at once */
+class FloatPacket
+{
+public:
+    __m128 v;
+    FloatPacket()
+    {
+    }
+    FloatPacket(__m128 v)
+        : v(v)
+    {
+    }
+    FloatPacket(float value)
+        : v(_mm_set1_ps(value))
+    {
+    }
+    static FloatPacket load(const float * values)
+    {
+        return FloatPacket(_mm_loadu_ps(values));
+    }
+    void store(float * values) const
+    {
+        _mm_storeu_ps(values, v);
+    }
+    friend FloatPacket operator +(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_add_ps(l.v, r.v));
+    }
+    friend FloatPacket operator -(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_sub_ps(l.v, r.v));
+    }
+    friend FloatPacket operator *(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_mul_ps(l.v, r.v));
+    }
+    friend FloatPacket operator /(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_div_ps(l.v, r.v));
+    }
+    FloatPacket operator -() const
+    {
+        return FloatPacket(_mm_xor_ps(v, _mm_set1_ps(-0.0f)));
+    }
+    friend FloatPacket sqrt(FloatPacket v)
+    {
+        return FloatPacket(_mm_sqrt_ps(v.v));
+    }
+    friend FloatPacket abs(FloatPacket v)
+    {
+        return FloatPacket(_mm_andnot_ps(_mm_set1_ps(-0.0f), v.v));
+    }
+    friend FloatPacket min(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_min_ps(l.v, r.v));
+    }
+    friend FloatPacket max(FloatPacket l, FloatPacket r)
+    {
+        return FloatPacket(_mm_max_ps(l.v, r.v));
+    }
+    friend MaskPacket operator <(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmplt_ps(l.v, r.v));
+    }
+    friend MaskPacket operator <=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmple_ps(l.v, r.v));
+    }
+    friend MaskPacket operator >(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmpgt_ps(l.v, r.v));
+    }
+    friend MaskPacket operator >=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmpge_ps(l.v, r.v));
+    }
+    friend MaskPacket operator ==(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmpeq_ps(l.v, r.v));
+    }
+    friend MaskPacket operator !=(FloatPacket l, FloatPacket r)
+    {
+        return MaskPacket(_mm_cmpneq_ps(l.v, r.v));
+    }
+    /** @return <code>ifTrue</code> in the lanes set in <code>mask</code> and <code>ifFalse</code> in the other lanes */
+    friend FloatPacket select(MaskPacket mask, FloatPacket ifTrue, FloatPacket ifFalse)
+    {
+        return FloatPacket(_mm_or_ps(_mm_and_ps(mask.v, ifTrue.v), _mm_andnot_ps(mask.v, ifFalse.v)));
+    }
+};
+
+#else
+
+/** per lane boolean produced by comparing <code>FloatPacket</code>s */
+class MaskPacket
+{
+public:
+    bool v[PacketSize];
+    MaskPacket()
+    {
+    }
+    explicit MaskPacket(bool value)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            v[i] = value;
+    }
+    /** @return the mask with lane <code>i</code> set if bit <code>i</code> of <code>bits</code> is set */
+    static MaskPacket fromBits(int bits)
+    {
+        MaskPacket retval;
+        for(int i = 0; i < PacketSize; i++)
+            retval.v[i] = ((bits >> i) & 1) != 0;
+        return retval;
+    }
+    int bits() const
+    {
+        int retval = 0;
+        for(int i = 0; i < PacketSize; i++)
+            if(v[i])
+                retval |= 1 << i;
+        return retval;
+    }
+    friend MaskPacket operator &(MaskPacket l, MaskPacket r)
+    {
+        return fromBits(l.bits() & r.bits());
+    }
+    friend MaskPacket operator |(MaskPacket l, MaskPacket r)
+    {
+        return fromBits(l.bits() | r.bits());
+    }
+    friend MaskPacket operator ^(MaskPacket l, MaskPacket r)
+    {
+        return fromBits(l.bits() ^ r.bits());
+    }
+    MaskPacket operator ~() const
+    {
+        return *this ^ MaskPacket(true);
+    }
+};
+
+/** <code>PacketSize</code> floats operated on at once */
+class FloatPacket
+{
+public:
+    float v[PacketSize];
+    FloatPacket()
+    {
+    }
+    FloatPacket(float value)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            v[i] = value;
+    }
+    static FloatPacket load(const float * values)
+    {
+        FloatPacket retval;
+        for(int i = 0; i < PacketSize; i++)
+            retval.v[i] = values[i];
+        return retval;
+    }
+    void store(float * values) const
+    {
+        for(int i = 0; i < PacketSize; i++)
+            values[i] = v[i];
+    }
+#define PATH_TRACE_SIMD_BINARY_OPERATOR(op) \
+    friend FloatPacket operator op(FloatPacket l, FloatPacket r) \
+    { \
+        FloatPacket retval; \
+        for(int i = 0; i < PacketSize; i++) \
+            retval.v[i] = l.v[i] op r.v[i]; \
+        return retval; \
+    }
+#define PATH_TRACE_SIMD_COMPARE_OPERATOR(op) \
+    friend MaskPacket operator op(FloatPacket l, FloatPacket r) \
+    { \
+        MaskPacket retval; \
+        for(int i = 0; i < PacketSize; i++) \
+            retval.v[i] = l.v[i] op r.v[i]; \
+        return retval; \
+    }
+    PATH_TRACE_SIMD_BINARY_OPERATOR(+)
+    PATH_TRACE_SIMD_BINARY_OPERATOR(-)
+    PATH_TRACE_SIMD_BINARY_OPERATOR(*)
+    PATH_TRACE_SIMD_BINARY_OPERATOR(/)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(<)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(<=)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(>)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(>=)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(==)
+    PATH_TRACE_SIMD_COMPARE_OPERATOR(!=)
+#undef PATH_TRACE_SIMD_BINARY_OPERATOR
+#undef PATH_TRACE_SIMD_COMPARE_OPERATOR
+    FloatPacket operator -() const
+    {
+        return FloatPacket(0.0f) - *this;
+    }
+    friend FloatPacket sqrt(FloatPacket v)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            v.v[i] = std::sqrt(v.v[i]);
+        return v;
+    }
+    friend FloatPacket abs(FloatPacket v)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            v.v[i] = std::fabs(v.v[i]);
+        return v;
+    }
+    friend FloatPacket min(FloatPacket l, FloatPacket r)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            l.v[i] = std::min(l.v[i], r.v[i]);
+        return l;
+    }
+    friend FloatPacket max(FloatPacket l, FloatPacket r)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            l.v[i] = std::max(l.v[i], r.v[i]);
+        return l;
+    }
+    /** @return <code>ifTrue</code> in the lanes set in <code>mask</code> and <code>ifFalse</code> in the other lanes */
+    friend FloatPacket select(MaskPacket mask, FloatPacket ifTrue, FloatPacket ifFalse)
+    {
+        for(int i = 0; i < PacketSize; i++)
+            if(mask.v[i])
+                ifFalse.v[i] = ifTrue.v[i];
+        return ifFalse;
+    }
+};
+
+#endif
+
+inline bool any(MaskPacket mask)
+{
+    return mask.bits() != 0;
+}
+
+inline bool all(MaskPacket mask)
+{
+    return mask.bits() == (1 << PacketSize) - 1;
+}
+
+inline bool lane(MaskPacket mask, int i)
+{
+    return ((mask.bits() >> i) & 1) != 0;
+}
+
+inline float lane(FloatPacket v, int i)
+{
+    float values[PacketSize];
+    v.store(values);
+    return values[i];
+}
+
+inline FloatPacket nextFloatUp(FloatPacket v)
+{
+    float values[PacketSize];
+    v.store(values);
+    for(int i = 0; i < PacketSize; i++)
+        values[i] = nextFloatUp(values[i]);
+    return FloatPacket::load(values);
+}
+
+}
+
+#endif // SIMD_H_INCLUDED
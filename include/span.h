@@ -9,60 +9,42 @@
 namespace PathTrace
 {
 
-class Span
+class SpanIterator;
+
+/** a boundary of a <code>Span</code>.<br/>
+ * only the primitive that made the boundary is kept, the normal and material are calculated
+ * by <code>getNormal</code> and <code>getMaterial</code> for the boundaries that are actually used */
+struct SpanBoundary
+{
+    static const unsigned ReversedNormal = 0x80000000U;
+    const SpanIterator * source; /// the iterator of the primitive that made this boundary
+    unsigned index; /// which boundary of <code>source</code>, with <code>ReversedNormal</code> set if the normal is reversed
+
+    /** @return this boundary with the normal reversed */
+    SpanBoundary reversed() const
+    {
+        SpanBoundary retval = *this;
+        retval.index ^= ReversedNormal;
+        return retval;
+    }
+    /** calculates the outward facing normal in the space of the ray passed to the iterator that returned this boundary
+     *
+     * @param t
+     *            the ray parameter of this boundary
+     * @return the normalized normal */
+    Vector3D getNormal(float t) const;
+    const Material * getMaterial() const;
+};
+
+/** a part of a ray that is inside of an object.<br/>
+ * only the ray parameters and the boundaries are stored so copying and merging spans is cheap,
+ * the boundaries are only valid until the iterators that made them are initialized again */
+struct Span
 {
-public:
     float start;
-    Vector3D startNormal;
-    const Material * startMaterial;
     float end;
-    Vector3D endNormal;
-    const Material * endMaterial;
-
-    Span()
-    {
-        start = 0;
-        startNormal = Vector3D(0, 0, 0);
-        startMaterial = NULL;
-        end = 0;
-        endNormal = Vector3D(0, 0, 0);
-        endMaterial = NULL;
-    }
-
-    Span(float start, Vector3D startNormal, const Material * startMaterial, float end, Vector3D endNormal, const Material * endMaterial)
-    {
-        this->start = start;
-        this->startNormal = startNormal;
-        this->startMaterial = startMaterial;
-        this->end = end;
-        this->endNormal = endNormal;
-        this->endMaterial = endMaterial;
-    }
-
-    virtual ~Span()
-    {
-    }
-
-    Span(const Span & rt)
-    {
-        start = rt.start;
-        startNormal = rt.startNormal;
-        startMaterial = rt.startMaterial;
-        end = rt.end;
-        endNormal = rt.endNormal;
-        endMaterial = rt.endMaterial;
-    }
-
-    const Span & operator =(const Span & rt)
-    {
-        start = rt.start;
-        startNormal = rt.startNormal;
-        startMaterial = rt.startMaterial;
-        end = rt.end;
-        endNormal = rt.endNormal;
-        endMaterial = rt.endMaterial;
-        return *this;
-    }
+    SpanBoundary startBoundary;
+    SpanBoundary endBoundary;
 
     bool isEmpty() const
     {
@@ -93,38 +75,47 @@ public:
     void copyStartFromStart(const Span & span)
     {
         start = span.start;
-        startMaterial = span.startMaterial;
-        startNormal = span.startNormal;
+        startBoundary = span.startBoundary;
     }
 
     void copyEndFromStart(const Span & span)
     {
         end = span.start;
-        endMaterial = span.startMaterial;
-        endNormal = -span.startNormal;
+        endBoundary = span.startBoundary.reversed();
     }
 
     void copyStartFromEnd(const Span & span)
     {
         start = span.end;
-        startMaterial = span.endMaterial;
-        startNormal = -span.endNormal;
+        startBoundary = span.endBoundary.reversed();
     }
 
     void copyEndFromEnd(const Span & span)
     {
         end = span.end;
-        endMaterial = span.endMaterial;
-        endNormal = span.endNormal;
+        endBoundary = span.endBoundary;
     }
-};
 
-inline Span transform(const Matrix &m, Span span)
-{
-    span.startNormal = normalize(m.applyNoTranslate(span.startNormal));
-    span.endNormal = normalize(m.applyNoTranslate(span.endNormal));
-    return span;
-}
+    Vector3D getStartNormal() const
+    {
+        return startBoundary.getNormal(start);
+    }
+
+    Vector3D getEndNormal() const
+    {
+        return endBoundary.getNormal(end);
+    }
+
+    const Material * getStartMaterial() const
+    {
+        return startBoundary.getMaterial();
+    }
+
+    const Material * getEndMaterial() const
+    {
+        return endBoundary.getMaterial();
+    }
+};
 
 class SpanIterator
 {
@@ -160,16 +151,72 @@ public:
         return *this;
     }
 
+    /** calculates the normal of a boundary made by this iterator in the space of the ray passed
+     * to the outermost iterator
+     *
+     * @param index
+     *            the boundary, without <code>SpanBoundary::ReversedNormal</code>
+     * @param t
+     *            the ray parameter of the boundary
+     * @return the normal, not normalized */
+    Vector3D getBoundaryNormal(unsigned index, float t) const
+    {
+        Vector3D normal = getLocalNormal(index, t);
+        for(const SpanIterator * iterator = parent; iterator != NULL; iterator = iterator->parent)
+        {
+            normal = iterator->transformNormal(normal);
+        }
+        return normal;
+    }
+
+    /** @return the material of a boundary made by this iterator, the default implementation returns NULL */
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return NULL;
+    }
 
 protected:
     SpanIterator()
+        : parent(NULL)
+    {
+    }
+    /** calculates the normal of a boundary made by this iterator in the space of the ray passed to
+     * <code>init</code>, only called for the boundaries in the spans this iterator makes.<br/>
+     * the default implementation returns a zero vector
+     *
+     * @return the outward facing normal, it doesn't have to be normalized */
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return Vector3D(0, 0, 0);
+    }
+    /** converts a normal from the space of the rays passed to the child iterators to the space
+     * of the ray passed to this iterator, the default implementation returns <code>normal</code> */
+    virtual Vector3D transformNormal(Vector3D normal) const
+    {
+        return normal;
+    }
+    /** makes <code>child</code> use the transforms of this iterator and its parents for its normals */
+    void adopt(SpanIterator * child)
     {
+        child->parent = this;
     }
 private:
+    const SpanIterator * parent;
     SpanIterator(const SpanIterator & rt); // not implemented
     const SpanIterator & operator =(const SpanIterator & rt); // not implemented
 };
 
+inline Vector3D SpanBoundary::getNormal(float t) const
+{
+    Vector3D normal = normalize(source->getBoundaryNormal(index & ~ReversedNormal, t));
+    return (index & ReversedNormal) ? -normal : normal;
+}
+
+inline const Material * SpanBoundary::getMaterial() const
+{
+    return source->getMaterial(index & ~ReversedNormal);
+}
+
 }
 
 #endif // SPAN_H
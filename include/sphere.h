@@ -6,16 +6,46 @@
 namespace PathTrace
 {
 
+/** intersects the line through <code>ray</code> with a sphere
+ * @return if the line goes through the sphere, <code>start</code> and <code>end</code> are set to where it enters and leaves */
+inline bool intersectSphere(const Ray & ray, const Vector3D & center, float r_squared, float & start, float & end)
+{
+    Vector3D origin_minus_center = ray.origin - center;
+    float a = abs_squared(ray.dir);
+    float b = dot(origin_minus_center, ray.dir);
+    float c = dot(origin_minus_center, origin_minus_center) - r_squared;
+    float sqrt_arg = b * b - a * c;
+    if(sqrt_arg <= eps)
+    {
+        return false;
+    }
+    float sqrt_v = std::sqrt(sqrt_arg);
+    start = (-b - sqrt_v) / a;
+    end = (-b + sqrt_v) / a;
+    return true;
+}
+
 class Sphere : public Object
 {
 public:
     Sphere(Vector3D center, float r, const Material * material);
     virtual ~Sphere();
     virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual void getLights(std::vector<Light *> & lights) const;
     virtual Object *duplicate() const
     {
         return new Sphere(center, r, material);
     }
+    /** @return the transformed sphere or NULL if <code>m</code> isn't a similarity transform */
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const
+    {
+        return BoundingBox(center - Vector3D(r), center + Vector3D(r));
+    }
+    virtual bool compile(CSGProgram & program) const;
 protected:
 private:
     Vector3D center;
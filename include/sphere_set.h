@@ -0,0 +1,57 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "object.h"
+#include <vector>
+#include <stdint.h>
+
+namespace PathTrace
+{
+
+struct SphereSetData;
+
+/** the union of many spheres, for particles and point clouds.<br/>
+ * the centers, radii and material indices are stored in separate arrays and the spheres have their own
+ * bounding volume hierarchy with up to <code>PacketSize</code> spheres in each leaf, so a leaf is
+ * intersected with one SIMD test. the overlapping spheres are merged into one span.<br/>
+ * the spheres are shared by the copies made by <code>duplicate</code>.
+ * emissive spheres aren't added to the light list. */
+class SphereSet : public Object
+{
+public:
+    typedef uint16_t MaterialIndex;
+    /** makes a set with one material for all the spheres
+     *
+     * @param centers
+     *            the center of each sphere
+     * @param radii
+     *            the radius of each sphere */
+    SphereSet(const std::vector<Vector3D> & centers, const std::vector<float> & radii, const Material * material);
+    /** makes a set with a material for each sphere
+     *
+     * @param centers
+     *            the center of each sphere
+     * @param radii
+     *            the radius of each sphere
+     * @param materials
+     *            the materials used by the spheres
+     * @param materialIndices
+     *            the index in <code>materials</code> for each sphere */
+    SphereSet(const std::vector<Vector3D> & centers, const std::vector<float> & radii, const std::vector<const Material *> & materials, const std::vector<MaterialIndex> & materialIndices);
+    virtual ~SphereSet();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual Object *duplicate() const;
+    /** @return the transformed spheres or NULL if <code>m</code> isn't a similarity transform, the hierarchy is rebuilt */
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const;
+    size_t getSphereCount() const;
+private:
+    explicit SphereSet(SphereSetData * data);
+    SphereSetData * data;
+};
+
+}
+
+#endif // SPHERE_SET_H
@@ -0,0 +1,718 @@
+#ifndef STATIC_CSG_H_INCLUDED
+#define STATIC_CSG_H_INCLUDED
+
+#include "object.h"
+#include "sphere.h"
+#include "plane.h"
+#include "csg.h"
+#include <vector>
+
+namespace PathTrace
+{
+
+/** a boundary of a <code>StaticSpan</code>.<br/>
+ * the normal is calculated when the boundary is made so it doesn't refer back to the iterator that made it */
+struct StaticSpanBoundary
+{
+    Vector3D normal; /// the outward facing normal, not normalized
+    const Material * material;
+
+    /** @return this boundary with the normal reversed */
+    StaticSpanBoundary reversed() const
+    {
+        StaticSpanBoundary retval = *this;
+        retval.normal = -normal;
+        return retval;
+    }
+};
+
+/** a part of a ray that is inside of a static object.
+ * @see Span */
+struct StaticSpan
+{
+    float start;
+    float end;
+    StaticSpanBoundary startBoundary;
+    StaticSpanBoundary endBoundary;
+
+    void copyStartFromStart(const StaticSpan & span)
+    {
+        start = span.start;
+        startBoundary = span.startBoundary;
+    }
+
+    void copyEndFromStart(const StaticSpan & span)
+    {
+        end = span.start;
+        endBoundary = span.startBoundary.reversed();
+    }
+
+    void copyStartFromEnd(const StaticSpan & span)
+    {
+        start = span.end;
+        startBoundary = span.endBoundary.reversed();
+    }
+
+    void copyEndFromEnd(const StaticSpan & span)
+    {
+        end = span.end;
+        endBoundary = span.endBoundary;
+    }
+};
+
+/** sets <code>hit.t</code> and <code>hit.entering</code> to the first boundary of the span from <code>start</code>
+ * to <code>end</code> with <code>tmin <= t <= tmax</code>
+ * @return if there is a boundary in the range */
+inline bool firstBoundary(float start, float end, float tmin, float tmax, Hit & hit)
+{
+    if(start >= tmin)
+    {
+        hit.t = start;
+        hit.entering = true;
+    }
+    else if(end >= tmin)
+    {
+        hit.t = end;
+        hit.entering = false;
+    }
+    else
+    {
+        return false;
+    }
+    return hit.t <= tmax;
+}
+
+/** static objects are objects whose type is the whole CSG tree, so their span iterators are
+ * stored by value inside the iterators of their parents and all the calls are inlined.<br/>
+ * a static object type <code>T</code> has :
+ * <ul>
+ * <li><code>BoundingBox getBounds() const</code></li>
+ * <li><code>bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const</code> like
+ * <code>Object::firstHit</code>, with <code>hit.object</code> set to NULL</li>
+ * <li>a nested class <code>T::Iterator</code> constructed from a <code>const T &</code> that is only used
+ * while the object exists, with <code>void init(const Ray & ray)</code>, <code>bool isAtEnd() const</code>,
+ * <code>void next()</code> and <code>const StaticSpan & operator *() const</code>.
+ * the spans are returned in order and don't overlap, the same as <code>SpanIterator</code></li>
+ * </ul>
+ * use <code>makeStaticObject</code> to put a static object in a scene made of <code>Object</code>s.
+ * @see makeStaticObject(const T & scene) */
+class StaticSphere
+{
+public:
+    StaticSphere(Vector3D center, float r, const Material * material)
+        : center(center), material(material->duplicate()), r(r), r_squared(r * r)
+    {
+    }
+    StaticSphere(const StaticSphere & rt)
+        : center(rt.center), material(rt.material->duplicate()), r(rt.r), r_squared(rt.r_squared)
+    {
+    }
+    const StaticSphere & operator =(const StaticSphere & rt)
+    {
+        rt.material->duplicate();
+        material->release();
+        center = rt.center;
+        material = rt.material;
+        r = rt.r;
+        r_squared = rt.r_squared;
+        return *this;
+    }
+    ~StaticSphere()
+    {
+        material->release();
+    }
+    BoundingBox getBounds() const
+    {
+        return BoundingBox(center - Vector3D(r), center + Vector3D(r));
+    }
+    bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        float start, end;
+        if(!intersectSphere(ray, center, r_squared, start, end))
+        {
+            return false;
+        }
+        if(!firstBoundary(start, end, tmin, tmax, hit))
+        {
+            return false;
+        }
+        hit.normal = normalize(ray.getPoint(hit.t) - center);
+        hit.material = material;
+        hit.object = NULL;
+        return true;
+    }
+    class Iterator
+    {
+    public:
+        explicit Iterator(const StaticSphere & sphere)
+            : sphere(sphere), ended(true)
+        {
+        }
+        void init(const Ray & ray)
+        {
+            ended = !intersectSphere(ray, sphere.center, sphere.r_squared, theSpan.start, theSpan.end);
+            if(ended)
+            {
+                return;
+            }
+            theSpan.startBoundary.normal = ray.getPoint(theSpan.start) - sphere.center;
+            theSpan.startBoundary.material = sphere.material;
+            theSpan.endBoundary.normal = ray.getPoint(theSpan.end) - sphere.center;
+            theSpan.endBoundary.material = sphere.material;
+        }
+        const StaticSpan & operator *() const
+        {
+            return theSpan;
+        }
+        bool isAtEnd() const
+        {
+            return ended;
+        }
+        void next()
+        {
+            ended = true;
+        }
+    private:
+        const StaticSphere & sphere;
+        StaticSpan theSpan;
+        bool ended;
+    };
+private:
+    friend class Iterator;
+    Vector3D center;
+    const Material * material;
+    float r, r_squared;
+};
+
+/** the half space behind a plane
+ * @see StaticSphere */
+class StaticPlane
+{
+public:
+    StaticPlane(Vector3D normal, float d, const Material * material)
+        : normal(normal), d(d), material(material->duplicate())
+    {
+    }
+    StaticPlane(Vector3D normal, Vector3D pos, const Material * material)
+        : normal(normal), d(-dot(normal, pos)), material(material->duplicate())
+    {
+    }
+    StaticPlane(const StaticPlane & rt)
+        : normal(rt.normal), d(rt.d), material(rt.material->duplicate())
+    {
+    }
+    const StaticPlane & operator =(const StaticPlane & rt)
+    {
+        rt.material->duplicate();
+        material->release();
+        normal = rt.normal;
+        d = rt.d;
+        material = rt.material;
+        return *this;
+    }
+    ~StaticPlane()
+    {
+        material->release();
+    }
+    BoundingBox getBounds() const
+    {
+        return BoundingBox::infinite();
+    }
+    bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        float start, end;
+        if(!intersectPlane(ray, normal, d, start, end))
+        {
+            return false;
+        }
+        if(!firstBoundary(start, end, tmin, tmax, hit))
+        {
+            return false;
+        }
+        hit.normal = normalize(normal);
+        hit.material = material;
+        hit.object = NULL;
+        return true;
+    }
+    class Iterator
+    {
+    public:
+        explicit Iterator(const StaticPlane & plane)
+            : plane(plane), ended(true)
+        {
+            theSpan.startBoundary.normal = plane.normal;
+            theSpan.startBoundary.material = plane.material;
+            theSpan.endBoundary = theSpan.startBoundary;
+        }
+        void init(const Ray & ray)
+        {
+            ended = !intersectPlane(ray, plane.normal, plane.d, theSpan.start, theSpan.end);
+        }
+        const StaticSpan & operator *() const
+        {
+            return theSpan;
+        }
+        bool isAtEnd() const
+        {
+            return ended;
+        }
+        void next()
+        {
+            ended = true;
+        }
+    private:
+        const StaticPlane & plane;
+        StaticSpan theSpan;
+        bool ended;
+    };
+private:
+    friend class Iterator;
+    Vector3D normal;
+    float d;
+    const Material * material;
+};
+
+/** the parts of the static CSG iterators that step through the spans of both operands */
+template <typename A, typename B>
+class StaticCSGIterator
+{
+protected:
+    StaticCSGIterator(const A & a, const B & b)
+        : iteratorA(a), iteratorB(b), ended(true)
+    {
+    }
+    void initOperands(const Ray & ray)
+    {
+        iteratorA.init(ray);
+        iteratorB.init(ray);
+        ended = false;
+        aEnded = false;
+        bEnded = false;
+        nextA();
+        nextB();
+    }
+    void nextA()
+    {
+        if(iteratorA.isAtEnd())
+        {
+            aEnded = true;
+        }
+        else
+        {
+            spanA = *iteratorA;
+            iteratorA.next();
+        }
+    }
+    void nextB()
+    {
+        if(iteratorB.isAtEnd())
+        {
+            bEnded = true;
+        }
+        else
+        {
+            spanB = *iteratorB;
+            iteratorB.next();
+        }
+    }
+    typename A::Iterator iteratorA;
+    typename B::Iterator iteratorB;
+    StaticSpan spanA, spanB, resultSpan;
+    bool ended, aEnded, bEnded;
+public:
+    const StaticSpan & operator *() const
+    {
+        return resultSpan;
+    }
+    bool isAtEnd() const
+    {
+        return ended;
+    }
+};
+
+/** the union of two static objects
+ * @see Union */
+template <typename A, typename B>
+class StaticUnion
+{
+public:
+    StaticUnion(const A & a, const B & b)
+        : a(a), b(b)
+    {
+    }
+    BoundingBox getBounds() const
+    {
+        return combine(a.getBounds(), b.getBounds());
+    }
+    bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return inlineCSGFirstHit(CSGUnion, a, b, ray, tmin, tmax, hit);
+    }
+    class Iterator : public StaticCSGIterator<A, B>
+    {
+    public:
+        explicit Iterator(const StaticUnion & u)
+            : StaticCSGIterator<A, B>(u.a, u.b)
+        {
+        }
+        void init(const Ray & ray)
+        {
+            this->initOperands(ray);
+            next();
+        }
+        void next()
+        {
+            StaticSpan & spanA = this->spanA, & spanB = this->spanB;
+            while(true)
+            {
+                if(this->aEnded)
+                {
+                    if(this->bEnded)
+                    {
+                        this->ended = true;
+                        return;
+                    }
+                    this->resultSpan = spanB;
+                    this->nextB();
+                    return;
+                }
+                if(this->bEnded)
+                {
+                    this->resultSpan = spanA;
+                    this->nextA();
+                    return;
+                }
+                if(spanA.end < spanB.start) // if a is completely before b
+                {
+                    this->resultSpan = spanA;
+                    this->nextA();
+                    return;
+                }
+                if(spanB.end < spanA.start) // if b is completely before a
+                {
+                    this->resultSpan = spanB;
+                    this->nextB();
+                    return;
+                }
+                if(spanA.start < spanB.start)
+                {
+                    if(spanA.end < spanB.end)
+                    {
+                        spanA.copyEndFromEnd(spanB);
+                    }
+                    this->nextB();
+                }
+                else
+                {
+                    if(spanA.end > spanB.end)
+                    {
+                        spanB.copyEndFromEnd(spanA);
+                    }
+                    this->nextA();
+                }
+            }
+        }
+    };
+private:
+    A a;
+    B b;
+};
+
+/** the intersection of two static objects
+ * @see Intersection */
+template <typename A, typename B>
+class StaticIntersection
+{
+public:
+    StaticIntersection(const A & a, const B & b)
+        : a(a), b(b)
+    {
+    }
+    BoundingBox getBounds() const
+    {
+        return intersect(a.getBounds(), b.getBounds());
+    }
+    bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return inlineCSGFirstHit(CSGIntersection, a, b, ray, tmin, tmax, hit);
+    }
+    class Iterator : public StaticCSGIterator<A, B>
+    {
+    public:
+        explicit Iterator(const StaticIntersection & i)
+            : StaticCSGIterator<A, B>(i.a, i.b)
+        {
+        }
+        void init(const Ray & ray)
+        {
+            this->initOperands(ray);
+            next();
+        }
+        void next()
+        {
+            StaticSpan & spanA = this->spanA, & spanB = this->spanB;
+            while(true)
+            {
+                if(this->aEnded || this->bEnded)
+                {
+                    this->ended = true;
+                    return;
+                }
+                if(spanA.end < spanB.start) // if a is completely before b
+                {
+                    this->nextA();
+                    continue;
+                }
+                if(spanB.end < spanA.start) // if b is completely before a
+                {
+                    this->nextB();
+                    continue;
+                }
+                if(spanA.start < spanB.start)
+                {
+                    if(spanA.end < spanB.end)
+                    {
+                        spanA.copyStartFromStart(spanB);
+                        this->resultSpan = spanA;
+                        this->nextA();
+                        return;
+                    }
+                    this->resultSpan = spanB;
+                    this->nextB();
+                    return;
+                }
+                if(spanB.end < spanA.end)
+                {
+                    spanB.copyStartFromStart(spanA);
+                    this->resultSpan = spanB;
+                    this->nextB();
+                    return;
+                }
+                this->resultSpan = spanA;
+                this->nextA();
+                return;
+            }
+        }
+    };
+private:
+    A a;
+    B b;
+};
+
+/** the parts of a static object that aren't in another static object
+ * @see Difference */
+template <typename A, typename B>
+class StaticDifference
+{
+public:
+    StaticDifference(const A & a, const B & b)
+        : a(a), b(b)
+    {
+    }
+    BoundingBox getBounds() const
+    {
+        return a.getBounds();
+    }
+    bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return inlineCSGFirstHit(CSGDifference, a, b, ray, tmin, tmax, hit);
+    }
+    class Iterator : public StaticCSGIterator<A, B>
+    {
+    public:
+        explicit Iterator(const StaticDifference & d)
+            : StaticCSGIterator<A, B>(d.a, d.b)
+        {
+        }
+        void init(const Ray & ray)
+        {
+            this->initOperands(ray);
+            next();
+        }
+        void next()
+        {
+            StaticSpan & spanA = this->spanA, & spanB = this->spanB;
+            while(true)
+            {
+                if(this->aEnded)
+                {
+                    this->ended = true;
+                    return;
+                }
+                if(this->bEnded)
+                {
+                    this->resultSpan = spanA;
+                    this->nextA();
+                    return;
+                }
+                if(spanA.end < spanB.start) // if a is completely before b
+                {
+                    this->resultSpan = spanA;
+                    this->nextA();
+                    return;
+                }
+                if(spanB.end < spanA.start) // if b is completely before a
+                {
+                    this->nextB();
+                }
+                else if(spanA.start < spanB.start)
+                {
+                    if(spanA.end < spanB.end)
+                    {
+                        spanA.copyEndFromStart(spanB);
+                        this->resultSpan = spanA;
+                        this->nextA();
+                        return;
+                    }
+                    this->resultSpan = spanA;
+                    this->resultSpan.copyEndFromStart(spanB);
+                    spanA.copyStartFromEnd(spanB);
+                    this->nextB();
+                    return;
+                }
+                else
+                {
+                    if(spanA.end > spanB.end)
+                    {
+                        spanA.copyStartFromEnd(spanB);
+                        this->nextB();
+                        continue;
+                    }
+                    this->nextA();
+                }
+            }
+        }
+    };
+private:
+    A a;
+    B b;
+};
+
+template <typename A, typename B>
+inline StaticUnion<A, B> makeStaticUnion(const A & a, const B & b)
+{
+    return StaticUnion<A, B>(a, b);
+}
+
+template <typename A, typename B>
+inline StaticIntersection<A, B> makeStaticIntersection(const A & a, const B & b)
+{
+    return StaticIntersection<A, B>(a, b);
+}
+
+template <typename A, typename B>
+inline StaticDifference<A, B> makeStaticDifference(const A & a, const B & b)
+{
+    return StaticDifference<A, B>(a, b);
+}
+
+/** adapts a static object to <code>Object</code>.<br/>
+ * <code>firstHit</code> is inlined all the way down to the primitives and doesn't allocate anything,
+ * <code>makeSpanIterator</code> is for using it in CSG operations with other <code>Object</code>s.
+ * emissive static objects aren't added to the light list.
+ * @see StaticSphere */
+template <typename T>
+class StaticObject : public Object
+{
+public:
+    explicit StaticObject(const T & scene)
+        : scene(scene)
+    {
+    }
+    virtual SpanIterator * makeSpanIterator() const
+    {
+        return new AdaptedSpanIterator(scene);
+    }
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        if(!scene.firstHit(ray, tmin, tmax, hit))
+        {
+            return false;
+        }
+        hit.object = this;
+        return true;
+    }
+    virtual Object * duplicate() const
+    {
+        return new StaticObject(scene);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return scene.getBounds();
+    }
+private:
+    /** converts the spans of the static object to <code>Span</code>s, the boundaries are kept
+     * until the next call to <code>init</code> so they stay valid while the parent iterators use them */
+    class AdaptedSpanIterator : public SpanIterator
+    {
+    public:
+        explicit AdaptedSpanIterator(const T & scene)
+            : iterator(scene)
+        {
+            theSpan.startBoundary.source = this;
+            theSpan.endBoundary.source = this;
+        }
+        virtual void init(const Ray & ray)
+        {
+            boundaries.clear();
+            iterator.init(ray);
+            convert();
+        }
+        virtual const Span & operator *() const
+        {
+            return theSpan;
+        }
+        virtual const Span * operator ->() const
+        {
+            return &theSpan;
+        }
+        virtual bool isAtEnd() const
+        {
+            return iterator.isAtEnd();
+        }
+        virtual void next()
+        {
+            iterator.next();
+            convert();
+        }
+        virtual const Material * getMaterial(unsigned index) const
+        {
+            return boundaries[index].material;
+        }
+    protected:
+        virtual Vector3D getLocalNormal(unsigned index, float t) const
+        {
+            return boundaries[index].normal;
+        }
+    private:
+        void convert()
+        {
+            if(iterator.isAtEnd())
+            {
+                return;
+            }
+            const StaticSpan & span = *iterator;
+            theSpan.start = span.start;
+            theSpan.end = span.end;
+            theSpan.startBoundary.index = boundaries.size();
+            boundaries.push_back(span.startBoundary);
+            theSpan.endBoundary.index = boundaries.size();
+            boundaries.push_back(span.endBoundary);
+        }
+        typename T::Iterator iterator;
+        Span theSpan;
+        std::vector<StaticSpanBoundary> boundaries;
+    };
+    const T scene;
+};
+
+/** @return a new <code>StaticObject</code> for <code>scene</code> */
+template <typename T>
+inline Object * makeStaticObject(const T & scene)
+{
+    return new StaticObject<T>(scene);
+}
+
+}
+
+#endif // STATIC_CSG_H_INCLUDED
@@ -4,10 +4,16 @@
 #include "color.h"
 #include "vector3d.h"
 #include "transform.h"
+#include "reference_counted.h"
 
 namespace PathTrace
 {
-class Texture
+/** textures are immutable so they are shared instead of copied : <code>duplicate</code> adds a reference
+ * and <code>release</code> removes one, the texture is deleted with the last reference.<br/>
+ * textures that own other textures release them in their destructors.<br/>
+ * textures are compared by what they look like with <code>hash</code> and <code>equals</code>, so materials
+ * made from separately made textures that look the same are only stored once. */
+class Texture : public ReferenceCounted
 {
 public:
     virtual Color getColor(Vector3D pos) const = 0;
@@ -16,11 +22,41 @@ public:
         Color c = getColor(pos);
         return (c.x + c.y + c.z) * (1.0f / 3.0f);
     }
-    virtual Texture *duplicate() const = 0;
+    /** @return another reference to this texture */
+    Texture *duplicate() const
+    {
+        addReference();
+        return const_cast<Texture *>(this);
+    }
+    /** removes a reference to this texture, deleting it if it was the last one */
+    void release() const
+    {
+        removeReference();
+    }
     virtual Texture *transform(const Matrix &m) const
     {
         return NULL;
     }
+    /** @return a hash of what this texture looks like, equal textures have the same hash */
+    virtual size_t hash() const
+    {
+        return reinterpret_cast<size_t>(this);
+    }
+    /** @return if this texture has the same colors as <code>rt</code> everywhere.
+     * textures that don't override this are only equal to themselves */
+    virtual bool equals(const Texture &rt) const
+    {
+        return this == &rt;
+    }
+    /** gets the size of the image this texture is looked up in, used to pick
+     * how finely to tabulate the texture for importance sampling
+     *
+     * @return if this texture is looked up in an image */
+    virtual bool getImageSize(unsigned &width, unsigned &height) const
+    {
+        return false;
+    }
+protected:
     virtual ~Texture()
     {
     }
@@ -47,13 +83,18 @@ public:
     {
         return color;
     }
-    virtual Texture *duplicate() const
+    virtual Texture *transform(const Matrix &) const
     {
-        return new ColorTexture(color);
+        return duplicate();
     }
-    virtual Texture *transform(const Matrix &) const
+    virtual size_t hash() const
     {
-        return new ColorTexture(color);
+        return hashCombine(hashCombine(hashFloat(color.x), hashFloat(color.y)), hashFloat(color.z));
+    }
+    virtual bool equals(const Texture &rt) const
+    {
+        const ColorTexture * other = dynamic_cast<const ColorTexture *>(&rt);
+        return other && other->color == color;
     }
 };
 
@@ -69,7 +110,7 @@ public:
     }
     virtual ~TransformedTexture()
     {
-        delete t;
+        t->release();
     }
     virtual Color getColor(Vector3D v) const
     {
@@ -79,16 +120,30 @@ public:
     {
         return t->getFloat(PathTrace::transform(m, v));
     }
-    virtual Texture *duplicate() const
+    virtual bool getImageSize(unsigned &width, unsigned &height) const
     {
-        return new TransformedTexture(m, t->duplicate());
+        return t->getImageSize(width, height);
     }
+    /** @return a view of the same texture, <code>m</code> is applied first */
     virtual Texture *transform(const Matrix &m) const
     {
-        return new TransformedTexture(this->m.concat(m), t->duplicate());
+        return new TransformedTexture(m.concat(this->m), t->duplicate());
+    }
+    virtual size_t hash() const
+    {
+        return hashCombine(hashMatrix(m), t->hash());
+    }
+    virtual bool equals(const Texture &rt) const
+    {
+        const TransformedTexture * other = dynamic_cast<const TransformedTexture *>(&rt);
+        return other && other->m == m && t->equals(*other->t);
     }
 };
 
+/** @return a <code>ColorTexture</code> shared with every other texture made by this for the same color, the caller owns the returned reference */
+Texture *makeColorTexture(Color color);
+
+/** @return a new reference to <code>t</code> with the lookups transformed by <code>m</code> */
 inline Texture *transform(const Matrix &m, Texture *t)
 {
     Texture *retval = t->transform(m);
@@ -0,0 +1,47 @@
+#ifndef TORUS_H
+#define TORUS_H
+
+#include "object.h"
+
+namespace PathTrace
+{
+
+/** a torus : the points within <code>minorRadius</code> of the circle of radius <code>majorRadius</code>
+ * around <code>center</code> in the plane perpendicular to <code>axis</code>.<br/>
+ * a line goes through at most two spans. the quartic is solved in double precision after moving
+ * the ray origin to the bounding sphere, each root is isolated between the roots of the derivative
+ * so no roots are lost to the cancellation in the closed form solution. */
+class Torus : public Object
+{
+public:
+    Torus(Vector3D center, Vector3D axis, float majorRadius, float minorRadius, const Material * material);
+    virtual ~Torus();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual Object *duplicate() const
+    {
+        return new Torus(center, axis, majorRadius, minorRadius, material);
+    }
+    /** @return the transformed torus or NULL if <code>m</code> isn't a similarity transform */
+    virtual Object *transform(const Matrix &m) const;
+    virtual BoundingBox getBounds() const;
+    static const size_t MaxSpanCount = 2;
+    /** intersects the line through <code>ray</code> with this torus
+     *
+     * @param starts
+     *            set to where the line enters each span
+     * @param ends
+     *            set to where the line leaves each span
+     * @return the number of spans */
+    size_t intersect(const Ray & ray, float starts[MaxSpanCount], float ends[MaxSpanCount]) const;
+    /** @return the outward facing normal at <code>position</code>, not normalized */
+    Vector3D getNormal(Vector3D position) const;
+private:
+    Vector3D center, axis;
+    float majorRadius, minorRadius;
+    const Material * material;
+};
+
+}
+
+#endif // TORUS_H
@@ -419,6 +419,38 @@ public:
                 * this->x01 + v.y * this->x11 + v.z * this->x21, v.x * this->x02
                 + v.y * this->x12 + v.z * this->x22);
     }
+
+    /** @return the transpose of this matrix without the translation.<br/>
+     * if the points of a surface are transformed by the inverse of this matrix then
+     * <code>transposeNoTranslate().applyNoTranslate(normal)</code> is the transformed normal */
+    Matrix transposeNoTranslate() const
+    {
+        return Matrix(this->x00, this->x01, this->x02, 0, this->x10, this->x11, this->x12, 0, this->x20, this->x21, this->x22, 0);
+    }
+
+    /** checks if this matrix only rotates, reflects, scales uniformly and translates
+     *
+     * @param scale
+     *            set to how much this matrix scales lengths
+     * @return if this matrix is a similarity transform */
+    bool isSimilarity(float & scale) const
+    {
+        Vector3D x = applyNoTranslate(Vector3D(1, 0, 0));
+        Vector3D y = applyNoTranslate(Vector3D(0, 1, 0));
+        Vector3D z = applyNoTranslate(Vector3D(0, 0, 1));
+        float lengthSquared = abs_squared(x);
+        const float tolerance = 1e-5f * lengthSquared;
+        if(lengthSquared == 0 || std::fabs(abs_squared(y) - lengthSquared) > tolerance || std::fabs(abs_squared(z) - lengthSquared) > tolerance)
+        {
+            return false;
+        }
+        if(std::fabs(dot(x, y)) > tolerance || std::fabs(dot(y, z)) > tolerance || std::fabs(dot(z, x)) > tolerance)
+        {
+            return false;
+        }
+        scale = std::sqrt(lengthSquared);
+        return true;
+    }
 };
 
 inline Vector3D transform(const Matrix & m, Vector3D v)
@@ -457,6 +489,20 @@ inline bool operator !=(const Matrix & a, const Matrix & b)
     return false;
 }
 
+/** @return a hash of <code>m</code>, equal matrices have the same hash */
+inline size_t hashMatrix(const Matrix & m)
+{
+    size_t retval = 0;
+    for(int y = 0; y < 3; y++)
+    {
+        for(int x = 0; x < 4; x++)
+        {
+            retval = hashCombine(retval, hashFloat(m.get(x, y)));
+        }
+    }
+    return retval;
+}
+
 }
 
 #endif // TRANSFORM_H
@@ -17,7 +17,7 @@ public:
     }
     virtual ~TransformTexture()
     {
-        delete t;
+        t->release();
     }
 protected:
     virtual Vector3D transform(Vector3D v) const = 0;
@@ -30,6 +30,10 @@ public:
     {
         return t->getFloat(transform(pos));
     }
+    virtual bool getImageSize(unsigned & width, unsigned & height) const
+    {
+        return t->getImageSize(width, height);
+    }
 };
 
 class MirrorBallSkymapTexture : public TransformTexture
@@ -39,10 +43,6 @@ public:
         : TransformTexture(t)
     {
     }
-    virtual Texture * duplicate() const
-    {
-        return new MirrorBallSkymapTexture(t->duplicate());
-    }
     virtual Vector3D transform(Vector3D v) const
     {
         if(v == Vector3D(0))
@@ -57,6 +57,15 @@ public:
         float yt = v.y / d;
         return Vector3D(xt * 0.5 + 0.5, yt * 0.5 + 0.5, 0);
     }
+    virtual size_t hash() const
+    {
+        return t->hash();
+    }
+    virtual bool equals(const Texture & rt) const
+    {
+        const MirrorBallSkymapTexture * other = dynamic_cast<const MirrorBallSkymapTexture *>(&rt);
+        return other && t->equals(*other->t);
+    }
 };
 
 class SphericalCoordinatesSkymapTexture : public TransformTexture
@@ -66,10 +75,6 @@ public:
         : TransformTexture(t)
     {
     }
-    virtual Texture * duplicate() const
-    {
-        return new SphericalCoordinatesSkymapTexture(t->duplicate());
-    }
     virtual Vector3D transform(Vector3D v) const
     {
         if(v == Vector3D(0))
@@ -83,6 +88,15 @@ public:
         float phi = asin(v.z);
         return Vector3D(theta * 0.5 / M_PI + 0.5, phi / (M_PI / 2) * 0.5 + 0.5, 0);
     }
+    virtual size_t hash() const
+    {
+        return hashCombine(t->hash(), 1);
+    }
+    virtual bool equals(const Texture & rt) const
+    {
+        const SphericalCoordinatesSkymapTexture * other = dynamic_cast<const SphericalCoordinatesSkymapTexture *>(&rt);
+        return other && t->equals(*other->t);
+    }
 };
 }
 
@@ -0,0 +1,75 @@
+#ifndef TRIANGLE_MESH_H_INCLUDED
+#define TRIANGLE_MESH_H_INCLUDED
+
+#include "object.h"
+#include "bvh_union.h"
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+namespace PathTrace
+{
+
+struct TriangleMeshData;
+
+class MeshLoadError : public std::runtime_error
+{
+public:
+    explicit MeshLoadError(const std::string &arg)
+        : std::runtime_error(arg)
+    {
+    }
+};
+
+/** a mesh of triangles with its own bounding volume hierarchy.<br/>
+ * the vertices of each triangle are in counter-clockwise order when looking at the outside
+ * of the mesh. if the mesh is closed it is a solid that can be used in CSG operations,
+ * otherwise the spans are only approximate : a ray is inside the mesh after it crosses
+ * more triangles from the front than from the back.<br/>
+ * the ray/triangle test is watertight (Woop, Benthin and Wald) so rays can't slip through
+ * the edges between triangles.<br/>
+ * the triangles and their hierarchy are shared by the copies made by <code>duplicate</code>, and the mesh isn't
+ * transformed directly so <code>transform(m, o)</code> makes a <code>TransformedObject</code> view of a copy that
+ * shares them instead of rebuilding the mesh.<br/>
+ * emissive meshes aren't added to the light list.
+ */
+class TriangleMesh : public Object
+{
+public:
+    /** makes a mesh from flat arrays
+     *
+     * @param vertices
+     *            the x, y and z coordinates of each vertex
+     * @param indices
+     *            the indices of the 3 vertices of each triangle
+     * @param material
+     *            the material of the whole mesh */
+    TriangleMesh(const std::vector<float> & vertices, const std::vector<unsigned> & indices, const Material * material);
+    /** loads a mesh from a Wavefront OBJ or PLY file, only the vertex positions and faces are used
+     *
+     * @param fileName
+     *            the file to load
+     * @param material
+     *            the material of the whole mesh
+     * @param format
+     *            <code>"obj"</code>, <code>"ply"</code> or empty to use the extension of <code>fileName</code> */
+    TriangleMesh(std::string fileName, const Material * material, std::string format = "");
+    virtual ~TriangleMesh();
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const;
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const;
+    virtual Object * duplicate() const;
+    virtual BoundingBox getBounds() const;
+    size_t getTriangleCount() const;
+    size_t getVertexCount() const;
+    Vector3D getVertex(size_t index) const;
+private:
+    TriangleMesh(TriangleMeshData * data, const Material * material);
+    TriangleMeshData * data;
+    const Material * material;
+};
+
+}
+
+#endif // TRIANGLE_MESH_H_INCLUDED
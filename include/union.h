@@ -2,6 +2,7 @@
 #define UNION_H
 
 #include "object.h"
+#include "csg.h"
 
 namespace PathTrace
 {
@@ -12,17 +13,40 @@ public:
     Union(Object * a, Object * b);
     virtual ~Union();
     virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+    {
+        return csgFirstHit(CSGUnion, a, b, ray, tmin, tmax, hit);
+    }
+    virtual MaskPacket firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+    {
+        return csgFirstHitPacket(CSGUnion, a, b, rays, tmin, tmax, hits);
+    }
+    virtual bool occluded(const Ray & ray, float tmin, float tmax) const
+    {
+        return a->occluded(ray, tmin, tmax) || b->occluded(ray, tmin, tmax);
+    }
     virtual Object *duplicate() const
     {
         return new Union(a->duplicate(), b->duplicate());
     }
     virtual Object *transform(const Matrix &m) const
     {
-        return new Union(PathTrace::transform(m, a), PathTrace::transform(m, a));
+        return new Union(PathTrace::transform(m, a), PathTrace::transform(m, b));
+    }
+    virtual void getLights(std::vector<Light *> & lights) const
+    {
+        a->getLights(lights);
+        b->getLights(lights);
+    }
+    virtual BoundingBox getBounds() const
+    {
+        return combine(a->getBounds(), b->getBounds());
     }
+    virtual bool compile(CSGProgram & program) const;
 private:
-    Object * const a;
-    Object * const b;
+    friend class CSGOptimizer;
+    Object * a;
+    Object * b;
 };
 
 }
@@ -104,6 +104,10 @@ public:
         Vector3D v = l * r;
         return v.x + v.y + v.z;
     }
+    friend Vector3D cross(const Vector3D & l, const Vector3D & r)
+    {
+        return Vector3D(l.y * r.z - l.z * r.y, l.z * r.x - l.x * r.z, l.x * r.y - l.y * r.x);
+    }
     friend float abs_squared(const Vector3D & v)
     {
         return dot(v, v);
@@ -0,0 +1,57 @@
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include "object.h"
+#include <vector>
+#include <stdint.h>
+
+namespace PathTrace
+{
+
+struct VoxelGridData;
+
+/** a grid of solid blocks, each voxel is empty or has one of the materials.<br/>
+ * the voxels are stored in bricks of <code>BrickSize</code> cubed that are only allocated when they have
+ * something in them, rays step through the grid a voxel at a time and skip the empty bricks in one step.
+ * the neighboring voxels with the same material are merged into one span.<br/>
+ * the voxels are shared by the copies made by <code>duplicate</code> until one of them is changed with <code>set</code>. */
+class VoxelGrid : public Object
+{
+public:
+    typedef uint8_t MaterialIndex;
+    static const MaterialIndex Empty = 0; /// the value of empty voxels, the other values are 1 more than the index in the materials
+    static const unsigned BrickSize = 8; /// the number of voxels along each side of a brick
+    /** makes an empty grid
+     *
+     * @param sizeX
+     *            the number of voxels along x
+     * @param sizeY
+     *            the number of voxels along y
+     * @param sizeZ
+     *            the number of voxels along z
+     * @param minCorner
+     *            the corner of the grid with the lowest coordinates
+     * @param maxCorner
+     *            the corner of the grid with the highest coordinates
+     * @param materials
+     *            the materials for the voxels, at most 255 */
+    VoxelGrid(unsigned sizeX, unsigned sizeY, unsigned sizeZ, Vector3D minCorner, Vector3D maxCorner, const std::vector<const Material *> & materials);
+    virtual ~VoxelGrid();
+    MaterialIndex get(unsigned x, unsigned y, unsigned z) const;
+    void set(unsigned x, unsigned y, unsigned z, MaterialIndex value);
+    virtual SpanIterator * makeSpanIterator() const;
+    virtual bool firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const;
+    virtual Object *duplicate() const;
+    virtual BoundingBox getBounds() const;
+    /** @return the outward facing normal of boundary <code>index</code> found by the span iterator */
+    static Vector3D getNormal(unsigned index);
+    /** @return the material of boundary <code>index</code> found by the span iterator */
+    const Material * getMaterial(unsigned index) const;
+private:
+    explicit VoxelGrid(VoxelGridData * data);
+    VoxelGridData * data;
+};
+
+}
+
+#endif // VOXEL_GRID_H
@@ -0,0 +1,97 @@
+#ifndef WAVEFRONT_H_INCLUDED
+#define WAVEFRONT_H_INCLUDED
+
+#include "path-trace.h"
+#include <vector>
+#include <cstddef>
+
+namespace PathTrace
+{
+
+/** the state of every path in a wavefront stored as one array per field */
+struct PathQueue
+{
+    std::vector<float> originX, originY, originZ;
+    std::vector<float> dirX, dirY, dirZ;
+    std::vector<float> throughputR, throughputG, throughputB;
+    std::vector<float> lastPositionX, lastPositionY, lastPositionZ;
+    std::vector<float> lastScatterPdf;
+    std::vector<unsigned> sample; /// index of the sample the path belongs to
+    std::vector<unsigned> dimension; /// the next random number of the path's stream
+    std::vector<float> hitT;
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<const Material *> material; /// the material hit or NULL if the path is finished
+    std::vector<char> entering;
+    std::vector<const Object *> object;
+    size_t size() const
+    {
+        return sample.size();
+    }
+    void resize(size_t newSize);
+    Ray getRay(size_t i) const
+    {
+        return Ray(Vector3D(originX[i], originY[i], originZ[i]), Vector3D(dirX[i], dirY[i], dirZ[i]));
+    }
+    void setRay(size_t i, const Ray & ray);
+    Hit getHit(size_t i) const;
+    PathState getState(size_t i) const;
+    void setState(size_t i, const PathState & state);
+    /** copies path <code>from</code> of <code>source</code> to path <code>to</code> of this queue */
+    void copy(size_t to, const PathQueue & source, size_t from);
+    void swap(PathQueue & other);
+};
+
+/** breadth-first path tracer.<br/>
+ * instead of following each path to its end like <code>tracePath</code>, all
+ * the paths of a block of pixels are advanced one bounce at a time in stages
+ * (generate, intersect, sort by material, shade and write-back) that each run
+ * over the whole queue on several threads.<br/>
+ * the paths are sorted by the material they hit before shading so the
+ * textures of each material are evaluated together.<br/>
+ * each path reads its random numbers from its own stream of a
+ * <code>DefaultRandomEngine</code>, so the result doesn't depend on the order
+ * the paths are shaded in.<br/>
+ * each bounce is shaded with <code>scatterPath</code> so the result has the
+ * same expected value as <code>tracePixel</code> with <code>PathIntegrator</code>
+ */
+class WavefrontRenderer
+{
+public:
+    WavefrontRenderer(const Object & world, int screenXResolution, int screenYResolution, float screenWidth, float screenHeight, float screenDistance, int sampleCount, int rayDepth, int threadCount, const LightList * lights = NULL);
+    /** renders the pixels from <code>(x, y)</code> to <code>(x + width - 1, y + height - 1)</code>
+     *
+     * @param output
+     *            set to the color of pixel <code>(px, py)</code> at <code>output[px - x + (py - y) * width]</code>
+     * @param seed
+     *            the seed for the random numbers, the result doesn't depend on the number of threads.
+     *            each sample gets the same random numbers as it does in <code>tracePixel</code> */
+    void render(int x, int y, int width, int height, Color * output, unsigned seed);
+private:
+    typedef void (WavefrontRenderer::*Stage)(size_t start, size_t end, size_t chunk);
+    struct StageJob;
+    static void stageThreadFn(StageJob * job);
+    void runStage(Stage stage, size_t count);
+    void generateStage(size_t start, size_t end, size_t chunk);
+    void intersectStage(size_t start, size_t end, size_t chunk);
+    void shadeStage(size_t start, size_t end, size_t chunk);
+    /** starts the random number stream of sample <code>sample</code> of the block */
+    void startSample(DefaultRandomEngine &randomEngine, unsigned sample, unsigned dimension) const;
+    void sortByMaterial();
+    void removeFinishedPaths();
+    void writeBack(Color * output);
+    static const size_t ChunkSize = 1024;
+    const Object & world;
+    const int screenXResolution, screenYResolution;
+    const float screenWidth, screenHeight, screenDistance;
+    const int sampleCount, rayDepth, threadCount;
+    const LightList * const lights;
+    int blockX, blockY, blockWidth;
+    unsigned seed;
+    int depth;
+    PathQueue paths, sortedPaths;
+    std::vector<Color> radiance; /// the light gathered by each sample
+};
+
+}
+
+#endif // WAVEFRONT_H_INCLUDED
@@ -0,0 +1,237 @@
+#include "box.h"
+
+namespace PathTrace
+{
+
+Box::Box(Vector3D minCorner, Vector3D maxCorner, const Material * material)
+    : minCorner(minCorner), maxCorner(maxCorner), material(material->duplicate())
+{
+}
+
+Box::~Box()
+{
+    material->release();
+}
+
+namespace
+{
+
+/** intersects the line through <code>ray</code> with a box
+ *
+ * @param startFace
+ *            set to the face where the line enters, 2 * axis for the minimum side and 2 * axis + 1 for the maximum side
+ * @param endFace
+ *            set to the face where the line leaves
+ * @return if the line goes through the box */
+bool intersectBox(const Ray & ray, const Vector3D & minCorner, const Vector3D & maxCorner, float & start, float & end, unsigned & startFace, unsigned & endFace)
+{
+    const float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    const float dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+    const float minV[3] = {minCorner.x, minCorner.y, minCorner.z};
+    const float maxV[3] = {maxCorner.x, maxCorner.y, maxCorner.z};
+    start = -max_value;
+    end = max_value;
+    startFace = endFace = 0;
+    for(unsigned axis = 0; axis < 3; axis++)
+    {
+        if(dir[axis] == 0)
+        {
+            if(origin[axis] < minV[axis] || origin[axis] > maxV[axis])
+            {
+                return false;
+            }
+            continue;
+        }
+        float invDir = 1 / dir[axis];
+        float t0 = (minV[axis] - origin[axis]) * invDir, t1 = (maxV[axis] - origin[axis]) * invDir;
+        unsigned face0 = 2 * axis, face1 = 2 * axis + 1;
+        if(t0 > t1)
+        {
+            std::swap(t0, t1);
+            std::swap(face0, face1);
+        }
+        if(t0 > start)
+        {
+            start = t0;
+            startFace = face0;
+        }
+        if(t1 < end)
+        {
+            end = t1;
+            endFace = face1;
+        }
+    }
+    return start < end;
+}
+
+Vector3D getFaceNormal(unsigned face)
+{
+    float sign = (face & 1) ? 1 : -1;
+    switch(face / 2)
+    {
+    case 0:
+        return Vector3D(sign, 0, 0);
+    case 1:
+        return Vector3D(0, sign, 0);
+    default:
+        return Vector3D(0, 0, sign);
+    }
+}
+
+class BoxSpanIterator : public SpanIterator
+{
+public:
+    BoxSpanIterator(const Vector3D & minCorner, const Vector3D & maxCorner, const Material * material)
+        : minCorner(minCorner), maxCorner(maxCorner), material(material)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+        ended = true;
+    }
+    virtual void init(const Ray & ray)
+    {
+        ended = !intersectBox(ray, minCorner, maxCorner, theSpan.start, theSpan.end, theSpan.startBoundary.index, theSpan.endBoundary.index);
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        ended = true;
+    }
+    virtual ~BoxSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return getFaceNormal(index);
+    }
+
+private:
+    Span theSpan;
+    bool ended;
+    const Vector3D minCorner, maxCorner;
+    const Material * const material;
+};
+
+/** intersects the lines through <code>rays</code> with one slab of a box
+ *
+ * @param nearNormal
+ *            set to the normal of the side where the lines enter the slab
+ * @param farNormal
+ *            set to the normal of the side where the lines leave the slab */
+inline void intersectSlabPacket(FloatPacket origin, FloatPacket dir, float minV, float maxV, FloatPacket & tNear, FloatPacket & tFar, FloatPacket & nearNormal, FloatPacket & farNormal)
+{
+    const FloatPacket tiny(1e-30f);
+    FloatPacket invDir = FloatPacket(1) / select(dir == FloatPacket(0), tiny, dir);
+    FloatPacket t0 = (FloatPacket(minV) - origin) * invDir, t1 = (FloatPacket(maxV) - origin) * invDir;
+    MaskPacket negative = dir < FloatPacket(0);
+    tNear = min(t0, t1);
+    tFar = max(t0, t1);
+    nearNormal = select(negative, FloatPacket(1), FloatPacket(-1));
+    farNormal = -nearNormal;
+}
+}
+
+SpanIterator * Box::makeSpanIterator() const
+{
+    return new BoxSpanIterator(minCorner, maxCorner, material);
+}
+
+bool Box::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float start, end;
+    unsigned startFace, endFace;
+    if(!intersectBox(ray, minCorner, maxCorner, start, end, startFace, endFace))
+    {
+        return false;
+    }
+    if(start >= tmin)
+    {
+        hit.t = start;
+        hit.entering = true;
+        hit.normal = getFaceNormal(startFace);
+    }
+    else if(end >= tmin)
+    {
+        hit.t = end;
+        hit.entering = false;
+        hit.normal = getFaceNormal(endFace);
+    }
+    else
+    {
+        return false;
+    }
+    if(hit.t > tmax)
+    {
+        return false;
+    }
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+bool Box::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    float start, end;
+    unsigned startFace, endFace;
+    return intersectBox(ray, minCorner, maxCorner, start, end, startFace, endFace) && start <= tmax && end >= tmin;
+}
+
+MaskPacket Box::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    FloatPacket nearX, farX, nearY, farY, nearZ, farZ;
+    FloatPacket nearNormalX, farNormalX, nearNormalY, farNormalY, nearNormalZ, farNormalZ;
+    intersectSlabPacket(rays.origin.x, rays.dir.x, minCorner.x, maxCorner.x, nearX, farX, nearNormalX, farNormalX);
+    intersectSlabPacket(rays.origin.y, rays.dir.y, minCorner.y, maxCorner.y, nearY, farY, nearNormalY, farNormalY);
+    intersectSlabPacket(rays.origin.z, rays.dir.z, minCorner.z, maxCorner.z, nearZ, farZ, nearNormalZ, farNormalZ);
+    FloatPacket tNear = max(nearX, max(nearY, nearZ)), tFar = min(farX, min(farY, farZ));
+    MaskPacket retval = rays.active & (tNear < tFar);
+    if(!any(retval))
+    {
+        return retval;
+    }
+    hits.entering = tNear >= tmin;
+    hits.t = select(hits.entering, tNear, tFar);
+    retval = retval & (hits.t >= tmin) & (hits.t <= tmax);
+    // only the normals of the slabs the boundary is on are used, both at edges
+    const FloatPacket zero(0);
+    hits.normal = normalize(VectorPacket(select(hits.entering, select(nearX == tNear, nearNormalX, zero), select(farX == tFar, farNormalX, zero)),
+                                         select(hits.entering, select(nearY == tNear, nearNormalY, zero), select(farY == tFar, farNormalY, zero)),
+                                         select(hits.entering, select(nearZ == tNear, nearNormalZ, zero), select(farZ == tFar, farNormalZ, zero))));
+    for(int i = 0; i < PacketSize; i++)
+    {
+        hits.material[i] = material;
+        hits.object[i] = this;
+    }
+    return retval;
+}
+
+Object * Box::transform(const Matrix & m) const
+{
+    if(m.x10 != 0 || m.x20 != 0 || m.x01 != 0 || m.x21 != 0 || m.x02 != 0 || m.x12 != 0)
+    {
+        return NULL;
+    }
+    // the rays are transformed by m so the box is transformed by the inverse
+    Matrix inv = invert(m);
+    Vector3D a = inv.apply(minCorner), b = inv.apply(maxCorner);
+    return new Box(Vector3D(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)), Vector3D(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)), material);
+}
+
+}
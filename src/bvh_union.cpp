@@ -0,0 +1,793 @@
+#include "bvh_union.h"
+#include "thread.h"
+#include <algorithm>
+
+namespace PathTrace
+{
+
+namespace
+{
+
+const int BinCount = 16;
+const float TraversalCost = 1;
+const float IntersectionCost = 2;
+const size_t ParallelBuildThreshold = 4096;
+const int MaxParallelBuildDepth = 4;
+
+float getComponent(const Vector3D & v, int axis)
+{
+    switch(axis)
+    {
+    case 0:
+        return v.x;
+    case 1:
+        return v.y;
+    default:
+        return v.z;
+    }
+}
+
+struct BuildItem
+{
+    BoundingBox bounds;
+    Vector3D centroid;
+    size_t index;
+};
+
+struct BuildNode
+{
+    BoundingBox bounds;
+    BuildNode * children[2];
+    size_t start, count;
+    BuildNode()
+        : start(0), count(0)
+    {
+        children[0] = NULL;
+        children[1] = NULL;
+    }
+    ~BuildNode()
+    {
+        delete children[0];
+        delete children[1];
+    }
+private:
+    BuildNode(const BuildNode &); // not implemented
+    const BuildNode & operator =(const BuildNode &); // not implemented
+};
+
+struct BuildTask
+{
+    BuildItem * items;
+    size_t start, end;
+    BuildNode * node;
+    int depth;
+    size_t maxLeafSize;
+};
+
+class BinPredicate
+{
+private:
+    int axis;
+    float minCentroid, binScale;
+    int split;
+public:
+    BinPredicate(int axis, float minCentroid, float binScale, int split)
+        : axis(axis), minCentroid(minCentroid), binScale(binScale), split(split)
+    {
+    }
+    static int getBin(float centroid, float minCentroid, float binScale)
+    {
+        int bin = (int)((centroid - minCentroid) * binScale);
+        return std::max(0, std::min(BinCount - 1, bin));
+    }
+    bool operator ()(const BuildItem & item) const
+    {
+        return getBin(getComponent(item.centroid, axis), minCentroid, binScale) < split;
+    }
+};
+
+void buildNode(BuildTask task);
+
+void buildThreadFn(BuildTask * task)
+{
+    buildNode(*task);
+}
+
+void buildNode(BuildTask task)
+{
+    BuildNode * node = task.node;
+    BuildItem * items = task.items;
+    BoundingBox bounds, centroidBounds;
+    for(size_t i = task.start; i < task.end; i++)
+    {
+        bounds = combine(bounds, items[i].bounds);
+        centroidBounds = combine(centroidBounds, items[i].centroid);
+    }
+    size_t count = task.end - task.start;
+    node->bounds = bounds;
+    node->start = task.start;
+    node->count = count;
+    if(count <= 1)
+    {
+        return;
+    }
+    Vector3D extent = centroidBounds.extent();
+    int axis = 0;
+    if(extent.y > extent.x)
+        axis = 1;
+    if(extent.z > getComponent(extent, axis))
+        axis = 2;
+    float minCentroid = getComponent(centroidBounds.minCorner, axis);
+    float width = getComponent(extent, axis);
+    size_t mid;
+    if(width <= 0)
+    {
+        if(count <= task.maxLeafSize)
+        {
+            return;
+        }
+        mid = task.start + count / 2;
+    }
+    else
+    {
+        float binScale = BinCount / width;
+        BoundingBox binBounds[BinCount];
+        size_t binCounts[BinCount];
+        for(int i = 0; i < BinCount; i++)
+        {
+            binCounts[i] = 0;
+        }
+        for(size_t i = task.start; i < task.end; i++)
+        {
+            int bin = BinPredicate::getBin(getComponent(items[i].centroid, axis), minCentroid, binScale);
+            binCounts[bin]++;
+            binBounds[bin] = combine(binBounds[bin], items[i].bounds);
+        }
+        float rightArea[BinCount];
+        size_t rightCount[BinCount];
+        BoundingBox accumulated;
+        size_t accumulatedCount = 0;
+        for(int i = BinCount - 1; i > 0; i--)
+        {
+            accumulated = combine(accumulated, binBounds[i]);
+            accumulatedCount += binCounts[i];
+            rightArea[i] = accumulated.surfaceArea();
+            rightCount[i] = accumulatedCount;
+        }
+        float parentArea = bounds.surfaceArea();
+        if(parentArea <= 0)
+            parentArea = 1;
+        float bestCost = max_value;
+        int bestSplit = -1;
+        accumulated = BoundingBox();
+        accumulatedCount = 0;
+        for(int split = 1; split < BinCount; split++)
+        {
+            accumulated = combine(accumulated, binBounds[split - 1]);
+            accumulatedCount += binCounts[split - 1];
+            if(accumulatedCount == 0 || rightCount[split] == 0)
+                continue;
+            float cost = TraversalCost + IntersectionCost * (accumulated.surfaceArea() * accumulatedCount + rightArea[split] * rightCount[split]) / parentArea;
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = split;
+            }
+        }
+        if(count <= task.maxLeafSize && (bestSplit == -1 || bestCost >= IntersectionCost * count))
+        {
+            return;
+        }
+        if(bestSplit == -1)
+        {
+            mid = task.start + count / 2;
+        }
+        else
+        {
+            mid = std::partition(items + task.start, items + task.end, BinPredicate(axis, minCentroid, binScale, bestSplit)) - items;
+            if(mid == task.start || mid == task.end)
+                mid = task.start + count / 2;
+        }
+    }
+    node->children[0] = new BuildNode;
+    node->children[1] = new BuildNode;
+    BuildTask left = {items, task.start, mid, node->children[0], task.depth + 1, task.maxLeafSize};
+    BuildTask right = {items, mid, task.end, node->children[1], task.depth + 1, task.maxLeafSize};
+    if(count >= ParallelBuildThreshold && task.depth < MaxParallelBuildDepth)
+    {
+        thread leftThread(buildThreadFn, &left);
+        buildNode(right);
+        leftThread.join();
+    }
+    else
+    {
+        buildNode(left);
+        buildNode(right);
+    }
+}
+
+size_t flatten(const BuildNode * buildNode, std::vector<BVHNode> & nodes)
+{
+    size_t index = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes[index].bounds = buildNode->bounds;
+    if(buildNode->children[0] == NULL)
+    {
+        nodes[index].start = buildNode->start;
+        nodes[index].count = buildNode->count;
+        return index;
+    }
+    flatten(buildNode->children[0], nodes);
+    size_t secondChild = flatten(buildNode->children[1], nodes);
+    nodes[index].start = secondChild;
+    nodes[index].count = 0;
+    return index;
+}
+
+}
+
+void buildBVH(const std::vector<BoundingBox> & bounds, std::vector<BVHNode> & nodes, std::vector<size_t> & order, size_t maxLeafSize)
+{
+    nodes.clear();
+    order.clear();
+    if(bounds.empty())
+    {
+        return;
+    }
+    std::vector<BuildItem> items(bounds.size());
+    for(size_t i = 0; i < bounds.size(); i++)
+    {
+        items[i].bounds = bounds[i];
+        items[i].centroid = bounds[i].center();
+        items[i].index = i;
+    }
+    BuildNode root;
+    BuildTask task = {&items[0], 0, items.size(), &root, 0, maxLeafSize};
+    buildNode(task);
+    flatten(&root, nodes);
+    order.resize(items.size());
+    for(size_t i = 0; i < items.size(); i++)
+    {
+        order[i] = items[i].index;
+    }
+}
+
+BVHUnion::BVHUnion(Object * const objects[], size_t count)
+{
+    build(objects, count);
+}
+
+BVHUnion::BVHUnion(const std::vector<Object *> & objects)
+{
+    build(objects.empty() ? NULL : &objects[0], objects.size());
+}
+
+void BVHUnion::build(Object * const objects[], size_t count)
+{
+    std::vector<Object *> boundedObjects;
+    std::vector<BoundingBox> objectBounds;
+    for(size_t i = 0; i < count; i++)
+    {
+        BoundingBox box = objects[i]->getBounds();
+        if(box.isEmpty())
+        {
+            delete objects[i]; // can't ever produce any spans
+            continue;
+        }
+        bounds = combine(bounds, box);
+        if(!box.isFinite())
+        {
+            unboundedObjects.push_back(objects[i]);
+            continue;
+        }
+        boundedObjects.push_back(objects[i]);
+        objectBounds.push_back(box);
+    }
+    std::vector<size_t> order;
+    buildBVH(objectBounds, nodes, order);
+    this->objects.reserve(order.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        this->objects.push_back(boundedObjects[order[i]]);
+    }
+}
+
+BVHUnion::~BVHUnion()
+{
+    for(size_t i = 0; i < objects.size(); i++)
+    {
+        delete objects[i];
+    }
+    for(size_t i = 0; i < unboundedObjects.size(); i++)
+    {
+        delete unboundedObjects[i];
+    }
+}
+
+void BVHUnion::getLights(std::vector<Light *> & lights) const
+{
+    for(size_t i = 0; i < objects.size(); i++)
+    {
+        objects[i]->getLights(lights);
+    }
+    for(size_t i = 0; i < unboundedObjects.size(); i++)
+    {
+        unboundedObjects[i]->getLights(lights);
+    }
+}
+
+Object * BVHUnion::duplicate() const
+{
+    std::vector<Object *> newObjects;
+    newObjects.reserve(objects.size() + unboundedObjects.size());
+    for(size_t i = 0; i < objects.size(); i++)
+    {
+        newObjects.push_back(objects[i]->duplicate());
+    }
+    for(size_t i = 0; i < unboundedObjects.size(); i++)
+    {
+        newObjects.push_back(unboundedObjects[i]->duplicate());
+    }
+    return new BVHUnion(newObjects);
+}
+
+Object * BVHUnion::transform(const Matrix &m) const
+{
+    std::vector<Object *> newObjects;
+    newObjects.reserve(objects.size() + unboundedObjects.size());
+    for(size_t i = 0; i < objects.size(); i++)
+    {
+        newObjects.push_back(PathTrace::transform(m, objects[i]));
+    }
+    for(size_t i = 0; i < unboundedObjects.size(); i++)
+    {
+        newObjects.push_back(PathTrace::transform(m, unboundedObjects[i]));
+    }
+    return new BVHUnion(newObjects);
+}
+
+namespace
+{
+
+/** a child span iterator of a union with the start of its current span */
+struct ActiveIterator
+{
+    float start;
+    SpanIterator * iterator;
+    /// orders the iterators so a heap has the one with the first span at the front
+    bool operator <(const ActiveIterator & rt) const
+    {
+        return start > rt.start;
+    }
+};
+
+class BVHUnionSpanIterator : public SpanIterator
+{
+public:
+    BVHUnionSpanIterator(const std::vector<BVHUnion::Node> & nodes, const std::vector<Object *> & objects, const std::vector<Object *> & unboundedObjects)
+        : nodes(nodes), objects(objects), iterators(objects.size(), (SpanIterator *)NULL)
+    {
+        for(size_t i = 0; i < unboundedObjects.size(); i++)
+        {
+            unboundedIterators.push_back(unboundedObjects[i]->makeSpanIterator());
+            adopt(unboundedIterators.back());
+        }
+        ended = true;
+    }
+
+    virtual void init(const Ray & ray)
+    {
+        active.clear();
+        for(size_t i = 0; i < unboundedIterators.size(); i++)
+        {
+            startIterator(unboundedIterators[i], ray);
+        }
+        if(!nodes.empty())
+        {
+            Vector3D invDir = BoundingBox::inverseDirection(ray.dir);
+            stack.clear();
+            stack.push_back(0);
+            while(!stack.empty())
+            {
+                const BVHUnion::Node & node = nodes[stack.back()];
+                size_t index = stack.back();
+                stack.pop_back();
+                float tNear, tFar;
+                if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar))
+                {
+                    continue;
+                }
+                if(node.count == 0)
+                {
+                    stack.push_back(node.start);
+                    stack.push_back(index + 1);
+                    continue;
+                }
+                for(size_t i = node.start; i < node.start + node.count; i++)
+                {
+                    // only make span iterators for objects that rays actually reach
+                    if(iterators[i] == NULL)
+                    {
+                        iterators[i] = objects[i]->makeSpanIterator();
+                        adopt(iterators[i]);
+                    }
+                    startIterator(iterators[i], ray);
+                }
+            }
+        }
+        std::make_heap(active.begin(), active.end());
+        ended = false;
+        next();
+    }
+
+    const Span & operator *() const
+    {
+        return resultSpan;
+    }
+
+    const Span * operator ->() const
+    {
+        return &resultSpan;
+    }
+
+    bool isAtEnd() const
+    {
+        return ended;
+    }
+
+    void next()
+    {
+        if(active.empty())
+        {
+            ended = true;
+            return;
+        }
+        resultSpan = **active.front().iterator;
+        advanceFirst();
+        // merge the spans that start before the result ends. when there are any they are all found in one pass
+        // and the heap is rebuilt, that is faster than taking them off the heap one at a time when many overlap
+        while(!active.empty() && active.front().start <= resultSpan.end)
+        {
+            for(size_t i = 0; i < active.size();)
+            {
+                if(active[i].start > resultSpan.end)
+                {
+                    i++;
+                    continue;
+                }
+                SpanIterator * iterator = active[i].iterator;
+                if((*iterator)->end > resultSpan.end)
+                {
+                    resultSpan.copyEndFromEnd(**iterator);
+                }
+                iterator->next();
+                if(*iterator)
+                {
+                    active[i].start = (*iterator)->start; // checked again
+                }
+                else
+                {
+                    active[i] = active.back();
+                    active.pop_back();
+                }
+            }
+            std::make_heap(active.begin(), active.end());
+        }
+    }
+
+    virtual ~BVHUnionSpanIterator()
+    {
+        for(size_t i = 0; i < iterators.size(); i++)
+        {
+            delete iterators[i];
+        }
+        for(size_t i = 0; i < unboundedIterators.size(); i++)
+        {
+            delete unboundedIterators[i];
+        }
+    }
+
+private:
+    void startIterator(SpanIterator * iterator, const Ray & ray)
+    {
+        iterator->init(ray);
+        if(*iterator)
+        {
+            ActiveIterator entry = {(*iterator)->start, iterator};
+            active.push_back(entry);
+        }
+    }
+
+    /// advances the iterator with the first span, removing it if it ended
+    void advanceFirst()
+    {
+        std::pop_heap(active.begin(), active.end());
+        SpanIterator * iterator = active.back().iterator;
+        iterator->next();
+        if(*iterator)
+        {
+            active.back().start = (*iterator)->start;
+            std::push_heap(active.begin(), active.end());
+        }
+        else
+        {
+            active.pop_back();
+        }
+    }
+
+    const std::vector<BVHUnion::Node> & nodes;
+    const std::vector<Object *> & objects;
+    std::vector<SpanIterator *> iterators;
+    std::vector<SpanIterator *> unboundedIterators;
+    std::vector<ActiveIterator> active; /// the iterators that haven't ended, a heap with the first span at the front
+    std::vector<size_t> stack;
+    Span resultSpan;
+    bool ended;
+};
+
+}
+
+SpanIterator * BVHUnion::makeSpanIterator() const
+{
+    return new BVHUnionSpanIterator(nodes, objects, unboundedObjects);
+}
+
+namespace
+{
+
+/** the children of a <code>BVHUnion</code> for <code>findUnionFirstHit</code> */
+class ChildLeaves
+{
+public:
+    typedef Hit Boundary;
+    ChildLeaves(const std::vector<Object *> & objects, const std::vector<Object *> & unboundedObjects)
+        : objects(objects), unboundedObjects(unboundedObjects)
+    {
+    }
+    void addLeaf(UnionFirstHitSearch<ChildLeaves> & search, size_t start, size_t count) const
+    {
+        for(size_t i = start; i < start + count; i++)
+        {
+            addObject(search, objects[i]);
+        }
+    }
+    void addUnbounded(UnionFirstHitSearch<ChildLeaves> & search) const
+    {
+        for(size_t i = 0; i < unboundedObjects.size(); i++)
+        {
+            addObject(search, unboundedObjects[i]);
+        }
+    }
+private:
+    static void addObject(UnionFirstHitSearch<ChildLeaves> & search, const Object * object)
+    {
+        Hit hit;
+        if(object->firstHit(search.ray, search.t, max_value, hit))
+        {
+            search.addBoundary(hit);
+        }
+    }
+    const std::vector<Object *> & objects;
+    const std::vector<Object *> & unboundedObjects;
+};
+
+}
+
+bool BVHUnion::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    return findUnionFirstHit(nodes, ChildLeaves(objects, unboundedObjects), ray, tmin, tmax, hit);
+}
+
+namespace
+{
+/** checks the objects in the nodes that a segment goes through, stopping at the first object on the segment */
+class OcclusionSearch
+{
+public:
+    OcclusionSearch(const std::vector<BVHUnion::Node> & nodes, const std::vector<Object *> & objects, const Ray & ray, float tmin, float tmax)
+        : nodes(nodes), objects(objects), ray(ray), invDir(BoundingBox::inverseDirection(ray.dir)), tmin(tmin), tmax(tmax)
+    {
+    }
+    bool occluded(size_t index) const
+    {
+        const BVHUnion::Node & node = nodes[index];
+        float tNear, tFar;
+        if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar) || tFar < tmin || tNear > tmax)
+        {
+            return false;
+        }
+        if(node.count > 0)
+        {
+            for(size_t i = node.start; i < node.start + node.count; i++)
+            {
+                if(objects[i]->occluded(ray, tmin, tmax))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return occluded(index + 1) || occluded(node.start);
+    }
+private:
+    const std::vector<BVHUnion::Node> & nodes;
+    const std::vector<Object *> & objects;
+    const Ray & ray;
+    const Vector3D invDir;
+    const float tmin, tmax;
+};
+}
+
+bool BVHUnion::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    for(size_t i = 0; i < unboundedObjects.size(); i++)
+    {
+        if(unboundedObjects[i]->occluded(ray, tmin, tmax))
+        {
+            return true;
+        }
+    }
+    return !nodes.empty() && OcclusionSearch(nodes, objects, ray, tmin, tmax).occluded(0);
+}
+
+namespace
+{
+/** the same as <code>UnionFirstHitSearch</code> for a packet of rays, visiting nodes that any of the rays enter */
+class PacketFirstHitSearch
+{
+public:
+    PacketFirstHitSearch(const std::vector<BVHUnion::Node> & nodes, const std::vector<Object *> & objects, const RayPacket & rays, FloatPacket t, FloatPacket tmax)
+        : nodes(nodes), objects(objects), rays(rays), t(t), limit(tmax), found(false), hasEntering(false), hasExiting(false), maxExitT(-2 * max_value)
+    {
+        float invDirs[3][PacketSize];
+        for(int i = 0; i < PacketSize; i++)
+        {
+            Vector3D invDir = BoundingBox::inverseDirection(rays.dir.get(i));
+            invDirs[0][i] = invDir.x;
+            invDirs[1][i] = invDir.y;
+            invDirs[2][i] = invDir.z;
+        }
+        this->invDir = VectorPacket(FloatPacket::load(invDirs[0]), FloatPacket::load(invDirs[1]), FloatPacket::load(invDirs[2]));
+    }
+    /** @return the rays in <code>active</code> that enter <code>bounds</code> before their current limit */
+    MaskPacket intersects(const BoundingBox & bounds, MaskPacket active, FloatPacket & tNear) const
+    {
+        FloatPacket tx0 = (FloatPacket(bounds.minCorner.x) - rays.origin.x) * invDir.x, tx1 = (FloatPacket(bounds.maxCorner.x) - rays.origin.x) * invDir.x;
+        FloatPacket ty0 = (FloatPacket(bounds.minCorner.y) - rays.origin.y) * invDir.y, ty1 = (FloatPacket(bounds.maxCorner.y) - rays.origin.y) * invDir.y;
+        FloatPacket tz0 = (FloatPacket(bounds.minCorner.z) - rays.origin.z) * invDir.z, tz1 = (FloatPacket(bounds.maxCorner.z) - rays.origin.z) * invDir.z;
+        tNear = max(FloatPacket(-max_value), max(min(tx0, tx1), max(min(ty0, ty1), min(tz0, tz1))));
+        FloatPacket tFar = min(FloatPacket(max_value), min(max(tx0, tx1), min(max(ty0, ty1), max(tz0, tz1))));
+        return active & (tNear <= tFar) & (tFar >= t) & (tNear <= limit);
+    }
+    void addObject(const Object * object, MaskPacket active)
+    {
+        RayPacket activeRays = rays;
+        activeRays.active = active;
+        HitPacket hit;
+        MaskPacket hasHit = object->firstHitPacket(activeRays, t, FloatPacket(max_value), hit) & active;
+        addHits(hit, hasHit);
+    }
+    void addHits(const HitPacket & hit, MaskPacket hasHit)
+    {
+        if(!any(hasHit))
+        {
+            return;
+        }
+        MaskPacket newMaxExit = hasHit & ~hit.entering & (hit.t > maxExitT);
+        maxExitT = select(newMaxExit, hit.t, maxExitT);
+        maxExitHit.merge(newMaxExit, hit);
+        MaskPacket useHit = hasHit & (hit.t <= limit);
+        MaskPacket reset = useHit & (~found | (hit.t < limit));
+        found = found | reset;
+        limit = select(reset, hit.t, limit);
+        hasEntering = hasEntering & ~reset;
+        hasExiting = hasExiting & ~reset;
+        MaskPacket entering = useHit & hit.entering;
+        MaskPacket exiting = useHit & ~hit.entering;
+        hasEntering = hasEntering | entering;
+        hasExiting = hasExiting | exiting;
+        enteringHit.merge(entering, hit);
+        exitingHit.merge(exiting, hit);
+    }
+    void addNode(size_t index, MaskPacket active)
+    {
+        const BVHUnion::Node & node = nodes[index];
+        if(node.count > 0)
+        {
+            for(size_t i = node.start; i < node.start + node.count; i++)
+            {
+                addObject(objects[i], active);
+            }
+            return;
+        }
+        size_t first = index + 1, second = node.start;
+        FloatPacket firstNear, secondNear;
+        MaskPacket hitFirst = intersects(nodes[first].bounds, active, firstNear);
+        MaskPacket hitSecond = intersects(nodes[second].bounds, active, secondNear);
+        // visit the child that is closer for most of the rays first
+        MaskPacket both = hitFirst & hitSecond;
+        int secondCloser = (both & (secondNear < firstNear)).bits(), firstCloser = (both & ~(secondNear < firstNear)).bits();
+        if(countBits(secondCloser) > countBits(firstCloser))
+        {
+            std::swap(first, second);
+            std::swap(hitFirst, hitSecond);
+        }
+        if(any(hitFirst))
+        {
+            addNode(first, hitFirst);
+        }
+        // the limits may have moved closer
+        hitSecond = intersects(nodes[second].bounds, hitSecond, secondNear);
+        if(any(hitSecond))
+        {
+            addNode(second, hitSecond);
+        }
+    }
+    static int countBits(int v)
+    {
+        int retval = 0;
+        for(; v != 0; v &= v - 1)
+        {
+            retval++;
+        }
+        return retval;
+    }
+    const std::vector<BVHUnion::Node> & nodes;
+    const std::vector<Object *> & objects;
+    const RayPacket & rays;
+    VectorPacket invDir;
+    const FloatPacket t;
+    FloatPacket limit;
+    MaskPacket found, hasEntering, hasExiting;
+    HitPacket enteringHit, exitingHit;
+    FloatPacket maxExitT;
+    HitPacket maxExitHit;
+};
+}
+
+MaskPacket BVHUnion::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    FloatPacket t = tmin;
+    MaskPacket retval = MaskPacket(false);
+    MaskPacket active = rays.active & (t <= tmax);
+    HitPacket pendingExit; // kept for the next search, the same as findUnionFirstHit
+    pendingExit.t = FloatPacket(max_value);
+    pendingExit.normal = VectorPacket(Vector3D(0));
+    pendingExit.entering = MaskPacket(false);
+    MaskPacket hasPendingExit = MaskPacket(false);
+    while(any(active))
+    {
+        PacketFirstHitSearch search(nodes, objects, rays, t, tmax);
+        search.addHits(pendingExit, hasPendingExit & active);
+        for(size_t i = 0; i < unboundedObjects.size(); i++)
+        {
+            search.addObject(unboundedObjects[i], active);
+        }
+        if(!nodes.empty())
+        {
+            FloatPacket rootNear;
+            MaskPacket hitRoot = search.intersects(nodes[0].bounds, active, rootNear);
+            if(any(hitRoot))
+            {
+                search.addNode(0, hitRoot);
+            }
+        }
+        active = active & search.found;
+        FloatPacket bestT = search.limit;
+        MaskPacket skip = active & (search.maxExitT > bestT); // inside a child until maxExitT
+        MaskPacket touching = active & (search.maxExitT == bestT);
+        MaskPacket step = touching & search.hasEntering; // one child starts where another ends
+        MaskPacket exiting = touching & ~search.hasEntering;
+        MaskPacket entering = active & (search.maxExitT < bestT);
+        hits.merge(exiting, search.exitingHit);
+        hits.merge(entering, search.enteringHit);
+        retval = retval | exiting | entering;
+        t = select(skip, search.maxExitT, select(step, nextFloatUp(bestT), t));
+        pendingExit.merge(skip, search.maxExitHit);
+        hasPendingExit = skip;
+        active = (skip | step) & (t <= tmax);
+    }
+    return retval;
+}
+
+}
@@ -0,0 +1,271 @@
+#include "cone.h"
+
+namespace PathTrace
+{
+
+Cone::Cone(Vector3D base, float baseRadius, Vector3D top, float topRadius, const Material * material)
+    : base(base), top(top), baseRadius(baseRadius), topRadius(topRadius), material(material->duplicate())
+{
+    assert(baseRadius >= 0 && topRadius >= 0);
+    length = abs(top - base);
+    assert(length > 0);
+    axis = (top - base) / length;
+    slope = (topRadius - baseRadius) / length;
+}
+
+Cone::~Cone()
+{
+    material->release();
+}
+
+namespace
+{
+/** clips <code>[start, end]</code> to <code>[clipStart, clipEnd]</code>, keeping track of which face each end is on */
+inline void clipSpan(float & start, float & end, unsigned & startFace, unsigned & endFace, float clipStart, float clipEnd, unsigned clipStartFace, unsigned clipEndFace)
+{
+    if(clipStart > start)
+    {
+        start = clipStart;
+        startFace = clipStartFace;
+    }
+    if(clipEnd < end)
+    {
+        end = clipEnd;
+        endFace = clipEndFace;
+    }
+}
+}
+
+bool Cone::intersect(const Ray & ray, float & start, float & end, unsigned & startFace, unsigned & endFace) const
+{
+    Vector3D origin = ray.origin - base;
+    float s = dot(origin, axis), ds = dot(ray.dir, axis);
+    // the slab between the caps
+    float slabStart = -max_value, slabEnd = max_value;
+    unsigned slabStartFace = BaseCap, slabEndFace = TopCap;
+    if(ds == 0)
+    {
+        if(s < 0 || s > length)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        slabStart = -s / ds;
+        slabEnd = (length - s) / ds;
+        if(slabStart > slabEnd)
+        {
+            std::swap(slabStart, slabEnd);
+            std::swap(slabStartFace, slabEndFace);
+        }
+    }
+    // the side : |perpendicular part|^2 - radius^2 = a * t^2 + 2 * b * t + c <= 0
+    Vector3D originPerpendicular = origin - axis * s, dirPerpendicular = ray.dir - axis * ds;
+    float r = baseRadius + slope * s;
+    float a = abs_squared(dirPerpendicular) - slope * slope * ds * ds;
+    float b = dot(originPerpendicular, dirPerpendicular) - slope * ds * r;
+    float c = abs_squared(originPerpendicular) - r * r;
+    start = -max_value;
+    end = max_value;
+    startFace = endFace = Side;
+    if(a == 0)
+    {
+        if(b == 0)
+        {
+            if(c > 0)
+            {
+                return false;
+            }
+        }
+        else if(b > 0)
+        {
+            end = -c / (2 * b);
+        }
+        else
+        {
+            start = -c / (2 * b);
+        }
+    }
+    else
+    {
+        float discriminant = b * b - a * c;
+        if(discriminant <= 0)
+        {
+            if(a > 0)
+            {
+                return false;
+            }
+            // the line is inside the quadric everywhere
+        }
+        else
+        {
+            float q = -(b + (b < 0 ? -1 : 1) * std::sqrt(discriminant));
+            float t0 = q / a, t1 = c / q;
+            if(t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            if(a > 0)
+            {
+                start = t0;
+                end = t1;
+            }
+            else if(t0 >= slabStart)
+            {
+                // the line goes through both halves of the double cone, only one half is between the caps
+                end = t0;
+            }
+            else
+            {
+                start = t1;
+            }
+        }
+    }
+    clipSpan(start, end, startFace, endFace, slabStart, slabEnd, slabStartFace, slabEndFace);
+    return start < end;
+}
+
+Vector3D Cone::getNormal(unsigned face, Vector3D position) const
+{
+    switch(face)
+    {
+    case BaseCap:
+        return -axis;
+    case TopCap:
+        return axis;
+    default:
+    {
+        Vector3D relative = position - base;
+        float s = dot(relative, axis);
+        return relative - axis * s - axis * (slope * (baseRadius + slope * s));
+    }
+    }
+}
+
+namespace
+{
+
+class ConeSpanIterator : public SpanIterator
+{
+public:
+    explicit ConeSpanIterator(const Cone & cone, const Material * material)
+        : cone(cone), material(material), ray(Vector3D(0), Vector3D(1, 0, 0))
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+        ended = true;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        ended = !cone.intersect(ray, theSpan.start, theSpan.end, theSpan.startBoundary.index, theSpan.endBoundary.index);
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        ended = true;
+    }
+    virtual ~ConeSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return cone.getNormal(index, ray.getPoint(t));
+    }
+
+private:
+    Span theSpan;
+    bool ended;
+    const Cone & cone;
+    const Material * const material;
+    Ray ray;
+};
+}
+
+SpanIterator * Cone::makeSpanIterator() const
+{
+    return new ConeSpanIterator(*this, material);
+}
+
+bool Cone::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float start, end;
+    unsigned startFace, endFace, face;
+    if(!intersect(ray, start, end, startFace, endFace))
+    {
+        return false;
+    }
+    if(start >= tmin)
+    {
+        hit.t = start;
+        hit.entering = true;
+        face = startFace;
+    }
+    else if(end >= tmin)
+    {
+        hit.t = end;
+        hit.entering = false;
+        face = endFace;
+    }
+    else
+    {
+        return false;
+    }
+    if(hit.t > tmax)
+    {
+        return false;
+    }
+    hit.normal = normalize(getNormal(face, ray.getPoint(hit.t)));
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+Object * Cone::transform(const Matrix & m) const
+{
+    float scale;
+    if(!m.isSimilarity(scale))
+    {
+        return NULL;
+    }
+    // the rays are transformed by m so the cone is transformed by the inverse
+    Matrix inv = invert(m);
+    return new Cone(inv.apply(base), baseRadius / scale, inv.apply(top), topRadius / scale, material);
+}
+
+namespace
+{
+/** @return the bounds of a disc */
+BoundingBox getDiscBounds(Vector3D center, Vector3D normal, float r)
+{
+    Vector3D extent(r * std::sqrt(std::max(0.0f, 1 - normal.x * normal.x)),
+                    r * std::sqrt(std::max(0.0f, 1 - normal.y * normal.y)),
+                    r * std::sqrt(std::max(0.0f, 1 - normal.z * normal.z)));
+    return BoundingBox(center - extent, center + extent);
+}
+}
+
+BoundingBox Cone::getBounds() const
+{
+    return combine(getDiscBounds(base, axis, baseRadius), getDiscBounds(top, axis, topRadius));
+}
+
+}
@@ -0,0 +1,70 @@
+#include "csg.h"
+#include <algorithm>
+
+namespace PathTrace
+{
+
+bool csgFirstHit(CSGOperation operation, const Object * a, const Object * b, const Ray & ray, float tmin, float tmax, Hit & hit)
+{
+    return inlineCSGFirstHit(operation, *a, *b, ray, tmin, tmax, hit);
+}
+
+MaskPacket csgFirstHitPacket(CSGOperation operation, const Object * a, const Object * b, const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits)
+{
+    FloatPacket t = tmin;
+    MaskPacket retval = MaskPacket(false);
+    RayPacket activeRays = rays;
+    activeRays.active = rays.active & (t <= tmax);
+    while(any(activeRays.active))
+    {
+        HitPacket hitA, hitB;
+        MaskPacket hasA = a->firstHitPacket(activeRays, t, FloatPacket(max_value), hitA) & activeRays.active;
+        if(operation != CSGUnion)
+        {
+            activeRays.active = hasA; // never inside a again
+            if(!any(activeRays.active))
+            {
+                break;
+            }
+        }
+        MaskPacket hasB = b->firstHitPacket(activeRays, t, FloatPacket(max_value), hitB) & activeRays.active;
+        MaskPacket done;
+        if(operation != CSGIntersection)
+        {
+            done = activeRays.active & hasA & ~hasB & (hitA.t <= tmax); // outside b for the rest of the ray
+            hits.merge(done, hitA);
+            retval = retval | done;
+        }
+        if(operation == CSGUnion)
+        {
+            done = activeRays.active & hasB & ~hasA & (hitB.t <= tmax);
+            hits.merge(done, hitB);
+            retval = retval | done;
+        }
+        FloatPacket eventT = min(hitA.t, hitB.t);
+        activeRays.active = activeRays.active & hasA & hasB & (eventT <= tmax);
+        MaskPacket inA = ~hitA.entering, inB = ~hitB.entering;
+        MaskPacket atA = hitA.t == eventT, atB = hitB.t == eventT;
+        MaskPacket afterA = inA ^ atA, afterB = inB ^ atB;
+        MaskPacket before = csgContains(operation, inA, inB);
+        MaskPacket after = csgContains(operation, afterA, afterB);
+        MaskPacket changed = activeRays.active & (before ^ after);
+        if(any(changed))
+        {
+            MaskPacket useA = atA & (csgContains(operation, afterA, inB) ^ before);
+            if(operation == CSGDifference)
+            {
+                hitB.normal = -hitB.normal;
+            }
+            hitB.merge(useA, hitA);
+            hitB.entering = after;
+            hits.merge(changed, hitB);
+            retval = retval | changed;
+            activeRays.active = activeRays.active & ~changed;
+        }
+        t = select(activeRays.active, nextFloatUp(eventT), t);
+    }
+    return retval;
+}
+
+}
@@ -0,0 +1,201 @@
+#include "csg_optimizer.h"
+#include "union.h"
+#include "intersection.h"
+#include "difference.h"
+#include "bvh_union.h"
+#include <sstream>
+
+namespace PathTrace
+{
+
+CSGOptimizer::CSGOptimizer(std::vector<std::string> * changes)
+    : changes(changes)
+{
+}
+
+void CSGOptimizer::report(const std::string & change)
+{
+    if(changes)
+    {
+        changes->push_back(change);
+    }
+}
+
+Object * CSGOptimizer::makeEmpty()
+{
+    return new BVHUnion(std::vector<Object *>());
+}
+
+Object * CSGOptimizer::optimize(Object * o, const BoundingBox & clip)
+{
+    BoundingBox bounds = o->getBounds();
+    if(intersect(bounds, clip).isEmpty())
+    {
+        if(dynamic_cast<Intersection *>(o) && !bounds.isEmpty())
+        {
+            report("removed an intersection that is outside of where it is used");
+        }
+        else if(dynamic_cast<Intersection *>(o))
+        {
+            report("removed an intersection whose operands don't overlap");
+        }
+        else if(!bounds.isEmpty())
+        {
+            report("removed an object that is outside of where it is used");
+        }
+        delete o;
+        return makeEmpty();
+    }
+    if(dynamic_cast<Union *>(o) || dynamic_cast<BVHUnion *>(o))
+    {
+        return optimizeUnion(o, clip);
+    }
+    if(dynamic_cast<Intersection *>(o))
+    {
+        return optimizeIntersection(o, clip);
+    }
+    if(dynamic_cast<Difference *>(o))
+    {
+        return optimizeDifference(o, clip);
+    }
+    if(TransformedObject * transformed = dynamic_cast<TransformedObject *>(o))
+    {
+        transformed->o = optimize(transformed->o, PathTrace::transform(transformed->m, clip));
+        return transformed;
+    }
+    return o;
+}
+
+bool CSGOptimizer::splitUnion(Object * o, std::vector<Object *> & objects)
+{
+    if(Union * u = dynamic_cast<Union *>(o))
+    {
+        objects.push_back(u->a);
+        objects.push_back(u->b);
+        u->a = NULL;
+        u->b = NULL;
+        delete u;
+        return true;
+    }
+    if(BVHUnion * u = dynamic_cast<BVHUnion *>(o))
+    {
+        objects.insert(objects.end(), u->objects.begin(), u->objects.end());
+        objects.insert(objects.end(), u->unboundedObjects.begin(), u->unboundedObjects.end());
+        u->objects.clear();
+        u->unboundedObjects.clear();
+        delete u;
+        return true;
+    }
+    return false;
+}
+
+size_t CSGOptimizer::collectUnion(Object * o, const BoundingBox & clip, std::vector<Object *> & objects)
+{
+    std::vector<Object *> children;
+    splitUnion(o, children);
+    size_t retval = 1;
+    for(size_t i = 0; i < children.size(); i++)
+    {
+        if(dynamic_cast<Union *>(children[i]) || dynamic_cast<BVHUnion *>(children[i]))
+        {
+            retval += collectUnion(children[i], clip, objects);
+            continue;
+        }
+        Object * child = optimize(children[i], clip);
+        if(child->getBounds().isEmpty())
+        {
+            delete child;
+            continue;
+        }
+        // the optimized object is a union if it was reduced to one of its operands, its objects are already optimized
+        if(splitUnion(child, objects))
+        {
+            retval++;
+        }
+        else
+        {
+            objects.push_back(child);
+        }
+    }
+    return retval;
+}
+
+Object * CSGOptimizer::optimizeUnion(Object * o, const BoundingBox & clip)
+{
+    std::vector<Object *> objects;
+    size_t unionCount = collectUnion(o, clip, objects);
+    if(unionCount > 1)
+    {
+        std::ostringstream ss;
+        ss << "merged " << unionCount << " nested unions into one union of " << objects.size() << " objects";
+        report(ss.str());
+    }
+    switch(objects.size())
+    {
+    case 0:
+        return makeEmpty();
+    case 1:
+        return objects[0];
+    case 2:
+        return new Union(objects[0], objects[1]);
+    default:
+        return new BVHUnion(objects);
+    }
+}
+
+Object * CSGOptimizer::optimizeIntersection(Object * o, const BoundingBox & clip)
+{
+    Intersection * intersection = dynamic_cast<Intersection *>(o);
+    Object * a = intersection->a, * b = intersection->b;
+    intersection->a = NULL;
+    intersection->b = NULL;
+    delete intersection;
+    // each operand is only used inside the other one
+    a = optimize(a, intersect(clip, b->getBounds()));
+    b = optimize(b, intersect(clip, a->getBounds()));
+    if(a->getBounds().isEmpty() || b->getBounds().isEmpty())
+    {
+        report("removed an intersection with an operand that is empty");
+        delete a;
+        delete b;
+        return makeEmpty();
+    }
+    if(b->getBounds().surfaceArea() < a->getBounds().surfaceArea())
+    {
+        report("swapped the operands of an intersection so the smaller one is tested first");
+        std::swap(a, b);
+    }
+    return new Intersection(a, b);
+}
+
+Object * CSGOptimizer::optimizeDifference(Object * o, const BoundingBox & clip)
+{
+    Difference * difference = dynamic_cast<Difference *>(o);
+    Object * a = difference->a, * b = difference->b;
+    difference->a = NULL;
+    difference->b = NULL;
+    delete difference;
+    a = optimize(a, clip);
+    if(a->getBounds().isEmpty())
+    {
+        report("removed a difference whose minuend is empty");
+        delete b;
+        return a;
+    }
+    // the subtrahend is only used inside the minuend
+    b = optimize(b, intersect(clip, a->getBounds()));
+    if(b->getBounds().isEmpty())
+    {
+        report("removed a difference whose subtrahend doesn't touch the minuend");
+        delete b;
+        return a;
+    }
+    return new Difference(a, b);
+}
+
+Object * optimizeCSG(Object * o, std::vector<std::string> * changes)
+{
+    return CSGOptimizer(changes).optimize(o, BoundingBox::infinite());
+}
+
+}
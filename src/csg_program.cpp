@@ -0,0 +1,360 @@
+#include "csg_program.h"
+#include "sphere.h"
+#include "plane.h"
+
+namespace PathTrace
+{
+
+const size_t CSGProgram::MaxPrimitiveCount;
+const CSGProgram::BoundaryReference CSGProgram::ReversedNormal;
+
+CSGProgram::CSGProgram()
+    : stackSize(0)
+{
+}
+
+bool CSGProgram::addPrimitive(Opcode opcode, Vector3D position, float value, const Material * material, const Object * object)
+{
+    if(primitives.size() >= MaxPrimitiveCount)
+    {
+        return false;
+    }
+    Primitive primitive;
+    primitive.type = opcode;
+    primitive.position = position;
+    primitive.value = value;
+    primitive.material = material;
+    primitive.object = object;
+    primitive.transformed = !transforms.empty();
+    if(primitive.transformed)
+    {
+        primitive.m = transforms.back();
+        primitive.normalMatrix = primitive.m.transposeNoTranslate();
+    }
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.operation = CSGUnion;
+    instruction.primitive = (unsigned)primitives.size();
+    primitives.push_back(primitive);
+    instructions.push_back(instruction);
+    stackSize++;
+    return true;
+}
+
+bool CSGProgram::addSphere(Vector3D center, float r, const Material * material, const Object * object)
+{
+    return addPrimitive(OpSphere, center, r * r, material, object);
+}
+
+bool CSGProgram::addPlane(Vector3D normal, float d, const Material * material, const Object * object)
+{
+    return addPrimitive(OpPlane, normal, d, material, object);
+}
+
+bool CSGProgram::addOperation(CSGOperation operation)
+{
+    if(stackSize < 2)
+    {
+        return false;
+    }
+    Instruction instruction;
+    instruction.opcode = OpCombine;
+    instruction.operation = operation;
+    instruction.primitive = 0;
+    instructions.push_back(instruction);
+    stackSize--;
+    return true;
+}
+
+void CSGProgram::pushTransform(const Matrix & m)
+{
+    // the outer transforms are applied to the ray first
+    transforms.push_back(transforms.empty() ? m : transforms.back().concat(m));
+}
+
+void CSGProgram::popTransform()
+{
+    transforms.pop_back();
+}
+
+namespace
+{
+/** combines the sorted span lists <code>a</code> and <code>b</code> like the span iterators of the CSG objects
+ * @return the number of spans written to <code>result</code> */
+size_t combine(CSGOperation operation, const CSGProgram::ProgramSpan * a, size_t countA, const CSGProgram::ProgramSpan * b, size_t countB, CSGProgram::ProgramSpan * result)
+{
+    size_t count = 0, indexA = 0, indexB = 0;
+    bool inA = false, inB = false, inResult = false;
+    for(;;)
+    {
+        bool hasA = indexA < countA, hasB = indexB < countB;
+        if(!hasA && !hasB)
+        {
+            return count;
+        }
+        float tA = hasA ? (inA ? a[indexA].end : a[indexA].start) : 0;
+        float tB = hasB ? (inB ? b[indexB].end : b[indexB].start) : 0;
+        // at the same t spans start before others end so touching spans are joined
+        bool useA = hasA && (!hasB || tA < tB || (tA == tB && (!inA || inB)));
+        float t;
+        CSGProgram::BoundaryReference boundary;
+        if(useA)
+        {
+            t = tA;
+            boundary = inA ? a[indexA].endBoundary : a[indexA].startBoundary;
+            if(inA)
+            {
+                indexA++;
+            }
+            inA = !inA;
+        }
+        else
+        {
+            t = tB;
+            boundary = inB ? b[indexB].endBoundary : b[indexB].startBoundary;
+            if(inB)
+            {
+                indexB++;
+            }
+            inB = !inB;
+            if(operation == CSGDifference)
+            {
+                boundary ^= CSGProgram::ReversedNormal; // the inside of b is the outside of the result
+            }
+        }
+        bool inside = csgContains(operation, inA, inB);
+        if(inside == inResult)
+        {
+            continue;
+        }
+        inResult = inside;
+        if(inside)
+        {
+            result[count].start = t;
+            result[count].startBoundary = boundary;
+            continue;
+        }
+        result[count].end = t;
+        result[count].endBoundary = boundary;
+        if(result[count].end > result[count].start)
+        {
+            count++;
+        }
+    }
+}
+}
+
+void CSGProgram::evaluate(const Ray & ray, Result & result) const
+{
+    ProgramSpan scratch[MaxPrimitiveCount];
+    size_t listStart[MaxPrimitiveCount];
+    size_t listCount = 0;
+    size_t & spanCount = result.count;
+    spanCount = 0;
+    for(size_t i = 0; i < instructions.size(); i++)
+    {
+        const Instruction & instruction = instructions[i];
+        if(instruction.opcode == OpCombine)
+        {
+            size_t startA = listStart[listCount - 2], startB = listStart[listCount - 1];
+            size_t count = combine(instruction.operation, &result.spans[startA], startB - startA, &result.spans[startB], spanCount - startB, scratch);
+            for(size_t j = 0; j < count; j++)
+            {
+                result.spans[startA + j] = scratch[j];
+            }
+            spanCount = startA + count;
+            listCount--;
+            continue;
+        }
+        listStart[listCount++] = spanCount;
+        const Primitive & primitive = primitives[instruction.primitive];
+        Ray primitiveRay = primitive.transformed ? PathTrace::transform(primitive.m, ray) : ray;
+        ProgramSpan & span = result.spans[spanCount];
+        bool hit;
+        if(instruction.opcode == OpSphere)
+        {
+            hit = intersectSphere(primitiveRay, primitive.position, primitive.value, span.start, span.end);
+        }
+        else
+        {
+            hit = intersectPlane(primitiveRay, primitive.position, primitive.value, span.start, span.end);
+        }
+        if(hit)
+        {
+            span.startBoundary = instruction.primitive;
+            span.endBoundary = instruction.primitive;
+            spanCount++;
+        }
+    }
+}
+
+void CSGProgram::getBoundary(const Ray & ray, float t, BoundaryReference boundary, Vector3D & normal, const Material *& material, const Object *& object) const
+{
+    const Primitive & primitive = primitives[boundary & ~ReversedNormal];
+    if(primitive.type == OpSphere)
+    {
+        Ray primitiveRay = primitive.transformed ? PathTrace::transform(primitive.m, ray) : ray;
+        normal = normalize(primitiveRay.getPoint(t) - primitive.position);
+    }
+    else
+    {
+        normal = normalize(primitive.position);
+    }
+    if(primitive.transformed)
+    {
+        normal = normalize(primitive.normalMatrix.applyNoTranslate(normal));
+    }
+    if(boundary & ReversedNormal)
+    {
+        normal = -normal;
+    }
+    material = primitive.material;
+    object = primitive.object;
+}
+
+CompiledCSG::CompiledCSG(Object * o, const CSGProgram & program)
+    : o(o), program(program)
+{
+}
+
+CompiledCSG::~CompiledCSG()
+{
+    delete o;
+}
+
+namespace
+{
+
+class CompiledCSGSpanIterator : public SpanIterator
+{
+public:
+    explicit CompiledCSGSpanIterator(const CSGProgram & program)
+        : program(program), index(0), ray(Vector3D(0), Vector3D(1, 0, 0))
+    {
+        result.count = 0;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        program.evaluate(ray, result);
+        index = 0;
+        calcSpan();
+    }
+    virtual const Span & operator *() const
+    {
+        return span;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &span;
+    }
+    virtual bool isAtEnd() const
+    {
+        return index >= result.count;
+    }
+    virtual void next()
+    {
+        index++;
+        calcSpan();
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return program.getMaterial(index);
+    }
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        Vector3D normal;
+        const Material * material;
+        const Object * object;
+        program.getBoundary(ray, t, index, normal, material, object);
+        return normal;
+    }
+private:
+    void calcSpan()
+    {
+        if(isAtEnd())
+        {
+            return;
+        }
+        const CSGProgram::ProgramSpan & programSpan = result.spans[index];
+        span.start = programSpan.start;
+        span.end = programSpan.end;
+        span.startBoundary.source = this;
+        span.startBoundary.index = programSpan.startBoundary;
+        span.endBoundary.source = this;
+        span.endBoundary.index = programSpan.endBoundary;
+    }
+    const CSGProgram & program;
+    CSGProgram::Result result;
+    size_t index;
+    Ray ray;
+    Span span;
+};
+
+}
+
+SpanIterator * CompiledCSG::makeSpanIterator() const
+{
+    return new CompiledCSGSpanIterator(program);
+}
+
+bool CompiledCSG::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    CSGProgram::Result result;
+    program.evaluate(ray, result);
+    for(size_t i = 0; i < result.count; i++)
+    {
+        const CSGProgram::ProgramSpan & span = result.spans[i];
+        CSGProgram::BoundaryReference boundary;
+        if(span.start > tmax)
+        {
+            return false;
+        }
+        if(span.start >= tmin)
+        {
+            hit.t = span.start;
+            hit.entering = true;
+            boundary = span.startBoundary;
+        }
+        else if(span.end > tmax)
+        {
+            return false;
+        }
+        else if(span.end >= tmin)
+        {
+            hit.t = span.end;
+            hit.entering = false;
+            boundary = span.endBoundary;
+        }
+        else
+        {
+            continue;
+        }
+        program.getBoundary(ray, hit.t, boundary, hit.normal, hit.material, hit.object);
+        return true;
+    }
+    return false;
+}
+
+Object * CompiledCSG::duplicate() const
+{
+    return new CompiledCSG(o->duplicate(), program);
+}
+
+Object * CompiledCSG::transform(const Matrix & m) const
+{
+    return compileCSG(PathTrace::transform(m, o));
+}
+
+Object * compileCSG(Object * o)
+{
+    CSGProgram program;
+    if(!o->compile(program) || !program.isComplete())
+    {
+        return o;
+    }
+    return new CompiledCSG(o, program);
+}
+
+}
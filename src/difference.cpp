@@ -1,4 +1,5 @@
 #include "difference.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
@@ -51,6 +52,8 @@ public:
     DifferenceSpanIterator(SpanIterator * spanIteratorA, SpanIterator * spanIteratorB)
         : spanIteratorA(*spanIteratorA), spanIteratorB(*spanIteratorB)
     {
+        adopt(spanIteratorA);
+        adopt(spanIteratorB);
         ended = true;
     }
 
@@ -125,7 +128,7 @@ public:
             {
                 if(spanA.end > spanB.end)
                 {
-                    spanA.copyEndFromStart(spanB);
+                    spanA.copyStartFromEnd(spanB);
                     nextB();
                     continue;
                 }
@@ -154,4 +157,8 @@ SpanIterator * Difference::makeSpanIterator() const
     return new DifferenceSpanIterator(a->makeSpanIterator(), b->makeSpanIterator());
 }
 
+bool Difference::compile(CSGProgram & program) const
+{
+    return a->compile(program) && b->compile(program) && program.addOperation(CSGDifference);
+}
 }
@@ -0,0 +1,553 @@
+#include "heightfield.h"
+#include "reference_counted.h"
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+/** the heights and the quadtree of a <code>Heightfield</code>, shared by its copies */
+struct HeightfieldData : public ReferenceCounted
+{
+    unsigned width, depth; /// the number of samples along x and z
+    std::vector<float> heights; /// the world space heights, a row of <code>width</code> samples for each z
+    /// the lowest and highest heights in each block of each level of the quadtree, level 0 has a block for each cell
+    std::vector<std::vector<float> > minHeights, maxHeights;
+    std::vector<unsigned> levelWidth, levelDepth; /// the number of blocks along x and z in each level
+    BoundingBox bounds;
+    float cellWidth, cellDepth; /// the size of a cell along x and z
+    float getHeight(unsigned x, unsigned z) const
+    {
+        return heights[x + (size_t)z * width];
+    }
+    unsigned getCellCount() const
+    {
+        return (width - 1) * (depth - 1);
+    }
+};
+
+namespace
+{
+/// the boundaries where the terrain is cut off by the bounds are <code>ClippedFace + face</code>,
+/// the faces are -x, +x, -y, +y, -z, +z. the other boundaries are <code>2 * cell + triangle</code>
+const unsigned ClippedFace = 0x7FFFFFF0U;
+
+void buildQuadtree(HeightfieldData & data)
+{
+    unsigned w = data.width - 1, d = data.depth - 1;
+    data.levelWidth.push_back(w);
+    data.levelDepth.push_back(d);
+    data.minHeights.push_back(std::vector<float>((size_t)w * d));
+    data.maxHeights.push_back(std::vector<float>((size_t)w * d));
+    for(unsigned z = 0; z < d; z++)
+    {
+        for(unsigned x = 0; x < w; x++)
+        {
+            float h00 = data.getHeight(x, z), h10 = data.getHeight(x + 1, z);
+            float h01 = data.getHeight(x, z + 1), h11 = data.getHeight(x + 1, z + 1);
+            data.minHeights[0][x + (size_t)z * w] = std::min(std::min(h00, h10), std::min(h01, h11));
+            data.maxHeights[0][x + (size_t)z * w] = std::max(std::max(h00, h10), std::max(h01, h11));
+        }
+    }
+    while(w > 1 || d > 1)
+    {
+        const std::vector<float> & childMin = data.minHeights.back(), & childMax = data.maxHeights.back();
+        unsigned childWidth = w, childDepth = d;
+        w = (w + 1) / 2;
+        d = (d + 1) / 2;
+        std::vector<float> minHeights((size_t)w * d, max_value), maxHeights((size_t)w * d, -max_value);
+        for(unsigned z = 0; z < childDepth; z++)
+        {
+            for(unsigned x = 0; x < childWidth; x++)
+            {
+                size_t parent = x / 2 + (size_t)(z / 2) * w, child = x + (size_t)z * childWidth;
+                minHeights[parent] = std::min(minHeights[parent], childMin[child]);
+                maxHeights[parent] = std::max(maxHeights[parent], childMax[child]);
+            }
+        }
+        data.minHeights.push_back(minHeights);
+        data.maxHeights.push_back(maxHeights);
+        data.levelWidth.push_back(w);
+        data.levelDepth.push_back(d);
+    }
+}
+
+/** receives the boundaries found by <code>Traversal</code> in order */
+class BoundarySink
+{
+public:
+    /** @return if the traversal should go on */
+    virtual bool add(float t, bool entering, unsigned index) = 0;
+    virtual ~BoundarySink()
+    {
+    }
+};
+
+/** walks the quadtree of a heightfield front to back along a ray, keeping track of whether the ray is in the ground */
+class Traversal
+{
+public:
+    Traversal(const HeightfieldData & data, const Ray & ray, BoundarySink & sink)
+        : data(data), ray(ray), invDir(BoundingBox::inverseDirection(ray.dir)), sink(sink), inside(false)
+    {
+    }
+    /** finds the boundaries from <code>tStart</code> to <code>tEnd</code>, the first is where the line enters the
+     * terrain or the bounds if it starts in the ground at the bounds */
+    void run(float tStart, float tEnd)
+    {
+        float tNear, tFar;
+        unsigned nearFace, farFace;
+        if(!clipToBounds(tNear, tFar, nearFace, farFace))
+        {
+            return;
+        }
+        float t0 = std::max(tNear, tStart), t1 = std::min(tFar, tEnd);
+        if(t0 > t1)
+        {
+            return;
+        }
+        Vector3D p = ray.getPoint(t0);
+        unsigned index;
+        inside = getHeightAt(p, index) > p.y;
+        if(inside && t0 == tNear && !sink.add(tNear, true, ClippedFace + nearFace))
+        {
+            return;
+        }
+        unsigned level = (unsigned)data.minHeights.size() - 1;
+        if(!visit(level, 0, 0, t0, t1))
+        {
+            return;
+        }
+        if(inside && t1 == tFar)
+        {
+            sink.add(tFar, false, ClippedFace + farFace);
+        }
+    }
+private:
+    bool clipToBounds(float & tNear, float & tFar, unsigned & nearFace, unsigned & farFace) const
+    {
+        tNear = -max_value;
+        tFar = max_value;
+        nearFace = farFace = 0;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float origin = axis == 0 ? ray.origin.x : axis == 1 ? ray.origin.y : ray.origin.z;
+            float inverse = axis == 0 ? invDir.x : axis == 1 ? invDir.y : invDir.z;
+            float lo = axis == 0 ? data.bounds.minCorner.x : axis == 1 ? data.bounds.minCorner.y : data.bounds.minCorner.z;
+            float hi = axis == 0 ? data.bounds.maxCorner.x : axis == 1 ? data.bounds.maxCorner.y : data.bounds.maxCorner.z;
+            float t0 = (lo - origin) * inverse, t1 = (hi - origin) * inverse;
+            unsigned face0 = 2 * axis, face1 = 2 * axis + 1;
+            if(t0 > t1)
+            {
+                std::swap(t0, t1);
+                std::swap(face0, face1);
+            }
+            if(t0 > tNear)
+            {
+                tNear = t0;
+                nearFace = face0;
+            }
+            if(t1 < tFar)
+            {
+                tFar = t1;
+                farFace = face1;
+            }
+        }
+        return tNear <= tFar;
+    }
+    /** @return the height of the surface above <code>p</code>, <code>index</code> is set to the triangle there */
+    float getHeightAt(Vector3D p, unsigned & index) const
+    {
+        float u = (p.x - data.bounds.minCorner.x) / data.cellWidth, v = (p.z - data.bounds.minCorner.z) / data.cellDepth;
+        unsigned x = (unsigned)std::min(std::max(std::floor(u), 0.0f), (float)(data.width - 2));
+        unsigned z = (unsigned)std::min(std::max(std::floor(v), 0.0f), (float)(data.depth - 2));
+        u -= x;
+        v -= z;
+        return getTriangleHeight(x, z, u, v, index);
+    }
+    /** @return the height of the surface at <code>(u, v)</code> in cell <code>(x, z)</code>, <code>index</code> is set to the triangle there */
+    float getTriangleHeight(unsigned x, unsigned z, float u, float v, unsigned & index) const
+    {
+        unsigned cell = x + z * (data.width - 1);
+        if(u + v <= 1)
+        {
+            index = 2 * cell;
+            float h00 = data.getHeight(x, z);
+            return h00 + (data.getHeight(x + 1, z) - h00) * u + (data.getHeight(x, z + 1) - h00) * v;
+        }
+        index = 2 * cell + 1;
+        float h11 = data.getHeight(x + 1, z + 1);
+        return h11 + (data.getHeight(x, z + 1) - h11) * (1 - u) + (data.getHeight(x + 1, z) - h11) * (1 - v);
+    }
+    /** moves to <code>t</code> where the ray is known to be in the ground or not */
+    bool setInside(bool newInside, float t, unsigned index)
+    {
+        if(newInside == inside)
+        {
+            return true;
+        }
+        inside = newInside;
+        return sink.add(t, newInside, index);
+    }
+    /** intersects the part of the ray in a triangle of cell <code>(x, z)</code> */
+    bool visitPiece(unsigned x, unsigned z, float ta, float tb)
+    {
+        Vector3D pa = ray.getPoint(ta), pb = ray.getPoint(tb);
+        float ua = (pa.x - data.bounds.minCorner.x) / data.cellWidth - x, va = (pa.z - data.bounds.minCorner.z) / data.cellDepth - z;
+        float ub = (pb.x - data.bounds.minCorner.x) / data.cellWidth - x, vb = (pb.z - data.bounds.minCorner.z) / data.cellDepth - z;
+        // pick the triangle at the middle so rounding at the diagonal doesn't matter
+        unsigned index;
+        getTriangleHeight(x, z, 0.5f * (ua + ub), 0.5f * (va + vb), index);
+        bool upper = (index & 1) != 0;
+        float ga, gb;
+        if(upper)
+        {
+            float h11 = data.getHeight(x + 1, z + 1), dx = data.getHeight(x, z + 1) - h11, dz = data.getHeight(x + 1, z) - h11;
+            ga = h11 + dx * (1 - ua) + dz * (1 - va) - pa.y;
+            gb = h11 + dx * (1 - ub) + dz * (1 - vb) - pb.y;
+        }
+        else
+        {
+            float h00 = data.getHeight(x, z), dx = data.getHeight(x + 1, z) - h00, dz = data.getHeight(x, z + 1) - h00;
+            ga = h00 + dx * ua + dz * va - pa.y;
+            gb = h00 + dx * ub + dz * vb - pb.y;
+        }
+        bool insideAtEnd = gb > 0;
+        if(insideAtEnd == inside)
+        {
+            return true;
+        }
+        float t = ta;
+        if((ga > 0) != insideAtEnd)
+        {
+            t = ta + (tb - ta) * (ga / (ga - gb));
+        }
+        return setInside(insideAtEnd, t, index);
+    }
+    bool visitCell(unsigned x, unsigned z, float ta, float tb)
+    {
+        // split where the ray crosses the diagonal u + v = 1
+        float sa = (ray.getPoint(ta).x - data.bounds.minCorner.x) / data.cellWidth - x + (ray.getPoint(ta).z - data.bounds.minCorner.z) / data.cellDepth - z - 1;
+        float sb = (ray.getPoint(tb).x - data.bounds.minCorner.x) / data.cellWidth - x + (ray.getPoint(tb).z - data.bounds.minCorner.z) / data.cellDepth - z - 1;
+        if((sa < 0) != (sb < 0))
+        {
+            float tm = ta + (tb - ta) * (sa / (sa - sb));
+            return visitPiece(x, z, ta, tm) && visitPiece(x, z, tm, tb);
+        }
+        return visitPiece(x, z, ta, tb);
+    }
+    /** @return the ray parameters where the ray is over cells <code>[x0, x1) x [z0, z1)</code>, clipped to <code>[ta, tb]</code> */
+    bool clipToCells(unsigned x0, unsigned x1, unsigned z0, unsigned z1, float & ta, float & tb) const
+    {
+        float tx0 = (data.bounds.minCorner.x + x0 * data.cellWidth - ray.origin.x) * invDir.x;
+        float tx1 = (data.bounds.minCorner.x + x1 * data.cellWidth - ray.origin.x) * invDir.x;
+        float tz0 = (data.bounds.minCorner.z + z0 * data.cellDepth - ray.origin.z) * invDir.z;
+        float tz1 = (data.bounds.minCorner.z + z1 * data.cellDepth - ray.origin.z) * invDir.z;
+        ta = std::max(ta, std::max(std::min(tx0, tx1), std::min(tz0, tz1)));
+        tb = std::min(tb, std::min(std::max(tx0, tx1), std::max(tz0, tz1)));
+        return ta <= tb;
+    }
+    struct Child
+    {
+        unsigned x, z;
+        float ta, tb;
+        bool operator <(const Child & rt) const
+        {
+            return ta < rt.ta;
+        }
+    };
+    /** visits block <code>(x, z)</code> of <code>level</code> where the ray is over it from <code>ta</code> to <code>tb</code>
+     * @return if the traversal should go on */
+    bool visit(unsigned level, unsigned x, unsigned z, float ta, float tb)
+    {
+        size_t block = x + (size_t)z * data.levelWidth[level];
+        float ya = ray.origin.y + ray.dir.y * ta, yb = ray.origin.y + ray.dir.y * tb;
+        if(std::min(ya, yb) > data.maxHeights[level][block])
+        {
+            unsigned index;
+            getHeightAt(ray.getPoint(ta), index);
+            return setInside(false, ta, index);
+        }
+        if(std::max(ya, yb) < data.minHeights[level][block])
+        {
+            unsigned index;
+            getHeightAt(ray.getPoint(ta), index);
+            return setInside(true, ta, index);
+        }
+        if(level == 0)
+        {
+            return visitCell(x, z, ta, tb);
+        }
+        Child children[4];
+        int childCount = 0;
+        unsigned childLevel = level - 1, cellsX = data.width - 1, cellsZ = data.depth - 1;
+        for(unsigned cz = 2 * z; cz < 2 * z + 2 && cz < data.levelDepth[childLevel]; cz++)
+        {
+            for(unsigned cx = 2 * x; cx < 2 * x + 2 && cx < data.levelWidth[childLevel]; cx++)
+            {
+                Child & child = children[childCount];
+                child.x = cx;
+                child.z = cz;
+                child.ta = ta;
+                child.tb = tb;
+                unsigned x0 = cx << childLevel, z0 = cz << childLevel;
+                if(clipToCells(x0, std::min((cx + 1) << childLevel, cellsX), z0, std::min((cz + 1) << childLevel, cellsZ), child.ta, child.tb))
+                {
+                    childCount++;
+                }
+            }
+        }
+        // insertion sort, there are at most 4 children
+        for(int i = 1; i < childCount; i++)
+        {
+            Child child = children[i];
+            int j = i;
+            for(; j > 0 && child < children[j - 1]; j--)
+            {
+                children[j] = children[j - 1];
+            }
+            children[j] = child;
+        }
+        for(int i = 0; i < childCount; i++)
+        {
+            if(!visit(childLevel, children[i].x, children[i].z, children[i].ta, children[i].tb))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    const HeightfieldData & data;
+    const Ray & ray;
+    const Vector3D invDir;
+    BoundarySink & sink;
+    bool inside;
+};
+
+/** a boundary of a heightfield along a ray */
+struct Boundary
+{
+    float t;
+    unsigned index;
+};
+
+class CollectingSink : public BoundarySink
+{
+public:
+    explicit CollectingSink(std::vector<Boundary> & boundaries)
+        : boundaries(boundaries)
+    {
+    }
+    virtual bool add(float t, bool entering, unsigned index)
+    {
+        Boundary boundary;
+        boundary.t = t;
+        boundary.index = index;
+        boundaries.push_back(boundary); // the boundaries alternate between entering and leaving
+        return true;
+    }
+    std::vector<Boundary> & boundaries;
+};
+
+class FirstSink : public BoundarySink
+{
+public:
+    FirstSink()
+        : found(false)
+    {
+    }
+    virtual bool add(float t, bool entering, unsigned index)
+    {
+        found = true;
+        this->t = t;
+        this->entering = entering;
+        this->index = index;
+        return false;
+    }
+    bool found;
+    float t;
+    bool entering;
+    unsigned index;
+};
+
+class HeightfieldSpanIterator : public SpanIterator
+{
+public:
+    HeightfieldSpanIterator(const Heightfield & heightfield, const HeightfieldData & data, const Material * material)
+        : heightfield(heightfield), data(data), material(material), nextBoundary(0)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+    }
+    virtual void init(const Ray & ray)
+    {
+        boundaries.clear();
+        CollectingSink sink(boundaries);
+        Traversal(data, ray, sink).run(-max_value, max_value);
+        nextBoundary = 0;
+        next();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return nextBoundary > boundaries.size();
+    }
+    virtual void next()
+    {
+        for(; nextBoundary + 1 < boundaries.size(); nextBoundary += 2)
+        {
+            theSpan.start = boundaries[nextBoundary].t;
+            theSpan.startBoundary.index = boundaries[nextBoundary].index;
+            theSpan.end = boundaries[nextBoundary + 1].t;
+            theSpan.endBoundary.index = boundaries[nextBoundary + 1].index;
+            if(!theSpan.isEmpty())
+            {
+                nextBoundary += 2;
+                return;
+            }
+        }
+        nextBoundary = boundaries.size() + 1;
+    }
+    virtual ~HeightfieldSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return heightfield.getNormal(index);
+    }
+
+private:
+    Span theSpan;
+    const Heightfield & heightfield;
+    const HeightfieldData & data;
+    const Material * const material;
+    std::vector<Boundary> boundaries;
+    size_t nextBoundary;
+};
+}
+
+Heightfield::Heightfield(const Image & image, Vector3D minCorner, Vector3D maxCorner, const Material * material)
+    : data(new HeightfieldData), material(material)
+{
+    if(!image || image.width() < 2 || image.height() < 2)
+    {
+        delete data;
+        throw std::runtime_error("heightfield image must be at least 2 by 2 pixels");
+    }
+    data->width = image.width();
+    data->depth = image.height();
+    data->heights.resize((size_t)data->width * data->depth);
+    float highest = minCorner.y;
+    for(unsigned z = 0; z < data->depth; z++)
+    {
+        for(unsigned x = 0; x < data->width; x++)
+        {
+            Color c = image.getPixel(x, z);
+            float h = minCorner.y + (maxCorner.y - minCorner.y) * std::max(0.0f, (c.x + c.y + c.z) * (1.0f / 3.0f));
+            data->heights[x + (size_t)z * data->width] = h;
+            highest = std::max(highest, h);
+        }
+    }
+    data->bounds = BoundingBox(minCorner, Vector3D(maxCorner.x, highest, maxCorner.z));
+    data->cellWidth = (maxCorner.x - minCorner.x) / (data->width - 1);
+    data->cellDepth = (maxCorner.z - minCorner.z) / (data->depth - 1);
+    buildQuadtree(*data);
+    material->duplicate(); // added last since the destructor doesn't run if the constructor throws
+}
+
+Heightfield::Heightfield(HeightfieldData * data, const Material * material)
+    : data(data), material(material->duplicate())
+{
+    data->addReference();
+}
+
+Heightfield::~Heightfield()
+{
+    data->removeReference();
+    material->release();
+}
+
+Object * Heightfield::duplicate() const
+{
+    return new Heightfield(data, material);
+}
+
+BoundingBox Heightfield::getBounds() const
+{
+    return data->bounds;
+}
+
+Vector3D Heightfield::getNormal(unsigned index) const
+{
+    if(index >= ClippedFace)
+    {
+        unsigned face = index - ClippedFace;
+        Vector3D retval(0);
+        float sign = (face & 1) ? 1 : -1;
+        switch(face / 2)
+        {
+        case 0:
+            retval.x = sign;
+            break;
+        case 1:
+            retval.y = sign;
+            break;
+        default:
+            retval.z = sign;
+            break;
+        }
+        return retval;
+    }
+    unsigned cell = index / 2, x = cell % (data->width - 1), z = cell / (data->width - 1);
+    float slopeX, slopeZ;
+    if(index & 1)
+    {
+        float h11 = data->getHeight(x + 1, z + 1);
+        slopeX = h11 - data->getHeight(x, z + 1);
+        slopeZ = h11 - data->getHeight(x + 1, z);
+    }
+    else
+    {
+        float h00 = data->getHeight(x, z);
+        slopeX = data->getHeight(x + 1, z) - h00;
+        slopeZ = data->getHeight(x, z + 1) - h00;
+    }
+    return Vector3D(-slopeX / data->cellWidth, 1, -slopeZ / data->cellDepth);
+}
+
+SpanIterator * Heightfield::makeSpanIterator() const
+{
+    return new HeightfieldSpanIterator(*this, *data, material);
+}
+
+bool Heightfield::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    FirstSink sink;
+    Traversal(*data, ray, sink).run(tmin, tmax);
+    if(!sink.found)
+    {
+        return false;
+    }
+    hit.t = std::max(sink.t, tmin);
+    hit.entering = sink.entering;
+    hit.normal = normalize(getNormal(sink.index));
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+}
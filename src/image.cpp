@@ -363,6 +363,30 @@ const Image & Image::operator =(const Image & rt)
     return *this;
 }
 
+size_t Image::hashPixels(const float * data, unsigned w, unsigned h)
+{
+    size_t retval = PathTrace::hashCombine(w, h);
+    for(size_t i = 0; i < (size_t)FloatsPerPixel * w * h; i++)
+    {
+        retval = PathTrace::hashCombine(retval, PathTrace::hashFloat(data[i]));
+    }
+    return retval;
+}
+
+bool Image::hasSamePixels(const Image & rt) const
+{
+    if(data == rt.data)
+        return true;
+    if(!data || !rt.data || data->hash != rt.data->hash || data->w != rt.data->w || data->h != rt.data->h)
+        return false;
+    for(size_t i = 0; i < (size_t)FloatsPerPixel * data->w * data->h; i++)
+    {
+        if(data->data[i] != rt.data->data[i])
+            return false;
+    }
+    return true;
+}
+
 Color Image::getPixel(int x, int y) const
 {
     if(!data)
@@ -0,0 +1,64 @@
+#include "instance.h"
+#include "bvh_union.h"
+
+namespace PathTrace
+{
+
+Instance::Instance(const Matrix & m, const Prototype * prototype)
+    : m(m), normalMatrix(m.transposeNoTranslate()), prototype(prototype)
+{
+    prototype->addReference();
+}
+
+Instance::~Instance()
+{
+    prototype->removeReference();
+}
+
+SpanIterator * Instance::makeSpanIterator() const
+{
+    return new TransformedSpanIterator(m, normalMatrix, prototype->get().makeSpanIterator());
+}
+
+bool Instance::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    if(!prototype->get().firstHit(PathTrace::transform(m, ray), tmin, tmax, hit))
+    {
+        return false;
+    }
+    hit.normal = normalize(normalMatrix.applyNoTranslate(hit.normal));
+    return true;
+}
+
+bool Instance::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    return prototype->get().occluded(PathTrace::transform(m, ray), tmin, tmax);
+}
+
+MaskPacket Instance::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    MaskPacket retval = prototype->get().firstHitPacket(PathTrace::transform(m, rays), tmin, tmax, hits);
+    if(any(retval))
+    {
+        hits.normal = normalize(applyNoTranslate(normalMatrix, hits.normal));
+    }
+    return retval;
+}
+
+BoundingBox Instance::getBounds() const
+{
+    return PathTrace::transform(invert(m), prototype->getBounds());
+}
+
+Object * makeInstances(const Prototype * prototype, const std::vector<Matrix> & transforms)
+{
+    std::vector<Object *> instances;
+    instances.reserve(transforms.size());
+    for(size_t i = 0; i < transforms.size(); i++)
+    {
+        instances.push_back(new Instance(transforms[i], prototype));
+    }
+    return new BVHUnion(instances);
+}
+
+}
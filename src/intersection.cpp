@@ -1,4 +1,5 @@
 #include "intersection.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
@@ -51,6 +52,8 @@ public:
     IntersectionSpanIterator(SpanIterator * spanIteratorA, SpanIterator * spanIteratorB)
         : spanIteratorA(*spanIteratorA), spanIteratorB(*spanIteratorB)
     {
+        adopt(spanIteratorA);
+        adopt(spanIteratorB);
         ended = true;
     }
 
@@ -149,4 +152,8 @@ SpanIterator * Intersection::makeSpanIterator() const
     return new IntersectionSpanIterator(a->makeSpanIterator(), b->makeSpanIterator());
 }
 
+bool Intersection::compile(CSGProgram & program) const
+{
+    return a->compile(program) && b->compile(program) && program.addOperation(CSGIntersection);
+}
 }
@@ -0,0 +1,560 @@
+#include "light.h"
+#include <cmath>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+namespace
+{
+const float Pi = M_PI;
+
+float emittedLuminance(const Material * material, Vector3D pos)
+{
+    return std::max(0.0f, material->emissive->getFloat(pos));
+}
+
+/** makes <code>u</code> and <code>v</code> perpendicular to the normalized vector <code>w</code> and each other */
+void makeBasis(Vector3D w, Vector3D & u, Vector3D & v)
+{
+    Vector3D a = std::abs(w.x) > 0.9f ? Vector3D(0, 1, 0) : Vector3D(1, 0, 0);
+    u = normalize(cross(a, w));
+    v = cross(w, u);
+}
+
+/** @return a direction with <code>dot(direction, w) == cosTheta</code> */
+Vector3D makeDirection(Vector3D w, float cosTheta, float phi)
+{
+    Vector3D u, v;
+    makeBasis(w, u, v);
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    return normalize(cosTheta * w + sinTheta * std::cos(phi) * u + sinTheta * std::sin(phi) * v);
+}
+
+class CompareCenters
+{
+public:
+    CompareCenters(const std::vector<Light *> & lights, int axis)
+        : lights(lights), axis(axis)
+    {
+    }
+    bool operator ()(size_t a, size_t b) const
+    {
+        return get(lights[a]->getBounds().center()) < get(lights[b]->getBounds().center());
+    }
+private:
+    float get(Vector3D v) const
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+    const std::vector<Light *> & lights;
+    int axis;
+};
+}
+
+SphereLight::SphereLight(Vector3D center, float r, const Material * material, const Object * object)
+    : center(center), r(r), object(object)
+{
+    float luminance = emittedLuminance(material, center + Vector3D(r, 0, 0)) + emittedLuminance(material, center - Vector3D(r, 0, 0))
+                      + emittedLuminance(material, center + Vector3D(0, r, 0)) + emittedLuminance(material, center - Vector3D(0, r, 0))
+                      + emittedLuminance(material, center + Vector3D(0, 0, r)) + emittedLuminance(material, center - Vector3D(0, 0, r));
+    power = luminance / 6 * 4 * Pi * r * r * Pi;
+}
+
+bool SphereLight::sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const
+{
+    Vector3D toCenter = center - x;
+    float distanceSquared = abs_squared(toCenter);
+    if(distanceSquared <= r * r * (1 + eps))
+    {
+        // inside or on the sphere : pick a point on the surface
+        float z = 1 - 2 * u1;
+        float s = std::sqrt(std::max(0.0f, 1 - z * z));
+        Vector3D normal = Vector3D(s * std::cos(2 * Pi * u2), s * std::sin(2 * Pi * u2), z);
+        Vector3D toPoint = center + r * normal - x;
+        float pointDistanceSquared = abs_squared(toPoint);
+        if(pointDistanceSquared <= 0)
+        {
+            return false;
+        }
+        dir = toPoint / std::sqrt(pointDistanceSquared);
+        float cosine = std::abs(dot(normal, dir));
+        if(cosine < 1e-6f)
+        {
+            return false;
+        }
+        pdf = pointDistanceSquared / (cosine * 4 * Pi * r * r);
+        return true;
+    }
+    // pick a direction in the cone the sphere covers
+    float sinSquared = r * r / distanceSquared;
+    float cosMax = std::sqrt(std::max(0.0f, 1 - sinSquared));
+    float oneMinusCosMax = sinSquared / (1 + cosMax);
+    dir = makeDirection(toCenter / std::sqrt(distanceSquared), 1 - u1 * oneMinusCosMax, 2 * Pi * u2);
+    pdf = 1 / (2 * Pi * oneMinusCosMax);
+    return true;
+}
+
+float SphereLight::pdf(Vector3D x, Vector3D dir) const
+{
+    Vector3D toCenter = center - x;
+    float distanceSquared = abs_squared(toCenter);
+    if(distanceSquared <= r * r * (1 + eps))
+    {
+        float b = dot(-toCenter, dir);
+        float discriminant = b * b - (distanceSquared - r * r);
+        if(discriminant < 0)
+        {
+            return 0;
+        }
+        float t = -b + std::sqrt(discriminant);
+        if(t <= 0)
+        {
+            return 0;
+        }
+        Vector3D normal = (x + t * dir - center) / r;
+        float cosine = std::abs(dot(normal, dir));
+        if(cosine < 1e-6f)
+        {
+            return 0;
+        }
+        return t * t / (cosine * 4 * Pi * r * r);
+    }
+    float sinSquared = r * r / distanceSquared;
+    float cosMax = std::sqrt(std::max(0.0f, 1 - sinSquared));
+    if(dot(dir, toCenter) < cosMax * std::sqrt(distanceSquared))
+    {
+        return 0;
+    }
+    return 1 / (2 * Pi * (sinSquared / (1 + cosMax)));
+}
+
+PlaneLight::PlaneLight(Vector3D normal, float d, const Material * material, const Object * object)
+    : material(material), object(object)
+{
+    float length = abs(normal);
+    this->normal = normal / length;
+    this->d = d / length;
+    power = emittedLuminance(material, -this->d * this->normal);
+}
+
+bool PlaneLight::sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const
+{
+    float distance = dot(normal, x) + d;
+    if(std::abs(distance) < eps)
+    {
+        return false;
+    }
+    // pick a direction uniformly from the hemisphere facing the plane
+    dir = makeDirection(distance > 0 ? -normal : normal, u1, 2 * Pi * u2);
+    pdf = 1 / (2 * Pi);
+    return true;
+}
+
+float PlaneLight::pdf(Vector3D x, Vector3D dir) const
+{
+    float distance = dot(normal, x) + d;
+    if(std::abs(distance) < eps || dot(dir, normal) * distance >= 0)
+    {
+        return 0;
+    }
+    return 1 / (2 * Pi);
+}
+
+const Material * PlaneLight::getEnvironmentMaterial() const
+{
+    unsigned width, height;
+    if(material->emissive->getImageSize(width, height))
+    {
+        return material;
+    }
+    return NULL;
+}
+
+const unsigned EnvironmentLight::MaxWidth, EnvironmentLight::MinWidth;
+
+EnvironmentLight::EnvironmentLight(const Material * material, const std::vector<Vector3D> & normals, const std::vector<float> & ds)
+    : normals(normals), ds(ds)
+{
+    unsigned imageWidth = 0, imageHeight = 0;
+    material->emissive->getImageSize(imageWidth, imageHeight);
+    width = (int)std::min(MaxWidth, std::max(MinWidth, std::max(imageWidth, imageHeight)));
+    height = width / 2;
+    values.resize((size_t)width * height);
+    columnCdf.resize((size_t)(width + 1) * height);
+    rowCdf.resize(height + 1);
+    double total = 0;
+    rowCdf[0] = 0;
+    for(int y = 0; y < height; y++)
+    {
+        float sinTheta = std::sin(Pi * (y + 0.5f) / height);
+        double rowTotal = 0;
+        columnCdf[(size_t)(width + 1) * y] = 0;
+        for(int x = 0; x < width; x++)
+        {
+            // average 2x2 samples in each cell so small bright spots like the sun aren't missed
+            float luminance = 0;
+            for(int i = 0; i < 4; i++)
+            {
+                float theta = Pi * (y + 0.25f + 0.5f * (i / 2)) / height;
+                float phi = 2 * Pi * (x + 0.25f + 0.5f * (i % 2)) / width;
+                Vector3D dir = Vector3D(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+                Vector3D point, normal;
+                if(findSkyPoint(Vector3D(0, 0, 0), dir, point, normal))
+                {
+                    luminance += emittedLuminance(material, point);
+                }
+            }
+            float value = luminance * 0.25f * sinTheta;
+            values[(size_t)width * y + x] = value;
+            rowTotal += value;
+            columnCdf[(size_t)(width + 1) * y + x + 1] = (float)rowTotal;
+        }
+        for(int x = 1; x <= width; x++)
+        {
+            float & cdf = columnCdf[(size_t)(width + 1) * y + x];
+            cdf = rowTotal > 0 ? (float)(cdf / rowTotal) : (float)x / width;
+        }
+        total += rowTotal;
+        rowCdf[y + 1] = (float)total;
+    }
+    for(int y = 1; y <= height; y++)
+    {
+        rowCdf[y] = total > 0 ? (float)(rowCdf[y] / total) : (float)y / height;
+    }
+    average = (float)(total / ((double)width * height));
+    power = average;
+}
+
+namespace
+{
+/** picks an entry of a piecewise constant distribution
+ *
+ * @param cdf
+ *            the <code>count + 1</code> values of the cumulative distribution, starting with 0 and ending with 1
+ * @param u
+ *            a random number in <code>[0, 1)</code>, replaced with the position in the picked entry
+ * @return the index of the entry picked */
+int sampleCdf(const float * cdf, int count, float & u)
+{
+    int index = (int)(std::upper_bound(cdf, cdf + count + 1, u) - cdf) - 1;
+    index = std::max(0, std::min(count - 1, index));
+    float size = cdf[index + 1] - cdf[index];
+    u = size > 0 ? std::min(1.0f, std::max(0.0f, (u - cdf[index]) / size)) : 0.5f;
+    return index;
+}
+}
+
+bool EnvironmentLight::findSkyPoint(Vector3D origin, Vector3D dir, Vector3D & point, Vector3D & normal) const
+{
+    float closest = max_value;
+    for(size_t i = 0; i < normals.size(); i++)
+    {
+        float divisor = dot(normals[i], dir);
+        if(divisor == 0)
+        {
+            continue;
+        }
+        float t = -(dot(normals[i], origin) + ds[i]) / divisor;
+        if(t > 0 && t < closest)
+        {
+            closest = t;
+            normal = normals[i];
+        }
+    }
+    if(closest >= max_value)
+    {
+        return false;
+    }
+    point = origin + closest * dir;
+    return true;
+}
+
+float EnvironmentLight::tablePdf(Vector3D dir) const
+{
+    float cosTheta = std::max(-1.0f, std::min(1.0f, dir.z));
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    if(sinTheta <= 0)
+    {
+        return 0;
+    }
+    float phi = std::atan2(dir.y, dir.x);
+    if(phi < 0)
+    {
+        phi += 2 * Pi;
+    }
+    int x = std::max(0, std::min(width - 1, (int)(phi / (2 * Pi) * width)));
+    int y = std::max(0, std::min(height - 1, (int)(std::acos(cosTheta) / Pi * height)));
+    return values[(size_t)width * y + x] / average / (2 * Pi * Pi * sinTheta);
+}
+
+float EnvironmentLight::solidAngleFactor(Vector3D x, Vector3D point, Vector3D normal)
+{
+    // solid angle from the origin -> area on the plane -> solid angle from x
+    Vector3D toPoint = point - x;
+    float distanceSquared = abs_squared(toPoint);
+    float cosineFromX = std::abs(dot(normal, toPoint));
+    if(distanceSquared <= 0 || cosineFromX <= 0)
+    {
+        return 0;
+    }
+    float cosineFromOrigin = std::abs(dot(normal, point));
+    float pointDistanceSquared = abs_squared(point);
+    return cosineFromOrigin * distanceSquared * std::sqrt(distanceSquared) / (cosineFromX * pointDistanceSquared * std::sqrt(pointDistanceSquared));
+}
+
+bool EnvironmentLight::sample(Vector3D x, float u1, float u2, Vector3D & dir, float & pdf) const
+{
+    if(!(average > 0))
+    {
+        return false;
+    }
+    int y = sampleCdf(&rowCdf[0], height, u2);
+    int x0 = sampleCdf(&columnCdf[(size_t)(width + 1) * y], width, u1);
+    float value = values[(size_t)width * y + x0];
+    float theta = Pi * (y + u2) / height;
+    float phi = 2 * Pi * (x0 + u1) / width;
+    float sinTheta = std::sin(theta);
+    if(value <= 0 || sinTheta <= 0)
+    {
+        return false;
+    }
+    Vector3D point, normal;
+    if(!findSkyPoint(Vector3D(0, 0, 0), Vector3D(sinTheta * std::cos(phi), sinTheta * std::sin(phi), std::cos(theta)), point, normal))
+    {
+        return false;
+    }
+    dir = normalize(point - x);
+    pdf = value / average / (2 * Pi * Pi * sinTheta) * solidAngleFactor(x, point, normal);
+    return pdf > 0;
+}
+
+float EnvironmentLight::pdf(Vector3D x, Vector3D dir) const
+{
+    if(!(average > 0))
+    {
+        return 0;
+    }
+    Vector3D point, normal;
+    if(!findSkyPoint(x, dir, point, normal))
+    {
+        return 0;
+    }
+    return tablePdf(normalize(point)) * solidAngleFactor(x, point, normal);
+}
+
+const size_t LightList::NoLight;
+
+LightList::LightList(const Object & world)
+    : world(world)
+{
+    std::vector<Light *> collectedLights;
+    world.getLights(collectedLights);
+    std::map<const Material *, EnvironmentPlanes> environments;
+    for(size_t i = 0; i < collectedLights.size(); i++)
+    {
+        const Material * material = collectedLights[i]->getEnvironmentMaterial();
+        if(material == NULL)
+        {
+            lightIndex[collectedLights[i]->getObject()] = lights.size();
+            lights.push_back(collectedLights[i]);
+            continue;
+        }
+        EnvironmentPlanes & planes = environments[material];
+        const PlaneLight * plane = static_cast<const PlaneLight *>(collectedLights[i]);
+        planes.normals.push_back(plane->getNormal());
+        planes.ds.push_back(plane->getD());
+        planes.objects.push_back(collectedLights[i]->getObject());
+        delete collectedLights[i];
+    }
+    for(std::map<const Material *, EnvironmentPlanes>::iterator iter = environments.begin(); iter != environments.end(); iter++)
+    {
+        for(size_t i = 0; i < iter->second.objects.size(); i++)
+        {
+            lightIndex[iter->second.objects[i]] = lights.size();
+        }
+        lights.push_back(new EnvironmentLight(iter->first, iter->second.normals, iter->second.ds));
+    }
+    leafNode.assign(lights.size(), NoLight);
+    for(size_t i = 0; i < lights.size(); i++)
+    {
+        BoundingBox bounds = lights[i]->getBounds();
+        if(bounds.isFinite() && !bounds.isEmpty())
+        {
+            boundedLights.push_back(i);
+        }
+        else
+        {
+            unboundedLights.push_back(i);
+        }
+    }
+    if(!boundedLights.empty())
+    {
+        std::vector<size_t> lightIndexes = boundedLights;
+        nodes.reserve(2 * lightIndexes.size());
+        build(&lightIndexes[0], lightIndexes.size(), NoLight);
+    }
+}
+
+LightList::~LightList()
+{
+    for(size_t i = 0; i < lights.size(); i++)
+    {
+        delete lights[i];
+    }
+}
+
+size_t LightList::build(size_t * lightIndexes, size_t count, size_t parent)
+{
+    size_t index = nodes.size();
+    nodes.push_back(Node());
+    BoundingBox bounds, centers;
+    float power = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        BoundingBox lightBounds = lights[lightIndexes[i]]->getBounds();
+        bounds = combine(bounds, lightBounds);
+        centers = combine(centers, lightBounds.center());
+        power += lights[lightIndexes[i]]->getPower();
+    }
+    nodes[index].bounds = bounds;
+    nodes[index].power = power;
+    nodes[index].parent = parent;
+    if(count == 1)
+    {
+        nodes[index].light = lightIndexes[0];
+        nodes[index].second = NoLight;
+        leafNode[lightIndexes[0]] = index;
+        return index;
+    }
+    Vector3D extent = centers.extent();
+    int axis = 0;
+    if(extent.y > extent.x && extent.y >= extent.z)
+    {
+        axis = 1;
+    }
+    else if(extent.z > extent.x && extent.z > extent.y)
+    {
+        axis = 2;
+    }
+    size_t half = count / 2;
+    std::nth_element(lightIndexes, lightIndexes + half, lightIndexes + count, CompareCenters(lights, axis));
+    build(lightIndexes, half, index);
+    size_t second = build(lightIndexes + half, count - half, index);
+    nodes[index].light = NoLight;
+    nodes[index].second = second;
+    return index;
+}
+
+float LightList::importance(const Node & node, Vector3D x) const
+{
+    float distanceSquared = abs_squared(x - node.bounds.center());
+    float radiusSquared = 0.25f * abs_squared(node.bounds.extent());
+    return node.power / std::max(distanceSquared, std::max(radiusSquared, eps));
+}
+
+float LightList::firstChildProbability(const Node & node, size_t index, Vector3D x) const
+{
+    float first = importance(nodes[index + 1], x);
+    float second = importance(nodes[node.second], x);
+    if(!(first + second > 0))
+    {
+        return 0.5f;
+    }
+    return first / (first + second);
+}
+
+float LightList::boundedProbability() const
+{
+    if(boundedLights.empty())
+    {
+        return 0;
+    }
+    if(unboundedLights.empty())
+    {
+        return 1;
+    }
+    return 0.5f;
+}
+
+bool LightList::sample(Vector3D x, float u0, float u1, float u2, Vector3D & dir, float & pdf, const Light *& light) const
+{
+    if(lights.empty())
+    {
+        return false;
+    }
+    float probability = boundedProbability();
+    size_t picked;
+    if(u0 < probability)
+    {
+        u0 /= probability;
+        size_t index = 0;
+        while(nodes[index].light == NoLight)
+        {
+            float firstProbability = firstChildProbability(nodes[index], index, x);
+            if(u0 < firstProbability)
+            {
+                u0 /= firstProbability;
+                probability *= firstProbability;
+                index = index + 1;
+            }
+            else
+            {
+                u0 = (u0 - firstProbability) / (1 - firstProbability);
+                probability *= 1 - firstProbability;
+                index = nodes[index].second;
+            }
+        }
+        picked = nodes[index].light;
+    }
+    else
+    {
+        u0 = (u0 - probability) / (1 - probability);
+        picked = unboundedLights[std::min(unboundedLights.size() - 1, (size_t)(u0 * unboundedLights.size()))];
+        probability = (1 - probability) / unboundedLights.size();
+    }
+    if(!lights[picked]->sample(x, u1, u2, dir, pdf))
+    {
+        return false;
+    }
+    pdf *= probability;
+    light = lights[picked];
+    return pdf > 0;
+}
+
+const Light * LightList::getLight(const Object * object) const
+{
+    std::map<const Object *, size_t>::const_iterator iter = lightIndex.find(object);
+    if(iter == lightIndex.end())
+    {
+        return NULL;
+    }
+    return lights[iter->second];
+}
+
+float LightList::pdf(Vector3D x, const Object * object, Vector3D dir) const
+{
+    std::map<const Object *, size_t>::const_iterator iter = lightIndex.find(object);
+    if(iter == lightIndex.end())
+    {
+        return 0;
+    }
+    size_t light = iter->second;
+    float probability = boundedProbability();
+    if(leafNode[light] == NoLight)
+    {
+        probability = (1 - probability) / unboundedLights.size();
+    }
+    else
+    {
+        for(size_t index = leafNode[light]; nodes[index].parent != NoLight; index = nodes[index].parent)
+        {
+            size_t parent = nodes[index].parent;
+            float firstProbability = firstChildProbability(nodes[parent], parent, x);
+            probability *= (index == parent + 1) ? firstProbability : 1 - firstProbability;
+        }
+    }
+    return probability * lights[light]->pdf(x, dir);
+}
+
+}
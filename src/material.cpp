@@ -1,5 +1,152 @@
-#include "material.h"
-
+#include "material.h"
+#include "mutex.h"
+#include <map>
+
 namespace PathTrace
 {
-}
+
+namespace
+{
+/** the textures and index of refraction of a material, compared by what the textures look like */
+struct MaterialKey
+{
+    const Texture * textures[5];
+    float ior;
+    MaterialKey(const Texture * reflect, const Texture * scatter_coefficient, const Texture * emissive, const Texture * transmit, float ior, const Texture * transmit_reflect_coefficient)
+        : ior(ior)
+    {
+        textures[0] = reflect;
+        textures[1] = scatter_coefficient;
+        textures[2] = emissive;
+        textures[3] = transmit;
+        textures[4] = transmit_reflect_coefficient;
+    }
+    explicit MaterialKey(const Material & material)
+        : ior(material.ior)
+    {
+        textures[0] = material.reflect;
+        textures[1] = material.scatter_coefficient;
+        textures[2] = material.emissive;
+        textures[3] = material.transmit;
+        textures[4] = material.transmit_reflect_coefficient;
+    }
+    size_t hash() const
+    {
+        size_t retval = hashFloat(ior);
+        for(int i = 0; i < 5; i++)
+        {
+            retval = hashCombine(retval, textures[i]->hash());
+        }
+        return retval;
+    }
+    bool matches(const Material & material) const
+    {
+        MaterialKey rt(material);
+        if(ior != rt.ior)
+        {
+            return false;
+        }
+        for(int i = 0; i < 5; i++)
+        {
+            if(textures[i] != rt.textures[i] && !textures[i]->equals(*rt.textures[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+typedef std::multimap<size_t, const Material *> MaterialTable;
+
+// constructed by the first call so materials can be made at namespace scope in other files
+mutex & getMaterialsLock()
+{
+    static mutex materialsLock;
+    return materialsLock;
+}
+
+/** @return the shared materials by the hash of their keys, only used with the lock held.<br/>
+ * the table doesn't hold references, the materials remove themselves when they are deleted.
+ * it is never destroyed so materials can still be released by destructors that run after <code>main</code> returns */
+MaterialTable & getMaterials()
+{
+    static MaterialTable * materials = new MaterialTable;
+    return *materials;
+}
+
+/** gets the shared material with these textures, making it if there isn't one. must be called with the lock held
+ * so no other thread can make the same material between the search and the insert
+ * @return a new reference to the shared material */
+const Material * internMaterial(Texture * reflect, Texture * scatter_coefficient, Texture * emissive, Texture * transmit, float ior, Texture * transmit_reflect_coefficient)
+{
+    MaterialKey key(reflect, scatter_coefficient, emissive, transmit, ior, transmit_reflect_coefficient);
+    size_t hash = key.hash();
+    MaterialTable & materials = getMaterials();
+    std::pair<MaterialTable::iterator, MaterialTable::iterator> range = materials.equal_range(hash);
+    for(MaterialTable::iterator iter = range.first; iter != range.second; iter++)
+    {
+        if(key.matches(*iter->second))
+        {
+            reflect->release();
+            scatter_coefficient->release();
+            emissive->release();
+            transmit->release();
+            transmit_reflect_coefficient->release();
+            return iter->second->duplicate();
+        }
+    }
+    const Material * material = new Material(reflect, scatter_coefficient, emissive, transmit, ior, transmit_reflect_coefficient);
+    materials.insert(std::make_pair(hash, material));
+    return material;
+}
+}
+
+void Material::release() const
+{
+    mutex & materialsLock = getMaterialsLock();
+    materialsLock.lock();
+    removeReference();
+    materialsLock.unlock();
+}
+
+Material::~Material()
+{
+    // deleted by release with the lock held
+    MaterialTable & materials = getMaterials();
+    std::pair<MaterialTable::iterator, MaterialTable::iterator> range = materials.equal_range(MaterialKey(*this).hash());
+    for(MaterialTable::iterator iter = range.first; iter != range.second; iter++)
+    {
+        if(iter->second == this)
+        {
+            materials.erase(iter);
+            break;
+        }
+    }
+    reflect->release();
+    scatter_coefficient->release();
+    emissive->release();
+    transmit->release();
+    transmit_reflect_coefficient->release();
+}
+
+const Material * makeMaterial(Texture * reflect, Texture * scatter_coefficient, Texture * emissive, Texture * transmit, float ior, Texture * transmit_reflect_coefficient)
+{
+    mutex & materialsLock = getMaterialsLock();
+    materialsLock.lock();
+    const Material * retval = internMaterial(reflect, scatter_coefficient, emissive, transmit, ior, transmit_reflect_coefficient);
+    materialsLock.unlock();
+    return retval;
+}
+
+const Material * transform(const Matrix & m, const Material * mat)
+{
+    // the transformed textures are equal to the textures of an earlier transform by the same matrix, so they find its material
+    mutex & materialsLock = getMaterialsLock();
+    materialsLock.lock();
+    const Material * retval = internMaterial(transform(m, mat->reflect), transform(m, mat->scatter_coefficient), transform(m, mat->emissive), transform(m, mat->transmit), mat->ior, transform(m, mat->transmit_reflect_coefficient));
+    materialsLock.unlock();
+    return retval;
+}
+
+}
@@ -1,4 +1,5 @@
 #include "object.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
@@ -6,4 +7,113 @@ Object::Object()
 {
     //ctor
 }
+
+bool Object::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    SpanIterator * spanIterator = makeSpanIterator();
+    AutoDestruct<SpanIterator> autoDestruct(spanIterator);
+    for(spanIterator->init(ray); *spanIterator; spanIterator->next())
+    {
+        const Span & span = **spanIterator;
+        if(span.start > tmax)
+        {
+            return false;
+        }
+        if(span.start >= tmin)
+        {
+            hit.t = span.start;
+            hit.normal = span.getStartNormal();
+            hit.material = span.getStartMaterial();
+            hit.entering = true;
+            hit.object = this;
+            return true;
+        }
+        if(span.end > tmax)
+        {
+            return false;
+        }
+        if(span.end >= tmin)
+        {
+            hit.t = span.end;
+            hit.normal = span.getEndNormal();
+            hit.material = span.getEndMaterial();
+            hit.entering = false;
+            hit.object = this;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Object::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    Hit hit;
+    if(firstHit(ray, tmin, tmax, hit))
+    {
+        return true;
+    }
+    return isInside(ray, tmax); // no boundary on the segment so it is either all inside or all outside
+}
+
+bool Object::isInside(const Ray & ray, float t) const
+{
+    float tNear, tFar;
+    if(!getBounds().intersects(ray, tNear, tFar) || tFar < t)
+    {
+        return false;
+    }
+    Hit hit;
+    if(!firstHit(ray, t, tFar + eps, hit)) // the ray leaves the object before it leaves the bounds
+    {
+        return false;
+    }
+    return !hit.entering;
+}
+
+MaskPacket Object::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    int activeBits = rays.active.bits(), hitBits = 0;
+    float tmins[PacketSize], tmaxs[PacketSize], ts[PacketSize], nx[PacketSize], ny[PacketSize], nz[PacketSize];
+    tmin.store(tmins);
+    tmax.store(tmaxs);
+    hits.t.store(ts);
+    hits.normal.x.store(nx);
+    hits.normal.y.store(ny);
+    hits.normal.z.store(nz);
+    int enteringBits = hits.entering.bits();
+    for(int i = 0; i < PacketSize; i++)
+    {
+        Hit hit;
+        if(((activeBits >> i) & 1) == 0 || !firstHit(rays.get(i), tmins[i], tmaxs[i], hit))
+        {
+            continue;
+        }
+        hitBits |= 1 << i;
+        ts[i] = hit.t;
+        nx[i] = hit.normal.x;
+        ny[i] = hit.normal.y;
+        nz[i] = hit.normal.z;
+        hits.material[i] = hit.material;
+        hits.object[i] = hit.object;
+        enteringBits = hit.entering ? (enteringBits | (1 << i)) : (enteringBits & ~(1 << i));
+    }
+    hits.t = FloatPacket::load(ts);
+    hits.normal = VectorPacket(FloatPacket::load(nx), FloatPacket::load(ny), FloatPacket::load(nz));
+    hits.entering = MaskPacket::fromBits(enteringBits);
+    return MaskPacket::fromBits(hitBits);
+}
+
+Object * TransformedObject::transform(const Matrix & m) const
+{
+    // rays are transformed by m first
+    return PathTrace::transform(m.concat(this->m), o);
+}
+
+bool TransformedObject::compile(CSGProgram & program) const
+{
+    program.pushTransform(m);
+    bool retval = o->compile(program);
+    program.popTransform();
+    return retval;
+}
 }
@@ -1,6 +0,0 @@
-#include "path-trace.h"
-
-namespace PathTrace
-{
-DefaultRandomEngine defaultRandomEngine;
-}
@@ -0,0 +1,79 @@
+#include "philox.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+namespace PathTrace
+{
+
+#ifdef __SSE2__
+namespace
+{
+/** multiplies each lane of <code>a</code> by <code>b</code> */
+inline void mulhiloPacket(__m128i a, __m128i b, __m128i &hi, __m128i &lo)
+{
+    __m128i even = _mm_mul_epu32(a, b); // lanes 0 and 2 as 64 bit products
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b); // lanes 1 and 3
+    lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+    hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(2, 0, 3, 1)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(2, 0, 3, 1)));
+}
+
+inline __m128 toFloatPacket(__m128i v)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+}
+}
+#endif
+
+void PhiloxRandomEngine::fill(float *values, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // 4 blocks at a time, one block per lane, starting with the block of the next number
+    while(i < count)
+    {
+        __m128i c0 = _mm_add_epi32(_mm_set1_epi32((int)(position >> 2)), _mm_set_epi32(3, 2, 1, 0));
+        __m128i c1 = _mm_set1_epi32((int)stream[0]);
+        __m128i c2 = _mm_set1_epi32((int)stream[1]);
+        __m128i c3 = _mm_set1_epi32((int)stream[2]);
+        __m128i k0 = _mm_set1_epi32((int)key);
+        __m128i k1 = _mm_set1_epi32((int)Key1);
+        const __m128i multiplier0 = _mm_set1_epi32((int)Multiplier0);
+        const __m128i multiplier1 = _mm_set1_epi32((int)Multiplier1);
+        const __m128i keyIncrement0 = _mm_set1_epi32((int)KeyIncrement0);
+        const __m128i keyIncrement1 = _mm_set1_epi32((int)KeyIncrement1);
+        for(int round = 0; round < RoundCount; round++)
+        {
+            __m128i hi0, lo0, hi1, lo1;
+            mulhiloPacket(c0, multiplier0, hi0, lo0);
+            mulhiloPacket(c2, multiplier1, hi1, lo1);
+            c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), k1);
+            c3 = lo0;
+            k0 = _mm_add_epi32(k0, keyIncrement0);
+            k1 = _mm_add_epi32(k1, keyIncrement1);
+        }
+        __m128 f0 = toFloatPacket(c0), f1 = toFloatPacket(c1), f2 = toFloatPacket(c2), f3 = toFloatPacket(c3);
+        // lane j of fk is number k of block j
+        _MM_TRANSPOSE4_PS(f0, f1, f2, f3);
+        float numbers[16];
+        _mm_storeu_ps(numbers, f0);
+        _mm_storeu_ps(numbers + 4, f1);
+        _mm_storeu_ps(numbers + 8, f2);
+        _mm_storeu_ps(numbers + 12, f3);
+        for(unsigned j = position & 3; j < 16 && i < count; j++, i++, position++)
+        {
+            values[i] = numbers[j];
+        }
+    }
+#endif
+    for(; i < count; i++)
+    {
+        values[i] = get1D();
+    }
+}
+
+}
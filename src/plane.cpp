@@ -1,20 +1,57 @@
 #include "plane.h"
+#include "light.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
 
 Plane::Plane(Vector3D normal, float d, const Material * material)
-    : normal(normal), d(d), material(material)
+    : normal(normal), d(d), material(material->duplicate())
 {
 }
 
 Plane::Plane(Vector3D normal, Vector3D pos, const Material * material)
-    : normal(normal), d(-dot(normal, pos)), material(material)
+    : normal(normal), d(-dot(normal, pos)), material(material->duplicate())
 {
 }
 
 Plane::~Plane()
 {
+    material->release();
+}
+
+Object * Plane::transform(const Matrix & m) const
+{
+    // dot(normal, m.apply(p)) + d is negative inside the transformed plane
+    return new Plane(m.transposeNoTranslate().applyNoTranslate(normal), dot(normal, m.apply(Vector3D(0, 0, 0))) + d, material);
+}
+
+BoundingBox Plane::getBounds() const
+{
+    BoundingBox retval = BoundingBox::infinite();
+    // only planes perpendicular to an axis have a bounded side
+    if(normal.y == 0 && normal.z == 0 && normal.x != 0)
+    {
+        if(normal.x > 0)
+            retval.maxCorner.x = std::min(max_value, -d / normal.x);
+        else
+            retval.minCorner.x = std::max(-max_value, -d / normal.x);
+    }
+    else if(normal.x == 0 && normal.z == 0 && normal.y != 0)
+    {
+        if(normal.y > 0)
+            retval.maxCorner.y = std::min(max_value, -d / normal.y);
+        else
+            retval.minCorner.y = std::max(-max_value, -d / normal.y);
+    }
+    else if(normal.x == 0 && normal.y == 0 && normal.z != 0)
+    {
+        if(normal.z > 0)
+            retval.maxCorner.z = std::min(max_value, -d / normal.z);
+        else
+            retval.minCorner.z = std::max(-max_value, -d / normal.z);
+    }
+    return retval;
 }
 
 namespace
@@ -24,42 +61,16 @@ class PlaneSpanIterator : public SpanIterator
 {
 public:
     PlaneSpanIterator(const Vector3D normal, const float d, const Material * material)
-        : normal(normal), d(d)
+        : normal(normal), d(d), material(material)
     {
-        theSpan.startNormal = normalize(normal);
-        theSpan.endNormal = normalize(normal);
-        theSpan.startMaterial = material;
-        theSpan.endMaterial = material;
+        theSpan.startBoundary.source = this;
+        theSpan.startBoundary.index = 0;
+        theSpan.endBoundary = theSpan.startBoundary;
         ended = true;
     }
     virtual void init(const Ray & ray)
     {
-        ended = false;
-        float divisor = dot(ray.dir, normal);
-        float numerator = -d - dot(ray.origin, normal);
-        float t;
-        if(std::abs(divisor) < eps * eps || std::abs(t = numerator / divisor) >= max_value)
-        {
-            if(std::abs(numerator) < eps * eps)
-            {
-                theSpan.start = -max_value;
-                theSpan.end = max_value;
-            }
-            else
-            {
-                ended = true;
-            }
-        }
-        else if(divisor < 0)
-        {
-            theSpan.start = t;
-            theSpan.end = max_value;
-        }
-        else
-        {
-            theSpan.start = -max_value;
-            theSpan.end = t;
-        }
+        ended = !intersectPlane(ray, normal, d, theSpan.start, theSpan.end);
     }
     virtual const Span & operator *() const
     {
@@ -80,12 +91,23 @@ public:
     virtual ~PlaneSpanIterator()
     {
     }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return normal;
+    }
 
 private:
     Span theSpan;
     bool ended;
     const Vector3D normal;
     const float d;
+    const Material * const material;
 };
 
 }
@@ -95,4 +117,90 @@ SpanIterator * Plane::makeSpanIterator() const
     return new PlaneSpanIterator(normal, d, material);
 }
 
+void Plane::getLights(std::vector<Light *> & lights) const
+{
+    PlaneLight * light = new PlaneLight(normal, d, material, this);
+    if(light->getPower() > 0 || light->getEnvironmentMaterial() != NULL)
+    {
+        lights.push_back(light);
+    }
+    else
+    {
+        delete light;
+    }
+}
+
+bool Plane::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float start, end;
+    if(!intersectPlane(ray, normal, d, start, end))
+    {
+        return false;
+    }
+    if(start >= tmin)
+    {
+        hit.t = start;
+        hit.entering = true;
+    }
+    else if(end >= tmin)
+    {
+        hit.t = end;
+        hit.entering = false;
+    }
+    else
+    {
+        return false;
+    }
+    if(hit.t > tmax)
+    {
+        return false;
+    }
+    hit.normal = normalize(normal);
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+bool Plane::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    float start, end;
+    if(!intersectPlane(ray, normal, d, start, end))
+    {
+        return false;
+    }
+    return start <= tmax && end >= tmin;
+}
+
+MaskPacket Plane::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    VectorPacket normal = VectorPacket(this->normal);
+    FloatPacket divisor = dot(rays.dir, normal);
+    FloatPacket numerator = FloatPacket(-d) - dot(rays.origin, normal);
+    FloatPacket t = numerator / divisor;
+    MaskPacket parallel = (abs(divisor) < FloatPacket(eps * eps)) | (abs(t) >= FloatPacket(max_value));
+    MaskPacket retval = rays.active & (~parallel | (abs(numerator) < FloatPacket(eps * eps)));
+    if(!any(retval))
+    {
+        return retval;
+    }
+    MaskPacket front = ~parallel & (divisor < FloatPacket(0.0f));
+    MaskPacket back = ~parallel & ~front;
+    FloatPacket start = select(front, t, FloatPacket(-max_value));
+    FloatPacket end = select(back, t, FloatPacket(max_value));
+    hits.entering = start >= tmin;
+    hits.t = select(hits.entering, start, end);
+    retval = retval & (hits.t >= tmin) & (hits.t <= tmax);
+    hits.normal = VectorPacket(normalize(this->normal));
+    for(int i = 0; i < PacketSize; i++)
+    {
+        hits.material[i] = material;
+        hits.object[i] = this;
+    }
+    return retval;
+}
+
+bool Plane::compile(CSGProgram & program) const
+{
+    return program.addPlane(normal, d, material, this);
+}
 }
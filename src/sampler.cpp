@@ -0,0 +1,214 @@
+#include "sampler.h"
+#include <cmath>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+namespace
+{
+/** the largest float less than 1 */
+const float OneMinusEpsilon = 1.0f - 1.0f / 16777216.0f;
+
+unsigned mix(unsigned v)
+{
+    v ^= v >> 16;
+    v *= 0x7FEB352DU;
+    v ^= v >> 15;
+    v *= 0x846CA68BU;
+    v ^= v >> 16;
+    return v;
+}
+
+unsigned hash(unsigned a, unsigned b)
+{
+    return mix(a * 0x9E3779B9U ^ mix(b + 0x632BE5ABU));
+}
+
+float toFloat(unsigned v)
+{
+    return std::min(OneMinusEpsilon, v * (1.0f / 4294967296.0f));
+}
+
+/** @return element <code>i</code> of a random permutation of <code>[0, l)</code> picked by <code>p</code>
+ * (Kensler, Correlated Multi-Jittered Sampling) */
+unsigned permute(unsigned i, unsigned l, unsigned p)
+{
+    unsigned w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xE170893DU;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929EB3FU;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935FA69U;
+        i ^= (i & w) >> 11;
+        i *= 0x74DCB303U;
+        i ^= (i & w) >> 2;
+        i *= 0x9E501CC3U;
+        i ^= (i & w) >> 2;
+        i *= 0xC860A3DFU;
+        i &= w;
+        i ^= i >> 5;
+    }
+    while(i >= l);
+    return (i + p) % l;
+}
+
+unsigned reverseBits(unsigned v)
+{
+    v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+    v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+    v = ((v >> 4) & 0x0F0F0F0FU) | ((v & 0x0F0F0F0FU) << 4);
+    v = ((v >> 8) & 0x00FF00FFU) | ((v & 0x00FF00FFU) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+/** a random permutation of the bits of <code>v</code> where each bit only depends
+ * on the higher bits, applied to reversed bits (Laine and Karras) */
+unsigned nestedUniformScramble(unsigned v, unsigned seed)
+{
+    v = reverseBits(v);
+    v += seed;
+    v ^= v * 0x6C50B47CU;
+    v ^= v * 0xB82F1E52U;
+    v ^= v * 0xC7AFE638U;
+    v ^= v * 0x8D22F6E6U;
+    return reverseBits(v);
+}
+
+/** @return the first dimension of the Sobol sequence */
+unsigned sobol0(unsigned index)
+{
+    return reverseBits(index);
+}
+
+/** @return the second dimension of the Sobol sequence */
+unsigned sobol1(unsigned index)
+{
+    unsigned retval = 0;
+    for(unsigned v = 1U << 31; index != 0; index >>= 1, v ^= v >> 1)
+    {
+        if(index & 1)
+        {
+            retval ^= v;
+        }
+    }
+    return retval;
+}
+
+const unsigned Primes[HaltonSampler::DimensionCount] =
+{
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+    59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+
+/** @return <code>index</code> with its digits in base <code>base</code> mirrored around the radix point
+ * and each digit position shuffled by a random permutation picked by <code>seed</code> */
+float scrambledRadicalInverse(unsigned index, unsigned base, unsigned seed)
+{
+    double inverseBase = 1.0 / base, factor = inverseBase, retval = 0;
+    // the zero digits after the last digit of index are shuffled too
+    for(unsigned digit = 0; factor * base > 1e-8; digit++)
+    {
+        retval += permute(index % base, base, hash(seed, digit)) * factor;
+        index /= base;
+        factor *= inverseBase;
+    }
+    return std::min(OneMinusEpsilon, (float)retval);
+}
+}
+
+void Sampler::startPixelSample(int px, int py, unsigned sampleIndex, unsigned dimension)
+{
+    pixelSeed = hash(hash(seed, (unsigned)px), (unsigned)py);
+    this->sampleIndex = sampleIndex;
+    this->dimension = dimension;
+}
+
+unsigned Sampler::getDimensionSeed(unsigned dimension) const
+{
+    return hash(pixelSeed, dimension);
+}
+
+float Sampler::getRandom(unsigned dimension) const
+{
+    return toFloat(hash(getDimensionSeed(dimension), sampleIndex));
+}
+
+StratifiedSampler::StratifiedSampler(unsigned sampleCount, unsigned seed)
+    : Sampler(seed), sampleCount(std::max(1U, sampleCount))
+{
+    gridWidth = (unsigned)std::ceil(std::sqrt((float)this->sampleCount));
+    gridHeight = (this->sampleCount + gridWidth - 1) / gridWidth;
+}
+
+float StratifiedSampler::sample1D(unsigned dimension) const
+{
+    unsigned seed = getDimensionSeed(dimension);
+    unsigned stratum = permute(getSampleIndex() % sampleCount, sampleCount, seed);
+    return std::min(OneMinusEpsilon, (stratum + getRandom(dimension)) / sampleCount);
+}
+
+void StratifiedSampler::sample2D(unsigned dimension, float &u1, float &u2) const
+{
+    // when the grid has more cells than samples the samples are still each in a random cell
+    unsigned cellCount = gridWidth * gridHeight;
+    unsigned cell = permute(getSampleIndex() % cellCount, cellCount, getDimensionSeed(dimension));
+    u1 = std::min(OneMinusEpsilon, (cell % gridWidth + getRandom(dimension)) / gridWidth);
+    u2 = std::min(OneMinusEpsilon, (cell / gridWidth + getRandom(dimension + 1)) / gridHeight);
+}
+
+HaltonSampler::HaltonSampler(unsigned seed)
+    : Sampler(seed)
+{
+}
+
+float HaltonSampler::sample1D(unsigned dimension) const
+{
+    if(dimension >= DimensionCount)
+    {
+        return getRandom(dimension);
+    }
+    return scrambledRadicalInverse(getSampleIndex(), Primes[dimension], getDimensionSeed(dimension));
+}
+
+void HaltonSampler::sample2D(unsigned dimension, float &u1, float &u2) const
+{
+    u1 = sample1D(dimension);
+    u2 = sample1D(dimension + 1);
+}
+
+SobolSampler::SobolSampler(unsigned seed)
+    : Sampler(seed)
+{
+}
+
+float SobolSampler::sample1D(unsigned dimension) const
+{
+    unsigned seed = getDimensionSeed(dimension);
+    unsigned index = nestedUniformScramble(getSampleIndex(), seed);
+    return toFloat(nestedUniformScramble(sobol0(index), mix(seed + 1)));
+}
+
+void SobolSampler::sample2D(unsigned dimension, float &u1, float &u2) const
+{
+    unsigned seed = getDimensionSeed(dimension);
+    unsigned index = nestedUniformScramble(getSampleIndex(), seed);
+    u1 = toFloat(nestedUniformScramble(sobol0(index), mix(seed + 1)));
+    u2 = toFloat(nestedUniformScramble(sobol1(index), mix(seed + 2)));
+}
+
+}
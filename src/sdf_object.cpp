@@ -0,0 +1,386 @@
+#include "sdf_object.h"
+
+namespace PathTrace
+{
+
+const int SDFObject::MaxSteps;
+const int SDFObject::RefineSteps;
+
+SDFObject::SDFObject(DistanceFunction * f, const BoundingBox & bounds, const Material * material, float lipschitz, float tolerance)
+    : f(f), bounds(bounds), material(material->duplicate()), lipschitz(lipschitz), tolerance(tolerance)
+{
+    assert(bounds.isFinite() && lipschitz > 0 && tolerance > 0);
+}
+
+SDFObject::~SDFObject()
+{
+    delete f;
+    material->release();
+}
+
+Vector3D SDFObject::getNormal(Vector3D position) const
+{
+    const float h = 10 * tolerance;
+    return Vector3D(f->evaluate(position + Vector3D(h, 0, 0)) - f->evaluate(position - Vector3D(h, 0, 0)),
+                    f->evaluate(position + Vector3D(0, h, 0)) - f->evaluate(position - Vector3D(0, h, 0)),
+                    f->evaluate(position + Vector3D(0, 0, h)) - f->evaluate(position - Vector3D(0, 0, h)));
+}
+
+VectorPacket SDFObject::getNormal(const VectorPacket & position) const
+{
+    const FloatPacket h = 10 * tolerance, zero = 0.0f;
+    return VectorPacket(f->evaluatePacket(position + VectorPacket(h, zero, zero)) - f->evaluatePacket(position - VectorPacket(h, zero, zero)),
+                        f->evaluatePacket(position + VectorPacket(zero, h, zero)) - f->evaluatePacket(position - VectorPacket(zero, h, zero)),
+                        f->evaluatePacket(position + VectorPacket(zero, zero, h)) - f->evaluatePacket(position - VectorPacket(zero, zero, h)));
+}
+
+namespace
+{
+/** @return the outward facing normal of the face of <code>bounds</code> closest to <code>position</code> */
+Vector3D getBoundsNormal(const BoundingBox & bounds, Vector3D position)
+{
+    float distances[6] =
+    {
+        position.x - bounds.minCorner.x, bounds.maxCorner.x - position.x,
+        position.y - bounds.minCorner.y, bounds.maxCorner.y - position.y,
+        position.z - bounds.minCorner.z, bounds.maxCorner.z - position.z
+    };
+    int face = 0;
+    for(int i = 1; i < 6; i++)
+    {
+        if(distances[i] < distances[face])
+        {
+            face = i;
+        }
+    }
+    Vector3D retval(0);
+    float sign = (face & 1) ? 1 : -1;
+    switch(face / 2)
+    {
+    case 0:
+        retval.x = sign;
+        break;
+    case 1:
+        retval.y = sign;
+        break;
+    default:
+        retval.z = sign;
+        break;
+    }
+    return retval;
+}
+
+/** marches along a ray from one boundary of a distance function to the next */
+class SphereTracer
+{
+public:
+    SphereTracer(const DistanceFunction & f, float lipschitz, float tolerance)
+        : f(f), lipschitz(lipschitz), tolerance(tolerance), ray(Vector3D(0), Vector3D(1, 0, 0))
+    {
+    }
+    /** starts tracing <code>ray</code> at <code>tStart</code>, it stops at <code>tEnd</code> */
+    void init(const Ray & ray, float tStart, float tEnd)
+    {
+        this->ray = ray;
+        float dirLength = abs(ray.dir);
+        stepScale = 1 / (lipschitz * dirLength);
+        minStep = tolerance / dirLength;
+        t = tStart;
+        this->tEnd = tEnd;
+        d = f.evaluate(ray.getPoint(t));
+    }
+    bool isInside() const
+    {
+        return d < 0;
+    }
+    float getT() const
+    {
+        return t;
+    }
+    /** steps to the next boundary
+     *
+     * @param boundary
+     *            set to the boundary found
+     * @return if a boundary was found before the end or the step limit */
+    bool findBoundary(float & boundary)
+    {
+        for(int step = 0; step < SDFObject::MaxSteps && t < tEnd; step++)
+        {
+            float nextT = std::min(t + std::max(std::fabs(d) * stepScale, minStep), tEnd);
+            float nextD = f.evaluate(ray.getPoint(nextT));
+            bool crossed = (nextD < 0) != (d < 0);
+            float lastT = t;
+            t = nextT;
+            d = nextD;
+            if(crossed)
+            {
+                boundary = refine(lastT, nextT, d >= 0);
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    /** bisects <code>[lo, hi]</code> where the inside changes */
+    float refine(float lo, float hi, bool loInside) const
+    {
+        for(int i = 0; i < SDFObject::RefineSteps; i++)
+        {
+            float mid = 0.5f * (lo + hi);
+            if((f.evaluate(ray.getPoint(mid)) < 0) == loInside)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        return 0.5f * (lo + hi);
+    }
+    const DistanceFunction & f;
+    const float lipschitz, tolerance;
+    Ray ray;
+    float stepScale, minStep;
+    float t, tEnd, d;
+};
+
+class SDFSpanIterator : public SpanIterator
+{
+public:
+    SDFSpanIterator(const SDFObject & object, const DistanceFunction & f, const BoundingBox & bounds, const Material * material, float lipschitz, float tolerance)
+        : object(object), bounds(bounds), material(material), tracer(f, lipschitz, tolerance), ray(Vector3D(0), Vector3D(1, 0, 0)), ended(true), lastSpan(true)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        float tNear, tFar;
+        ended = false;
+        lastSpan = false;
+        if(!bounds.intersects(ray, tNear, tFar))
+        {
+            ended = true;
+            return;
+        }
+        tracer.init(ray, tNear, tFar);
+        next();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        if(lastSpan)
+        {
+            ended = true;
+            return;
+        }
+        // only the first span can start inside, where the line enters the bounds
+        if(tracer.isInside())
+        {
+            theSpan.start = tracer.getT();
+            theSpan.startBoundary.index = Clipped;
+        }
+        else if(tracer.findBoundary(theSpan.start))
+        {
+            theSpan.startBoundary.index = Surface;
+        }
+        else
+        {
+            ended = true;
+            return;
+        }
+        if(tracer.findBoundary(theSpan.end))
+        {
+            theSpan.endBoundary.index = Surface;
+        }
+        else
+        {
+            // clipped by the bounds or out of steps
+            theSpan.end = tracer.getT();
+            theSpan.endBoundary.index = Clipped;
+            lastSpan = true;
+        }
+    }
+    virtual ~SDFSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        if(index == Clipped)
+        {
+            return getBoundsNormal(bounds, ray.getPoint(t));
+        }
+        return object.getNormal(ray.getPoint(t));
+    }
+
+private:
+    enum Boundary
+    {
+        Surface,
+        Clipped /// where the shape is cut by the bounds
+    };
+    Span theSpan;
+    const SDFObject & object;
+    const BoundingBox & bounds;
+    const Material * const material;
+    SphereTracer tracer;
+    Ray ray;
+    bool ended, lastSpan;
+};
+}
+
+SpanIterator * SDFObject::makeSpanIterator() const
+{
+    return new SDFSpanIterator(*this, *f, bounds, material, lipschitz, tolerance);
+}
+
+bool SDFObject::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float tNear, tFar;
+    if(!bounds.intersects(ray, tNear, tFar))
+    {
+        return false;
+    }
+    float tStart = std::max(tNear, tmin), tEnd = std::min(tFar, tmax);
+    if(tStart > tEnd)
+    {
+        return false;
+    }
+    SphereTracer tracer(*f, lipschitz, tolerance);
+    tracer.init(ray, tStart, tEnd);
+    bool inside = tracer.isInside();
+    if(inside && tStart == tNear)
+    {
+        hit.t = tNear;
+        hit.entering = true;
+        hit.normal = getBoundsNormal(bounds, ray.getPoint(hit.t));
+    }
+    else if(tracer.findBoundary(hit.t))
+    {
+        hit.entering = !inside;
+        hit.normal = normalize(getNormal(ray.getPoint(hit.t)));
+    }
+    else if(tracer.isInside() && tracer.getT() == tFar)
+    {
+        hit.t = tFar;
+        hit.entering = false;
+        hit.normal = getBoundsNormal(bounds, ray.getPoint(hit.t));
+    }
+    else
+    {
+        return false;
+    }
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+MaskPacket SDFObject::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    int activeBits = rays.active.bits(), boundsBits = 0;
+    float tNears[PacketSize], tFars[PacketSize];
+    for(int i = 0; i < PacketSize; i++)
+    {
+        tNears[i] = tFars[i] = 0;
+        if(((activeBits >> i) & 1) != 0 && bounds.intersects(rays.get(i), tNears[i], tFars[i]))
+        {
+            boundsBits |= 1 << i;
+        }
+    }
+    FloatPacket tNear = FloatPacket::load(tNears), tFar = FloatPacket::load(tFars);
+    FloatPacket t = max(tNear, tmin), tEnd = min(tFar, tmax);
+    MaskPacket traced = MaskPacket::fromBits(boundsBits) & (t <= tEnd);
+    if(!any(traced))
+    {
+        return traced;
+    }
+    FloatPacket dirLength = sqrt(dot(rays.dir, rays.dir));
+    FloatPacket stepScale = FloatPacket(1.0f) / (FloatPacket(lipschitz) * dirLength), minStep = FloatPacket(tolerance) / dirLength;
+    FloatPacket d = f->evaluatePacket(rays.origin + t * rays.dir);
+    // the rays that start inside where they enter the bounds hit there
+    MaskPacket enteredBounds = traced & (d < FloatPacket(0.0f)) & (t == tNear);
+    MaskPacket active = traced & ~enteredBounds, crossed(false), loInside(false);
+    FloatPacket lo = t, hi = t;
+    for(int step = 0; step < MaxSteps && any(active); step++)
+    {
+        FloatPacket nextT = min(t + max(abs(d) * stepScale, minStep), tEnd);
+        FloatPacket nextD = f->evaluatePacket(rays.origin + nextT * rays.dir);
+        MaskPacket inside = d < FloatPacket(0.0f);
+        MaskPacket crossedNow = active & (inside ^ (nextD < FloatPacket(0.0f)));
+        lo = select(crossedNow, t, lo);
+        hi = select(crossedNow, nextT, hi);
+        loInside = (crossedNow & inside) | (~crossedNow & loInside);
+        crossed = crossed | crossedNow;
+        t = select(active, nextT, t);
+        d = select(active, nextD, d);
+        active = active & ~crossedNow & (t < tEnd);
+    }
+    // the rays still inside at the far side of the bounds leave there
+    MaskPacket leftBounds = traced & ~enteredBounds & ~crossed & (d < FloatPacket(0.0f)) & (t == tFar);
+    for(int i = 0; i < RefineSteps && any(crossed); i++)
+    {
+        FloatPacket mid = FloatPacket(0.5f) * (lo + hi);
+        MaskPacket sameAsLo = ~((f->evaluatePacket(rays.origin + mid * rays.dir) < FloatPacket(0.0f)) ^ loInside);
+        lo = select(crossed & sameAsLo, mid, lo);
+        hi = select(crossed & ~sameAsLo, mid, hi);
+    }
+    MaskPacket retval = enteredBounds | crossed | leftBounds;
+    if(!any(retval))
+    {
+        return retval;
+    }
+    FloatPacket hitT = select(enteredBounds, tNear, select(crossed, FloatPacket(0.5f) * (lo + hi), tFar));
+    hits.t = select(retval, hitT, hits.t);
+    hits.normal = select(retval, normalize(getNormal(rays.origin + hitT * rays.dir)), hits.normal);
+    MaskPacket entering = enteredBounds | (crossed & ~loInside);
+    hits.entering = (retval & entering) | (~retval & hits.entering);
+    int bits = retval.bits(), clippedBits = (enteredBounds | leftBounds).bits();
+    for(int i = 0; i < PacketSize; i++)
+    {
+        if((bits >> i) & 1)
+        {
+            hits.material[i] = material;
+            hits.object[i] = this;
+        }
+    }
+    if(clippedBits != 0)
+    {
+        float nx[PacketSize], ny[PacketSize], nz[PacketSize];
+        hits.normal.x.store(nx);
+        hits.normal.y.store(ny);
+        hits.normal.z.store(nz);
+        for(int i = 0; i < PacketSize; i++)
+        {
+            if((clippedBits >> i) & 1)
+            {
+                Vector3D normal = getBoundsNormal(bounds, rays.get(i).getPoint(lane(hitT, i)));
+                nx[i] = normal.x;
+                ny[i] = normal.y;
+                nz[i] = normal.z;
+            }
+        }
+        hits.normal = VectorPacket(FloatPacket::load(nx), FloatPacket::load(ny), FloatPacket::load(nz));
+    }
+    return retval;
+}
+
+}
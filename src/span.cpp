@@ -3,4 +3,6 @@
 namespace PathTrace
 {
 
+const unsigned SpanBoundary::ReversedNormal;
+
 }
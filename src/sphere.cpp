@@ -1,4 +1,6 @@
 #include "sphere.h"
+#include "light.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
@@ -8,11 +10,12 @@ Sphere::Sphere(Vector3D center, float r, const Material * material)
     this->center = center;
     this->r = r;
     this->r_squared = r * r;
-    this->material = material;
+    this->material = material->duplicate();
 }
 
 Sphere::~Sphere()
 {
+    material->release();
 }
 
 namespace
@@ -22,30 +25,17 @@ class SphereSpanIterator : public SpanIterator
 {
 public:
     SphereSpanIterator(const Vector3D & center, float r_squared, const Material * material)
-        : center(center), r_squared(r_squared)
+        : center(center), r_squared(r_squared), material(material), ray(Vector3D(0), Vector3D(1, 0, 0))
     {
-        theSpan.startMaterial = material;
-        theSpan.endMaterial = material;
+        theSpan.startBoundary.source = this;
+        theSpan.startBoundary.index = 0;
+        theSpan.endBoundary = theSpan.startBoundary;
         ended = true;
     }
     virtual void init(const Ray & ray)
     {
-        ended = false;
-        Vector3D origin_minus_center = ray.origin - center;
-        float a = abs_squared(ray.dir);
-        float b = dot(origin_minus_center, ray.dir);
-        float c = dot(origin_minus_center, origin_minus_center) - r_squared;
-        float sqrt_arg = b * b - a * c;
-        if(sqrt_arg <= eps)
-        {
-            ended = true;
-            return;
-        }
-        float sqrt_v = std::sqrt(sqrt_arg);
-        theSpan.start = (-b - sqrt_v) / a;
-        theSpan.end = (-b + sqrt_v) / a;
-        theSpan.startNormal = normalize(ray.getPoint(theSpan.start) - center);
-        theSpan.endNormal = normalize(ray.getPoint(theSpan.end) - center);
+        this->ray = ray;
+        ended = !intersectSphere(ray, center, r_squared, theSpan.start, theSpan.end);
     }
     virtual const Span & operator *() const
     {
@@ -66,12 +56,24 @@ public:
     virtual ~SphereSpanIterator()
     {
     }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return ray.getPoint(t) - center;
+    }
 
 private:
     Span theSpan;
     bool ended;
     const Vector3D center;
     const float r_squared;
+    const Material * const material;
+    Ray ray;
 };
 }
 
@@ -80,4 +82,106 @@ SpanIterator * Sphere::makeSpanIterator() const
     return new SphereSpanIterator(center, r_squared, material);
 }
 
+Object * Sphere::transform(const Matrix & m) const
+{
+    float scale;
+    if(!m.isSimilarity(scale))
+    {
+        return NULL;
+    }
+    // the rays are transformed by m so the sphere is transformed by the inverse
+    return new Sphere(invert(m).apply(center), r / scale, material);
+}
+
+void Sphere::getLights(std::vector<Light *> & lights) const
+{
+    SphereLight * light = new SphereLight(center, r, material, this);
+    if(light->getPower() > 0)
+    {
+        lights.push_back(light);
+    }
+    else
+    {
+        delete light;
+    }
+}
+
+bool Sphere::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float start, end;
+    if(!intersectSphere(ray, center, r_squared, start, end))
+    {
+        return false;
+    }
+    if(start >= tmin)
+    {
+        hit.t = start;
+        hit.entering = true;
+    }
+    else if(end >= tmin)
+    {
+        hit.t = end;
+        hit.entering = false;
+    }
+    else
+    {
+        return false;
+    }
+    if(hit.t > tmax)
+    {
+        return false;
+    }
+    hit.normal = normalize(ray.getPoint(hit.t) - center);
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+bool Sphere::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    Vector3D origin_minus_center = ray.origin - center;
+    float a = abs_squared(ray.dir);
+    float b = dot(origin_minus_center, ray.dir);
+    float c = dot(origin_minus_center, origin_minus_center) - r_squared;
+    if(b * b - a * c <= eps)
+    {
+        return false;
+    }
+    // a * t * t + 2 * b * t + c is negative inside the sphere, so only the point of the segment
+    // closest to the center has to be checked instead of finding where the ray enters and leaves
+    float t = std::min(std::max(-b / a, tmin), tmax);
+    return (a * t + 2 * b) * t + c < 0;
+}
+
+MaskPacket Sphere::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    VectorPacket origin_minus_center = rays.origin - VectorPacket(center);
+    FloatPacket a = dot(rays.dir, rays.dir);
+    FloatPacket b = dot(origin_minus_center, rays.dir);
+    FloatPacket c = dot(origin_minus_center, origin_minus_center) - FloatPacket(r_squared);
+    FloatPacket sqrt_arg = b * b - a * c;
+    MaskPacket retval = rays.active & (sqrt_arg > FloatPacket(eps));
+    if(!any(retval))
+    {
+        return retval;
+    }
+    FloatPacket sqrt_v = sqrt(max(sqrt_arg, FloatPacket(0.0f)));
+    FloatPacket start = (-b - sqrt_v) / a;
+    FloatPacket end = (-b + sqrt_v) / a;
+    hits.entering = start >= tmin;
+    hits.t = select(hits.entering, start, end);
+    retval = retval & (hits.t >= tmin) & (hits.t <= tmax);
+    hits.normal = normalize(rays.getPoint(hits.t) - VectorPacket(center));
+    for(int i = 0; i < PacketSize; i++)
+    {
+        hits.material[i] = material;
+        hits.object[i] = this;
+    }
+    return retval;
+}
+
+bool Sphere::compile(CSGProgram & program) const
+{
+    return program.addSphere(center, r, material, this);
+}
 }
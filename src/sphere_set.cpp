@@ -0,0 +1,429 @@
+#include "sphere_set.h"
+#include "reference_counted.h"
+#include "bvh_union.h"
+#include <cassert>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+/** the spheres of a <code>SphereSet</code>, shared by its copies */
+struct SphereSetData : public ReferenceCounted
+{
+    /// the spheres in the order referenced by the leaves, followed by <code>PacketSize - 1</code> empty spheres so
+    /// a whole packet can be loaded at any leaf
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<SphereSet::MaterialIndex> materialIndices; /// empty if there is only one material
+    std::vector<const Material *> materials; /// holds a reference to each material
+    std::vector<BVHNode> nodes;
+    size_t count;
+    SphereSetData()
+        : count(0)
+    {
+    }
+    ~SphereSetData()
+    {
+        for(size_t i = 0; i < materials.size(); i++)
+        {
+            materials[i]->release();
+        }
+    }
+    void addMaterial(const Material * material)
+    {
+        materials.push_back(material->duplicate());
+    }
+    Vector3D getCenter(size_t index) const
+    {
+        return Vector3D(centerX[index], centerY[index], centerZ[index]);
+    }
+    const Material * getMaterial(size_t index) const
+    {
+        return materialIndices.empty() ? materials[0] : materials[materialIndices[index]];
+    }
+    void build(const std::vector<Vector3D> & centers, const std::vector<float> & radii, const std::vector<SphereSet::MaterialIndex> & materialIndices)
+    {
+        assert(centers.size() == radii.size() && (materialIndices.empty() || materialIndices.size() == centers.size()));
+        std::vector<BoundingBox> sphereBounds;
+        std::vector<size_t> valid;
+        sphereBounds.reserve(centers.size());
+        valid.reserve(centers.size());
+        for(size_t i = 0; i < centers.size(); i++)
+        {
+            if(radii[i] <= 0)
+            {
+                continue; // can't be hit
+            }
+            sphereBounds.push_back(BoundingBox(centers[i] - Vector3D(radii[i]), centers[i] + Vector3D(radii[i])));
+            valid.push_back(i);
+        }
+        std::vector<size_t> order;
+        buildBVH(sphereBounds, nodes, order, PacketSize);
+        count = order.size();
+        centerX.assign(count + PacketSize - 1, 0.0f);
+        centerY.assign(count + PacketSize - 1, 0.0f);
+        centerZ.assign(count + PacketSize - 1, 0.0f);
+        radius.assign(count + PacketSize - 1, 0.0f);
+        this->materialIndices.resize(materialIndices.empty() ? 0 : count);
+        for(size_t i = 0; i < count; i++)
+        {
+            size_t sphere = valid[order[i]];
+            centerX[i] = centers[sphere].x;
+            centerY[i] = centers[sphere].y;
+            centerZ[i] = centers[sphere].z;
+            radius[i] = radii[sphere];
+            if(!materialIndices.empty())
+            {
+                assert(materialIndices[sphere] < materials.size());
+                this->materialIndices[i] = materialIndices[sphere];
+            }
+        }
+    }
+};
+
+namespace
+{
+/** the values of a ray used to intersect it with a packet of spheres */
+struct LeafRay
+{
+    VectorPacket origin, dir;
+    FloatPacket invA;
+    explicit LeafRay(const Ray & ray)
+        : origin(ray.origin), dir(ray.dir), invA(1 / abs_squared(ray.dir))
+    {
+    }
+};
+
+/** intersects the line through a ray with the spheres <code>[start, start + count)</code>, <code>count</code> is at most <code>PacketSize</code>
+ * @return the spheres the line goes through, <code>tStart</code> and <code>tEnd</code> are set to where it enters and leaves them */
+MaskPacket intersectSpheres(const SphereSetData & data, const LeafRay & ray, size_t start, size_t count, FloatPacket & tStart, FloatPacket & tEnd)
+{
+    VectorPacket center(FloatPacket::load(&data.centerX[start]), FloatPacket::load(&data.centerY[start]), FloatPacket::load(&data.centerZ[start]));
+    FloatPacket r = FloatPacket::load(&data.radius[start]);
+    VectorPacket originMinusCenter = ray.origin - center;
+    // use the distance from the center to the line instead of b * b - a * c so distant spheres don't lose precision
+    FloatPacket tClosest = -dot(originMinusCenter, ray.dir) * ray.invA;
+    VectorPacket fromCenter = originMinusCenter + tClosest * ray.dir;
+    FloatPacket sqrtArg = r * r - dot(fromCenter, fromCenter);
+    MaskPacket retval = (sqrtArg > FloatPacket(0.0f)) & MaskPacket::fromBits((1 << count) - 1);
+    FloatPacket halfLength = sqrt(max(sqrtArg, FloatPacket(0.0f)) * ray.invA);
+    tStart = tClosest - halfLength;
+    tEnd = tClosest + halfLength;
+    return retval;
+}
+
+/** where the line through a ray goes through a sphere */
+struct Interval
+{
+    float start, end;
+    unsigned sphere;
+    bool operator <(const Interval & rt) const
+    {
+        return start < rt.start;
+    }
+};
+
+class SphereSetSpanIterator : public SpanIterator
+{
+public:
+    explicit SphereSetSpanIterator(const SphereSetData & data)
+        : data(data), ray(Vector3D(0), Vector3D(1, 0, 0)), nextInterval(0), ended(true)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        intervals.clear();
+        nextInterval = 0;
+        if(!data.nodes.empty())
+        {
+            LeafRay leafRay(ray);
+            Vector3D invDir = BoundingBox::inverseDirection(ray.dir);
+            stack.clear();
+            stack.push_back(0);
+            while(!stack.empty())
+            {
+                size_t index = stack.back();
+                const BVHNode & node = data.nodes[index];
+                stack.pop_back();
+                float tNear, tFar;
+                if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar))
+                {
+                    continue;
+                }
+                if(node.count == 0)
+                {
+                    stack.push_back(node.start);
+                    stack.push_back(index + 1);
+                    continue;
+                }
+                FloatPacket tStart, tEnd;
+                int bits = intersectSpheres(data, leafRay, node.start, node.count, tStart, tEnd).bits();
+                if(bits == 0)
+                {
+                    continue;
+                }
+                float starts[PacketSize], ends[PacketSize];
+                tStart.store(starts);
+                tEnd.store(ends);
+                for(int i = 0; i < (int)node.count; i++)
+                {
+                    if((bits >> i) & 1)
+                    {
+                        Interval interval;
+                        interval.start = starts[i];
+                        interval.end = ends[i];
+                        interval.sphere = (unsigned)(node.start + i);
+                        intervals.push_back(interval);
+                    }
+                }
+            }
+            std::sort(intervals.begin(), intervals.end());
+        }
+        ended = false;
+        next();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        if(nextInterval >= intervals.size())
+        {
+            ended = true;
+            return;
+        }
+        const Interval & first = intervals[nextInterval++];
+        theSpan.start = first.start;
+        theSpan.startBoundary.index = first.sphere;
+        theSpan.end = first.end;
+        theSpan.endBoundary.index = first.sphere;
+        // merge the spheres that overlap
+        for(; nextInterval < intervals.size() && intervals[nextInterval].start <= theSpan.end; nextInterval++)
+        {
+            if(intervals[nextInterval].end > theSpan.end)
+            {
+                theSpan.end = intervals[nextInterval].end;
+                theSpan.endBoundary.index = intervals[nextInterval].sphere;
+            }
+        }
+    }
+    virtual ~SphereSetSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return data.getMaterial(index);
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return ray.getPoint(t) - data.getCenter(index);
+    }
+
+private:
+    Span theSpan;
+    const SphereSetData & data;
+    Ray ray;
+    std::vector<size_t> stack;
+    std::vector<Interval> intervals;
+    size_t nextInterval;
+    bool ended;
+};
+
+/** the spheres of a <code>SphereSet</code> for <code>findUnionFirstHit</code> */
+class SphereLeaves
+{
+public:
+    struct Boundary
+    {
+        float t;
+        bool entering;
+        size_t sphere;
+    };
+    SphereLeaves(const SphereSetData & data, const Ray & ray)
+        : data(data), leafRay(ray)
+    {
+    }
+    void addLeaf(UnionFirstHitSearch<SphereLeaves> & search, size_t start, size_t count) const
+    {
+        FloatPacket tStart, tEnd;
+        int bits = intersectSpheres(data, leafRay, start, count, tStart, tEnd).bits();
+        if(bits == 0)
+        {
+            return;
+        }
+        float starts[PacketSize], ends[PacketSize];
+        tStart.store(starts);
+        tEnd.store(ends);
+        for(int i = 0; i < (int)count; i++)
+        {
+            if(((bits >> i) & 1) == 0)
+            {
+                continue;
+            }
+            Boundary boundary;
+            boundary.entering = starts[i] >= search.t;
+            boundary.t = boundary.entering ? starts[i] : ends[i];
+            boundary.sphere = start + i;
+            if(boundary.t >= search.t)
+            {
+                search.addBoundary(boundary);
+            }
+        }
+    }
+    void addUnbounded(UnionFirstHitSearch<SphereLeaves> & search) const
+    {
+    }
+private:
+    const SphereSetData & data;
+    const LeafRay leafRay;
+};
+
+/** checks the spheres in the nodes that a segment goes through, stopping at the first sphere that overlaps the segment */
+class OcclusionSearch
+{
+public:
+    OcclusionSearch(const SphereSetData & data, const Ray & ray, float tmin, float tmax)
+        : data(data), ray(ray), leafRay(ray), invDir(BoundingBox::inverseDirection(ray.dir)), tmin(tmin), tmax(tmax)
+    {
+    }
+    bool occluded(size_t index) const
+    {
+        const BVHNode & node = data.nodes[index];
+        float tNear, tFar;
+        if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar) || tFar < tmin || tNear > tmax)
+        {
+            return false;
+        }
+        if(node.count > 0)
+        {
+            FloatPacket tStart, tEnd;
+            int bits = intersectSpheres(data, leafRay, node.start, node.count, tStart, tEnd).bits();
+            if(bits == 0)
+            {
+                return false;
+            }
+            float starts[PacketSize], ends[PacketSize];
+            tStart.store(starts);
+            tEnd.store(ends);
+            for(int i = 0; i < (int)node.count; i++)
+            {
+                if(((bits >> i) & 1) && starts[i] <= tmax && ends[i] >= tmin)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return occluded(index + 1) || occluded(node.start);
+    }
+private:
+    const SphereSetData & data;
+    const Ray & ray;
+    const LeafRay leafRay;
+    const Vector3D invDir;
+    const float tmin, tmax;
+};
+}
+
+SphereSet::SphereSet(const std::vector<Vector3D> & centers, const std::vector<float> & radii, const Material * material)
+    : data(new SphereSetData)
+{
+    data->addMaterial(material);
+    data->build(centers, radii, std::vector<MaterialIndex>());
+}
+
+SphereSet::SphereSet(const std::vector<Vector3D> & centers, const std::vector<float> & radii, const std::vector<const Material *> & materials, const std::vector<MaterialIndex> & materialIndices)
+    : data(new SphereSetData)
+{
+    assert(!materials.empty());
+    for(size_t i = 0; i < materials.size(); i++)
+    {
+        data->addMaterial(materials[i]);
+    }
+    data->build(centers, radii, materialIndices);
+}
+
+SphereSet::SphereSet(SphereSetData * data)
+    : data(data)
+{
+    data->addReference();
+}
+
+SphereSet::~SphereSet()
+{
+    data->removeReference();
+}
+
+Object * SphereSet::duplicate() const
+{
+    return new SphereSet(data);
+}
+
+Object * SphereSet::transform(const Matrix & m) const
+{
+    float scale;
+    if(!m.isSimilarity(scale))
+    {
+        return NULL;
+    }
+    // the rays are transformed by m so the spheres are transformed by the inverse
+    Matrix inv = invert(m);
+    std::vector<Vector3D> centers(data->count);
+    std::vector<float> radii(data->count);
+    for(size_t i = 0; i < data->count; i++)
+    {
+        centers[i] = inv.apply(data->getCenter(i));
+        radii[i] = data->radius[i] / scale;
+    }
+    return new SphereSet(centers, radii, data->materials, data->materialIndices);
+}
+
+BoundingBox SphereSet::getBounds() const
+{
+    return data->nodes.empty() ? BoundingBox() : data->nodes[0].bounds;
+}
+
+size_t SphereSet::getSphereCount() const
+{
+    return data->count;
+}
+
+SpanIterator * SphereSet::makeSpanIterator() const
+{
+    return new SphereSetSpanIterator(*data);
+}
+
+bool SphereSet::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    SphereLeaves::Boundary boundary;
+    if(!findUnionFirstHit(data->nodes, SphereLeaves(*data, ray), ray, tmin, tmax, boundary))
+    {
+        return false;
+    }
+    hit.t = boundary.t;
+    hit.entering = boundary.entering;
+    hit.normal = normalize(ray.getPoint(boundary.t) - data->getCenter(boundary.sphere));
+    hit.material = data->getMaterial(boundary.sphere);
+    hit.object = this;
+    return true;
+}
+
+bool SphereSet::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    return !data->nodes.empty() && OcclusionSearch(*data, ray, tmin, tmax).occluded(0);
+}
+
+}
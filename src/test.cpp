@@ -1,4 +1,5 @@
 #include "path-trace.h"
+#include "wavefront.h"
 #ifndef SERVER_ONLY
 #include <SDL.h>
 #endif
@@ -22,17 +23,34 @@
 #include "image_texture.h"
 #include "transform_texture.h"
 #include "filter_texture.h"
+#include "csg_program.h"
+#include "csg_optimizer.h"
+#include "box.h"
+#include "instance.h"
 
 #define WRITE_BMP
 #define WRITE_HDR
+//#define WRITE_VARIANCE // write the variance of each pixel's color next to the HDR image
 
 using namespace std;
 using namespace PathTrace;
 const char * NET_PORT = "12346";
 const bool multiThreaded = true;
 const int rendererCount = 200;
-const int rayCount = 10;
+const Integrator integrator = PathIntegrator;
+const int rayCount = integrator == PathIntegrator ? 256 : 10; // samples per pixel, the maximum when sampling adaptively
+const bool adaptiveSampling = true; // stop tracing a pixel when its estimated error is small enough
+const int minimumRayCount = integrator == PathIntegrator ? 16 : rayCount; // samples per pixel before checking the error
+const float maximumRelativeError = 0.02; // the relative standard error of each pixel's brightness
 const int rayDepth = 16;
+enum SamplerType
+{
+    StratifiedSampling,
+    HaltonSampling,
+    SobolSampling
+};
+const SamplerType samplerType = SobolSampling;
+const bool useWavefrontRenderer = false; // render every pixel breadth-first instead of adaptively refining blocks
 const int ScreenWidth = 1920, ScreenHeight = 1080;
 const char *const ProgramName = "Path Trace Test";
 const float minimumColorDelta = 0.003; // if the color change is less than this then we don't need to check inside this box
@@ -55,14 +73,10 @@ Object *unionArray(Object *array[], int start, int end)
     {
         return array[start];
     }
-    if(end - start == 2)
-    {
-        return new Union(array[start], array[start + 1]);
-    }
-    int split = (end - start) / 2 + start;
-    return new Union(unionArray(array, start, split), unionArray(array, split, end));
+    return new BVHUnion(&array[start], end - start);
 }
 
+/** @return the CSG tree of a lens, not compiled so it can be optimized first */
 Object *makeLens(Vector3D position, Vector3D orientation, float radius, float sphereRadius, const Material *material)
 {
     assert(radius <= sphereRadius);
@@ -85,63 +99,81 @@ Vector3D interpolate(float t, Vector3D a, Vector3D b)
     return a + t * (b - a);
 }
 
-Material * makeSkyBox(string folderName)
+const Material * makeSkyBox(string folderName)
 {
     if(folderName == "")
         folderName = ".";
     else if(folderName[folderName.size() - 1] == '/')
         folderName.erase(folderName.size() - 1);
-    return new Material(new ColorTexture(0), new ColorTexture(0), new ImageSkyboxTexture(Image(folderName + "/top.png"), Image(folderName + "/bottom.png"), Image(folderName + "/left.png"), Image(folderName + "/right.png"), Image(folderName + "/front.png"), Image(folderName + "/back.png")));
+    return makeMaterial(makeColorTexture(0), makeColorTexture(0), new ImageSkyboxTexture(Image(folderName + "/top.png"), Image(folderName + "/bottom.png"), Image(folderName + "/left.png"), Image(folderName + "/right.png"), Image(folderName + "/front.png"), Image(folderName + "/back.png")));
+}
+
+const Material * makeSkyMirrorSphere(string fileName, Color scaleFactor = Color(1))
+{
+    return makeMaterial(makeColorTexture(0), makeColorTexture(0), new MultiplyTexture(scaleFactor, new MirrorBallSkymapTexture(new ImageTexture(Image(fileName)))));
 }
 
-Material * makeSkyMirrorSphere(string fileName, Color scaleFactor = Color(1))
+const Material * makeSkySphericalCoordinates(string fileName, Color scaleFactor = Color(1))
 {
-    return new Material(new ColorTexture(0), new ColorTexture(0), new MultiplyTexture(scaleFactor, new MirrorBallSkymapTexture(new ImageTexture(Image(fileName)))));
+    return makeMaterial(makeColorTexture(0), makeColorTexture(0), new MultiplyTexture(scaleFactor, new SphericalCoordinatesSkymapTexture(new ImageTexture(Image(fileName)))));
 }
 
-Material * makeSkySphericalCoordinates(string fileName, Color scaleFactor = Color(1))
+/** optimizes the CSG tree <code>o</code> and compiles the result, the optimizer doesn't change compiled trees */
+Object *optimizeAndCompileCSG(Object *o, vector<string> *changes)
 {
-    return new Material(new ColorTexture(0), new ColorTexture(0), new MultiplyTexture(scaleFactor, new SphericalCoordinatesSkymapTexture(new ImageTexture(Image(fileName)))));
+    return compileCSG(optimizeCSG(o, changes));
 }
 
-Object *makeWorld()
+/** @param changes
+ *            the description of each change made by the CSG optimizer is added to this
+ * @return the scene */
+Object *makeWorld(vector<string> *changes)
 {
-    static Material matEmitR(new ColorTexture(0), new ColorTexture(0), new ColorTexture(24, 0, 0));
-    static Material matEmitG(new ColorTexture(0), new ColorTexture(0), new ColorTexture(0, 24, 0));
-    static Material matEmitB(new ColorTexture(0), new ColorTexture(0), new ColorTexture(0, 0, 24));
-    static Material matEmitW(new ColorTexture(0), new ColorTexture(0), new ColorTexture(2));
-    static Material matEmitBrightW(new ColorTexture(0), new ColorTexture(0), new ColorTexture(40));
-    static Material matDiffuseWhite(new ColorTexture(0.8), new ColorTexture(1));
-    static Material matBrightDiffuseWhite(new ColorTexture(8), new ColorTexture(1));
-    static Material matGlass(new ColorTexture(0.7), new ColorTexture(0), new ColorTexture(0), new ColorTexture(0.9), 1.3, new ColorTexture(1));
-    static Material matDiamond(new ColorTexture(0.2), new ColorTexture(0), new ColorTexture(0), new ColorTexture(0.9), 2.419, new ColorTexture(1));
-    static Material matMirror(new ColorTexture(0.99), new ColorTexture(0));
-    //static Material matImageInternal(new ImageTexture(Image("test2.hdr")));
-    //static Material & matImage = *transform(Matrix::scale(0.1), &matImageInternal);
-    static Material matImageEmitInternal(new ColorTexture(0), new ColorTexture(0), new ImageTexture(Image("test2.hdr")));
-    //static Material & matImageEmit = *transform(Matrix::translate(-1, 0, -4).inverse(), &matImageEmitInternal);
-    static Material & matSkyBox = *transform(Matrix::rotateX(2 * M_PI / 4), makeSkySphericalCoordinates("Serpentine_Valley_3k.hdr", Color(0.01)));
+    //const Material * matEmitR = makeMaterial(makeColorTexture(0), makeColorTexture(0), makeColorTexture(Color(24, 0, 0)));
+    //const Material * matEmitG = makeMaterial(makeColorTexture(0), makeColorTexture(0), makeColorTexture(Color(0, 24, 0)));
+    //const Material * matEmitB = makeMaterial(makeColorTexture(0), makeColorTexture(0), makeColorTexture(Color(0, 0, 24)));
+    const Material * matEmitW = makeMaterial(makeColorTexture(0), makeColorTexture(0), makeColorTexture(2));
+    //const Material * matEmitBrightW = makeMaterial(makeColorTexture(0), makeColorTexture(0), makeColorTexture(40));
+    const Material * matDiffuseWhite = makeMaterial(makeColorTexture(0.8), makeColorTexture(1));
+    //const Material * matBrightDiffuseWhite = makeMaterial(makeColorTexture(8), makeColorTexture(1));
+    const Material * matGlass = makeMaterial(makeColorTexture(0.7), makeColorTexture(0), makeColorTexture(0), makeColorTexture(0.9), 1.3, makeColorTexture(1));
+    //const Material * matDiamond = makeMaterial(makeColorTexture(0.2), makeColorTexture(0), makeColorTexture(0), makeColorTexture(0.9), 2.419, makeColorTexture(1));
+    //const Material * matMirror = makeMaterial(makeColorTexture(0.99), makeColorTexture(0));
+    //const Material * matImageInternal = makeMaterial(new ImageTexture(Image("test2.hdr")));
+    //const Material * matImage = transform(Matrix::scale(0.1), matImageInternal);
+    //const Material * matImageEmitInternal = makeMaterial(makeColorTexture(0), makeColorTexture(0), new ImageTexture(Image("test2.hdr")));
+    //const Material * matImageEmit = transform(Matrix::translate(-1, 0, -4).inverse(), matImageEmitInternal);
+    const Material * matSky = makeSkySphericalCoordinates("Serpentine_Valley_3k.hdr", Color(0.01));
+    const Material * matSkyBox = transform(Matrix::rotateX(2 * M_PI / 4), matSky);
+    const Material * matDiffuseWhiteTranslated = transform(Matrix::translate(-1, 0, 4), matDiffuseWhite);
+    const Material * matEmitWTranslated = transform(Matrix::translate(-1, 0, 4), matEmitW);
     Object *objects[] =
     {
-        /*new Sphere(Vector3D(-1 + sin(M_PI * 2 / 3) * 3, 6 + cos(M_PI * 2 / 3) * 3, 14), 6, &matEmitR),
-        new Sphere(Vector3D(-1 + sin(M_PI * 4 / 3) * 3, 6 + cos(M_PI * 2 / 3) * 3, 14), 6, &matEmitB),
-        new Sphere(Vector3D(-1, 6 + 3, 14), 6, &matEmitG),
-        new Sphere(Vector3D(-1, 6, 14), 6, &matEmitBrightW),
-        new Sphere(Vector3D(-1, 6, 16), 7.5, &matMirror),*/
-        new Sphere(Vector3D(1, 0, -4), 0.2, transform(Matrix::translate(-1, 0, 4), &matDiffuseWhite)),
-        new Intersection(new Sphere(Vector3D(1, 0, -4), 0.2 * 5, &matGlass), new Union(new Plane(Vector3D(-1, 0, -0.7), Vector3D(1, 0, -4), &matGlass), new Sphere(Vector3D(1, 0, -4), 0.2, transform(Matrix::translate(-1, 0, 4), &matEmitW)))),
-        new Sphere(Vector3D(-1, 0, -4), 0.2, &matDiffuseWhite),
-        new Plane(Vector3D(0, 0, -1), 200, &matSkyBox),
-        new Plane(Vector3D(0, 0, 1), 200, &matSkyBox),
-        //new Plane(Vector3D(0, 0, 1), 1, transform(Matrix::translate(-0.5, -0.5, 0).concat(Matrix::scale(640.0f / 480, 1, 1)).inverse(), &matImageEmitInternal)),
-        new Plane(Vector3D(0, -1, 0), 200, &matSkyBox),
-        new Plane(Vector3D(0, 1, 0), 200, &matSkyBox),
-        new Plane(Vector3D(1, 0, 0), 200, &matSkyBox),
-        new Plane(Vector3D(-1, 0, 0), 200, &matSkyBox),
-        makeLens(Vector3D(-2.5 / 4, 0, -2.5), Vector3D(-1, 0, -4), 0.5, 1, &matGlass),
-        //makeLensPointedAt(interpolate(0.9, Vector3D(-1, 10, 14), Vector3D(0, 0, -10)), Vector3D(0, -1, -20), 1.2, 2.5, &matDiamond),
+        /*new Sphere(Vector3D(-1 + sin(M_PI * 2 / 3) * 3, 6 + cos(M_PI * 2 / 3) * 3, 14), 6, matEmitR),
+        new Sphere(Vector3D(-1 + sin(M_PI * 4 / 3) * 3, 6 + cos(M_PI * 2 / 3) * 3, 14), 6, matEmitB),
+        new Sphere(Vector3D(-1, 6 + 3, 14), 6, matEmitG),
+        new Sphere(Vector3D(-1, 6, 14), 6, matEmitBrightW),
+        new Sphere(Vector3D(-1, 6, 16), 7.5, matMirror),*/
+        new Sphere(Vector3D(1, 0, -4), 0.2, matDiffuseWhiteTranslated),
+        optimizeAndCompileCSG(new Intersection(new Sphere(Vector3D(1, 0, -4), 0.2 * 5, matGlass), new Union(new Plane(Vector3D(-1, 0, -0.7), Vector3D(1, 0, -4), matGlass), new Sphere(Vector3D(1, 0, -4), 0.2, matEmitWTranslated))), changes),
+        new Sphere(Vector3D(-1, 0, -4), 0.2, matDiffuseWhite),
+        new Plane(Vector3D(0, 0, -1), 200, matSkyBox),
+        new Plane(Vector3D(0, 0, 1), 200, matSkyBox),
+        //new Plane(Vector3D(0, 0, 1), 1, transform(Matrix::translate(-0.5, -0.5, 0).concat(Matrix::scale(640.0f / 480, 1, 1)).inverse(), matImageEmitInternal)),
+        new Plane(Vector3D(0, -1, 0), 200, matSkyBox),
+        new Plane(Vector3D(0, 1, 0), 200, matSkyBox),
+        new Plane(Vector3D(1, 0, 0), 200, matSkyBox),
+        new Plane(Vector3D(-1, 0, 0), 200, matSkyBox),
+        optimizeAndCompileCSG(makeLens(Vector3D(-2.5 / 4, 0, -2.5), Vector3D(-1, 0, -4), 0.5, 1, matGlass), changes),
+        //optimizeAndCompileCSG(makeLensPointedAt(interpolate(0.9, Vector3D(-1, 10, 14), Vector3D(0, 0, -10)), Vector3D(0, -1, -20), 1.2, 2.5, matDiamond), changes),
     };
-    return unionArray(objects, 0, sizeof(objects) / sizeof(objects[0]));
+    // the objects hold their own references to the materials
+    const Material * materials[] = {matEmitW, matDiffuseWhite, matGlass, matSky, matSkyBox, matDiffuseWhiteTranslated, matEmitWTranslated};
+    for(size_t i = 0; i < sizeof(materials) / sizeof(materials[0]); i++)
+    {
+        materials[i]->release();
+    }
+    return optimizeCSG(unionArray(objects, 0, sizeof(objects) / sizeof(objects[0])), changes);
 }
 
 class Runnable
@@ -317,16 +349,34 @@ public:
     }
     virtual bool done() = 0;
     virtual void copyToBuffer(Color *screenBuffer, int w, int h) = 0;
+    /** copies the variance of each pixel's color, for renderers that don't estimate it the buffer is left alone */
+    virtual void copyVarianceToBuffer(Color *varianceBuffer, int w, int h)
+    {
+    }
     virtual ~BlockRenderer()
     {
     }
 };
 
+Sampler *makeSampler()
+{
+    switch(samplerType)
+    {
+    case StratifiedSampling:
+        return new StratifiedSampler(rayCount);
+    case HaltonSampling:
+        return new HaltonSampler();
+    case SobolSampling:
+        break;
+    }
+    return new SobolSampler();
+}
+
 class RenderBlock : public Runnable, public BlockRenderer
 {
 public:
-    RenderBlock(const int x, const int y, int size, const Object *world)
-        : Runnable(), xOrigin(x), yOrigin(y), buffer(new Color[(size + 1) * (size + 1)]), validBuffer(new bool[(size + 1) * (size + 1)]), wroteBuffer(new bool[(size + 1) * (size + 1)]), size(size), world(world), ran_finish(false), finished(false)
+    RenderBlock(const int x, const int y, int size, const Object *world, const LightList *lights)
+        : Runnable(), xOrigin(x), yOrigin(y), buffer(new Color[(size + 1) * (size + 1)]), varianceBuffer(new Color[(size + 1) * (size + 1)]), validBuffer(new bool[(size + 1) * (size + 1)]), wroteBuffer(new bool[(size + 1) * (size + 1)]), size(size), world(world), lights(lights), sampler(makeSampler()), ran_finish(false), finished(false)
     {
         for(int i = 0; i < (size + 1) * (size + 1); i++)
         {
@@ -372,6 +422,19 @@ public:
             }
         }
     }
+    void copyVarianceToBuffer(Color *varianceBuffer, int w, int h)
+    {
+        for(int y = yOrigin; y < yOrigin + size && y < h; y++)
+        {
+            for(int x = xOrigin; x < xOrigin + size && x < w; x++)
+            {
+                if(validPixel(x, y))
+                {
+                    varianceBuffer[x + w * y] = pixelVariance(x, y);
+                }
+            }
+        }
+    }
     void copyToSocket(FILE *f)
     {
         for(int y = yOrigin; y < yOrigin + size; y++)
@@ -392,13 +455,19 @@ public:
     ~RenderBlock()
     {
         delete []buffer;
+        delete []varianceBuffer;
         delete []validBuffer;
+        delete sampler;
     }
 private:
     Color &pixel(int x, int y)
     {
         return buffer[x - xOrigin + (y - yOrigin) * (size + 1)];
     }
+    Color &pixelVariance(int x, int y)
+    {
+        return varianceBuffer[x - xOrigin + (y - yOrigin) * (size + 1)];
+    }
     bool &validPixel(int x, int y)
     {
         return validBuffer[x - xOrigin + (y - yOrigin) * (size + 1)];
@@ -407,7 +476,7 @@ private:
     {
         return wroteBuffer[x - xOrigin + (y - yOrigin) * (size + 1)];
     }
-    void setPixel(int x, int y, Color color)
+    void setPixel(int x, int y, Color color, Color variance = Color(0))
     {
         if(x < xOrigin || x - xOrigin > size)
         {
@@ -418,6 +487,7 @@ private:
             return;
         }
         pixel(x, y) = color;
+        pixelVariance(x, y) = variance;
         validPixel(x, y) = true;
     }
     void interpolateSquare(int xOrigin, int yOrigin, int size, Color tl, Color tr, Color bl, Color br)
@@ -447,7 +517,16 @@ private:
                 return pixel(x, y);
             }
         }
-        Color retval = tracePixel(*spanIterator, x, y, ScreenWidth, ScreenHeight, rayCount, rayDepth, ScreenWidth, ScreenHeight, min(ScreenWidth, ScreenHeight) * 2);
+        PixelStatistics statistics;
+        Color retval;
+        if(adaptiveSampling)
+        {
+            retval = tracePixelAdaptive(*world, x, y, ScreenWidth, ScreenHeight, minimumRayCount, rayCount, maximumRelativeError, rayDepth, ScreenWidth, ScreenHeight, min(ScreenWidth, ScreenHeight) * 2, *sampler, integrator, lights, &statistics);
+        }
+        else
+        {
+            retval = tracePixel(*world, x, y, ScreenWidth, ScreenHeight, rayCount, rayDepth, ScreenWidth, ScreenHeight, min(ScreenWidth, ScreenHeight) * 2, *sampler, integrator, lights);
+        }
 #if 0
         float r = max(retval.x, max(retval.y, retval.z));
         if(r > 1)
@@ -460,7 +539,7 @@ private:
             retval.z = min(1.0f, retval.z);
         }
 #endif
-        setPixel(x, y, retval);
+        setPixel(x, y, retval, statistics.getMeanVariance());
         return retval;
     }
     void renderSquare(int x, int y, int size, Color tl, Color tr, Color bl, Color br)
@@ -500,23 +579,76 @@ private:
 protected:
     virtual void run()
     {
-        spanIterator = world->makeSpanIterator();
         renderSquare(xOrigin, yOrigin, size, calcPixelColor(xOrigin, yOrigin), calcPixelColor(xOrigin + size, yOrigin), calcPixelColor(xOrigin, yOrigin + size), calcPixelColor(xOrigin + size, yOrigin + size));
-        delete spanIterator;
         finished = true;
     }
 private:
     const int xOrigin, yOrigin;
     Color *const buffer;
+    Color *const varianceBuffer; /// the variance of each traced pixel's color, 0 for interpolated pixels
     bool *const validBuffer;
     bool *const wroteBuffer;
     const int size;
     const Object *world;
+    const LightList *lights;
+    Sampler *sampler; /// only used by the thread rendering this block
     bool ran_finish;
-    SpanIterator *spanIterator;
     atomic_bool finished;
 };
 
+class WavefrontRenderBlock : public BlockRenderer
+{
+private:
+    const int x, y, width, height;
+    Color * const buffer;
+    const Object *world;
+    const LightList *lights;
+    atomic_bool finished;
+    thread * th;
+    static mutex renderMutex;
+    static void threadFn(WavefrontRenderBlock * wrb)
+    {
+        // each block uses all the processors so render them one at a time
+        renderMutex.lock();
+        WavefrontRenderer renderer(*wrb->world, ScreenWidth, ScreenHeight, ScreenWidth, ScreenHeight, min(ScreenWidth, ScreenHeight) * 2, rayCount, rayDepth, thread::hardware_concurrency(), wrb->lights);
+        renderer.render(wrb->x, wrb->y, wrb->width, wrb->height, wrb->buffer, wrb->x + ScreenWidth * wrb->y);
+        renderMutex.unlock();
+        wrb->finished = true;
+    }
+public:
+    WavefrontRenderBlock(int x, int y, int size, const Object *world, const LightList *lights)
+        : x(x), y(y), width(max(0, min(size, ScreenWidth - x))), height(max(0, min(size, ScreenHeight - y))), buffer(new Color[width * height]), world(world), lights(lights), finished(false)
+    {
+        th = new thread(threadFn, this);
+    }
+    bool done()
+    {
+        return finished;
+    }
+    void copyToBuffer(Color *screenBuffer, int w, int h)
+    {
+        if(!finished)
+        {
+            return;
+        }
+        for(int py = 0; py < height && py + y < h; py++)
+        {
+            for(int px = 0; px < width && px + x < w; px++)
+            {
+                screenBuffer[px + x + w * (py + y)] = buffer[px + width * py];
+            }
+        }
+    }
+    ~WavefrontRenderBlock()
+    {
+        th->join();
+        delete th;
+        delete []buffer;
+    }
+};
+
+mutex WavefrontRenderBlock::renderMutex;
+
 class NetRenderBlock : public BlockRenderer
 {
 private:
@@ -675,9 +807,19 @@ public:
 
 vector<string> NetRenderBlock::addresses;
 
-Object *const world = makeWorld();
+vector<string> worldChanges; /// the changes the CSG optimizer made to the world, defined first so it is constructed first
+Object *const world = makeWorld(&worldChanges);
+const LightList *const lights = new LightList(*world);
 AutoDestruct<Object> autoDestruct1(world);
 
+void logWorldChanges()
+{
+    for(size_t i = 0; i < worldChanges.size(); i++)
+    {
+        cout << "CSG optimizer: " << worldChanges[i] << endl;
+    }
+}
+
 void serverThreadFn(int fd)
 {
     static atomic_int running_count(0);
@@ -705,7 +847,7 @@ void serverThreadFn(int fd)
     fclose(f2);
     fprintf(f, "S\n");
     fflush(f);
-    RenderBlock *rb = new RenderBlock(x, y, size, world);
+    RenderBlock *rb = new RenderBlock(x, y, size, world, lights);
     while(!rb->done())
     {
         rb->copyToSocket(f);
@@ -783,7 +925,9 @@ BlockRenderer * makeBlockRenderer(int x, int y, int size)
 {
     if(isNetworkClient)
         return new NetRenderBlock(x, y, size);
-    return new RenderBlock(x, y, size, world);
+    if(useWavefrontRenderer)
+        return new WavefrontRenderBlock(x, y, size, world, lights);
+    return new RenderBlock(x, y, size, world, lights);
 }
 
 void client(vector<string> addresses)
@@ -794,9 +938,78 @@ void client(vector<string> addresses)
 #ifdef SERVER_ONLY
 int main()
 {
+    logWorldChanges();
     return server();
 }
 #else
+namespace
+{
+float randomSigned()
+{
+    return rand() * (2.0f / RAND_MAX) - 1;
+}
+
+/** @return if <code>firstHit</code> finds the same boundary as the spans of <code>o</code> */
+bool firstHitMatchesSpans(const Object & o, const Ray & ray, float tmin)
+{
+    Hit hit;
+    bool found = o.firstHit(ray, tmin, max_value, hit);
+    SpanIterator * spanIterator = o.makeSpanIterator();
+    AutoDestruct<SpanIterator> autoDestruct(spanIterator);
+    for(spanIterator->init(ray); *spanIterator; spanIterator->next())
+    {
+        const Span & span = **spanIterator;
+        float t = span.start >= tmin ? span.start : span.end;
+        if(t < tmin)
+        {
+            continue;
+        }
+        return found && hit.entering == (span.start >= tmin) && fabs(hit.t - t) <= 1e-4f * (1 + fabs(t));
+    }
+    return !found;
+}
+
+/** compares <code>firstHit</code> of unions of overlapping objects with their spans
+ * @return the number of rays that found a different boundary */
+int checkUnionFirstHit()
+{
+    srand(1);
+    const Material * material = makeMaterial();
+    int mismatches = 0;
+    for(int scene = 0; scene < 200; scene++)
+    {
+        vector<Object *> boxes;
+        vector<Matrix> transforms;
+        for(int i = 0; i < 6; i++)
+        {
+            Matrix m = Matrix::translate(randomSigned(), randomSigned(), randomSigned()).concat(Matrix::rotateX(3 * randomSigned())).concat(Matrix::rotateY(3 * randomSigned())).concat(Matrix::scale(1.5f + randomSigned()));
+            boxes.push_back(new TransformedObject(m, new Box(Vector3D(-0.5), Vector3D(0.5), material)));
+            transforms.push_back(Matrix::translate(randomSigned(), randomSigned(), randomSigned()).concat(Matrix::rotateZ(3 * randomSigned())));
+        }
+        BVHUnion overlappingBoxes(boxes);
+        Prototype * prototype = new Prototype(new Difference(new Box(Vector3D(-0.5), Vector3D(0.5), material), new Sphere(Vector3D(0.3, 0.2, 0.1), 0.4, material)));
+        Object * instances = makeInstances(prototype, transforms);
+        AutoDestruct<Object> autoDestruct(instances);
+        prototype->removeReference();
+        for(int i = 0; i < 1000; i++)
+        {
+            Ray ray(2 * Vector3D(randomSigned(), randomSigned(), randomSigned()), normalize(Vector3D(randomSigned(), randomSigned(), randomSigned())));
+            float tmin = rand() % 2 ? 0 : fabs(randomSigned());
+            if(!firstHitMatchesSpans(overlappingBoxes, ray, tmin))
+            {
+                mismatches++;
+            }
+            if(!firstHitMatchesSpans(*instances, ray, tmin))
+            {
+                mismatches++;
+            }
+        }
+    }
+    material->release();
+    return mismatches;
+}
+}
+
 int main(int argc, char **argv)
 {
     signal(SIGPIPE, SIG_IGN);
@@ -804,16 +1017,23 @@ int main(int argc, char **argv)
     {
         if(argv[1] == string("-h") || argv[1] == string("--help"))
         {
-            cout << "usage: path-trace [--novideo] [--server] [--client server.web.address]\n";
+            cout << "usage: path-trace [--novideo] [--server] [--check] [--client server.web.address]\n";
             return EXIT_SUCCESS;
         }
         else if(argv[1] == string("--server"))
         {
+            logWorldChanges();
             return server();
         }
+        else if(argv[1] == string("--check"))
+        {
+            int mismatches = checkUnionFirstHit();
+            cout << mismatches << " rays found a different first boundary than the spans of the unions\n";
+            return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
         else
         {
-            cout << "usage: path-trace [--novideo] [--server] [--client server.web.address]\n";
+            cout << "usage: path-trace [--novideo] [--server] [--check] [--client server.web.address]\n";
             return EXIT_FAILURE;
         }
     }
@@ -830,10 +1050,11 @@ int main(int argc, char **argv)
         }
         else
         {
-            cout << "usage: path-trace [--novideo] [--server] [--client server.web.address]\n";
+            cout << "usage: path-trace [--novideo] [--server] [--check] [--client server.web.address]\n";
             return EXIT_FAILURE;
         }
     }
+    logWorldChanges();
     bool useVideo = true;
     if(argc >= 2 && string(argv[1]) == "--novideo")
     {
@@ -870,6 +1091,9 @@ int main(int argc, char **argv)
     int bx = 0, by = 0;
     int count = 1;
     Color *screenBuffer = new Color[ScreenWidth * ScreenHeight];
+#ifdef WRITE_VARIANCE
+    Color *varianceBuffer = new Color[ScreenWidth * ScreenHeight];
+#endif // WRITE_VARIANCE
     while(SDL_LockSurface(screen) != 0)
         ;
     for(int y = 0; y < ScreenHeight; y++)
@@ -1029,6 +1253,9 @@ int main(int argc, char **argv)
                         continue;
                     }
                     renderers[i]->copyToBuffer(screenBuffer, ScreenWidth, ScreenHeight);
+#ifdef WRITE_VARIANCE
+                    renderers[i]->copyVarianceToBuffer(varianceBuffer, ScreenWidth, ScreenHeight);
+#endif // WRITE_VARIANCE
                     for(int y = by; y < by + blockSize && y < ScreenHeight; y++)
                     {
                         for(int x = bx; x < bx + blockSize && x < ScreenWidth; x++)
@@ -1049,10 +1276,10 @@ int main(int argc, char **argv)
                         if(by >= ScreenHeight)
                         {
                             rendered = true;
-#if defined(WRITE_BMP) || defined(WRITE_HDR)
+#if defined(WRITE_BMP) || defined(WRITE_HDR) || defined(WRITE_VARIANCE)
                             char fname[100];
                             unsigned theTime = (unsigned)time(NULL);
-#endif // WRITE_BMP || WRITE_HDR
+#endif // WRITE_BMP || WRITE_HDR || WRITE_VARIANCE
 #ifdef WRITE_BMP
                             sprintf(fname, "image%08X.bmp", theTime);
                             SDL_SaveBMP(screen, fname);
@@ -1070,6 +1297,18 @@ int main(int argc, char **argv)
                             sprintf(fname, "image%08X.hdr", theTime);
                             img.writeHDR(fname);
 #endif // WRITE_HDR
+#ifdef WRITE_VARIANCE
+                            MutableImage varianceImage(ScreenWidth, ScreenHeight);
+                            for(int y = 0; y < ScreenHeight; y++)
+                            {
+                                for(int x = 0; x < ScreenWidth; x++)
+                                {
+                                    varianceImage.setPixel(x, y, varianceBuffer[x + ScreenWidth * y]);
+                                }
+                            }
+                            sprintf(fname, "image%08X-variance.hdr", theTime);
+                            varianceImage.writeHDR(fname);
+#endif // WRITE_VARIANCE
                         }
                     }
                 }
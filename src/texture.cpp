@@ -0,0 +1,47 @@
+#include "texture.h"
+#include <map>
+
+namespace PathTrace
+{
+
+namespace
+{
+struct ColorKey
+{
+    float r, g, b;
+    explicit ColorKey(Color c)
+        : r(c.x), g(c.y), b(c.z)
+    {
+    }
+    bool operator <(const ColorKey & rt) const
+    {
+        if(r != rt.r)
+        {
+            return r < rt.r;
+        }
+        if(g != rt.g)
+        {
+            return g < rt.g;
+        }
+        return b < rt.b;
+    }
+};
+}
+
+Texture *makeColorTexture(Color color)
+{
+    // constructed by the first call so materials at namespace scope in other files can use them
+    static mutex colorTexturesLock;
+    static std::map<ColorKey, Texture *> colorTextures; // holds a reference to each texture so they are never deleted
+    colorTexturesLock.lock();
+    Texture *& texture = colorTextures[ColorKey(color)];
+    if(!texture)
+    {
+        texture = new ColorTexture(color);
+    }
+    Texture * retval = texture->duplicate();
+    colorTexturesLock.unlock();
+    return retval;
+}
+
+}
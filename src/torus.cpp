@@ -0,0 +1,319 @@
+#include "torus.h"
+
+namespace PathTrace
+{
+
+const size_t Torus::MaxSpanCount;
+
+Torus::Torus(Vector3D center, Vector3D axis, float majorRadius, float minorRadius, const Material * material)
+    : center(center), axis(normalize(axis)), majorRadius(majorRadius), minorRadius(minorRadius), material(material->duplicate())
+{
+}
+
+Torus::~Torus()
+{
+    material->release();
+}
+
+namespace
+{
+const int MaxDegree = 4;
+
+/** @return the polynomial <code>coefficients[0] + coefficients[1] * x + ...</code> at <code>x</code> */
+inline double evaluate(const double coefficients[], int degree, double x)
+{
+    double retval = coefficients[degree];
+    for(int i = degree - 1; i >= 0; i--)
+    {
+        retval = retval * x + coefficients[i];
+    }
+    return retval;
+}
+
+/** finds the root in <code>[lo, hi]</code> of a polynomial with different signs at the ends,
+ * with Newton's method falling back to bisection when it leaves the bracket */
+double refineRoot(const double coefficients[], const double derivative[], int degree, double lo, double hi)
+{
+    const int MaxIterations = 64;
+    double valueLo = evaluate(coefficients, degree, lo);
+    double x = 0.5 * (lo + hi);
+    double tolerance = 1e-12 * (hi - lo) + 1e-15;
+    for(int i = 0; i < MaxIterations && hi - lo > tolerance; i++)
+    {
+        double value = evaluate(coefficients, degree, x);
+        if(value == 0)
+        {
+            return x;
+        }
+        if((value < 0) == (valueLo < 0))
+        {
+            lo = x;
+            valueLo = value;
+        }
+        else
+        {
+            hi = x;
+        }
+        double slope = evaluate(derivative, degree - 1, x);
+        double next = slope != 0 ? x - value / slope : lo;
+        x = (next > lo && next < hi) ? next : 0.5 * (lo + hi);
+    }
+    return x;
+}
+
+/** finds the real roots in <code>[lo, hi]</code> of a polynomial, each root is isolated between
+ * the roots of the derivative so it can be found by <code>refineRoot</code>
+ * @return the number of roots written to <code>roots</code> in increasing order */
+int findRoots(const double coefficients[], int degree, double lo, double hi, double roots[])
+{
+    if(degree == 1)
+    {
+        if(coefficients[1] == 0)
+        {
+            return 0;
+        }
+        double root = -coefficients[0] / coefficients[1];
+        if(root < lo || root > hi)
+        {
+            return 0;
+        }
+        roots[0] = root;
+        return 1;
+    }
+    double derivative[MaxDegree] = {0};
+    for(int i = 1; i <= degree; i++)
+    {
+        derivative[i - 1] = i * coefficients[i];
+    }
+    double criticalPoints[MaxDegree + 1];
+    int criticalPointCount = findRoots(derivative, degree - 1, lo, hi, criticalPoints + 1);
+    criticalPoints[0] = lo;
+    criticalPoints[criticalPointCount + 1] = hi;
+    int rootCount = 0;
+    double valueLo = evaluate(coefficients, degree, lo);
+    for(int i = 0; i <= criticalPointCount; i++)
+    {
+        double intervalLo = criticalPoints[i], intervalHi = criticalPoints[i + 1];
+        double valueHi = evaluate(coefficients, degree, intervalHi);
+        if(valueLo == 0)
+        {
+            if(rootCount == 0 || roots[rootCount - 1] != intervalLo)
+            {
+                roots[rootCount++] = intervalLo;
+            }
+        }
+        else if(valueHi != 0 && (valueLo < 0) != (valueHi < 0))
+        {
+            roots[rootCount++] = refineRoot(coefficients, derivative, degree, intervalLo, intervalHi);
+        }
+        valueLo = valueHi;
+    }
+    if(valueLo == 0 && (rootCount == 0 || roots[rootCount - 1] != hi))
+    {
+        roots[rootCount++] = hi;
+    }
+    return rootCount;
+}
+}
+
+size_t Torus::intersect(const Ray & ray, float starts[MaxSpanCount], float ends[MaxSpanCount]) const
+{
+    // work with a unit direction starting where the line enters the bounding sphere so the coefficients are well scaled
+    double dirLength = abs(ray.dir);
+    double dx = ray.dir.x / dirLength, dy = ray.dir.y / dirLength, dz = ray.dir.z / dirLength;
+    double ox = (double)ray.origin.x - center.x, oy = (double)ray.origin.y - center.y, oz = (double)ray.origin.z - center.z;
+    double boundingRadius = (double)majorRadius + minorRadius;
+    double h = ox * dx + oy * dy + oz * dz;
+    double discriminant = h * h - (ox * ox + oy * oy + oz * oz - boundingRadius * boundingRadius);
+    if(discriminant <= 0)
+    {
+        return 0;
+    }
+    double sqrtDiscriminant = std::sqrt(discriminant);
+    double enter = -h - sqrtDiscriminant, length = 2 * sqrtDiscriminant;
+    double px = ox + enter * dx, py = oy + enter * dy, pz = oz + enter * dz;
+    double pa = px * axis.x + py * axis.y + pz * axis.z, da = dx * axis.x + dy * axis.y + dz * axis.z;
+    double pp = px * px + py * py + pz * pz, pd = px * dx + py * dy + pz * dz;
+    double R2 = (double)majorRadius * majorRadius, r2 = (double)minorRadius * minorRadius;
+    double g = pp + R2 - r2;
+    // (|p + u * d|^2 + R^2 - r^2)^2 - 4 * R^2 * (distance from the axis)^2
+    double coefficients[MaxDegree + 1];
+    coefficients[4] = 1;
+    coefficients[3] = 4 * pd;
+    coefficients[2] = 4 * pd * pd + 2 * g - 4 * R2 * (1 - da * da);
+    coefficients[1] = 4 * pd * g - 8 * R2 * (pd - pa * da);
+    coefficients[0] = g * g - 4 * R2 * (pp - pa * pa);
+    double roots[MaxDegree + 2];
+    int rootCount = findRoots(coefficients, MaxDegree, 0, length, roots + 1);
+    roots[0] = 0;
+    roots[rootCount + 1] = length;
+    size_t spanCount = 0;
+    bool inside = false;
+    for(int i = 0; i <= rootCount; i++)
+    {
+        bool insideInterval = roots[i + 1] > roots[i] && evaluate(coefficients, MaxDegree, 0.5 * (roots[i] + roots[i + 1])) < 0;
+        if(insideInterval == inside)
+        {
+            continue;
+        }
+        inside = insideInterval;
+        float t = (float)((enter + roots[i]) / dirLength);
+        if(inside)
+        {
+            if(spanCount >= MaxSpanCount)
+            {
+                inside = false; // rounding errors can't add more spans than a torus has
+                break;
+            }
+            starts[spanCount] = t;
+        }
+        else
+        {
+            ends[spanCount++] = t;
+        }
+    }
+    if(inside)
+    {
+        ends[spanCount++] = (float)((enter + length) / dirLength);
+    }
+    return spanCount;
+}
+
+Vector3D Torus::getNormal(Vector3D position) const
+{
+    Vector3D p = position - center;
+    Vector3D fromAxis = p - axis * dot(p, axis);
+    return p * (abs_squared(p) + majorRadius * majorRadius - minorRadius * minorRadius) - fromAxis * (2 * majorRadius * majorRadius);
+}
+
+namespace
+{
+
+class TorusSpanIterator : public SpanIterator
+{
+public:
+    TorusSpanIterator(const Torus & torus, const Material * material)
+        : torus(torus), material(material), ray(Vector3D(0), Vector3D(1, 0, 0)), spanCount(0), index(0)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.startBoundary.index = 0;
+        theSpan.endBoundary = theSpan.startBoundary;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        spanCount = torus.intersect(ray, starts, ends);
+        index = 0;
+        calcSpan();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return index >= spanCount;
+    }
+    virtual void next()
+    {
+        index++;
+        calcSpan();
+    }
+    virtual ~TorusSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return torus.getNormal(ray.getPoint(t));
+    }
+
+private:
+    void calcSpan()
+    {
+        if(index < spanCount)
+        {
+            theSpan.start = starts[index];
+            theSpan.end = ends[index];
+        }
+    }
+    Span theSpan;
+    const Torus & torus;
+    const Material * const material;
+    Ray ray;
+    float starts[Torus::MaxSpanCount], ends[Torus::MaxSpanCount];
+    size_t spanCount, index;
+};
+}
+
+SpanIterator * Torus::makeSpanIterator() const
+{
+    return new TorusSpanIterator(*this, material);
+}
+
+bool Torus::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    float starts[MaxSpanCount], ends[MaxSpanCount];
+    size_t spanCount = intersect(ray, starts, ends);
+    for(size_t i = 0; i < spanCount; i++)
+    {
+        if(starts[i] > tmax)
+        {
+            return false;
+        }
+        if(starts[i] >= tmin)
+        {
+            hit.t = starts[i];
+            hit.entering = true;
+        }
+        else if(ends[i] > tmax)
+        {
+            return false;
+        }
+        else if(ends[i] >= tmin)
+        {
+            hit.t = ends[i];
+            hit.entering = false;
+        }
+        else
+        {
+            continue;
+        }
+        hit.normal = normalize(getNormal(ray.getPoint(hit.t)));
+        hit.material = material;
+        hit.object = this;
+        return true;
+    }
+    return false;
+}
+
+Object * Torus::transform(const Matrix & m) const
+{
+    float scale;
+    if(!m.isSimilarity(scale))
+    {
+        return NULL;
+    }
+    // the rays are transformed by m so the torus is transformed by the inverse
+    Matrix inv = invert(m);
+    return new Torus(inv.apply(center), inv.applyNoTranslate(axis), majorRadius / scale, minorRadius / scale, material);
+}
+
+BoundingBox Torus::getBounds() const
+{
+    Vector3D extent(majorRadius * std::sqrt(std::max(0.0f, 1 - axis.x * axis.x)) + minorRadius,
+                    majorRadius * std::sqrt(std::max(0.0f, 1 - axis.y * axis.y)) + minorRadius,
+                    majorRadius * std::sqrt(std::max(0.0f, 1 - axis.z * axis.z)) + minorRadius);
+    return BoundingBox(center - extent, center + extent);
+}
+
+}
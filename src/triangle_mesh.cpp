@@ -0,0 +1,1052 @@
+#include "triangle_mesh.h"
+#include "reference_counted.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+namespace PathTrace
+{
+
+/** the triangles of a <code>TriangleMesh</code>, shared by its copies */
+struct TriangleMeshData : public ReferenceCounted
+{
+    std::vector<float> vertices; /// x, y and z of each vertex
+    std::vector<unsigned> indices; /// 3 vertex indices per triangle, in the order referenced by the leaves
+    std::vector<BVHNode> nodes;
+    BoundingBox bounds;
+    size_t getTriangleCount() const
+    {
+        return indices.size() / 3;
+    }
+    Vector3D getVertex(size_t index) const
+    {
+        return Vector3D(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+    void build();
+};
+
+namespace
+{
+
+float getComponent(const Vector3D & v, int axis)
+{
+    switch(axis)
+    {
+    case 0:
+        return v.x;
+    case 1:
+        return v.y;
+    default:
+        return v.z;
+    }
+}
+
+/** the per ray values of the watertight ray/triangle test : the ray is translated to the origin
+ * and sheared so it points along the z axis */
+struct ShearedRay
+{
+    Vector3D origin;
+    int kx, ky, kz; /// the axes that are used as x, y and z
+    float sx, sy, sz;
+    explicit ShearedRay(const Ray & ray)
+        : origin(ray.origin)
+    {
+        Vector3D absDir(std::abs(ray.dir.x), std::abs(ray.dir.y), std::abs(ray.dir.z));
+        kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        float dirZ = getComponent(ray.dir, kz);
+        if(dirZ < 0)
+        {
+            std::swap(kx, ky); // keep the winding of the triangles
+        }
+        sx = getComponent(ray.dir, kx) / dirZ;
+        sy = getComponent(ray.dir, ky) / dirZ;
+        sz = 1 / dirZ;
+    }
+    /** @return if the line through the ray intersects the triangle, <code>t</code> is set to the ray parameter */
+    bool intersect(Vector3D v0, Vector3D v1, Vector3D v2, float & t) const
+    {
+        Vector3D a = v0 - origin, b = v1 - origin, c = v2 - origin;
+        float az = getComponent(a, kz), bz = getComponent(b, kz), cz = getComponent(c, kz);
+        float ax = getComponent(a, kx) - sx * az, ay = getComponent(a, ky) - sy * az;
+        float bx = getComponent(b, kx) - sx * bz, by = getComponent(b, ky) - sy * bz;
+        float cx = getComponent(c, kx) - sx * cz, cy = getComponent(c, ky) - sy * cz;
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+        if(u == 0 || v == 0 || w == 0)
+        {
+            // recalculate the edge functions exactly so rays through edges hit one of the triangles
+            u = (float)((double)cx * by - (double)cy * bx);
+            v = (float)((double)ax * cy - (double)ay * cx);
+            w = (float)((double)bx * ay - (double)by * ax);
+        }
+        if((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+        {
+            return false;
+        }
+        float det = u + v + w;
+        if(det == 0)
+        {
+            return false;
+        }
+        t = (u * sz * az + v * sz * bz + w * sz * cz) / det;
+        return true;
+    }
+};
+
+/** the same as <code>ShearedRay</code> for a packet of rays, each lane can use different axes */
+struct ShearedRayPacket
+{
+    const RayPacket & rays;
+    MaskPacket zIsX, zIsY, swapXY;
+    FloatPacket sx, sy, sz;
+    explicit ShearedRayPacket(const RayPacket & rays)
+        : rays(rays)
+    {
+        FloatPacket absX = abs(rays.dir.x), absY = abs(rays.dir.y), absZ = abs(rays.dir.z);
+        zIsX = (absX > absY) & (absX > absZ);
+        zIsY = ~zIsX & (absY > absZ);
+        swapXY = MaskPacket(false);
+        VectorPacket dir = permute(rays.dir);
+        swapXY = dir.z < FloatPacket(0.0f);
+        dir = permute(rays.dir);
+        sz = FloatPacket(1.0f) / dir.z;
+        sx = dir.x * sz;
+        sy = dir.y * sz;
+    }
+    /** @return <code>v</code> with the components reordered to the axes of each lane */
+    VectorPacket permute(const VectorPacket & v) const
+    {
+        FloatPacket x = select(zIsX, v.y, select(zIsY, v.z, v.x));
+        FloatPacket y = select(zIsX, v.z, select(zIsY, v.x, v.y));
+        FloatPacket z = select(zIsX, v.x, select(zIsY, v.y, v.z));
+        return VectorPacket(select(swapXY, y, x), select(swapXY, x, y), z);
+    }
+    /** @return the active rays whose lines intersect the triangle, <code>t</code> is set to the ray parameters */
+    MaskPacket intersect(MaskPacket active, Vector3D v0, Vector3D v1, Vector3D v2, FloatPacket & t) const
+    {
+        VectorPacket a = permute(VectorPacket(v0) - rays.origin);
+        VectorPacket b = permute(VectorPacket(v1) - rays.origin);
+        VectorPacket c = permute(VectorPacket(v2) - rays.origin);
+        FloatPacket ax = a.x - sx * a.z, ay = a.y - sy * a.z;
+        FloatPacket bx = b.x - sx * b.z, by = b.y - sy * b.z;
+        FloatPacket cx = c.x - sx * c.z, cy = c.y - sy * c.z;
+        FloatPacket u = cx * by - cy * bx;
+        FloatPacket v = ax * cy - ay * cx;
+        FloatPacket w = bx * ay - by * ax;
+        FloatPacket zero(0.0f);
+        MaskPacket inside = ~((u < zero) | (v < zero) | (w < zero)) | ~((u > zero) | (v > zero) | (w > zero));
+        FloatPacket det = u + v + w;
+        MaskPacket retval = active & inside & (det != zero);
+        t = (u * a.z + v * b.z + w * c.z) * sz / select(retval, det, FloatPacket(1.0f));
+        int exactBits = (active & ((u == zero) | (v == zero) | (w == zero))).bits();
+        if(exactBits == 0)
+        {
+            return retval;
+        }
+        // rays through an edge or vertex are tested one at a time with the exact edge functions
+        int bits = retval.bits() & ~exactBits;
+        float values[PacketSize];
+        t.store(values);
+        for(int i = 0; i < PacketSize; i++)
+        {
+            if(((exactBits >> i) & 1) && ShearedRay(rays.get(i)).intersect(v0, v1, v2, values[i]))
+            {
+                bits |= 1 << i;
+            }
+        }
+        t = FloatPacket::load(values);
+        return MaskPacket::fromBits(bits);
+    }
+};
+
+/** finds the closest triangle of a mesh intersected by a ray */
+class FirstHitSearch
+{
+public:
+    FirstHitSearch(const std::vector<BVHNode> & nodes, const std::vector<float> & vertices, const std::vector<unsigned> & indices, const Ray & ray, float tmin, float tmax)
+        : nodes(nodes), vertices(vertices), indices(indices), ray(ray), shearedRay(ray), invDir(BoundingBox::inverseDirection(ray.dir)), tmin(tmin), limit(tmax), triangle(0), found(false)
+    {
+    }
+    Vector3D getVertex(size_t index) const
+    {
+        return Vector3D(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+    void addNode(size_t index)
+    {
+        const BVHNode & node = nodes[index];
+        if(node.count > 0)
+        {
+            for(size_t i = node.start; i < node.start + node.count; i++)
+            {
+                float t;
+                if(shearedRay.intersect(getVertex(indices[3 * i]), getVertex(indices[3 * i + 1]), getVertex(indices[3 * i + 2]), t) && t >= tmin && t <= limit)
+                {
+                    limit = t;
+                    triangle = i;
+                    found = true;
+                }
+            }
+            return;
+        }
+        size_t first = index + 1, second = node.start;
+        float firstNear, firstFar, secondNear, secondFar;
+        bool hitFirst = nodes[first].bounds.intersects(ray.origin, invDir, firstNear, firstFar) && firstFar >= tmin;
+        bool hitSecond = nodes[second].bounds.intersects(ray.origin, invDir, secondNear, secondFar) && secondFar >= tmin;
+        if(hitFirst && hitSecond && secondNear < firstNear)
+        {
+            std::swap(first, second);
+            std::swap(firstNear, secondNear);
+            std::swap(hitFirst, hitSecond);
+        }
+        if(hitFirst && firstNear <= limit)
+        {
+            addNode(first);
+        }
+        if(hitSecond && secondNear <= limit)
+        {
+            addNode(second);
+        }
+    }
+    const std::vector<BVHNode> & nodes;
+    const std::vector<float> & vertices;
+    const std::vector<unsigned> & indices;
+    const Ray & ray;
+    const ShearedRay shearedRay;
+    const Vector3D invDir;
+    const float tmin;
+    float limit;
+    size_t triangle;
+    bool found;
+};
+
+/** checks the triangles in the nodes that a segment goes through, stopping at the first triangle on the segment */
+class OcclusionSearch
+{
+public:
+    OcclusionSearch(const std::vector<BVHNode> & nodes, const std::vector<float> & vertices, const std::vector<unsigned> & indices, const Ray & ray, float tmin, float tmax)
+        : nodes(nodes), vertices(vertices), indices(indices), ray(ray), shearedRay(ray), invDir(BoundingBox::inverseDirection(ray.dir)), tmin(tmin), tmax(tmax)
+    {
+    }
+    Vector3D getVertex(size_t index) const
+    {
+        return Vector3D(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+    bool occluded(size_t index) const
+    {
+        const BVHNode & node = nodes[index];
+        float tNear, tFar;
+        if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar) || tFar < tmin || tNear > tmax)
+        {
+            return false;
+        }
+        if(node.count > 0)
+        {
+            for(size_t i = node.start; i < node.start + node.count; i++)
+            {
+                float t;
+                if(shearedRay.intersect(getVertex(indices[3 * i]), getVertex(indices[3 * i + 1]), getVertex(indices[3 * i + 2]), t) && t >= tmin && t <= tmax)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return occluded(index + 1) || occluded(node.start);
+    }
+private:
+    const std::vector<BVHNode> & nodes;
+    const std::vector<float> & vertices;
+    const std::vector<unsigned> & indices;
+    const Ray & ray;
+    const ShearedRay shearedRay;
+    const Vector3D invDir;
+    const float tmin, tmax;
+};
+
+/** the same as <code>FirstHitSearch</code> for a packet of rays, visiting nodes that any of the rays enter */
+class PacketFirstHitSearch
+{
+public:
+    PacketFirstHitSearch(const std::vector<BVHNode> & nodes, const std::vector<float> & vertices, const std::vector<unsigned> & indices, const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits)
+        : nodes(nodes), vertices(vertices), indices(indices), rays(rays), shearedRays(rays), tmin(tmin), limit(tmax), found(false), hits(hits)
+    {
+        float invDirs[3][PacketSize];
+        for(int i = 0; i < PacketSize; i++)
+        {
+            Vector3D invDir = BoundingBox::inverseDirection(rays.dir.get(i));
+            invDirs[0][i] = invDir.x;
+            invDirs[1][i] = invDir.y;
+            invDirs[2][i] = invDir.z;
+        }
+        this->invDir = VectorPacket(FloatPacket::load(invDirs[0]), FloatPacket::load(invDirs[1]), FloatPacket::load(invDirs[2]));
+    }
+    Vector3D getVertex(size_t index) const
+    {
+        return Vector3D(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+    /** @return the rays in <code>active</code> that enter <code>bounds</code> before their current limit */
+    MaskPacket intersects(const BoundingBox & bounds, MaskPacket active, FloatPacket & tNear) const
+    {
+        FloatPacket tx0 = (FloatPacket(bounds.minCorner.x) - rays.origin.x) * invDir.x, tx1 = (FloatPacket(bounds.maxCorner.x) - rays.origin.x) * invDir.x;
+        FloatPacket ty0 = (FloatPacket(bounds.minCorner.y) - rays.origin.y) * invDir.y, ty1 = (FloatPacket(bounds.maxCorner.y) - rays.origin.y) * invDir.y;
+        FloatPacket tz0 = (FloatPacket(bounds.minCorner.z) - rays.origin.z) * invDir.z, tz1 = (FloatPacket(bounds.maxCorner.z) - rays.origin.z) * invDir.z;
+        tNear = max(FloatPacket(-max_value), max(min(tx0, tx1), max(min(ty0, ty1), min(tz0, tz1))));
+        FloatPacket tFar = min(FloatPacket(max_value), min(max(tx0, tx1), min(max(ty0, ty1), max(tz0, tz1))));
+        return active & (tNear <= tFar) & (tFar >= tmin) & (tNear <= limit);
+    }
+    void addTriangle(size_t triangle, MaskPacket active)
+    {
+        Vector3D v0 = getVertex(indices[3 * triangle]), v1 = getVertex(indices[3 * triangle + 1]), v2 = getVertex(indices[3 * triangle + 2]);
+        FloatPacket t;
+        MaskPacket hit = shearedRays.intersect(active, v0, v1, v2, t);
+        hit = hit & (t >= tmin) & (t <= limit);
+        int bits = hit.bits();
+        if(bits == 0)
+        {
+            return;
+        }
+        Vector3D normal = normalize(cross(v1 - v0, v2 - v0));
+        found = found | hit;
+        limit = select(hit, t, limit);
+        hits.t = limit;
+        hits.normal = select(hit, VectorPacket(normal), hits.normal);
+        MaskPacket entering = dot(rays.dir, VectorPacket(normal)) < FloatPacket(0.0f);
+        hits.entering = (hit & entering) | (~hit & hits.entering);
+    }
+    void addNode(size_t index, MaskPacket active)
+    {
+        const BVHNode & node = nodes[index];
+        if(node.count > 0)
+        {
+            for(size_t i = node.start; i < node.start + node.count; i++)
+            {
+                addTriangle(i, active);
+            }
+            return;
+        }
+        size_t first = index + 1, second = node.start;
+        FloatPacket firstNear, secondNear;
+        MaskPacket hitFirst = intersects(nodes[first].bounds, active, firstNear);
+        MaskPacket hitSecond = intersects(nodes[second].bounds, active, secondNear);
+        // visit the child that is closer for most of the rays first
+        MaskPacket both = hitFirst & hitSecond;
+        int secondCloser = (both & (secondNear < firstNear)).bits(), firstCloser = (both & ~(secondNear < firstNear)).bits();
+        if(countBits(secondCloser) > countBits(firstCloser))
+        {
+            std::swap(first, second);
+            std::swap(hitFirst, hitSecond);
+        }
+        if(any(hitFirst))
+        {
+            addNode(first, hitFirst);
+        }
+        // the limits may have moved closer
+        hitSecond = intersects(nodes[second].bounds, hitSecond, secondNear);
+        if(any(hitSecond))
+        {
+            addNode(second, hitSecond);
+        }
+    }
+    static int countBits(int v)
+    {
+        int retval = 0;
+        for(; v != 0; v &= v - 1)
+        {
+            retval++;
+        }
+        return retval;
+    }
+    const std::vector<BVHNode> & nodes;
+    const std::vector<float> & vertices;
+    const std::vector<unsigned> & indices;
+    const RayPacket & rays;
+    const ShearedRayPacket shearedRays;
+    VectorPacket invDir;
+    const FloatPacket tmin;
+    FloatPacket limit;
+    MaskPacket found;
+    HitPacket & hits;
+};
+
+/** a triangle crossed by the line through a ray */
+struct Crossing
+{
+    float t;
+    bool entering;
+    unsigned triangle;
+    bool operator <(const Crossing & rt) const
+    {
+        if(t != rt.t)
+        {
+            return t < rt.t;
+        }
+        return entering && !rt.entering; // so touching an edge from outside makes an empty span
+    }
+};
+
+class TriangleMeshSpanIterator : public SpanIterator
+{
+public:
+    TriangleMeshSpanIterator(const std::vector<BVHNode> & nodes, const std::vector<float> & vertices, const std::vector<unsigned> & indices, const Material * material)
+        : nodes(nodes), vertices(vertices), indices(indices), material(material), ray(Vector3D(0), Vector3D(1, 0, 0)), ended(true)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+    }
+    virtual void init(const Ray & ray)
+    {
+        this->ray = ray;
+        crossings.clear();
+        nextCrossing = 0;
+        if(!nodes.empty())
+        {
+            ShearedRay shearedRay(ray);
+            Vector3D invDir = BoundingBox::inverseDirection(ray.dir);
+            stack.clear();
+            stack.push_back(0);
+            while(!stack.empty())
+            {
+                size_t index = stack.back();
+                const BVHNode & node = nodes[index];
+                stack.pop_back();
+                float tNear, tFar;
+                if(!node.bounds.intersects(ray.origin, invDir, tNear, tFar))
+                {
+                    continue;
+                }
+                if(node.count == 0)
+                {
+                    stack.push_back(node.start);
+                    stack.push_back(index + 1);
+                    continue;
+                }
+                for(size_t i = node.start; i < node.start + node.count; i++)
+                {
+                    Vector3D v0 = getVertex(indices[3 * i]), v1 = getVertex(indices[3 * i + 1]), v2 = getVertex(indices[3 * i + 2]);
+                    Crossing crossing;
+                    if(!shearedRay.intersect(v0, v1, v2, crossing.t))
+                    {
+                        continue;
+                    }
+                    crossing.triangle = (unsigned)i;
+                    crossing.entering = dot(ray.dir, cross(v1 - v0, v2 - v0)) < 0;
+                    crossings.push_back(crossing);
+                }
+            }
+            std::sort(crossings.begin(), crossings.end());
+        }
+        ended = false;
+        next();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        for(;;)
+        {
+            // skip to the first front facing triangle then to where the ray has crossed as many triangles from the back
+            while(nextCrossing < crossings.size() && !crossings[nextCrossing].entering)
+            {
+                nextCrossing++;
+            }
+            if(nextCrossing >= crossings.size())
+            {
+                ended = true;
+                return;
+            }
+            const Crossing & start = crossings[nextCrossing++];
+            theSpan.start = start.t;
+            theSpan.startBoundary.index = start.triangle;
+            theSpan.end = max_value; // the mesh isn't closed
+            theSpan.endBoundary.index = OpenEnd;
+            for(int depth = 1; nextCrossing < crossings.size(); nextCrossing++)
+            {
+                depth += crossings[nextCrossing].entering ? 1 : -1;
+                if(depth == 0)
+                {
+                    theSpan.end = crossings[nextCrossing].t;
+                    theSpan.endBoundary.index = crossings[nextCrossing].triangle;
+                    nextCrossing++;
+                    break;
+                }
+            }
+            if(!theSpan.isEmpty())
+            {
+                return;
+            }
+        }
+    }
+    virtual ~TriangleMeshSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return material;
+    }
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        if(index == OpenEnd)
+        {
+            return ray.dir;
+        }
+        Vector3D v0 = getVertex(indices[3 * index]), v1 = getVertex(indices[3 * index + 1]), v2 = getVertex(indices[3 * index + 2]);
+        return cross(v1 - v0, v2 - v0);
+    }
+private:
+    static const unsigned OpenEnd = ~SpanBoundary::ReversedNormal; /// the boundary at the end of an open mesh
+    Vector3D getVertex(size_t index) const
+    {
+        return Vector3D(vertices[3 * index], vertices[3 * index + 1], vertices[3 * index + 2]);
+    }
+    const std::vector<BVHNode> & nodes;
+    const std::vector<float> & vertices;
+    const std::vector<unsigned> & indices;
+    std::vector<size_t> stack;
+    std::vector<Crossing> crossings;
+    size_t nextCrossing;
+    const Material * const material;
+    Ray ray;
+    Span theSpan;
+    bool ended;
+};
+
+/** adds the triangles of a polygon to <code>indices</code> as a fan */
+void addPolygon(const std::vector<unsigned> & polygon, std::vector<unsigned> & indices)
+{
+    for(size_t i = 2; i < polygon.size(); i++)
+    {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[i - 1]);
+        indices.push_back(polygon[i]);
+    }
+}
+
+void checkIndices(const std::vector<float> & vertices, const std::vector<unsigned> & indices)
+{
+    size_t vertexCount = vertices.size() / 3;
+    for(size_t i = 0; i < indices.size(); i++)
+    {
+        if(indices[i] >= vertexCount)
+        {
+            throw MeshLoadError("vertex index out of range");
+        }
+    }
+}
+
+void loadOBJ(std::istream & is, std::vector<float> & vertices, std::vector<unsigned> & indices)
+{
+    std::string line;
+    std::vector<unsigned> polygon;
+    while(std::getline(is, line))
+    {
+        const char * str = line.c_str();
+        while(std::isspace(*str))
+        {
+            str++;
+        }
+        if(str[0] == 'v' && std::isspace(str[1]))
+        {
+            str++;
+            for(int i = 0; i < 3; i++)
+            {
+                char * end;
+                float value = std::strtod(str, &end);
+                if(end == str)
+                {
+                    throw MeshLoadError("invalid vertex");
+                }
+                vertices.push_back(value);
+                str = end;
+            }
+        }
+        else if(str[0] == 'f' && std::isspace(str[1]))
+        {
+            str++;
+            polygon.clear();
+            for(;;)
+            {
+                char * end;
+                long index = std::strtol(str, &end, 10);
+                if(end == str)
+                {
+                    break;
+                }
+                // indices start at 1, negative indices are relative to the last vertex
+                long vertexCount = (long)(vertices.size() / 3);
+                index = index < 0 ? vertexCount + index : index - 1;
+                if(index < 0 || index >= vertexCount)
+                {
+                    throw MeshLoadError("vertex index out of range");
+                }
+                polygon.push_back((unsigned)index);
+                // skip the texture coordinate and normal indices
+                str = end;
+                while(*str != '\0' && !std::isspace(*str))
+                {
+                    str++;
+                }
+            }
+            if(polygon.size() < 3)
+            {
+                throw MeshLoadError("face with less than 3 vertices");
+            }
+            addPolygon(polygon, indices);
+        }
+    }
+}
+
+enum PlyType
+{
+    PlyInt8,
+    PlyUInt8,
+    PlyInt16,
+    PlyUInt16,
+    PlyInt32,
+    PlyUInt32,
+    PlyFloat32,
+    PlyFloat64
+};
+
+PlyType parsePlyType(const std::string & name)
+{
+    if(name == "char" || name == "int8")
+        return PlyInt8;
+    if(name == "uchar" || name == "uint8")
+        return PlyUInt8;
+    if(name == "short" || name == "int16")
+        return PlyInt16;
+    if(name == "ushort" || name == "uint16")
+        return PlyUInt16;
+    if(name == "int" || name == "int32")
+        return PlyInt32;
+    if(name == "uint" || name == "uint32")
+        return PlyUInt32;
+    if(name == "float" || name == "float32")
+        return PlyFloat32;
+    if(name == "double" || name == "float64")
+        return PlyFloat64;
+    throw MeshLoadError("unknown PLY type : " + name);
+}
+
+struct PlyProperty
+{
+    std::string name;
+    bool isList;
+    PlyType countType, type;
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+/** reads the values of a PLY file in any of its formats */
+class PlyReader
+{
+public:
+    enum Format
+    {
+        Ascii,
+        BinaryLittleEndian,
+        BinaryBigEndian
+    };
+    PlyReader(std::istream & is, Format format)
+        : is(is), format(format)
+    {
+    }
+    double read(PlyType type)
+    {
+        if(format == Ascii)
+        {
+            double retval;
+            if(!(is >> retval))
+            {
+                throw MeshLoadError("unexpected end of PLY file");
+            }
+            return retval;
+        }
+        static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+        size_t size = sizes[type];
+        unsigned char bytes[8];
+        if(!is.read((char *)bytes, size))
+        {
+            throw MeshLoadError("unexpected end of PLY file");
+        }
+        uint64_t bits = 0;
+        for(size_t i = 0; i < size; i++)
+        {
+            size_t byte = format == BinaryLittleEndian ? size - 1 - i : i;
+            bits = bits << 8 | bytes[byte];
+        }
+        switch(type)
+        {
+        case PlyInt8:
+            return (int8_t)bits;
+        case PlyUInt8:
+            return (uint8_t)bits;
+        case PlyInt16:
+            return (int16_t)bits;
+        case PlyUInt16:
+            return (uint16_t)bits;
+        case PlyInt32:
+            return (int32_t)bits;
+        case PlyUInt32:
+            return (uint32_t)bits;
+        case PlyFloat32:
+        {
+            uint32_t value = (uint32_t)bits;
+            float retval;
+            std::memcpy(&retval, &value, sizeof(retval));
+            return retval;
+        }
+        case PlyFloat64:
+        {
+            double retval;
+            std::memcpy(&retval, &bits, sizeof(retval));
+            return retval;
+        }
+        }
+        return 0;
+    }
+private:
+    std::istream & is;
+    const Format format;
+};
+
+void loadPLY(std::istream & is, std::vector<float> & vertices, std::vector<unsigned> & indices)
+{
+    std::string line;
+    if(!std::getline(is, line) || line.compare(0, 3, "ply") != 0)
+    {
+        throw MeshLoadError("magic string doesn't match");
+    }
+    PlyReader::Format format = PlyReader::Ascii;
+    bool gotFormat = false;
+    std::vector<PlyElement> elements;
+    for(;;)
+    {
+        if(!std::getline(is, line))
+        {
+            throw MeshLoadError("unexpected end of PLY header");
+        }
+        std::istringstream ss(line);
+        std::string keyword;
+        ss >> keyword;
+        if(keyword == "end_header")
+        {
+            break;
+        }
+        if(keyword == "format")
+        {
+            std::string name;
+            ss >> name;
+            if(name == "ascii")
+                format = PlyReader::Ascii;
+            else if(name == "binary_little_endian")
+                format = PlyReader::BinaryLittleEndian;
+            else if(name == "binary_big_endian")
+                format = PlyReader::BinaryBigEndian;
+            else
+                throw MeshLoadError("unknown PLY format : " + name);
+            gotFormat = true;
+        }
+        else if(keyword == "element")
+        {
+            PlyElement element;
+            if(!(ss >> element.name >> element.count))
+            {
+                throw MeshLoadError("invalid PLY element");
+            }
+            elements.push_back(element);
+        }
+        else if(keyword == "property")
+        {
+            if(elements.empty())
+            {
+                throw MeshLoadError("PLY property before any element");
+            }
+            PlyProperty property;
+            std::string type;
+            ss >> type;
+            property.isList = type == "list";
+            property.countType = PlyUInt8;
+            if(property.isList)
+            {
+                std::string countType;
+                ss >> countType >> type;
+                property.countType = parsePlyType(countType);
+            }
+            property.type = parsePlyType(type);
+            if(!(ss >> property.name))
+            {
+                throw MeshLoadError("invalid PLY property");
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+    if(!gotFormat)
+    {
+        throw MeshLoadError("PLY format not specified");
+    }
+    PlyReader reader(is, format);
+    std::vector<unsigned> polygon;
+    for(size_t i = 0; i < elements.size(); i++)
+    {
+        const PlyElement & element = elements[i];
+        bool isVertex = element.name == "vertex", isFace = element.name == "face";
+        for(size_t j = 0; j < element.count; j++)
+        {
+            float position[3] = {0, 0, 0};
+            for(size_t k = 0; k < element.properties.size(); k++)
+            {
+                const PlyProperty & property = element.properties[k];
+                if(!property.isList)
+                {
+                    double value = reader.read(property.type);
+                    if(isVertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z')
+                    {
+                        position[property.name[0] - 'x'] = (float)value;
+                    }
+                    continue;
+                }
+                size_t count = (size_t)reader.read(property.countType);
+                bool isIndices = isFace && (property.name == "vertex_indices" || property.name == "vertex_index");
+                polygon.clear();
+                for(size_t l = 0; l < count; l++)
+                {
+                    double value = reader.read(property.type);
+                    if(isIndices)
+                    {
+                        polygon.push_back((unsigned)value);
+                    }
+                }
+                if(isIndices)
+                {
+                    addPolygon(polygon, indices);
+                }
+            }
+            if(isVertex)
+            {
+                vertices.insert(vertices.end(), position, position + 3);
+            }
+        }
+    }
+    checkIndices(vertices, indices);
+}
+
+}
+
+TriangleMesh::TriangleMesh(const std::vector<float> & vertices, const std::vector<unsigned> & indices, const Material * material)
+    : data(new TriangleMeshData), material(material)
+{
+    try
+    {
+        data->vertices = vertices;
+        data->indices = indices;
+        data->indices.resize(indices.size() - indices.size() % 3);
+        checkIndices(data->vertices, data->indices);
+        data->build();
+    }
+    catch(...)
+    {
+        data->removeReference();
+        throw;
+    }
+    material->duplicate(); // added last since the destructor doesn't run if the constructor throws
+}
+
+TriangleMesh::TriangleMesh(std::string fileName, const Material * material, std::string format)
+    : data(new TriangleMeshData), material(material)
+{
+    try
+    {
+        if(format == "")
+        {
+            size_t index = fileName.find_last_of('.');
+            if(index == std::string::npos)
+                throw MeshLoadError("can't determine format");
+            format = fileName.substr(index + 1);
+            for(size_t i = 0; i < format.size(); i++)
+                format[i] = std::tolower(format[i]);
+        }
+        std::ifstream is(fileName.c_str(), std::ios::binary);
+        if(!is)
+        {
+            throw MeshLoadError("can't open " + fileName);
+        }
+        if(format == "obj")
+        {
+            loadOBJ(is, data->vertices, data->indices);
+        }
+        else if(format == "ply")
+        {
+            loadPLY(is, data->vertices, data->indices);
+        }
+        else
+        {
+            throw MeshLoadError("unknown format : " + format);
+        }
+        data->build();
+    }
+    catch(...)
+    {
+        data->removeReference();
+        throw;
+    }
+    material->duplicate(); // added last since the destructor doesn't run if the constructor throws
+}
+
+TriangleMesh::TriangleMesh(TriangleMeshData * data, const Material * material)
+    : data(data), material(material->duplicate())
+{
+    data->addReference();
+}
+
+TriangleMesh::~TriangleMesh()
+{
+    data->removeReference();
+    material->release();
+}
+
+void TriangleMeshData::build()
+{
+    std::vector<BoundingBox> triangleBounds;
+    triangleBounds.reserve(getTriangleCount());
+    std::vector<unsigned> validIndices;
+    validIndices.reserve(indices.size());
+    for(size_t i = 0; i < getTriangleCount(); i++)
+    {
+        Vector3D v0 = getVertex(indices[3 * i]), v1 = getVertex(indices[3 * i + 1]), v2 = getVertex(indices[3 * i + 2]);
+        if(abs_squared(cross(v1 - v0, v2 - v0)) == 0)
+        {
+            continue; // degenerate triangles can't be hit
+        }
+        triangleBounds.push_back(combine(combine(BoundingBox(v0, v0), v1), v2));
+        validIndices.insert(validIndices.end(), &indices[3 * i], &indices[3 * i] + 3);
+    }
+    std::vector<size_t> order;
+    buildBVH(triangleBounds, nodes, order);
+    indices.resize(validIndices.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        for(int j = 0; j < 3; j++)
+        {
+            indices[3 * i + j] = validIndices[3 * order[i] + j];
+        }
+    }
+    bounds = nodes.empty() ? BoundingBox() : nodes[0].bounds;
+}
+
+BoundingBox TriangleMesh::getBounds() const
+{
+    return data->bounds;
+}
+
+size_t TriangleMesh::getTriangleCount() const
+{
+    return data->getTriangleCount();
+}
+
+size_t TriangleMesh::getVertexCount() const
+{
+    return data->vertices.size() / 3;
+}
+
+Vector3D TriangleMesh::getVertex(size_t index) const
+{
+    return data->getVertex(index);
+}
+
+SpanIterator * TriangleMesh::makeSpanIterator() const
+{
+    return new TriangleMeshSpanIterator(data->nodes, data->vertices, data->indices, material);
+}
+
+bool TriangleMesh::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    if(data->nodes.empty())
+    {
+        return false;
+    }
+    FirstHitSearch search(data->nodes, data->vertices, data->indices, ray, tmin, tmax);
+    float rootNear, rootFar;
+    if(!data->nodes[0].bounds.intersects(ray.origin, search.invDir, rootNear, rootFar) || rootFar < tmin || rootNear > tmax)
+    {
+        return false;
+    }
+    search.addNode(0);
+    if(!search.found)
+    {
+        return false;
+    }
+    size_t i = search.triangle;
+    Vector3D v0 = getVertex(data->indices[3 * i]), v1 = getVertex(data->indices[3 * i + 1]), v2 = getVertex(data->indices[3 * i + 2]);
+    hit.t = search.limit;
+    hit.normal = normalize(cross(v1 - v0, v2 - v0));
+    hit.entering = dot(ray.dir, hit.normal) < 0;
+    hit.material = material;
+    hit.object = this;
+    return true;
+}
+
+bool TriangleMesh::occluded(const Ray & ray, float tmin, float tmax) const
+{
+    if(data->nodes.empty())
+    {
+        return false;
+    }
+    if(OcclusionSearch(data->nodes, data->vertices, data->indices, ray, tmin, tmax).occluded(0))
+    {
+        return true;
+    }
+    return isInside(ray, tmax); // no triangle on the segment
+}
+
+MaskPacket TriangleMesh::firstHitPacket(const RayPacket & rays, FloatPacket tmin, FloatPacket tmax, HitPacket & hits) const
+{
+    if(data->nodes.empty())
+    {
+        return MaskPacket(false);
+    }
+    PacketFirstHitSearch search(data->nodes, data->vertices, data->indices, rays, tmin, tmax, hits);
+    FloatPacket rootNear;
+    MaskPacket hitRoot = search.intersects(data->nodes[0].bounds, rays.active & (tmin <= tmax), rootNear);
+    if(!any(hitRoot))
+    {
+        return MaskPacket(false);
+    }
+    search.addNode(0, hitRoot);
+    for(int i = 0; i < PacketSize; i++)
+    {
+        hits.material[i] = material;
+        hits.object[i] = this;
+    }
+    return search.found;
+}
+
+Object * TriangleMesh::duplicate() const
+{
+    return new TriangleMesh(data, material);
+}
+
+}
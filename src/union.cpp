@@ -1,4 +1,5 @@
 #include "union.h"
+#include "csg_program.h"
 
 namespace PathTrace
 {
@@ -51,6 +52,8 @@ public:
     UnionSpanIterator(SpanIterator * spanIteratorA, SpanIterator * spanIteratorB)
         : spanIteratorA(*spanIteratorA), spanIteratorB(*spanIteratorB)
     {
+        adopt(spanIteratorA);
+        adopt(spanIteratorB);
         ended = true;
     }
 
@@ -153,4 +156,8 @@ SpanIterator * Union::makeSpanIterator() const
     return new UnionSpanIterator(a->makeSpanIterator(), b->makeSpanIterator());
 }
 
+bool Union::compile(CSGProgram & program) const
+{
+    return a->compile(program) && b->compile(program) && program.addOperation(CSGUnion);
+}
 }
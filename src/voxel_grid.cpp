@@ -0,0 +1,487 @@
+#include "voxel_grid.h"
+#include "reference_counted.h"
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace PathTrace
+{
+
+const VoxelGrid::MaterialIndex VoxelGrid::Empty;
+const unsigned VoxelGrid::BrickSize;
+
+/** the voxels of a <code>VoxelGrid</code>, shared by its copies */
+struct VoxelGridData : public ReferenceCounted
+{
+    static const unsigned BrickVolume = VoxelGrid::BrickSize * VoxelGrid::BrickSize * VoxelGrid::BrickSize;
+    struct Brick
+    {
+        VoxelGrid::MaterialIndex voxels[BrickVolume];
+    };
+    unsigned size[3]; /// the number of voxels along each axis
+    unsigned brickCount[3]; /// the number of bricks along each axis
+    std::vector<Brick *> bricks; /// NULL for the bricks that are all empty
+    std::vector<const Material *> materials; /// holds a reference to each material
+    float minCorner[3], voxelSize[3];
+    BoundingBox bounds;
+    ~VoxelGridData()
+    {
+        for(size_t i = 0; i < bricks.size(); i++)
+        {
+            delete bricks[i];
+        }
+        for(size_t i = 0; i < materials.size(); i++)
+        {
+            materials[i]->release();
+        }
+    }
+    void setMaterials(const std::vector<const Material *> & newMaterials)
+    {
+        assert(materials.empty());
+        for(size_t i = 0; i < newMaterials.size(); i++)
+        {
+            materials.push_back(newMaterials[i]->duplicate());
+        }
+    }
+    /** @return a new copy of the voxels, with a reference held by the caller */
+    VoxelGridData * copy() const
+    {
+        VoxelGridData * retval = new VoxelGridData;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            retval->size[axis] = size[axis];
+            retval->brickCount[axis] = brickCount[axis];
+            retval->minCorner[axis] = minCorner[axis];
+            retval->voxelSize[axis] = voxelSize[axis];
+        }
+        retval->bricks.resize(bricks.size(), NULL);
+        for(size_t i = 0; i < bricks.size(); i++)
+        {
+            if(bricks[i])
+            {
+                retval->bricks[i] = new Brick(*bricks[i]);
+            }
+        }
+        retval->setMaterials(materials);
+        retval->bounds = bounds;
+        return retval;
+    }
+    size_t getBrickIndex(const int voxel[3]) const
+    {
+        return voxel[0] / VoxelGrid::BrickSize + brickCount[0] * (voxel[1] / VoxelGrid::BrickSize + (size_t)brickCount[1] * (voxel[2] / VoxelGrid::BrickSize));
+    }
+    static unsigned getVoxelIndex(const int voxel[3])
+    {
+        const unsigned mask = VoxelGrid::BrickSize - 1;
+        return (voxel[0] & mask) + VoxelGrid::BrickSize * ((voxel[1] & mask) + VoxelGrid::BrickSize * (voxel[2] & mask));
+    }
+};
+
+namespace
+{
+/** where a ray goes from one voxel to a voxel with a different value */
+struct Transition
+{
+    float t;
+    VoxelGrid::MaterialIndex from, to;
+    int axis; /// the axis of the face crossed
+    int step; /// the direction the face is crossed in along <code>axis</code>
+    /** @return the index of the boundary where <code>to</code> starts */
+    unsigned getStartIndex() const
+    {
+        return ((unsigned)to << 3) | (2 * axis + (step < 0 ? 1 : 0));
+    }
+    /** @return the index of the boundary where <code>from</code> ends */
+    unsigned getEndIndex() const
+    {
+        return ((unsigned)from << 3) | (2 * axis + (step > 0 ? 1 : 0));
+    }
+};
+
+/** steps a ray through a voxel grid a voxel at a time, skipping the empty bricks */
+class Traversal
+{
+public:
+    explicit Traversal(const VoxelGridData & data)
+        : data(data), ended(true), current(VoxelGrid::Empty)
+    {
+    }
+    /** starts walking along <code>ray</code> at <code>tStart</code>, the voxels after <code>tEnd</code> are skipped */
+    void init(const Ray & ray, float tStart, float tEnd)
+    {
+        ended = true;
+        current = VoxelGrid::Empty;
+        float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z}, dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+        float tNear = -max_value, tFar = max_value;
+        int nearAxis = 0;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float lo = data.minCorner[axis], hi = lo + data.size[axis] * data.voxelSize[axis];
+            if(dir[axis] == 0)
+            {
+                if(origin[axis] < lo || origin[axis] > hi)
+                {
+                    return;
+                }
+                continue;
+            }
+            float t0 = (lo - origin[axis]) / dir[axis], t1 = (hi - origin[axis]) / dir[axis];
+            if(t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            if(t0 > tNear)
+            {
+                tNear = t0;
+                nearAxis = axis;
+            }
+            tFar = std::min(tFar, t1);
+        }
+        t = std::max(tNear, tStart);
+        this->tEnd = std::min(tFar, tEnd);
+        if(t > this->tEnd)
+        {
+            return;
+        }
+        ended = false;
+        entryAxis = nearAxis;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float position = (origin[axis] + dir[axis] * t - data.minCorner[axis]) / data.voxelSize[axis];
+            voxel[axis] = (int)std::min(std::max(std::floor(position), 0.0f), (float)(data.size[axis] - 1));
+            if(dir[axis] == 0)
+            {
+                step[axis] = 1;
+                tMax[axis] = tDelta[axis] = max_value;
+                continue;
+            }
+            step[axis] = dir[axis] > 0 ? 1 : -1;
+            tMax[axis] = (data.minCorner[axis] + (voxel[axis] + (step[axis] > 0 ? 1 : 0)) * data.voxelSize[axis] - origin[axis]) / dir[axis];
+            tDelta[axis] = data.voxelSize[axis] / std::fabs(dir[axis]);
+        }
+        if(t > tNear)
+        {
+            // starting inside the grid : only the boundaries after here are wanted
+            current = getValue();
+        }
+    }
+    /** finds the next place the value changes, the last one leaves the grid
+     * @return if there is one */
+    bool next(Transition & transition)
+    {
+        while(!ended)
+        {
+            const VoxelGridData::Brick * brick = data.bricks[data.getBrickIndex(voxel)];
+            if(brick == NULL && current == VoxelGrid::Empty)
+            {
+                skipBrick();
+                continue;
+            }
+            VoxelGrid::MaterialIndex value = brick ? brick->voxels[VoxelGridData::getVoxelIndex(voxel)] : VoxelGrid::Empty;
+            if(value != current)
+            {
+                makeTransition(transition, value);
+                return true;
+            }
+            stepVoxel();
+        }
+        if(current != VoxelGrid::Empty)
+        {
+            makeTransition(transition, VoxelGrid::Empty);
+            return true;
+        }
+        return false;
+    }
+private:
+    VoxelGrid::MaterialIndex getValue() const
+    {
+        const VoxelGridData::Brick * brick = data.bricks[data.getBrickIndex(voxel)];
+        return brick ? brick->voxels[VoxelGridData::getVoxelIndex(voxel)] : VoxelGrid::Empty;
+    }
+    void makeTransition(Transition & transition, VoxelGrid::MaterialIndex value)
+    {
+        transition.t = t;
+        transition.from = current;
+        transition.to = value;
+        transition.axis = entryAxis;
+        transition.step = step[entryAxis];
+        current = value;
+    }
+    bool isOutside(int axis) const
+    {
+        return voxel[axis] < 0 || voxel[axis] >= (int)data.size[axis];
+    }
+    void stepVoxel()
+    {
+        int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+        t = tMax[axis];
+        voxel[axis] += step[axis];
+        tMax[axis] += tDelta[axis];
+        entryAxis = axis;
+        if(isOutside(axis) || t > tEnd)
+        {
+            ended = true;
+        }
+    }
+    /** moves to the first voxel past the current brick, taking the same path as stepping a voxel at a time */
+    void skipBrick()
+    {
+        int steps[3], exitAxis = 0;
+        float tExit = max_value;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int brickStart = voxel[axis] & ~(int)(VoxelGrid::BrickSize - 1);
+            if(step[axis] > 0)
+            {
+                steps[axis] = std::min(brickStart + (int)VoxelGrid::BrickSize, (int)data.size[axis]) - voxel[axis];
+            }
+            else
+            {
+                steps[axis] = voxel[axis] - brickStart + 1;
+            }
+            float tLeave = tMax[axis] + (steps[axis] - 1) * tDelta[axis];
+            if(tLeave < tExit)
+            {
+                tExit = tLeave;
+                exitAxis = axis;
+            }
+        }
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(axis == exitAxis)
+            {
+                continue;
+            }
+            // the steps along the other axes before leaving the brick
+            if(tMax[axis] > tExit)
+            {
+                steps[axis] = 0;
+            }
+            else
+            {
+                steps[axis] = std::min((int)((tExit - tMax[axis]) / tDelta[axis]) + 1, steps[axis] - 1);
+            }
+        }
+        for(int axis = 0; axis < 3; axis++)
+        {
+            voxel[axis] += step[axis] * steps[axis];
+            tMax[axis] += steps[axis] * tDelta[axis];
+        }
+        t = tExit;
+        entryAxis = exitAxis;
+        if(isOutside(exitAxis) || t > tEnd)
+        {
+            ended = true;
+        }
+    }
+    const VoxelGridData & data;
+    int voxel[3], step[3];
+    float tMax[3], tDelta[3]; /// where the ray leaves the current voxel and crosses a voxel along each axis
+    float t, tEnd; /// where the ray entered the current voxel and where it stops
+    int entryAxis; /// the axis of the face the ray entered the current voxel through
+    bool ended;
+    VoxelGrid::MaterialIndex current; /// the value before the current voxel
+};
+
+class VoxelGridSpanIterator : public SpanIterator
+{
+public:
+    VoxelGridSpanIterator(const VoxelGrid & grid, const VoxelGridData & data)
+        : grid(grid), traversal(data), ended(true), havePending(false)
+    {
+        theSpan.startBoundary.source = this;
+        theSpan.endBoundary.source = this;
+    }
+    virtual void init(const Ray & ray)
+    {
+        traversal.init(ray, -max_value, max_value);
+        havePending = traversal.next(pending);
+        ended = false;
+        next();
+    }
+    virtual const Span & operator *() const
+    {
+        return theSpan;
+    }
+    virtual const Span * operator ->() const
+    {
+        return &theSpan;
+    }
+    virtual bool isAtEnd() const
+    {
+        return ended;
+    }
+    virtual void next()
+    {
+        while(havePending && pending.to == VoxelGrid::Empty)
+        {
+            havePending = traversal.next(pending);
+        }
+        if(!havePending)
+        {
+            ended = true;
+            return;
+        }
+        theSpan.start = pending.t;
+        theSpan.startBoundary.index = pending.getStartIndex();
+        // the grid is always left after going in so there is a next one
+        havePending = traversal.next(pending);
+        assert(havePending);
+        theSpan.end = pending.t;
+        theSpan.endBoundary.index = pending.getEndIndex();
+        // the next span starts here if this is between 2 materials
+    }
+    virtual ~VoxelGridSpanIterator()
+    {
+    }
+    virtual const Material * getMaterial(unsigned index) const
+    {
+        return grid.getMaterial(index);
+    }
+
+protected:
+    virtual Vector3D getLocalNormal(unsigned index, float t) const
+    {
+        return VoxelGrid::getNormal(index);
+    }
+
+private:
+    Span theSpan;
+    const VoxelGrid & grid;
+    Traversal traversal;
+    Transition pending;
+    bool ended, havePending;
+};
+}
+
+VoxelGrid::VoxelGrid(unsigned sizeX, unsigned sizeY, unsigned sizeZ, Vector3D minCorner, Vector3D maxCorner, const std::vector<const Material *> & materials)
+    : data(new VoxelGridData)
+{
+    assert(sizeX > 0 && sizeY > 0 && sizeZ > 0 && materials.size() <= 255);
+    data->size[0] = sizeX;
+    data->size[1] = sizeY;
+    data->size[2] = sizeZ;
+    data->minCorner[0] = minCorner.x;
+    data->minCorner[1] = minCorner.y;
+    data->minCorner[2] = minCorner.z;
+    data->voxelSize[0] = (maxCorner.x - minCorner.x) / sizeX;
+    data->voxelSize[1] = (maxCorner.y - minCorner.y) / sizeY;
+    data->voxelSize[2] = (maxCorner.z - minCorner.z) / sizeZ;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        data->brickCount[axis] = (data->size[axis] + BrickSize - 1) / BrickSize;
+    }
+    data->bricks.resize((size_t)data->brickCount[0] * data->brickCount[1] * data->brickCount[2], NULL);
+    data->setMaterials(materials);
+    data->bounds = BoundingBox(minCorner, maxCorner);
+}
+
+VoxelGrid::VoxelGrid(VoxelGridData * data)
+    : data(data)
+{
+    data->addReference();
+}
+
+VoxelGrid::~VoxelGrid()
+{
+    data->removeReference();
+}
+
+VoxelGrid::MaterialIndex VoxelGrid::get(unsigned x, unsigned y, unsigned z) const
+{
+    assert(x < data->size[0] && y < data->size[1] && z < data->size[2]);
+    int voxel[3] = {(int)x, (int)y, (int)z};
+    const VoxelGridData::Brick * brick = data->bricks[data->getBrickIndex(voxel)];
+    return brick ? brick->voxels[VoxelGridData::getVoxelIndex(voxel)] : Empty;
+}
+
+void VoxelGrid::set(unsigned x, unsigned y, unsigned z, MaterialIndex value)
+{
+    assert(x < data->size[0] && y < data->size[1] && z < data->size[2] && value <= data->materials.size());
+    int voxel[3] = {(int)x, (int)y, (int)z};
+    if(data->isShared())
+    {
+        VoxelGridData * newData = data->copy();
+        data->removeReference();
+        data = newData;
+    }
+    VoxelGridData::Brick *& brick = data->bricks[data->getBrickIndex(voxel)];
+    if(brick == NULL)
+    {
+        if(value == Empty)
+        {
+            return;
+        }
+        brick = new VoxelGridData::Brick;
+        std::fill(brick->voxels, brick->voxels + VoxelGridData::BrickVolume, Empty);
+    }
+    brick->voxels[VoxelGridData::getVoxelIndex(voxel)] = value;
+}
+
+Object * VoxelGrid::duplicate() const
+{
+    return new VoxelGrid(data);
+}
+
+BoundingBox VoxelGrid::getBounds() const
+{
+    return data->bounds;
+}
+
+Vector3D VoxelGrid::getNormal(unsigned index)
+{
+    unsigned face = index & 7;
+    Vector3D retval(0);
+    float sign = (face & 1) ? 1 : -1;
+    switch(face / 2)
+    {
+    case 0:
+        retval.x = sign;
+        break;
+    case 1:
+        retval.y = sign;
+        break;
+    default:
+        retval.z = sign;
+        break;
+    }
+    return retval;
+}
+
+const Material * VoxelGrid::getMaterial(unsigned index) const
+{
+    return data->materials[(index >> 3) - 1];
+}
+
+SpanIterator * VoxelGrid::makeSpanIterator() const
+{
+    return new VoxelGridSpanIterator(*this, *data);
+}
+
+bool VoxelGrid::firstHit(const Ray & ray, float tmin, float tmax, Hit & hit) const
+{
+    Traversal traversal(*data);
+    traversal.init(ray, tmin, tmax);
+    Transition transition;
+    if(!traversal.next(transition) || transition.t > tmax)
+    {
+        return false;
+    }
+    hit.t = std::max(transition.t, tmin);
+    // going from one material to another ends the span of the first one before the next one starts
+    hit.entering = transition.from == Empty;
+    if(hit.entering)
+    {
+        hit.normal = getNormal(transition.getStartIndex());
+        hit.material = data->materials[transition.to - 1];
+    }
+    else
+    {
+        hit.normal = getNormal(transition.getEndIndex());
+        hit.material = data->materials[transition.from - 1];
+    }
+    hit.object = this;
+    return true;
+}
+
+}
@@ -0,0 +1,371 @@
+#include "wavefront.h"
+#include "thread.h"
+#include "atomic.h"
+#include <algorithm>
+#include <utility>
+
+namespace PathTrace
+{
+
+void PathQueue::resize(size_t newSize)
+{
+    originX.resize(newSize);
+    originY.resize(newSize);
+    originZ.resize(newSize);
+    dirX.resize(newSize);
+    dirY.resize(newSize);
+    dirZ.resize(newSize);
+    throughputR.resize(newSize);
+    throughputG.resize(newSize);
+    throughputB.resize(newSize);
+    lastPositionX.resize(newSize);
+    lastPositionY.resize(newSize);
+    lastPositionZ.resize(newSize);
+    lastScatterPdf.resize(newSize);
+    sample.resize(newSize);
+    dimension.resize(newSize);
+    hitT.resize(newSize);
+    normalX.resize(newSize);
+    normalY.resize(newSize);
+    normalZ.resize(newSize);
+    material.resize(newSize);
+    entering.resize(newSize);
+    object.resize(newSize);
+}
+
+void PathQueue::setRay(size_t i, const Ray & ray)
+{
+    originX[i] = ray.origin.x;
+    originY[i] = ray.origin.y;
+    originZ[i] = ray.origin.z;
+    dirX[i] = ray.dir.x;
+    dirY[i] = ray.dir.y;
+    dirZ[i] = ray.dir.z;
+}
+
+Hit PathQueue::getHit(size_t i) const
+{
+    Hit retval;
+    retval.t = hitT[i];
+    retval.normal = Vector3D(normalX[i], normalY[i], normalZ[i]);
+    retval.material = material[i];
+    retval.entering = entering[i] != 0;
+    retval.object = object[i];
+    return retval;
+}
+
+PathState PathQueue::getState(size_t i) const
+{
+    PathState retval;
+    retval.throughput = Color(throughputR[i], throughputG[i], throughputB[i]);
+    retval.lastPosition = Vector3D(lastPositionX[i], lastPositionY[i], lastPositionZ[i]);
+    retval.lastScatterPdf = lastScatterPdf[i];
+    return retval;
+}
+
+void PathQueue::setState(size_t i, const PathState & state)
+{
+    throughputR[i] = state.throughput.x;
+    throughputG[i] = state.throughput.y;
+    throughputB[i] = state.throughput.z;
+    lastPositionX[i] = state.lastPosition.x;
+    lastPositionY[i] = state.lastPosition.y;
+    lastPositionZ[i] = state.lastPosition.z;
+    lastScatterPdf[i] = state.lastScatterPdf;
+}
+
+void PathQueue::copy(size_t to, const PathQueue & source, size_t from)
+{
+    originX[to] = source.originX[from];
+    originY[to] = source.originY[from];
+    originZ[to] = source.originZ[from];
+    dirX[to] = source.dirX[from];
+    dirY[to] = source.dirY[from];
+    dirZ[to] = source.dirZ[from];
+    throughputR[to] = source.throughputR[from];
+    throughputG[to] = source.throughputG[from];
+    throughputB[to] = source.throughputB[from];
+    lastPositionX[to] = source.lastPositionX[from];
+    lastPositionY[to] = source.lastPositionY[from];
+    lastPositionZ[to] = source.lastPositionZ[from];
+    lastScatterPdf[to] = source.lastScatterPdf[from];
+    sample[to] = source.sample[from];
+    dimension[to] = source.dimension[from];
+    hitT[to] = source.hitT[from];
+    normalX[to] = source.normalX[from];
+    normalY[to] = source.normalY[from];
+    normalZ[to] = source.normalZ[from];
+    material[to] = source.material[from];
+    entering[to] = source.entering[from];
+    object[to] = source.object[from];
+}
+
+void PathQueue::swap(PathQueue & other)
+{
+    originX.swap(other.originX);
+    originY.swap(other.originY);
+    originZ.swap(other.originZ);
+    dirX.swap(other.dirX);
+    dirY.swap(other.dirY);
+    dirZ.swap(other.dirZ);
+    throughputR.swap(other.throughputR);
+    throughputG.swap(other.throughputG);
+    throughputB.swap(other.throughputB);
+    lastPositionX.swap(other.lastPositionX);
+    lastPositionY.swap(other.lastPositionY);
+    lastPositionZ.swap(other.lastPositionZ);
+    lastScatterPdf.swap(other.lastScatterPdf);
+    sample.swap(other.sample);
+    dimension.swap(other.dimension);
+    hitT.swap(other.hitT);
+    normalX.swap(other.normalX);
+    normalY.swap(other.normalY);
+    normalZ.swap(other.normalZ);
+    material.swap(other.material);
+    entering.swap(other.entering);
+    object.swap(other.object);
+}
+
+namespace
+{
+/** the random numbers for one bounce of a path, read from its stream in one batch with <code>fill</code>.<br/>
+ * a bounce that uses more than <code>Count</code> numbers reads the rest one at a time, so the path gets
+ * the same numbers as it does from the engine */
+class BounceRandomNumbers
+{
+public:
+    static const unsigned Count = 8; /// enough for a bounce that refracts or samples a light, scatters and is tested for russian roulette
+    explicit BounceRandomNumbers(DefaultRandomEngine & randomEngine)
+        : randomEngine(randomEngine), start(randomEngine.getDimension()), used(0)
+    {
+        randomEngine.fill(values, Count);
+    }
+    float get1D()
+    {
+        if(used < Count)
+        {
+            return values[used++];
+        }
+        used++;
+        return randomEngine.get1D();
+    }
+    void get2D(float &u1, float &u2)
+    {
+        u1 = get1D();
+        u2 = get1D();
+    }
+    /** @return the index in the stream of the next number */
+    unsigned getDimension() const
+    {
+        return start + used;
+    }
+private:
+    DefaultRandomEngine & randomEngine;
+    const unsigned start;
+    unsigned used;
+    float values[Count];
+};
+}
+
+struct WavefrontRenderer::StageJob
+{
+    WavefrontRenderer * renderer;
+    Stage stage;
+    size_t count;
+    atomic_int nextChunk;
+};
+
+WavefrontRenderer::WavefrontRenderer(const Object & world, int screenXResolution, int screenYResolution, float screenWidth, float screenHeight, float screenDistance, int sampleCount, int rayDepth, int threadCount, const LightList * lights)
+    : world(world), screenXResolution(screenXResolution), screenYResolution(screenYResolution), screenWidth(screenWidth), screenHeight(screenHeight), screenDistance(screenDistance), sampleCount(sampleCount), rayDepth(rayDepth), threadCount(std::max(1, threadCount)), lights(lights)
+{
+}
+
+void WavefrontRenderer::stageThreadFn(StageJob * job)
+{
+    for(;;)
+    {
+        size_t chunk = (size_t)job->nextChunk++;
+        size_t start = chunk * ChunkSize;
+        if(start >= job->count)
+        {
+            return;
+        }
+        (job->renderer->*job->stage)(start, std::min(job->count, start + ChunkSize), chunk);
+    }
+}
+
+void WavefrontRenderer::runStage(Stage stage, size_t count)
+{
+    StageJob job;
+    job.renderer = this;
+    job.stage = stage;
+    job.count = count;
+    job.nextChunk = 0;
+    size_t chunkCount = (count + ChunkSize - 1) / ChunkSize;
+    size_t extraThreadCount = std::min((size_t)threadCount, chunkCount);
+    extraThreadCount = extraThreadCount > 0 ? extraThreadCount - 1 : 0;
+    std::vector<thread *> threads(extraThreadCount);
+    for(size_t i = 0; i < extraThreadCount; i++)
+    {
+        threads[i] = new thread(stageThreadFn, &job);
+    }
+    stageThreadFn(&job);
+    for(size_t i = 0; i < extraThreadCount; i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+void WavefrontRenderer::startSample(DefaultRandomEngine &randomEngine, unsigned sample, unsigned dimension) const
+{
+    int pixel = (int)(sample / sampleCount);
+    randomEngine.startPixelSample(blockX + pixel % blockWidth, blockY + pixel / blockWidth, sample % sampleCount, dimension);
+}
+
+void WavefrontRenderer::generateStage(size_t start, size_t end, size_t)
+{
+    DefaultRandomEngine randomEngine(seed);
+    for(size_t i = start; i < end; i++)
+    {
+        int pixel = (int)(i / sampleCount);
+        int px = blockX + pixel % blockWidth;
+        int py = blockY + pixel / blockWidth;
+        float jitterX, jitterY;
+        startSample(randomEngine, (unsigned)i, 0);
+        randomEngine.get2D(jitterX, jitterY);
+        float x = 2 * (px + jitterX) / screenXResolution - 1;
+        float y = 1 - 2 * (py + jitterY) / screenYResolution;
+        paths.setRay(i, Ray(Vector3D(0, 0, 0), Vector3D(x * screenWidth, y * screenHeight, -screenDistance)));
+        paths.setState(i, PathState());
+        paths.sample[i] = (unsigned)i;
+        paths.dimension[i] = randomEngine.getDimension();
+        radiance[i] = Color(0, 0, 0);
+    }
+}
+
+void WavefrontRenderer::intersectStage(size_t start, size_t end, size_t)
+{
+    for(size_t i = start; i < end; i += PacketSize)
+    {
+        int count = (int)std::min((size_t)PacketSize, end - i);
+        RayPacket rays(&paths.originX[i], &paths.originY[i], &paths.originZ[i], &paths.dirX[i], &paths.dirY[i], &paths.dirZ[i], count);
+        HitPacket hits;
+        int hitBits = world.firstHitPacket(rays, FloatPacket(eps), FloatPacket(max_value), hits).bits();
+        for(int j = 0; j < count; j++)
+        {
+            if(((hitBits >> j) & 1) == 0 || lane(hits.t, j) >= max_value)
+            {
+                paths.material[i + j] = NULL;
+                continue;
+            }
+            Hit hit = hits.get(j);
+            paths.hitT[i + j] = hit.t;
+            paths.normalX[i + j] = hit.normal.x;
+            paths.normalY[i + j] = hit.normal.y;
+            paths.normalZ[i + j] = hit.normal.z;
+            paths.material[i + j] = hit.material;
+            paths.entering[i + j] = hit.entering;
+            paths.object[i + j] = hit.object;
+        }
+    }
+}
+
+void WavefrontRenderer::sortByMaterial()
+{
+    std::vector<std::pair<size_t, size_t> > order;
+    order.reserve(paths.size());
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        if(paths.material[i] != NULL)
+        {
+            order.push_back(std::make_pair((size_t)paths.material[i], i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    sortedPaths.resize(order.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        sortedPaths.copy(i, paths, order[i].second);
+    }
+    paths.swap(sortedPaths);
+}
+
+void WavefrontRenderer::shadeStage(size_t start, size_t end, size_t)
+{
+    DefaultRandomEngine randomEngine(seed);
+    for(size_t i = start; i < end; i++)
+    {
+        startSample(randomEngine, paths.sample[i], paths.dimension[i]);
+        BounceRandomNumbers bounceRandomNumbers(randomEngine);
+        Ray ray = paths.getRay(i);
+        PathState state = paths.getState(i);
+        Color & sampleRadiance = radiance[paths.sample[i]];
+        if(!scatterPath(ray, paths.getHit(i), depth, state, sampleRadiance, rayDepth, bounceRandomNumbers, DefaultRussianRouletteDepth, lights))
+        {
+            paths.material[i] = NULL;
+            continue;
+        }
+        paths.setRay(i, ray);
+        paths.setState(i, state);
+        paths.dimension[i] = bounceRandomNumbers.getDimension();
+    }
+}
+
+void WavefrontRenderer::removeFinishedPaths()
+{
+    size_t newSize = 0;
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        if(paths.material[i] != NULL)
+        {
+            if(newSize != i)
+            {
+                paths.copy(newSize, paths, i);
+            }
+            newSize++;
+        }
+    }
+    paths.resize(newSize);
+}
+
+void WavefrontRenderer::writeBack(Color * output)
+{
+    for(size_t pixel = 0; pixel * sampleCount < radiance.size(); pixel++)
+    {
+        Color sum = Color(0, 0, 0);
+        for(int i = 0; i < sampleCount; i++)
+        {
+            sum += radiance[pixel * sampleCount + i];
+        }
+        output[pixel] = sum / sampleCount;
+    }
+}
+
+void WavefrontRenderer::render(int x, int y, int width, int height, Color * output, unsigned seed)
+{
+    if(width <= 0 || height <= 0 || sampleCount <= 0)
+    {
+        return;
+    }
+    blockX = x;
+    blockY = y;
+    blockWidth = width;
+    this->seed = seed;
+    size_t pathCount = (size_t)width * height * sampleCount;
+    paths.resize(pathCount);
+    radiance.resize(pathCount);
+    runStage(&WavefrontRenderer::generateStage, pathCount);
+    for(depth = 0; paths.size() > 0; depth++)
+    {
+        runStage(&WavefrontRenderer::intersectStage, paths.size());
+        sortByMaterial();
+        runStage(&WavefrontRenderer::shadeStage, paths.size());
+        removeFinishedPaths();
+    }
+    writeBack(output);
+    paths.resize(0);
+    sortedPaths.resize(0);
+}
+
+}